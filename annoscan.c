@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "scan.h"
+#include "sources.h"
+
+void scan_class(ClassSources* sources, ClassSource* source, SourceReader* reader, AnnotationTargets* targets, AnnotationHits* hits, FILE* out, FILE* err);
+
+
+/* Internal name or descriptor of a class, printed as a Java name */
+static void print_class_name(FILE* out, const char* name, size_t length)
+{
+	size_t i;
+
+	if (length >= 2 && name[0] == 'L' && name[length - 1] == ';')
+	{
+		name += 1;
+		length -= 2;
+	}
+
+	for (i = 0; i < length; i += 1)
+		fputc(name[i] == '/' ? '.' : name[i], out);
+}
+
+void scan_class(ClassSources* sources, ClassSource* source, SourceReader* reader, AnnotationTargets* targets, AnnotationHits* hits, FILE* out, FILE* err)
+{
+	const unsigned char* data;
+	const char* annotation;
+	AnnotationHit* hit;
+	ClassHeader header;
+	size_t size;
+	uint32_t i;
+
+	data = load_class_source(sources, source, reader, &size, err);
+	if (data == NULL)
+		return;
+
+	hits->count = 0;
+	if (scan_annotations(data, size, targets, hits) < 0)
+	{
+		fprintf(err, "%s: Unable to scan class file\n", source->name);
+		return;
+	}
+
+	/* Only classes with hits are worth a second look at the pool */
+	if (hits->count == 0 || !scan_class_header(data, size, &header))
+		return;
+
+	for (i = 0, hit = hits->hits; i < hits->count; i += 1, hit += 1)
+	{
+		print_class_name(out, header.name.data, header.name.length);
+
+		if (hit->kind == ANNOTATED_METHOD)
+			fprintf(out, ".%.*s%.*s", hit->name.length, hit->name.data, hit->descriptor.length, hit->descriptor.data);
+		else if (hit->kind == ANNOTATED_FIELD)
+			fprintf(out, ".%.*s", hit->name.length, hit->name.data);
+
+		annotation = targets->descriptors[hit->target];
+		fprintf(out, ": @");
+		print_class_name(out, annotation, strlen(annotation));
+		fprintf(out, "\n");
+	}
+}
+
+static void scan_source(ClassSources* sources, ClassSource* source, SourceReader* reader, void* scratch, void* context, FILE* out, FILE* err)
+{
+	scan_class(sources, source, reader, context, scratch, out, err);
+}
+
+static void free_hits(void* scratch)
+{
+	free_annotation_hits(scratch);
+}
+
+int main(int argc, char** argv)
+{
+	int i, opt, workers = 1;
+	AnnotationTargets targets;
+	ClassSources sources;
+
+	init_annotation_targets(&targets);
+
+	while ((opt = getopt(argc, argv, "ha:t:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				add_annotation_target(&targets, optarg);
+				break;
+
+			case 't':
+				workers = atoi(optarg);
+				if (workers < 1)
+				{
+					fprintf(stderr, "%s: invalid number of workers '%s'\n", argv[0], optarg);
+					return 1;
+				}
+				break;
+
+			case 'h':
+			case '?':
+				printf("Usage: %s [options] -a ANNOTATION... PATH...\n"
+					"Lists the classes, fields and methods of PATH carrying any of the given\n"
+					"runtime visible annotations.\n"
+					"PATH is a class file, a jar/zip archive or a directory containing either\n"
+					"options:\n"
+					"  -a NAME  annotation type to look for, as a class name (javax.inject.Named)\n"
+					"           or a descriptor (Ljavax/inject/Named;); can be repeated\n"
+					"  -t N     scan classes with N worker threads (default: 1)\n"
+					"", argv[0]);
+				return optopt ? 1 : 0;
+		}
+	}
+
+	if (targets.count == 0)
+	{
+		fprintf(stderr, "%s: no annotation given (-a)\n", argv[0]);
+		return 1;
+	}
+
+	memset(&sources, 0, sizeof(sources));
+	for (i = optind; i < argc; i += 1)
+		add_class_sources(&sources, argv[i]);
+
+	process_class_sources(&sources, workers, scan_source, &targets, sizeof(AnnotationHits), free_hits);
+
+	free_class_sources(&sources);
+	free_annotation_targets(&targets);
+	return 0;
+}
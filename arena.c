@@ -0,0 +1,89 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "stats.h"
+
+#define ALIGNMENT sizeof(max_align_t)
+
+void init_arena(Arena* arena, size_t chunk_size)
+{
+	arena->first = arena->current = NULL;
+	arena->chunk_size = chunk_size;
+}
+
+static ArenaChunk* new_chunk(size_t size)
+{
+	ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+	STAT_ADD(allocations, 1);
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+void* arena_alloc(Arena* arena, size_t size)
+{
+	ArenaChunk* chunk = arena->current;
+	void* p;
+
+	size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+	/* Move on to the next chunk kept by reset_arena(), or add a new one
+		after the current chunk if that one is too small as well */
+	while (chunk == NULL || chunk->used + size > chunk->size)
+	{
+		if (chunk != NULL && chunk->next != NULL && chunk->next->size >= size)
+		{
+			chunk = chunk->next;
+			continue;
+		}
+
+		chunk = new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+		if (arena->current == NULL)
+		{
+			chunk->next = arena->first;
+			arena->first = chunk;
+		}
+		else
+		{
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		}
+		break;
+	}
+
+	arena->current = chunk;
+	p = (char*)chunk->data + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size)
+{
+	void* p = arena_alloc(arena, count * size);
+	memset(p, 0, count * size);
+	return p;
+}
+
+void reset_arena(Arena* arena)
+{
+	ArenaChunk* chunk;
+
+	for (chunk = arena->first; chunk != NULL; chunk = chunk->next)
+		chunk->used = 0;
+	arena->current = arena->first;
+}
+
+void free_arena(Arena* arena)
+{
+	ArenaChunk *chunk, *next;
+
+	for (chunk = arena->first; chunk != NULL; chunk = next)
+	{
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->first = arena->current = NULL;
+}
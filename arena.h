@@ -0,0 +1,34 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+	Bump allocator for scratch data of a single analysis. Nothing is freed
+	individually; reset_arena() makes all of the memory available again
+	without returning it, so an arena reused across methods stops
+	allocating once it has grown to fit the largest one.
+*/
+
+typedef struct tagArenaChunk
+{
+	struct tagArenaChunk* next;
+	size_t size;
+	size_t used;
+	max_align_t data[];
+} ArenaChunk;
+
+typedef struct
+{
+	ArenaChunk* first;
+	ArenaChunk* current;
+	size_t chunk_size;
+} Arena;
+
+void init_arena(Arena* arena, size_t chunk_size);
+void* arena_alloc(Arena* arena, size_t size);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+void reset_arena(Arena* arena);
+void free_arena(Arena* arena);
+
+#endif
@@ -0,0 +1,727 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "classfile.h"
+#include "bytecode.h"
+#include "cfg.h"
+#include "dominators.h"
+#include "stack.h"
+#include "liveness.h"
+#include "constprop.h"
+#include "scan.h"
+#include "pool.h"
+#include "classgen.h"
+#include "util.h"
+#include "utf8.h"
+
+typedef struct
+{
+	char* name;
+	char* data;
+	size_t size;
+	ClassFile* classFile;
+	ConstantPool pool;
+} CorpusEntry;
+
+typedef struct
+{
+	int count;
+	CorpusEntry* entries;
+} Corpus;
+
+typedef struct
+{
+	uint64_t operations;
+	uint64_t bytes;
+} BenchCount;
+
+typedef void (*BenchFunction)(Corpus* corpus, BenchCount* count);
+
+typedef struct
+{
+	const char* name;
+	const char* unit;
+	BenchFunction function;
+} Benchmark;
+
+static volatile uintptr_t sink;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_file(CorpusEntry* entry, const char* filename)
+{
+	FILE* fp;
+	long size;
+
+	if ((fp = fopen(filename, "r")) == NULL)
+	{
+		perror(filename);
+		return 0;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	entry->name = strdup(filename);
+	entry->data = malloc(size);
+	entry->size = fread(entry->data, sizeof(char), size, fp);
+	fclose(fp);
+
+	return 1;
+}
+
+static void generate_entry(CorpusEntry* entry, ClassGenOptions* options, int n)
+{
+	ClassFile* classFile;
+	char className[64];
+	FILE* fp;
+
+	snprintf(className, sizeof(className), "bench.Class%04d", n);
+	classFile = generate_class(className, options);
+
+	fp = open_memstream(&entry->data, &entry->size);
+	write_class(classFile, fp);
+	fclose(fp);
+	free_class(classFile);
+
+	snprintf(className, sizeof(className), "Class%04d.class", n);
+	entry->name = strdup(className);
+}
+
+static void bench_read_class(Corpus* corpus, BenchCount* count)
+{
+	CorpusEntry* entry;
+	ClassFile* classFile;
+	int i;
+
+	for (i = 0, entry = corpus->entries; i < corpus->count; i += 1, entry += 1)
+	{
+		classFile = read_class_buffer(entry->data, entry->size);
+		sink = (uintptr_t)classFile;
+		free_class(classFile);
+
+		count->operations += 1;
+		count->bytes += entry->size;
+	}
+}
+
+static void bench_find_constant(Corpus* corpus, BenchCount* count)
+{
+	ClassFile* classFile;
+	int i, index, max_index;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		max_index = classFile->constants[classFile->constant_count - 1].index;
+
+		for (index = 1; index <= max_index; index += 1)
+			sink = (uintptr_t)find_constant(classFile, index);
+
+		count->operations += max_index;
+	}
+}
+
+static void bench_walk_constants(Corpus* corpus, BenchCount* count)
+{
+	static uint32_t* offsets = NULL;
+	static size_t capacity = 0;
+	CorpusEntry* entry;
+	const unsigned char* pool;
+	size_t max_index;
+	int i;
+
+	for (i = 0, entry = corpus->entries; i < corpus->count; i += 1, entry += 1)
+	{
+		if (entry->size < sizeof(ClassFileHeader) + 2)
+			continue;
+
+		pool = (const unsigned char*)entry->data + sizeof(ClassFileHeader);
+		max_index = (pool[0] << 8) | pool[1];
+		if (max_index > capacity)
+		{
+			capacity = max_index;
+			offsets = realloc(offsets, capacity * sizeof(uint32_t));
+		}
+
+		sink = walk_constants(pool, entry->size - sizeof(ClassFileHeader), offsets);
+
+		count->operations += 1;
+		count->bytes += sink;
+	}
+}
+
+static void bench_build_constant_pool(Corpus* corpus, BenchCount* count)
+{
+	ConstantPool pool;
+	int i;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		build_constant_pool(corpus->entries[i].classFile, &pool);
+		count->operations += 1;
+		count->bytes += constant_pool_size(&pool);
+		free_constant_pool(&pool);
+	}
+}
+
+/* The string constants: as dexor finds them, over the Constants, then
+	over the tags of a ConstantPool that is already built */
+static void bench_filter_constants(Corpus* corpus, BenchCount* count)
+{
+	ClassFile* classFile;
+	Constant *c, *string;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, c = classFile->constants; j < classFile->constant_count; j += 1, c += 1)
+		{
+			if (c->tag != TAG_STRINGREF)
+				continue;
+
+			string = find_constant(classFile, c->ref);
+			if (string != NULL && string->tag == TAG_STRING)
+				sink = (uintptr_t)string->buffer;
+		}
+		count->operations += 1;
+	}
+}
+
+static void bench_filter_pool_tags(Corpus* corpus, BenchCount* count)
+{
+	ConstantPool* pool;
+	uint32_t slot;
+	uint16_t ref;
+	int i;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		pool = &corpus->entries[i].pool;
+		for (slot = find_next_tag(pool, TAG_STRINGREF, 1); slot < pool->slot_count; slot = find_next_tag(pool, TAG_STRINGREF, slot + 1))
+		{
+			ref = POOL_REF(pool, slot);
+			if (POOL_TAG(pool, ref) == TAG_STRING)
+				sink = (uintptr_t)POOL_STRING(pool, ref);
+		}
+		count->operations += 1;
+	}
+}
+
+static void bench_format_numbers(Corpus* corpus, BenchCount* count)
+{
+	ClassFile* classFile;
+	Constant* c;
+	char buffer[64];
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, c = classFile->constants; j < classFile->constant_count; j += 1, c += 1)
+		{
+			if (c->tag < TAG_INTEGER || c->tag > TAG_DOUBLE)
+				continue;
+
+			sink = (uintptr_t)constant_to_string_r(classFile, c, buffer);
+			count->operations += 1;
+		}
+	}
+}
+
+static void bench_scan_class_header(Corpus* corpus, BenchCount* count)
+{
+	CorpusEntry* entry;
+	ClassHeader header;
+	int i;
+
+	for (i = 0, entry = corpus->entries; i < corpus->count; i += 1, entry += 1)
+	{
+		if (scan_class_header(entry->data, entry->size, &header))
+		{
+			sink = header.name.length;
+			count->bytes += header.pool_size;
+		}
+		count->operations += 1;
+	}
+}
+
+static void bench_scan_annotations(Corpus* corpus, BenchCount* count)
+{
+	static const char* names[] = { "javax.inject.Inject", "javax.inject.Singleton", "org.junit.Test", NULL };
+	AnnotationTargets targets;
+	AnnotationHits hits = { 0, 0, NULL };
+	CorpusEntry* entry;
+	int i;
+
+	init_annotation_targets(&targets);
+	for (i = 0; names[i] != NULL; i += 1)
+		add_annotation_target(&targets, names[i]);
+
+	for (i = 0, entry = corpus->entries; i < corpus->count; i += 1, entry += 1)
+	{
+		hits.count = 0;
+		sink = scan_annotations(entry->data, entry->size, &targets, &hits);
+		count->operations += 1;
+		count->bytes += entry->size;
+	}
+
+	free_annotation_hits(&hits);
+	free_annotation_targets(&targets);
+}
+
+static void bench_get_single_instruction(Corpus* corpus, BenchCount* count)
+{
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	Instruction ins;
+	uint32_t pc;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			for (pc = 0; pc < code->code.code_length; )
+			{
+				pc += get_single_instruction(code->code.code + pc, &ins, pc);
+				free_single_instruction(&ins);
+				count->operations += 1;
+			}
+
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_dump_code_attribute(Corpus* corpus, BenchCount* count)
+{
+	static FILE* devnull = NULL;
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	int i, j;
+
+	if (devnull == NULL)
+		devnull = fopen("/dev/null", "w");
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			dump_code_attribute(devnull, classFile, code);
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_build_cfg(Corpus* corpus, BenchCount* count)
+{
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			decode_code(code, &decoded);
+			sink = build_cfg(code, &decoded, &cfg);
+			free_cfg(&cfg);
+			free_decoded_code(&decoded);
+
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_find_loops(Corpus* corpus, BenchCount* count)
+{
+	static Arena arena = { NULL, NULL, 64 * 1024 };
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	Dominators dom;
+	LoopForest forest;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			decode_code(code, &decoded);
+			build_cfg(code, &decoded, &cfg);
+
+			reset_arena(&arena);
+			compute_dominators(&cfg, &arena, &dom);
+			find_loops(&cfg, &dom, &arena, &forest);
+			sink = forest.loop_count;
+
+			free_cfg(&cfg);
+			free_decoded_code(&decoded);
+
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_simulate_stack(Corpus* corpus, BenchCount* count)
+{
+	static Arena arena = { NULL, NULL, 64 * 1024 };
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	DecodedCode decoded;
+	StackInfo info;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			decode_code(code, &decoded);
+
+			reset_arena(&arena);
+			simulate_stack(classFile, code, &decoded, &arena, STACK_TYPES, &info);
+			sink = info.max_depth;
+
+			free_decoded_code(&decoded);
+
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_def_use(Corpus* corpus, BenchCount* count)
+{
+	static Arena arena = { NULL, NULL, 64 * 1024 };
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	Liveness live;
+	DefUse du;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			decode_code(code, &decoded);
+			build_cfg(code, &decoded, &cfg);
+
+			reset_arena(&arena);
+			compute_liveness(code, &decoded, &cfg, &arena, &live);
+			build_def_use(code, &decoded, &cfg, &arena, &du);
+			sink = du.def_count;
+
+			free_cfg(&cfg);
+			free_decoded_code(&decoded);
+
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_propagate_constants(Corpus* corpus, BenchCount* count)
+{
+	static Arena arena = { NULL, NULL, 64 * 1024 };
+	ClassFile* classFile;
+	Attribute* code;
+	Method* method;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	ConstProp cp;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, method = classFile->methods; j < classFile->method_count; j += 1, method += 1)
+		{
+			code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+			if (code == NULL)
+				continue;
+
+			decode_code(code, &decoded);
+			build_cfg(code, &decoded, &cfg);
+
+			reset_arena(&arena);
+			sink = propagate_constants(classFile, code, &decoded, &cfg, &arena, &cp);
+
+			free_cfg(&cfg);
+			free_decoded_code(&decoded);
+
+			count->operations += 1;
+			count->bytes += code->code.code_length;
+		}
+	}
+}
+
+static void bench_u8_toucs(Corpus* corpus, BenchCount* count)
+{
+	static uint32_t* wbuffer = NULL;
+	static int wbuffer_size = 0;
+	ClassFile* classFile;
+	Constant* c;
+	int i, j;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		classFile = corpus->entries[i].classFile;
+		for (j = 0, c = classFile->constants; j < classFile->constant_count; j += 1, c += 1)
+		{
+			if (c->tag != TAG_STRING)
+				continue;
+
+			if (c->length + 1 > wbuffer_size)
+			{
+				wbuffer_size = c->length + 1;
+				wbuffer = realloc(wbuffer, wbuffer_size * sizeof(uint32_t));
+			}
+
+			sink = u8_toucs(wbuffer, wbuffer_size, c->buffer, c->length + 1);
+			count->operations += 1;
+			count->bytes += c->length;
+		}
+	}
+}
+
+static Benchmark Benchmarks[] = {
+	{ "read_class",             "classes",      bench_read_class },
+	{ "find_constant",          "lookups",      bench_find_constant },
+	{ "walk_constants",         "classes",      bench_walk_constants },
+	{ "build_constant_pool",    "classes",      bench_build_constant_pool },
+	{ "filter_constants",       "classes",      bench_filter_constants },
+	{ "filter_pool_tags",       "classes",      bench_filter_pool_tags },
+	{ "format_numbers",         "constants",    bench_format_numbers },
+	{ "scan_class_header",      "classes",      bench_scan_class_header },
+	{ "scan_annotations",       "classes",      bench_scan_annotations },
+	{ "get_single_instruction", "instructions", bench_get_single_instruction },
+	{ "dump_code_attribute",    "methods",      bench_dump_code_attribute },
+	{ "build_cfg",              "methods",      bench_build_cfg },
+	{ "find_loops",             "methods",      bench_find_loops },
+	{ "simulate_stack",         "methods",      bench_simulate_stack },
+	{ "def_use",                "methods",      bench_def_use },
+	{ "propagate_constants",    "methods",      bench_propagate_constants },
+	{ "u8_toucs",               "strings",      bench_u8_toucs },
+	{ NULL, NULL, NULL }
+};
+
+static void run_benchmark(Benchmark* benchmark, Corpus* corpus, int iterations)
+{
+	BenchCount count;
+	double start, elapsed;
+	int i;
+
+	/* Warm up caches and the allocator */
+	memset(&count, 0, sizeof(count));
+	benchmark->function(corpus, &count);
+
+	memset(&count, 0, sizeof(count));
+	start = now();
+	for (i = 0; i < iterations; i += 1)
+		benchmark->function(corpus, &count);
+	elapsed = now() - start;
+
+	printf("%-24s %10lu %-12s %10.3f ms %10.1f ns/op", benchmark->name,
+		(unsigned long)(count.operations / iterations), benchmark->unit,
+		elapsed * 1000 / iterations, count.operations ? elapsed * 1e9 / count.operations : 0.0);
+	if (count.bytes)
+		printf(" %8.1f MB/s", count.bytes / elapsed / 1e6);
+	printf("\n");
+}
+
+static int write_corpus(Corpus* corpus, const char* directory)
+{
+	char filename[1024];
+	FILE* fp;
+	int i;
+
+	for (i = 0; i < corpus->count; i += 1)
+	{
+		snprintf(filename, sizeof(filename), "%s/%s", directory, corpus->entries[i].name);
+		if ((fp = fopen(filename, "w")) == NULL)
+		{
+			perror(filename);
+			return 0;
+		}
+
+		fwrite(corpus->entries[i].data, sizeof(char), corpus->entries[i].size, fp);
+		fclose(fp);
+	}
+
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	ClassGenOptions options;
+	Corpus corpus;
+	Benchmark* benchmark;
+	const char *output_directory = NULL, *only = NULL;
+	uint64_t total_size = 0, constants_size = 0, pool_size = 0, text_size = 0, constant_count = 0;
+	Constant* c;
+	int i, j, opt, iterations = 10, classes = 100;
+
+	classgen_default_options(&options);
+
+	while ((opt = getopt(argc, argv, "n:k:s:c:w:m:l:x:o:b:h")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': iterations = atoi(optarg); break;
+			case 'k': classes = atoi(optarg); break;
+			case 's': options.seed = strtoul(optarg, NULL, 0); break;
+			case 'c': options.constant_count = atoi(optarg); break;
+			case 'w': options.wide_percent = atoi(optarg); break;
+			case 'm': options.method_count = atoi(optarg); break;
+			case 'l': options.code_length = atoi(optarg); break;
+			case 'x': options.switch_size = atoi(optarg); break;
+			case 'o': output_directory = optarg; break;
+			case 'b': only = optarg; break;
+
+			case 'h':
+			case '?':
+				printf("Usage: %s [options] [CLASSFILE...]\n"
+					"Benchmarks the given class files, or a generated corpus.\n"
+					"options:\n"
+					"  -n N    iterations per benchmark (default: 10)\n"
+					"  -b NAME only run the named benchmark\n"
+					"  -o DIR  write the generated corpus to DIR and exit\n"
+					"corpus options:\n"
+					"  -k N    number of classes (default: 100)\n"
+					"  -s N    random seed (default: 0x%x)\n"
+					"  -c N    numeric and string constants per class (default: %d)\n"
+					"  -w N    percentage of long/double constants (default: %d)\n"
+					"  -m N    methods per class (default: %d)\n"
+					"  -l N    instructions per method (default: %d)\n"
+					"  -x N    cases per switch (default: %d)\n"
+					"", argv[0], options.seed, options.constant_count, options.wide_percent,
+					options.method_count, options.code_length, options.switch_size);
+				return optopt ? 1 : 0;
+		}
+	}
+
+	if (iterations < 1)
+		iterations = 1;
+
+	if (optind < argc)
+	{
+		corpus.count = 0;
+		corpus.entries = calloc(argc - optind, sizeof(CorpusEntry));
+		for (i = optind; i < argc; i += 1)
+			corpus.count += load_file(&corpus.entries[corpus.count], argv[i]);
+	}
+	else
+	{
+		corpus.count = classes;
+		corpus.entries = calloc(classes, sizeof(CorpusEntry));
+		for (i = 0; i < classes; i += 1)
+		{
+			generate_entry(&corpus.entries[i], &options, i);
+			options.seed += 1;
+		}
+	}
+
+	if (output_directory != NULL)
+		return write_corpus(&corpus, output_directory) ? 0 : 1;
+
+	for (i = 0; i < corpus.count; i += 1)
+	{
+		corpus.entries[i].classFile = read_class_buffer(corpus.entries[i].data, corpus.entries[i].size);
+		if (corpus.entries[i].classFile == NULL)
+		{
+			fprintf(stderr, "%s: Unable to read class file\n", corpus.entries[i].name);
+			return 1;
+		}
+		total_size += corpus.entries[i].size;
+
+		build_constant_pool(corpus.entries[i].classFile, &corpus.entries[i].pool);
+		pool_size += constant_pool_size(&corpus.entries[i].pool);
+		for (j = 0, c = corpus.entries[i].classFile->constants; j < corpus.entries[i].classFile->constant_count; j += 1, c += 1)
+		{
+			constants_size += sizeof(Constant);
+			if (c->tag == TAG_STRING)
+				text_size += c->length + 1;
+		}
+		constant_count += corpus.entries[i].classFile->constant_count;
+	}
+
+	printf("corpus: %d classes, %lu bytes, %d iterations\n", corpus.count, (unsigned long)total_size, iterations);
+	/* Per constant, without the contents of the strings, which both keep */
+	if (constant_count > 0)
+		printf("constants: %.1f bytes each as Constants, %.1f as ConstantPool\n", (double)constants_size / constant_count,
+			(double)(pool_size - text_size) / constant_count);
+	printf("\n");
+
+	for (benchmark = Benchmarks; benchmark->name; benchmark += 1)
+	{
+		if (only == NULL || strcmp(only, benchmark->name) == 0)
+			run_benchmark(benchmark, &corpus, iterations);
+	}
+
+	for (i = 0; i < corpus.count; i += 1)
+	{
+		free_class(corpus.entries[i].classFile);
+		free_constant_pool(&corpus.entries[i].pool);
+		free(corpus.entries[i].data);
+		free(corpus.entries[i].name);
+	}
+	free(corpus.entries);
+
+	return 0;
+}
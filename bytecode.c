@@ -1,4 +1,10 @@
 #include "bytecode.h"
+#include "stack.h"
+#include "liveness.h"
+#include "exceptions.h"
+#include "stackmap.h"
+#include "dominators.h"
+#include "stats.h"
 
 const char* OpcodeNames[256] = {
 	"nop",
@@ -82,18 +88,12 @@ const char* ArrayTypeNames[] = {
 	"byte", "short", "int", "long",
 };
 
-typedef struct
-{
-	uint32_t pc;
-	uint32_t dest;
-} Branch;
-
-#define MAX_BRANCHES 500
-
 uint32_t get_single_instruction(unsigned char* code, Instruction* ins, uint32_t pc)
 {
 	int offset, i;
 
+	STAT_ADD(instructions, 1);
+
 	ins->opcode = code[0];
 	switch (ins->opcode)
 	{
@@ -159,6 +159,7 @@ uint32_t get_single_instruction(unsigned char* code, Instruction* ins, uint32_t
 			offset += 4;
 
 			ins->branchoffsets = malloc((ins->high - ins->low + 1) * sizeof(int32_t));
+			STAT_ADD(allocations, 1);
 			for (i = 0; i <= ins->high - ins->low; i += 1)
 			{
 				ins->branchoffsets[i] = be32toh(*(int32_t*)(code + offset));
@@ -176,6 +177,7 @@ uint32_t get_single_instruction(unsigned char* code, Instruction* ins, uint32_t
 
 			ins->matches = malloc(ins->npairs * sizeof(int32_t));
 			ins->branchoffsets = malloc(ins->npairs * sizeof(int32_t));
+			STAT_ADD(allocations, 2);
 
 			for (i = 0; i < ins->npairs; i += 1)
 			{
@@ -252,6 +254,174 @@ void free_single_instruction(Instruction* ins)
 	}
 }
 
+uint32_t decode_code(Attribute* codeAttribute, DecodedCode* decoded)
+{
+	uint32_t pc, size, i, length = codeAttribute->code.code_length;
+
+	decoded->code_length = length;
+	decoded->count = 0;
+
+	/* Every instruction is at least one byte long */
+	decoded->pcs = malloc(length * sizeof(uint32_t));
+	decoded->instructions = malloc(length * sizeof(Instruction));
+	decoded->index = malloc((length + 1) * sizeof(int32_t));
+	STAT_ADD(allocations, 3);
+
+	for (pc = 0; pc < length; pc += size)
+	{
+		decoded->index[pc] = decoded->count;
+		size = get_single_instruction(codeAttribute->code.code + pc, &decoded->instructions[decoded->count], pc);
+		decoded->pcs[decoded->count] = pc;
+		decoded->count += 1;
+
+		for (i = 1; i < size && pc + i < length; i += 1)
+			decoded->index[pc + i] = -1;
+	}
+
+	decoded->index[length] = decoded->count;
+	return decoded->count;
+}
+
+void free_decoded_code(DecodedCode* decoded)
+{
+	uint32_t i;
+
+	for (i = 0; i < decoded->count; i += 1)
+		free_single_instruction(&decoded->instructions[i]);
+
+	free(decoded->pcs);
+	free(decoded->instructions);
+	free(decoded->index);
+}
+
+int get_instruction_operands(Instruction* ins, uint32_t pc, int32_t* operands, int capacity)
+{
+	int i, count = 0;
+
+	/* Operands are stored if they fit, but always counted */
+#define _operand(value)          \
+	if (count < capacity)        \
+		operands[count] = value; \
+	count += 1;
+
+	switch (ins->opcode)
+	{
+		case OP_BIPUSH:
+			_operand((int8_t)ins->uint8);
+			break;
+
+		case OP_SIPUSH:
+			_operand((int16_t)ins->uint16);
+			break;
+
+		case OP_LDC:
+		case OP_LDC_W:
+		case OP_LDC2_W:
+		case OP_GETSTATIC:
+		case OP_PUTSTATIC:
+		case OP_GETFIELD:
+		case OP_PUTFIELD:
+		case OP_INVOKEVIRTUAL:
+		case OP_INVOKESPECIAL:
+		case OP_INVOKESTATIC:
+		case OP_INVOKEINTERFACE:
+		case OP_INVOKEDYNAMIC:
+		case OP_NEW:
+		case OP_ANEWARRAY:
+		case OP_CHECKCAST:
+		case OP_INSTANCEOF:
+			_operand(ins->constant);
+			break;
+
+		case OP_MULTIANEWARRAY:
+			_operand(ins->constant);
+			_operand((uint8_t)ins->dimensions);
+			break;
+
+		case OP_ILOAD:
+		case OP_LLOAD:
+		case OP_FLOAD:
+		case OP_DLOAD:
+		case OP_ALOAD:
+		case OP_ISTORE:
+		case OP_LSTORE:
+		case OP_FSTORE:
+		case OP_DSTORE:
+		case OP_ASTORE:
+		case OP_RET:
+			_operand((uint8_t)ins->varIndex);
+			break;
+
+		case OP_IINC:
+			_operand((uint8_t)ins->varIndex);
+			_operand(ins->value);
+			break;
+
+		case OP_IFEQ:
+		case OP_IFNE:
+		case OP_IFLT:
+		case OP_IFGE:
+		case OP_IFGT:
+		case OP_IFLE:
+		case OP_IF_ICMPEQ:
+		case OP_IF_ICMPNE:
+		case OP_IF_ICMPLT:
+		case OP_IF_ICMPGE:
+		case OP_IF_ICMPGT:
+		case OP_IF_ICMPLE:
+		case OP_IF_ACMPEQ:
+		case OP_IF_ACMPNE:
+		case OP_GOTO:
+		case OP_JSR:
+		case OP_IFNULL:
+		case OP_IFNONNULL:
+			_operand(pc + ins->branchoffset);
+			break;
+
+		case OP_GOTO_W:
+		case OP_JSR_W:
+			_operand(pc + ins->branchoffset32);
+			break;
+
+		case OP_NEWARRAY:
+			_operand(ins->uint8);
+			break;
+
+		case OP_WIDE:
+			_operand(ins->opcode2);
+			_operand(ins->varIndex16);
+			if (ins->opcode2 == OP_IINC)
+			{
+				_operand((int16_t)ins->value16);
+			}
+			break;
+
+		case OP_TABLESWITCH:
+			_operand(pc + ins->defaultoffset);
+			_operand(ins->low);
+			_operand(ins->high);
+			for (i = 0; i <= ins->high - ins->low; i += 1)
+			{
+				_operand(pc + ins->branchoffsets[i]);
+			}
+			break;
+
+		case OP_LOOKUPSWITCH:
+			_operand(pc + ins->defaultoffset);
+			_operand(ins->npairs);
+			for (i = 0; i < ins->npairs; i += 1)
+			{
+				_operand(ins->matches[i]);
+				_operand(pc + ins->branchoffsets[i]);
+			}
+			break;
+	}
+
+#undef _operand
+
+	return count;
+}
+
 int instruction_to_string(ClassFile* classFile, Instruction* ins, uint32_t pc, int bufsize, char* buf)
 {
 	int i, outsize;
@@ -292,7 +462,10 @@ int instruction_to_string(ClassFile* classFile, Instruction* ins, uint32_t pc, i
 		case OP_CHECKCAST:
 		case OP_INSTANCEOF:
 			c = find_constant(classFile, ins->constant);
-			outsize += snprintf(buf, bufsize - outsize, " #%hu // %s", ins->constant, constant_to_string(classFile, c));
+			if (c != NULL && (c->tag == TAG_DYNAMIC || c->tag == TAG_INVOKEDYNAMIC))
+				outsize += snprintf(buf, bufsize - outsize, " #%hu // %s", ins->constant, call_site_to_string(classFile, c));
+			else
+				outsize += snprintf(buf, bufsize - outsize, " #%hu // %s", ins->constant, constant_to_string(classFile, c));
 			break;
 
 		case OP_ILOAD:
@@ -551,82 +724,312 @@ uint32_t instruction_to_bytecode(Instruction* ins, unsigned char* code, uint32_t
 	}
 }
 
-void dump_code_attribute(FILE* fp, ClassFile* classFile, Attribute* attribute)
+static int stack_to_string(StackInfo* stack, DecodedCode* decoded, uint32_t pc, char* buf)
 {
-	uint32_t pc, size;
-	Instruction ins;
-	char insbuf[10240], label[128];
-	Branch branches[MAX_BRANCHES], *branch = branches;
-	int i, nins = 0, nbranch = 0, branchdest;
+	uint8_t* types;
+	int i, n, depth = stack->depth[pc];
+
+	static const char* names[] = { "top", "I", "F", "J", "D", "null", "A", "uninit", "ret" };
 
-	for (pc = 0; pc < attribute->code.code_length && nbranch < MAX_BRANCHES; )
+	if (depth < 0)
+		return sprintf(buf, "unreachable");
+
+	n = sprintf(buf, "stack %d:", depth);
+	types = stack_types_at(stack, decoded, pc);
+	for (i = 0; i < depth; i += 1)
 	{
-		size = get_single_instruction(attribute->code.code + pc, &ins, pc);
+		n += sprintf(buf + n, " %s", names[types[i]]);
 
-		if (ins.opcode == OP_GOTO_W || ins.opcode == OP_JSR_W)
+		/* The second slot of a long or double */
+		if (types[i] == VT_LONG || types[i] == VT_DOUBLE)
+			i += 1;
+	}
+	return n;
+}
+
+typedef struct
+{
+	ControlFlowGraph* cfg;
+	Liveness live;
+	DefUse du;
+	uint64_t* set;
+} Locals;
+
+/* Live slots before the instruction, and where the locals it reads come
+	from or the value it stores goes to */
+static int locals_to_string(Locals* locals, DecodedCode* decoded, uint32_t pc, char* buf)
+{
+	uint32_t index = decoded->index[pc], i, d, insn, n;
+	DefUse* du = &locals->du;
+
+	n = sprintf(buf, "live:");
+	live_before(&locals->live, decoded, locals->cfg, index, locals->set);
+	for (i = 0; i < locals->live.max_locals; i += 1)
+	{
+		if (bitset_test(locals->set, i))
+			n += sprintf(buf + n, " %u", i);
+	}
+	if (n == 5)
+		n += sprintf(buf + n, " none");
+
+	if (du->reach_start[index + 1] > du->reach_start[index])
+	{
+		n += sprintf(buf + n, "; from:");
+		for (i = du->reach_start[index]; i < du->reach_start[index + 1]; i += 1)
 		{
-			branch->pc = pc;
-			branch->dest = pc + ins.branchoffset32;
-			nbranch += 1;
-			branch += 1;
+			insn = du->def_instruction[du->reaching[i]];
+			if (insn == DEF_ENTRY)
+				n += sprintf(buf + n, " entry");
+			else
+				n += sprintf(buf + n, " %u", decoded->pcs[insn]);
 		}
-		else if ((ins.opcode >= OP_IFEQ && ins.opcode <= OP_JSR) ||
-			ins.opcode == OP_IFNULL || ins.opcode == OP_IFNONNULL)
+	}
+
+	if ((d = du->def_at[index]) != UINT32_MAX)
+	{
+		if (du->use_start[d + 1] == du->use_start[d])
+			n += sprintf(buf + n, "; dead store");
+		else
 		{
-			branch->pc = pc;
-			branch->dest = pc + ins.branchoffset;
-			nbranch += 1;
-			branch += 1;
+			n += sprintf(buf + n, "; used at:");
+			for (i = du->use_start[d]; i < du->use_start[d + 1]; i += 1)
+				n += sprintf(buf + n, " %u", decoded->pcs[du->uses[i]]);
 		}
-		else if (ins.opcode == OP_TABLESWITCH)
-		{
-			for (i = 0; i <= ins.high - ins.low && nbranch < MAX_BRANCHES; i += 1)
-			{
-				branch->pc = pc;
-				branch->dest = pc + ins.branchoffsets[i];
-				nbranch += 1;
-				branch += 1;
-			}
+	}
+	return n;
+}
 
-			if (nbranch < MAX_BRANCHES)
-			{
-				branch->pc = pc;
-				branch->dest = pc + ins.defaultoffset;
-				nbranch += 1;
-				branch += 1;
-			}
-		}
-		else if (ins.opcode == OP_LOOKUPSWITCH)
-		{
-			for (i = 0; i < ins.npairs && nbranch < MAX_BRANCHES; i += 1)
-			{
-				branch->pc = pc;
-				branch->dest = pc + ins.branchoffsets[i];
-				nbranch += 1;
-				branch += 1;
-			}
+void dump_code_attribute(FILE* fp, ClassFile* classFile, Attribute* attribute)
+{
+	dump_code_attribute_ex(fp, classFile, attribute, 0);
+}
 
-			if (nbranch < MAX_BRANCHES)
-			{
-				branch->pc = pc;
-				branch->dest = pc + ins.defaultoffset;
-				nbranch += 1;
-				branch += 1;
-			}
+/* Class an exception handler catches, "any" for a finally handler */
+static const char* catch_type_name(ClassFile* classFile, uint16_t catch_type)
+{
+	Constant *classref, *name;
+
+	if (catch_type == 0)
+		return "any";
+
+	classref = find_constant(classFile, catch_type);
+	if (classref == NULL || classref->tag != TAG_CLASSREF)
+		return "?";
+
+	name = find_constant(classFile, classref->ref);
+	if (name == NULL || name->tag != TAG_STRING)
+		return "?";
+	return class_name_from_internal(name->buffer);
+}
+
+static void print_items(FILE* fp, ClassFile* classFile, StackMap* map, const char* title, VerificationItem* item, uint32_t count)
+{
+	char buffer[256];
+	uint32_t i;
+
+	fprintf(fp, " %s [", title);
+	for (i = 0; i < count; i += 1, item += 1)
+		fprintf(fp, "%s%s", i > 0 ? ", " : "", verification_item_to_string(classFile, map, item, buffer, sizeof(buffer)));
+	fprintf(fp, "]");
+}
+
+/* A frame as the class file stores it: what changes from the frame before */
+static void print_frame(FILE* fp, ClassFile* classFile, StackMap* map, StackMapFrame* frame)
+{
+	VerificationItem* items = map->items + frame->items;
+
+	fprintf(fp, "        // frame %s", frame_type_to_string(frame->type));
+	if (FRAME_CHOP(frame->type))
+		fprintf(fp, " %hhu", frame->chop);
+	if (FRAME_APPEND(frame->type) || FRAME_FULL(frame->type))
+		print_items(fp, classFile, map, "locals", items, frame->local_count);
+	if (FRAME_SAME_STACK1(frame->type) || FRAME_FULL(frame->type))
+		print_items(fp, classFile, map, "stack", items + frame->local_count, frame->stack_count);
+	fprintf(fp, "\n");
+}
+
+static void print_try_ends(FILE* fp, ClassFile* classFile, ExceptionIndex* exceptions, uint32_t pc)
+{
+	const uint16_t* entries;
+	uint32_t count, k;
+
+	count = ranges_ending_at(exceptions, pc, &entries);
+	for (k = 0; k < count; k += 1)
+		fprintf(fp, "        // } try #%hu: catch %s -> %hu\n", entries[k],
+			catch_type_name(classFile, exceptions->table[entries[k]].catch_type), exceptions->table[entries[k]].handler_pc);
+}
+
+/* Number of targets of a branch, the cases and default of a switch
+	included; 0 if the instruction doesn't branch */
+static uint32_t branch_count(Instruction* ins)
+{
+	switch (ins->opcode)
+	{
+		case OP_TABLESWITCH:
+			return ins->high >= ins->low ? (uint32_t)(ins->high - ins->low) + 2 : 1;
+
+		case OP_LOOKUPSWITCH:
+			return ins->npairs + 1;
+
+		case OP_GOTO_W:
+		case OP_JSR_W:
+		case OP_IFNULL:
+		case OP_IFNONNULL:
+			return 1;
+	}
+	return ins->opcode >= OP_IFEQ && ins->opcode <= OP_JSR;
+}
+
+static int64_t branch_target(Instruction* ins, uint32_t pc, uint32_t k)
+{
+	switch (ins->opcode)
+	{
+		case OP_TABLESWITCH:
+		case OP_LOOKUPSWITCH:
+			return (int64_t)pc + (k + 1 < branch_count(ins) ? ins->branchoffsets[k] : ins->defaultoffset);
+
+		case OP_GOTO_W:
+		case OP_JSR_W:
+			return (int64_t)pc + ins->branchoffset32;
+	}
+	return (int64_t)pc + ins->branchoffset;
+}
+
+/* The pcs of the branches into block b; fallthrough and exception edges
+	are not branches */
+static void print_branches_from(FILE* fp, ControlFlowGraph* cfg, DecodedCode* decoded, uint32_t b)
+{
+	BasicBlock* block = cfg->blocks + b;
+	Instruction* ins;
+	uint32_t i, k, last, count = 0;
+	char label[16];
+
+	for (i = block->pred_start; i < block->pred_start + block->pred_count; i += 1)
+	{
+		if (cfg->predecessor_kinds[i] != EDGE_NORMAL)
+			continue;
+
+		last = cfg->blocks[cfg->predecessors[i]].first + cfg->blocks[cfg->predecessors[i]].count - 1;
+		ins = decoded->instructions + last;
+		for (k = 0; k < branch_count(ins) && branch_target(ins, decoded->pcs[last], k) != block->start_pc; k += 1)
+			;
+		if (k == branch_count(ins))
+			continue;
+
+		if (count == 0)
+		{
+			sprintf(label, "%u:", block->start_pc);
+			fprintf(fp, "%-7s // Branches from: %u", label, decoded->pcs[last]);
 		}
+		else
+			fprintf(fp, ", %u", decoded->pcs[last]);
+		count += 1;
+	}
 
-		free_single_instruction(&ins);
+	if (count > 0)
+		fprintf(fp, "\n");
+}
 
-		pc += size;
-		nins += 1;
+/* The natural loops, innermost first, with the pc of their header */
+static void print_loops(FILE* fp, ControlFlowGraph* cfg, Arena* arena)
+{
+	Dominators dom;
+	LoopForest forest;
+	Loop* loop;
+	uint32_t i;
+
+	compute_dominators(cfg, arena, &dom);
+	find_loops(cfg, &dom, arena, &forest);
+
+	fprintf(fp, "        // Loops: %u\n", forest.loop_count);
+	for (i = 0, loop = forest.loops; i < forest.loop_count; i += 1, loop += 1)
+		fprintf(fp, "        // loop at %u: depth %u, %u blocks\n", cfg->blocks[loop->header].start_pc, loop->depth, loop->block_count);
+	if (forest.irreducible_edges > 0)
+		fprintf(fp, "        // (%u irreducible edges)\n", forest.irreducible_edges);
+}
+
+void dump_code_attribute_ex(FILE* fp, ClassFile* classFile, Attribute* attribute, int flags)
+{
+	uint32_t pc, size;
+	Instruction ins;
+	char insbuf[10240], label[128];
+	uint32_t nbranch = 0;
+	int32_t block;
+	int phase;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	StackInfo stack;
+	Locals locals;
+	Arena arena;
+	char* notebuf = NULL;
+	size_t notesize;
+	int n;
+	LineNumber* line;
+	LocalVariable* variable;
+	LocalAccess access;
+	Constant* name;
+	ExceptionIndex exceptions;
+	const uint16_t* entries;
+	uint32_t count, k;
+	StackMap map;
+	int32_t frames = 0, frame = 0;
+
+	phase = STATS_PHASE(PHASE_DECODE);
+
+	build_exception_index(attribute, &exceptions);
+
+	/* Without the method, the implicit first frame is left empty; only
+		the frames themselves are shown */
+	if (flags & DUMP_FRAMES)
+		frames = decode_stack_map(classFile, NULL, attribute, &map);
+
+	/* The branch labels come from the predecessors in the CFG */
+	decode_code(attribute, &decoded);
+	build_cfg(attribute, &decoded, &cfg);
+	for (k = 0; k < decoded.count; k += 1)
+		nbranch += branch_count(decoded.instructions + k);
+
+	if (flags & (DUMP_STACK | DUMP_LOCALS | DUMP_LOOPS))
+		init_arena(&arena, 64 * 1024);
+
+	if (flags & (DUMP_STACK | DUMP_LOCALS))
+	{
+		/* Longest type name per stack slot, a number per local, and a pc
+			per definition or use */
+		notesize = 64 + 8 * (size_t)attribute->code.max_stack + 6 * (size_t)attribute->code.max_locals
+			+ 12 * ((size_t)decoded.count + attribute->code.max_locals);
+		notebuf = arena_alloc(&arena, notesize);
+	}
+
+	if (flags & DUMP_STACK)
+		simulate_stack(classFile, attribute, &decoded, &arena, STACK_TYPES, &stack);
+
+	if (flags & DUMP_LOCALS)
+	{
+		locals.cfg = &cfg;
+		compute_liveness(attribute, &decoded, &cfg, &arena, &locals.live);
+		build_def_use(attribute, &decoded, &cfg, &arena, &locals.du);
+		locals.set = arena_alloc(&arena, locals.live.words_per_set * sizeof(uint64_t) + 1);
 	}
 
-	fprintf(fp, "        // Code Length: %d bytes / %d instructions\n", attribute->code.code_length, nins);
+	STATS_PHASE(PHASE_FORMAT);
+
+	fprintf(fp, "        // Code Length: %d bytes / %u instructions\n", attribute->code.code_length, decoded.count);
 	fprintf(fp, "        // Max Stack: %hd, Max Locals: %hd, Attributes: %hd\n", attribute->code.max_stack, attribute->code.max_locals, attribute->code.attribute_count);
-	fprintf(fp, "        // Branches: %d\n", nbranch);
+	fprintf(fp, "        // Branches: %u\n", nbranch);
+
+	if (flags & DUMP_STACK)
+	{
+		fprintf(fp, "        // Stack Depth: %hu\n", stack.max_depth);
+		if (stack.error != STACK_OK)
+			fprintf(fp, "        // Stack Error at %u: %s\n", stack.error_pc, stack_error_to_string(stack.error));
+	}
 
-	if (nbranch >= MAX_BRANCHES)
-		fprintf(fp, "        // (Branch Analysis incomplete)\n");
+	if ((flags & DUMP_FRAMES) && frames < 0)
+		fprintf(fp, "        // (StackMapTable malformed)\n");
+
+	if (flags & DUMP_LOOPS)
+		print_loops(fp, &cfg, &arena);
 
 	fprintf(fp, "\n");
 
@@ -637,40 +1040,88 @@ void dump_code_attribute(FILE* fp, ClassFile* classFile, Attribute* attribute)
 		if (instruction_to_string(classFile, &ins, pc, sizeof(insbuf), insbuf) >= sizeof(insbuf))
 			strcpy(insbuf, "// Error: Unable to decode instruction");
 
-		free_single_instruction(&ins);
+		/* Name the local an instruction reads or writes; a store comes
+			just before the scope of the variable it starts */
+		if (attribute->code.local_count > 0 && local_access(&ins, &access) &&
+			((variable = find_local_variable(attribute, access.slot, pc)) != NULL ||
+			((access.kind & ACCESS_DEF) && (variable = find_local_variable(attribute, access.slot, pc + size)) != NULL)))
+		{
+			name = find_constant(classFile, variable->name_index);
+			n = strlen(insbuf);
+			if (name != NULL && name->tag == TAG_STRING && strchr(insbuf, '\n') == NULL)
+				snprintf(insbuf + n, sizeof(insbuf) - n, " // %s", name->buffer);
+		}
+
+		/* Try blocks close before the line starts and open after it */
+		print_try_ends(fp, classFile, &exceptions, pc);
+
+		if ((line = find_line_number(attribute, pc)) != NULL && line->start_pc == pc)
+			fprintf(fp, "        // line %hu\n", line->line);
 
-		branchdest = 0;
-		for (i = 0, branch = branches; i < nbranch; i += 1, branch += 1)
+		count = handlers_entered_at(&exceptions, pc, &entries);
+		for (k = 0; k < count; k += 1)
+			fprintf(fp, "        // catch #%hu %s\n", entries[k], catch_type_name(classFile, exceptions.table[entries[k]].catch_type));
+
+		count = ranges_starting_at(&exceptions, pc, &entries);
+		for (k = 0; k < count; k += 1)
+			fprintf(fp, "        // try #%hu {\n", entries[k]);
+
+		for ( ; frame < frames && map.frames[frame].pc <= pc; frame += 1)
 		{
-			if (pc == branch->dest)
-			{
-				if (branchdest == 0)
-				{
-					sprintf(label, "%d:", pc);
-					fprintf(fp, "%-7s // Branches from: %d", label, branch->pc);
-				}
-				else
-					fprintf(fp, ", %d", branch->pc);
-				branchdest += 1;
-			}
+			if (map.frames[frame].pc == pc)
+				print_frame(fp, classFile, &map, map.frames + frame);
 		}
-		if (branchdest)
-			fprintf(fp, "\n");
 
-		for (i = 0, branch = branches; i < nbranch; i += 1, branch += 1)
+		if ((block = cfg_block_at(&cfg, &decoded, pc)) >= 0 && cfg.blocks[block].start_pc == pc)
+			print_branches_from(fp, &cfg, &decoded, block);
+
+		if (branch_count(&ins) > 0)
+		{
+			sprintf(label, "%d:", pc);
+			fprintf(fp, "%-7s ", label);
+		}
+		else
+			fprintf(fp, "        ");
+
+		if (flags & (DUMP_STACK | DUMP_LOCALS))
 		{
-			if (pc == branch->pc)
+			n = 0;
+			if (flags & DUMP_STACK)
+				n += stack_to_string(&stack, &decoded, pc, notebuf);
+			if (flags & DUMP_LOCALS)
 			{
-				sprintf(label, "%d:", pc);
-				fprintf(fp, "%-7s ", label);
-				break;
+				if (n > 0)
+					n += sprintf(notebuf + n, "; ");
+				locals_to_string(&locals, &decoded, pc, notebuf + n);
 			}
-		}
 
-		if (i >= nbranch)
-			fprintf(fp, "        ");
-		fprintf(fp, "%s\n", insbuf);
+			/* Switches span several lines; annotate those above */
+			if (strchr(insbuf, '\n') != NULL)
+				fprintf(fp, "// %s\n        %s\n", notebuf, insbuf);
+			else if (strstr(insbuf, "//") != NULL)
+				fprintf(fp, "%s; %s\n", insbuf, notebuf);
+			else
+				fprintf(fp, "%-40s // %s\n", insbuf, notebuf);
+		}
+		else
+			fprintf(fp, "%s\n", insbuf);
 
+		free_single_instruction(&ins);
 		pc += size;
 	}
+
+	/* Ranges that run to the end of the code */
+	print_try_ends(fp, classFile, &exceptions, attribute->code.code_length);
+
+	free_cfg(&cfg);
+	free_decoded_code(&decoded);
+
+	if (flags & (DUMP_STACK | DUMP_LOCALS | DUMP_LOOPS))
+		free_arena(&arena);
+
+	if ((flags & DUMP_FRAMES) && frames >= 0)
+		free_stack_map(&map);
+
+	free_exception_index(&exceptions);
+	STATS_PHASE(phase);
 }
\ No newline at end of file
@@ -274,6 +274,7 @@
 #define ATYPE_LONG    11
 
 extern const char* OpcodeNames[256];
+extern const char* ArrayTypeNames[];
 
 typedef struct
 {
@@ -320,10 +321,33 @@ typedef struct
 	};
 } Instruction;
 
+/* A whole Code attribute, decoded once */
+typedef struct
+{
+	uint32_t code_length;
+	uint32_t count;
+	uint32_t* pcs;             /* pc of each instruction */
+	Instruction* instructions;
+	int32_t* index;            /* pc -> instruction index, -1 if not an instruction start */
+} DecodedCode;
+
+#define instruction_index(decoded, pc) \
+	((pc) <= (decoded)->code_length ? (decoded)->index[pc] : -1)
+
+/* dump_code_attribute_ex flags */
+#define DUMP_STACK  0x01 /* annotate instructions with the operand stack */
+#define DUMP_LOCALS 0x02 /* annotate instructions with live locals and def-use links */
+#define DUMP_FRAMES 0x04 /* show the StackMapTable frames where they apply */
+#define DUMP_LOOPS  0x08 /* list the natural loops, by header pc and nesting depth */
+
 void dump_code_attribute(FILE* fp, ClassFile* classFile, Attribute* attribute);
+void dump_code_attribute_ex(FILE* fp, ClassFile* classFile, Attribute* attribute, int flags);
 int instruction_to_string(ClassFile* classFile, Instruction* ins, uint32_t pc, int bufsize, char* buf);
+int get_instruction_operands(Instruction* ins, uint32_t pc, int32_t* operands, int capacity);
 uint32_t instruction_to_bytecode(Instruction* ins, unsigned char* code, uint32_t pc);
 uint32_t get_single_instruction(unsigned char* code, Instruction* ins, uint32_t pc);
 void free_single_instruction(Instruction* ins);
+uint32_t decode_code(Attribute* codeAttribute, DecodedCode* decoded);
+void free_decoded_code(DecodedCode* decoded);
 
 #endif
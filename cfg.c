@@ -0,0 +1,396 @@
+#include "cfg.h"
+#include "stats.h"
+
+/*
+	Construction is linear in the number of instructions and edges, plus
+	a lookup in the exception index per block:
+
+	1. Mark leaders: the first instruction, branch targets, instructions
+	   following a branch, and the start, end and handler of every
+	   exception table entry.
+	2. Number the blocks and map every instruction to its block.
+	3. Collect edges in pc order, then counting sort them by source (the
+	   successor lists) and by destination (the predecessor lists).
+*/
+
+typedef struct
+{
+	uint32_t from;
+	uint32_t to;
+	uint8_t kind;
+} Edge;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t capacity;
+	Edge* edges;
+} EdgeList;
+
+static void add_edge(EdgeList* list, uint32_t from, uint32_t to, uint8_t kind)
+{
+	if (list->count == list->capacity)
+	{
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->edges = realloc(list->edges, list->capacity * sizeof(Edge));
+		STAT_ADD(allocations, 1);
+	}
+
+	list->edges[list->count].from = from;
+	list->edges[list->count].to = to;
+	list->edges[list->count].kind = kind;
+	list->count += 1;
+}
+
+/* Instruction index of a branch target, -1 if it isn't an instruction */
+static int32_t target_index(DecodedCode* decoded, int64_t pc)
+{
+	if (pc < 0 || pc >= decoded->code_length)
+		return -1;
+	return decoded->index[pc];
+}
+
+/* Instruction index of the handler of an entry, -1 if its range or
+	handler doesn't line up with instructions */
+static int32_t exception_target(DecodedCode* decoded, ExceptionTableEntry* entry)
+{
+	if (target_index(decoded, entry->start_pc) < 0)
+		return -1;
+	if (entry->end_pc < decoded->code_length && target_index(decoded, entry->end_pc) < 0)
+		return -1;
+	return target_index(decoded, entry->handler_pc);
+}
+
+static void mark_leader(uint8_t* leaders, DecodedCode* decoded, int64_t pc)
+{
+	int32_t i = target_index(decoded, pc);
+	if (i >= 0)
+		leaders[i] = 1;
+}
+
+static int is_conditional(uint8_t opcode)
+{
+	return (opcode >= OP_IFEQ && opcode <= OP_IF_ACMPNE) || opcode == OP_IFNULL || opcode == OP_IFNONNULL;
+}
+
+static int ends_block(Instruction* ins)
+{
+	switch (ins->opcode)
+	{
+		case OP_GOTO:
+		case OP_GOTO_W:
+		case OP_JSR:
+		case OP_JSR_W:
+		case OP_RET:
+		case OP_TABLESWITCH:
+		case OP_LOOKUPSWITCH:
+		case OP_IRETURN:
+		case OP_LRETURN:
+		case OP_FRETURN:
+		case OP_DRETURN:
+		case OP_ARETURN:
+		case OP_RETURN:
+		case OP_ATHROW:
+			return 1;
+
+		case OP_WIDE:
+			return ins->opcode2 == OP_RET;
+	}
+	return is_conditional(ins->opcode);
+}
+
+/* Adds the edges leaving block b, which ends with ins at pc */
+static void add_block_edges(ControlFlowGraph* cfg, DecodedCode* decoded, EdgeList* list, uint32_t b, Instruction* ins, uint32_t pc)
+{
+	BasicBlock* block = cfg->blocks + b;
+	int32_t target;
+	int i, fallthrough = 1;
+
+#define _branch(dest)                                                           \
+	if ((target = target_index(decoded, (int64_t)pc + (dest))) >= 0)            \
+		add_edge(list, b, cfg->block_of[target], EDGE_NORMAL);
+
+	switch (ins->opcode)
+	{
+		case OP_GOTO:
+			_branch(ins->branchoffset);
+			fallthrough = 0;
+			break;
+
+		case OP_GOTO_W:
+			_branch(ins->branchoffset32);
+			fallthrough = 0;
+			break;
+
+		/* A subroutine returns to the instruction after the jsr */
+		case OP_JSR:
+			_branch(ins->branchoffset);
+			break;
+
+		case OP_JSR_W:
+			_branch(ins->branchoffset32);
+			break;
+
+		case OP_TABLESWITCH:
+			for (i = 0; i <= ins->high - ins->low; i += 1)
+			{
+				_branch(ins->branchoffsets[i]);
+			}
+			_branch(ins->defaultoffset);
+			fallthrough = 0;
+			break;
+
+		case OP_LOOKUPSWITCH:
+			for (i = 0; i < ins->npairs; i += 1)
+			{
+				_branch(ins->branchoffsets[i]);
+			}
+			_branch(ins->defaultoffset);
+			fallthrough = 0;
+			break;
+
+		case OP_IRETURN:
+		case OP_LRETURN:
+		case OP_FRETURN:
+		case OP_DRETURN:
+		case OP_ARETURN:
+		case OP_RETURN:
+		case OP_ATHROW:
+			block->flags |= BLOCK_EXIT;
+			fallthrough = 0;
+			break;
+
+		case OP_RET:
+			block->flags |= BLOCK_RET;
+			fallthrough = 0;
+			break;
+
+		case OP_WIDE:
+			if (ins->opcode2 == OP_RET)
+			{
+				block->flags |= BLOCK_RET;
+				fallthrough = 0;
+			}
+			break;
+
+		default:
+			if (is_conditional(ins->opcode))
+			{
+				_branch(ins->branchoffset);
+			}
+			break;
+	}
+
+#undef _branch
+
+	if (fallthrough && b + 1 < cfg->block_count)
+		add_edge(list, b, b + 1, EDGE_NORMAL);
+}
+
+/* Groups the edges by source (or destination) block, keeping their order
+	and dropping duplicates. Each block's slice of targets and kinds is
+	returned in starts and counts. */
+static uint32_t sort_edges(EdgeList* list, uint32_t block_count, int by_source,
+	uint32_t* starts, uint32_t* counts, uint32_t* targets, uint8_t* kinds)
+{
+	uint32_t *offsets, *seen, *order, i, key, other, total = 0;
+	Edge* edge;
+
+	offsets = calloc(block_count + 1, sizeof(uint32_t));
+	seen = calloc(block_count, sizeof(uint32_t));
+	order = malloc(list->count * sizeof(uint32_t) + 1);
+	STAT_ADD(allocations, 3);
+
+	/* Counting sort */
+	for (i = 0, edge = list->edges; i < list->count; i += 1, edge += 1)
+		offsets[(by_source ? edge->from : edge->to) + 1] += 1;
+	for (i = 0; i < block_count; i += 1)
+		offsets[i + 1] += offsets[i];
+	for (i = 0, edge = list->edges; i < list->count; i += 1, edge += 1)
+		order[offsets[by_source ? edge->from : edge->to]++] = i;
+
+	/* offsets[key] is now the end of key's slice in order; seen[other]
+		holds key + 1 once other is in key's slice */
+	for (key = 0, i = 0; key < block_count; key += 1)
+	{
+		starts[key] = total;
+		counts[key] = 0;
+
+		for ( ; i < offsets[key]; i += 1)
+		{
+			edge = list->edges + order[i];
+			other = by_source ? edge->to : edge->from;
+			if (seen[other] == key + 1)
+				continue;
+			seen[other] = key + 1;
+
+			targets[total] = other;
+			kinds[total] = edge->kind;
+			counts[key] += 1;
+			total += 1;
+		}
+	}
+
+	free(offsets);
+	free(seen);
+	free(order);
+	return total;
+}
+
+uint32_t build_cfg(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg)
+{
+	ExceptionTableEntry* entry;
+	EdgeList list = { 0, 0, NULL };
+	BasicBlock* block;
+	Instruction* ins;
+	uint8_t* leaders;
+	const uint16_t* covers;
+	int32_t handler;
+	uint32_t i, b, count, *starts, *counts;
+	int k;
+
+	memset(cfg, 0, sizeof(ControlFlowGraph));
+	if (decoded->count == 0)
+		return 0;
+
+	/* 1. Leaders */
+	leaders = calloc(decoded->count, sizeof(uint8_t));
+	STAT_ADD(allocations, 1);
+	leaders[0] = 1;
+
+	for (i = 0, ins = decoded->instructions; i < decoded->count; i += 1, ins += 1)
+	{
+		if (!ends_block(ins))
+			continue;
+
+		if (i + 1 < decoded->count)
+			leaders[i + 1] = 1;
+
+		switch (ins->opcode)
+		{
+			case OP_GOTO_W:
+			case OP_JSR_W:
+				mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->branchoffset32);
+				break;
+
+			case OP_TABLESWITCH:
+				for (k = 0; k <= ins->high - ins->low; k += 1)
+					mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->branchoffsets[k]);
+				mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->defaultoffset);
+				break;
+
+			case OP_LOOKUPSWITCH:
+				for (k = 0; k < ins->npairs; k += 1)
+					mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->branchoffsets[k]);
+				mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->defaultoffset);
+				break;
+
+			case OP_GOTO:
+			case OP_JSR:
+				mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->branchoffset);
+				break;
+
+			default:
+				if (is_conditional(ins->opcode))
+					mark_leader(leaders, decoded, (int64_t)decoded->pcs[i] + ins->branchoffset);
+				break;
+		}
+	}
+
+	for (k = 0, entry = codeAttribute->code.exception_table; k < codeAttribute->code.exception_table_length; k += 1, entry += 1)
+	{
+		mark_leader(leaders, decoded, entry->start_pc);
+		mark_leader(leaders, decoded, entry->end_pc);
+		mark_leader(leaders, decoded, entry->handler_pc);
+	}
+
+	/* 2. Blocks */
+	for (i = 0; i < decoded->count; i += 1)
+		cfg->block_count += leaders[i];
+
+	cfg->blocks = calloc(cfg->block_count, sizeof(BasicBlock));
+	cfg->block_of = malloc(decoded->count * sizeof(uint32_t));
+	STAT_ADD(allocations, 2);
+
+	for (i = 0, b = 0, block = NULL; i < decoded->count; i += 1)
+	{
+		if (leaders[i])
+		{
+			block = cfg->blocks + b++;
+			block->start_pc = decoded->pcs[i];
+			block->first = i;
+		}
+
+		block->count += 1;
+		block->end_pc = i + 1 < decoded->count ? decoded->pcs[i + 1] : decoded->code_length;
+		cfg->block_of[i] = b - 1;
+	}
+	cfg->blocks[0].flags |= BLOCK_ENTRY;
+	free(leaders);
+
+	/* 3. Edges; normal ones first, so they are kept over an exception
+		edge to the same block */
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		i = block->first + block->count - 1;
+		add_block_edges(cfg, decoded, &list, b, decoded->instructions + i, decoded->pcs[i]);
+	}
+
+	build_exception_index(codeAttribute, &cfg->exceptions);
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		count = handlers_at(&cfg->exceptions, block->start_pc, &covers);
+		for (i = 0; i < count; i += 1)
+		{
+			if ((handler = exception_target(decoded, codeAttribute->code.exception_table + covers[i])) >= 0)
+				add_edge(&list, b, cfg->block_of[handler], EDGE_EXCEPTION);
+		}
+	}
+
+	for (k = 0, entry = codeAttribute->code.exception_table; k < codeAttribute->code.exception_table_length; k += 1, entry += 1)
+	{
+		if ((handler = exception_target(decoded, entry)) >= 0)
+			cfg->blocks[cfg->block_of[handler]].flags |= BLOCK_HANDLER;
+	}
+
+	cfg->successors = malloc(list.count * sizeof(uint32_t) + 1);
+	cfg->successor_kinds = malloc(list.count * sizeof(uint8_t) + 1);
+	cfg->predecessors = malloc(list.count * sizeof(uint32_t) + 1);
+	cfg->predecessor_kinds = malloc(list.count * sizeof(uint8_t) + 1);
+	STAT_ADD(allocations, 4);
+
+	starts = malloc(cfg->block_count * sizeof(uint32_t));
+	counts = malloc(cfg->block_count * sizeof(uint32_t));
+	STAT_ADD(allocations, 2);
+
+	cfg->edge_count = sort_edges(&list, cfg->block_count, 1, starts, counts, cfg->successors, cfg->successor_kinds);
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		block->succ_start = starts[b];
+		block->succ_count = counts[b];
+	}
+
+	sort_edges(&list, cfg->block_count, 0, starts, counts, cfg->predecessors, cfg->predecessor_kinds);
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		block->pred_start = starts[b];
+		block->pred_count = counts[b];
+	}
+
+	free(starts);
+	free(counts);
+	free(list.edges);
+	return cfg->block_count;
+}
+
+void free_cfg(ControlFlowGraph* cfg)
+{
+	free(cfg->blocks);
+	free(cfg->successors);
+	free(cfg->successor_kinds);
+	free(cfg->predecessors);
+	free(cfg->predecessor_kinds);
+	free(cfg->block_of);
+	free_exception_index(&cfg->exceptions);
+	memset(cfg, 0, sizeof(ControlFlowGraph));
+}
@@ -0,0 +1,67 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "bytecode.h"
+#include "exceptions.h"
+
+/*
+	Control flow graph of a Code attribute, built from its DecodedCode.
+
+	Blocks are stored in pc order in a single array. Successors and
+	predecessors are block indices in two flat arrays; each block owns the
+	slice [succ_start, succ_start + succ_count) (and likewise for
+	predecessors). Exception handlers are reached through EDGE_EXCEPTION
+	edges from every block inside the protected range; the exception
+	index built along the way is kept so analyses can ask which handlers
+	cover a pc.
+*/
+
+#define BLOCK_ENTRY   0x01 /* first block of the method */
+#define BLOCK_HANDLER 0x02 /* start of an exception handler */
+#define BLOCK_EXIT    0x04 /* ends in a return or athrow */
+#define BLOCK_RET     0x08 /* ends in ret; successors are not known */
+
+#define EDGE_NORMAL    0
+#define EDGE_EXCEPTION 1
+
+typedef struct
+{
+	uint32_t start_pc;
+	uint32_t end_pc;          /* exclusive */
+	uint32_t first;           /* index of the first instruction */
+	uint32_t count;           /* number of instructions */
+	uint32_t succ_start;
+	uint32_t succ_count;
+	uint32_t pred_start;
+	uint32_t pred_count;
+	uint32_t flags;
+} BasicBlock;
+
+typedef struct
+{
+	uint32_t block_count;
+	BasicBlock* blocks;
+
+	uint32_t edge_count;
+	uint32_t* successors;
+	uint8_t* successor_kinds; /* EDGE_NORMAL or EDGE_EXCEPTION */
+	uint32_t* predecessors;
+	uint8_t* predecessor_kinds;
+
+	uint32_t* block_of;       /* instruction index -> block index */
+
+	ExceptionIndex exceptions;
+} ControlFlowGraph;
+
+uint32_t build_cfg(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg);
+void free_cfg(ControlFlowGraph* cfg);
+
+/* Block containing pc, -1 if pc is not the start of an instruction */
+#define cfg_block_at(cfg, decoded, pc) \
+	(instruction_index(decoded, pc) >= 0 && instruction_index(decoded, pc) < (int32_t)(decoded)->count \
+		? (int32_t)(cfg)->block_of[instruction_index(decoded, pc)] : -1)
+
+#endif
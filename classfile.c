@@ -1,4 +1,6 @@
 #include "classfile.h"
+#include "stats.h"
+#include "dtoa.h"
 
 ConstantType ConstantTypes[] = {
 	{ 0, "invalid_0" },
@@ -52,6 +54,45 @@ ConstantType ConstantTypes[] = {
 		constant pool, the first representing a name (identifier) and the
 		second a specially encoded type descriptor. */
 	{ 4, "typedesc" },
+
+	/* 13, 14: Missing */
+	{ 0, "invalid_13" },
+	{ 0, "invalid_14" },
+
+	/* 15: Method handle: a reference kind (1 byte, REF_*) and an index to
+		the field, method or interface method reference it applies to. */
+	{ 3, "mhandle" },
+
+	/* 16: Method type: an index to a UTF-8 string holding a method descriptor */
+	{ 2, "mtype" },
+
+	/* 17: Dynamically computed constant: an index into the BootstrapMethods
+		attribute and an index to a Name and Type descriptor. */
+	{ 4, "dynamic" },
+
+	/* 18: Dynamically computed call site (invokedynamic): the same as a
+		dynamic constant, with a method descriptor. */
+	{ 4, "indy" },
+
+	/* 19: Module: an index to a UTF-8 string holding the module name */
+	{ 2, "module" },
+
+	/* 20: Package: an index to a UTF-8 string holding the package name (in
+		internal format) */
+	{ 2, "package" },
+};
+
+const char* ReferenceKinds[] = {
+	"REF_invalid",
+	"REF_getField",
+	"REF_getStatic",
+	"REF_putField",
+	"REF_putStatic",
+	"REF_invokeVirtual",
+	"REF_invokeStatic",
+	"REF_invokeSpecial",
+	"REF_newInvokeSpecial",
+	"REF_invokeInterface",
 };
 
 BaseType BaseTypes[] = {
@@ -91,6 +132,8 @@ BaseType BaseTypes[] = {
 int read_constants(FILE* fp, Constant** constants)
 {
 	uint16_t uint16;
+	uint32_t uint32;
+	uint64_t uint64;
 	uint8_t tag;
 	int max_index, i, length;
 	char *buffer, shortbuf[8];
@@ -100,16 +143,29 @@ int read_constants(FILE* fp, Constant** constants)
 	read16(max_index);
 
 	p = *constants = (Constant*)malloc((max_index - 1) * sizeof(Constant));
+	STAT_ADD(allocations, 1);
 
 	for (i = 1; i < max_index; i += 1)
 	{
 		fread(&tag, sizeof(tag), 1, fp);
+
+		/* The size of an unknown entry isn't known either, so the rest of
+			the file can't be parsed */
+		if (tag >= CONSTANT_TAG_COUNT || (tag != TAG_STRING && ConstantTypes[tag].length == 0))
+		{
+			fprintf(stderr, "Error: Invalid Constant Tag %d at index %d\n", tag, i);
+			free_constants(p - *constants, *constants);
+			*constants = NULL;
+			return -1;
+		}
+
 		if (tag == TAG_STRING)
 		{
 			fread(&uint16, sizeof(uint16), 1, fp);
 			length = be16toh(uint16);
 
 			buffer = malloc((length + 1) * sizeof(char));
+			STAT_ADD(allocations, 1);
 			fread(buffer, sizeof(char), length, fp);
 			buffer[length] = '\0';
 
@@ -135,8 +191,10 @@ int read_constants(FILE* fp, Constant** constants)
 				p->intval = be32toh(*(int32_t*)shortbuf);
 				break;
 
+			/* The bits are big-endian like any other number */
 			case TAG_FLOAT:
-				p->floatval = *(float*)shortbuf;
+				uint32 = be32toh(*(uint32_t*)shortbuf);
+				memcpy(&p->floatval, &uint32, sizeof(float));
 				break;
 
 			case TAG_LONG:
@@ -144,17 +202,23 @@ int read_constants(FILE* fp, Constant** constants)
 				break;
 
 			case TAG_DOUBLE:
-				p->doubleval = *(double*)shortbuf;
+				uint64 = be64toh(*(uint64_t*)shortbuf);
+				memcpy(&p->doubleval, &uint64, sizeof(double));
 				break;
 
 			case TAG_CLASSREF:
 			case TAG_STRINGREF:
+			case TAG_METHODTYPE:
+			case TAG_MODULE:
+			case TAG_PACKAGE:
 				p->ref = be16toh(*(uint16_t*)shortbuf);
 				break;
 
 			case TAG_FIELDREF:
 			case TAG_METHODREF:
 			case TAG_IFACEREF:
+			case TAG_DYNAMIC:
+			case TAG_INVOKEDYNAMIC:
 				p->classref = be16toh(*(uint16_t*)shortbuf);
 				p->typedescref = be16toh(*(uint16_t*)(shortbuf + sizeof(uint16_t)));
 				break;
@@ -164,8 +228,9 @@ int read_constants(FILE* fp, Constant** constants)
 				p->typeref = be16toh(*(uint16_t*)(shortbuf + sizeof(uint16_t)));
 				break;
 
-			default:
-				fprintf(stderr, "Warning: Invalid Constant Tag: %d\n", tag);
+			case TAG_METHODHANDLE:
+				p->refkind = shortbuf[0];
+				p->handleref = be16toh(*(uint16_t*)(shortbuf + 1));
 				break;
 		}
 
@@ -176,6 +241,7 @@ int read_constants(FILE* fp, Constant** constants)
 			i += 1;
 	}
 
+	STAT_ADD(constants, p - *constants);
 	return p - *constants;
 }
 
@@ -212,7 +278,8 @@ int write_constants(FILE* fp, uint16_t count, Constant* constants)
 				break;
 
 			case TAG_FLOAT:
-				fwrite(&c->floatval, sizeof(float), 1, fp);
+				memcpy(&uint32, &c->floatval, sizeof(float));
+				write32(uint32);
 				break;
 
 			case TAG_LONG:
@@ -220,17 +287,23 @@ int write_constants(FILE* fp, uint16_t count, Constant* constants)
 				break;
 
 			case TAG_DOUBLE:
-				fwrite(&c->doubleval, sizeof(double), 1, fp);
+				memcpy(&uint64, &c->doubleval, sizeof(double));
+				write64(uint64);
 				break;
 
 			case TAG_CLASSREF:
 			case TAG_STRINGREF:
+			case TAG_METHODTYPE:
+			case TAG_MODULE:
+			case TAG_PACKAGE:
 				write16(c->ref);
 				break;
 
 			case TAG_FIELDREF:
 			case TAG_METHODREF:
 			case TAG_IFACEREF:
+			case TAG_DYNAMIC:
+			case TAG_INVOKEDYNAMIC:
 				write16(c->classref);
 				write16(c->typedescref);
 				break;
@@ -240,6 +313,11 @@ int write_constants(FILE* fp, uint16_t count, Constant* constants)
 				write16(c->typeref);
 				break;
 
+			case TAG_METHODHANDLE:
+				fwrite(&c->refkind, sizeof(uint8_t), 1, fp);
+				write16(c->handleref);
+				break;
+
 			default:
 				fprintf(stderr, "Error: Invalid Constant tag: %d\n", c->tag);
 				return 0;
@@ -250,6 +328,66 @@ int write_constants(FILE* fp, uint16_t count, Constant* constants)
 	return 1;
 }
 
+/*
+	Size of the raw pool entry at offset, 0 if it is truncated or has an
+	unknown tag. Only UTF-8 strings have a variable size, everything else
+	is sized by its ConstantTypes[] length.
+*/
+size_t constant_entry_size(const unsigned char* pool, size_t size, size_t offset)
+{
+	uint8_t tag;
+
+	if (offset >= size)
+		return 0;
+
+	tag = pool[offset];
+	if (tag == TAG_STRING)
+		return offset + 3 <= size ? 3 + ((pool[offset + 1] << 8) | pool[offset + 2]) : 0;
+	if (tag < CONSTANT_TAG_COUNT && ConstantTypes[tag].length != 0)
+		return 1 + ConstantTypes[tag].length;
+	return 0;
+}
+
+/*
+	Walks a constant pool in memory without decoding it; pool points at the
+	constant_pool_count, and entries are skipped by constant_entry_size.
+	If offsets is not NULL, offsets[i] receives the offset of entry i from
+	pool (0 for index 0 and for the unusable slot after a long or double),
+	so it needs room for constant_pool_count entries. Returns the size of the whole pool, or 0
+	if it is truncated or holds an unknown tag.
+*/
+size_t walk_constants(const unsigned char* pool, size_t size, uint32_t* offsets)
+{
+	size_t offset = 2, length;
+	uint16_t max_index, i;
+	uint8_t tag;
+
+	if (size < 2)
+		return 0;
+
+	max_index = (pool[0] << 8) | pool[1];
+	if (offsets != NULL && max_index > 0)
+		offsets[0] = 0;
+
+	for (i = 1; i < max_index; i += 1)
+	{
+		if ((length = constant_entry_size(pool, size, offset)) == 0)
+			return 0;
+
+		if (offsets != NULL)
+			offsets[i] = offset;
+
+		tag = pool[offset];
+		offset += length;
+
+		/* Longs and doubles take up two slots in the table */
+		if ((tag == TAG_LONG || tag == TAG_DOUBLE) && ++i < max_index && offsets != NULL)
+			offsets[i] = 0;
+	}
+
+	return offset <= size ? offset : 0;
+}
+
 Constant* find_constant(ClassFile* classFile, int index)
 {
 	/* We take advantage of two facts here:
@@ -264,9 +402,13 @@ Constant* find_constant(ClassFile* classFile, int index)
 	else
 		p += classFile->constant_count - 1;
 
+	STAT_ADD(find_constant_calls, 1);
 	for ( ; p >= classFile->constants; p -= 1)
+	{
+		STAT_ADD(find_constant_steps, 1);
 		if (p->index == index)
 			return p;
+	}
 	return NULL;
 }
 
@@ -280,6 +422,12 @@ Constant* add_constant(ClassFile* classFile, int tag)
 	c = classFile->constants + classFile->constant_count - 1;
 	c->tag = tag;
 
+	if (classFile->call_sites != NULL)
+	{
+		classFile->call_sites = realloc(classFile->call_sites, sizeof(char*) * classFile->constant_count);
+		classFile->call_sites[classFile->constant_count - 1] = NULL;
+	}
+
 	if (classFile->constant_count == 1)
 	{
 		c->index = 1;
@@ -318,6 +466,17 @@ uint16_t add_classref(ClassFile* classFile, const char* className)
 	return constant->index;
 }
 
+int special_method(const char* name)
+{
+	if (name[0] != '<')
+		return 0;
+	if (strcmp(name, "<init>") == 0)
+		return METHOD_INIT;
+	if (strcmp(name, "<clinit>") == 0)
+		return METHOD_CLINIT;
+	return 0;
+}
+
 Method* add_method(ClassFile* classFile, const char* methodName, const char* descriptor)
 {
 	Method* method;
@@ -338,9 +497,153 @@ Method* add_method(ClassFile* classFile, const char* methodName, const char* des
 	constant = add_string_constant(classFile, descriptor);
 	method->descriptor_index = constant->index;
 
+	method->special = special_method(methodName);
+
+	/* Rebuilt on the next lookup */
+	free_member_index(&classFile->method_index);
+
 	return method;
 }
 
+static uint32_t hash_name(const char* name)
+{
+	/* FNV-1a */
+	uint32_t hash = 2166136261u;
+
+	for ( ; *name != '\0'; name += 1)
+		hash = (hash ^ (uint8_t)*name) * 16777619u;
+	return hash;
+}
+
+static const char* member_string(ClassFile* classFile, uint16_t index)
+{
+	Constant* constant = find_constant(classFile, index);
+
+	if (constant == NULL || constant->tag != TAG_STRING)
+		return NULL;
+	return constant->buffer;
+}
+
+/*
+	Fields and methods share their leading members, so the index is built
+	and searched through a (name_index, descriptor_index) pair per member
+	read from whichever array it covers.
+*/
+#define member_name(members, size, i)       (*(uint16_t*)((char*)(members) + (size) * (i) + offsetof(Field, name_index)))
+#define member_descriptor(members, size, i) (*(uint16_t*)((char*)(members) + (size) * (i) + offsetof(Field, descriptor_index)))
+
+static void build_member_index(ClassFile* classFile, MemberIndex* index, void* members, size_t size, int count)
+{
+	const char* name;
+	uint32_t slot, hash;
+	int i;
+
+	/* Keep the load factor at or below one half */
+	for (index->capacity = 8; index->capacity < 2 * (uint32_t)count; index->capacity *= 2)
+		;
+
+	index->slots = malloc(index->capacity * sizeof(MemberSlot));
+	STAT_ADD(allocations, 1);
+	for (slot = 0; slot < index->capacity; slot += 1)
+		index->slots[slot].member = -1;
+
+	for (i = 0; i < count; i += 1)
+	{
+		name = member_string(classFile, member_name(members, size, i));
+		if (name == NULL)
+			continue;
+
+		hash = hash_name(name);
+		for (slot = hash & (index->capacity - 1); index->slots[slot].member >= 0; slot = (slot + 1) & (index->capacity - 1))
+			;
+
+		index->slots[slot].hash = hash;
+		index->slots[slot].member = i;
+	}
+}
+
+static int find_member(ClassFile* classFile, MemberIndex* index, void* members, size_t size, int count,
+	const char* name, const char* descriptor)
+{
+	MemberSlot* p;
+	const char* string;
+	uint32_t slot, hash;
+
+	if (count == 0)
+		return -1;
+
+	if (index->slots == NULL)
+		build_member_index(classFile, index, members, size, count);
+
+	hash = hash_name(name);
+	for (slot = hash & (index->capacity - 1); (p = index->slots + slot)->member >= 0; slot = (slot + 1) & (index->capacity - 1))
+	{
+		if (p->hash != hash)
+			continue;
+
+		string = member_string(classFile, member_name(members, size, p->member));
+		if (strcmp(string, name) != 0)
+			continue;
+
+		if (descriptor == NULL)
+			return p->member;
+
+		string = member_string(classFile, member_descriptor(members, size, p->member));
+		if (string != NULL && strcmp(string, descriptor) == 0)
+			return p->member;
+	}
+
+	return -1;
+}
+
+void free_member_index(MemberIndex* index)
+{
+	free(index->slots);
+	index->slots = NULL;
+	index->capacity = 0;
+}
+
+/* A NULL descriptor matches the first member with that name */
+Method* find_method(ClassFile* classFile, const char* name, const char* descriptor)
+{
+	int i = find_member(classFile, &classFile->method_index, classFile->methods, sizeof(Method),
+		classFile->method_count, name, descriptor);
+	return i < 0 ? NULL : classFile->methods + i;
+}
+
+/* The indices may come from a Methodref, so the strings are compared rather
+	than the indices themselves */
+Method* find_method_by_index(ClassFile* classFile, uint16_t name_index, uint16_t descriptor_index)
+{
+	const char *name, *descriptor;
+
+	name = member_string(classFile, name_index);
+	descriptor = member_string(classFile, descriptor_index);
+	if (name == NULL || descriptor == NULL)
+		return NULL;
+
+	return find_method(classFile, name, descriptor);
+}
+
+Field* find_field(ClassFile* classFile, const char* name, const char* descriptor)
+{
+	int i = find_member(classFile, &classFile->field_index, classFile->fields, sizeof(Field),
+		classFile->field_count, name, descriptor);
+	return i < 0 ? NULL : classFile->fields + i;
+}
+
+Field* find_field_by_index(ClassFile* classFile, uint16_t name_index, uint16_t descriptor_index)
+{
+	const char *name, *descriptor;
+
+	name = member_string(classFile, name_index);
+	descriptor = member_string(classFile, descriptor_index);
+	if (name == NULL || descriptor == NULL)
+		return NULL;
+
+	return find_field(classFile, name, descriptor);
+}
+
 void free_constants(int count, Constant* constants)
 {
 	Constant *p;
@@ -355,9 +658,17 @@ void free_constants(int count, Constant* constants)
 const char* constant_to_string_r(ClassFile* classFile, Constant* constant, char* buffer)
 {
 	Constant *ref, *className, *name, *typedesc, *descriptor;
+	int n;
 
 	char fullname[255];
 
+	/* Operands of malformed code can point past the pool */
+	if (constant == NULL)
+	{
+		strcpy(buffer, "???");
+		return buffer;
+	}
+
 	switch (constant->tag)
 	{
 		case TAG_STRING:
@@ -367,49 +678,113 @@ const char* constant_to_string_r(ClassFile* classFile, Constant* constant, char*
 			break;
 
 		case TAG_INTEGER:
-			sprintf(buffer, "%d", constant->intval);
+			format_integer(constant->intval, buffer);
 			break;
 
 		case TAG_FLOAT:
-			sprintf(buffer, "%f", constant->floatval);
+			format_float(constant->floatval, buffer);
 			break;
 
 		case TAG_LONG:
-			sprintf(buffer, "%ld", constant->longval);
+			format_integer(constant->longval, buffer);
 			break;
 
 		case TAG_DOUBLE:
-			sprintf(buffer, "%f", constant->doubleval);
+			format_double(constant->doubleval, buffer);
 			break;
 
 		case TAG_CLASSREF:
 			ref = find_constant(classFile, constant->ref);
-			sprintf(buffer, "class %s", class_name_from_internal(ref->buffer));
+			if (ref == NULL || ref->tag != TAG_STRING)
+				sprintf(buffer, "???");
+			else
+				sprintf(buffer, "class %s", class_name_from_internal(ref->buffer));
 			break;
 
 		case TAG_STRINGREF:
 			ref = find_constant(classFile, constant->ref);
-			constant_to_string_r(classFile, ref, buffer);
+			if (ref == NULL || ref->tag != TAG_STRING)
+				sprintf(buffer, "???");
+			else
+				constant_to_string_r(classFile, ref, buffer);
 			break;
 
 		case TAG_FIELDREF:
 		case TAG_METHODREF:
 		case TAG_IFACEREF:
 			ref = find_constant(classFile, constant->classref);
-			className = find_constant(classFile, ref->ref);
+			className = ref != NULL && ref->tag == TAG_CLASSREF ? find_constant(classFile, ref->ref) : NULL;
 			typedesc = find_constant(classFile, constant->typedescref);
+			if (className == NULL || className->tag != TAG_STRING || typedesc == NULL || typedesc->tag != TAG_TYPEDESC)
+			{
+				sprintf(buffer, "???");
+				break;
+			}
+
 			name = find_constant(classFile, typedesc->nameref);
 			descriptor = find_constant(classFile, typedesc->typeref);
+			if (name == NULL || name->tag != TAG_STRING || descriptor == NULL || descriptor->tag != TAG_STRING)
+			{
+				sprintf(buffer, "???");
+				break;
+			}
 
-			sprintf(fullname, "%s.%s", class_name_from_internal(className->buffer), name->buffer);
+			snprintf(fullname, sizeof(fullname), "%s.%s", class_name_from_internal(className->buffer), name->buffer);
 			descriptor_to_string(descriptor->buffer, fullname, buffer);
 			break;
 
 		case TAG_TYPEDESC:
 			name = find_constant(classFile, constant->nameref);
 			descriptor = find_constant(classFile, constant->typeref);
+			if (name == NULL || name->tag != TAG_STRING || descriptor == NULL || descriptor->tag != TAG_STRING)
+				sprintf(buffer, "???");
+			else
+				descriptor_to_string(descriptor->buffer, name->buffer, buffer);
+			break;
+
+		case TAG_METHODHANDLE:
+			ref = find_constant(classFile, constant->handleref);
+			if (ref == NULL || constant->refkind > REF_INVOKEINTERFACE ||
+				(ref->tag != TAG_FIELDREF && ref->tag != TAG_METHODREF && ref->tag != TAG_IFACEREF))
+			{
+				sprintf(buffer, "???");
+				break;
+			}
 
-			descriptor_to_string(descriptor->buffer, name->buffer, buffer);
+			n = sprintf(buffer, "%s ", ReferenceKinds[constant->refkind]);
+			constant_to_string_r(classFile, ref, buffer + n);
+			break;
+
+		case TAG_METHODTYPE:
+			descriptor = find_constant(classFile, constant->ref);
+			if (descriptor == NULL || descriptor->tag != TAG_STRING)
+				sprintf(buffer, "???");
+			else
+				sprintf(buffer, "type %s", descriptor->buffer);
+			break;
+
+		case TAG_DYNAMIC:
+		case TAG_INVOKEDYNAMIC:
+			typedesc = find_constant(classFile, constant->typedescref);
+			if (typedesc == NULL || typedesc->tag != TAG_TYPEDESC)
+			{
+				sprintf(buffer, "???");
+				break;
+			}
+
+			n = sprintf(buffer, "bootstrap %hu: ", constant->bootstrap);
+			constant_to_string_r(classFile, typedesc, buffer + n);
+			break;
+
+		case TAG_MODULE:
+		case TAG_PACKAGE:
+			name = find_constant(classFile, constant->ref);
+			if (name == NULL || name->tag != TAG_STRING)
+				sprintf(buffer, "???");
+			else if (constant->tag == TAG_MODULE)
+				sprintf(buffer, "module %s", name->buffer);
+			else
+				sprintf(buffer, "package %s", class_name_from_internal(name->buffer));
 			break;
 
 		default:
@@ -422,10 +797,317 @@ const char* constant_to_string_r(ClassFile* classFile, Constant* constant, char*
 
 const char* constant_to_string(ClassFile* classFile, Constant* constant)
 {
-	static char buffer[1024];
+	static __thread char buffer[1024];
 	return constant_to_string_r(classFile, constant, buffer);
 }
 
+/* A method handle by kind and member name, without the descriptor */
+static int handle_to_string(ClassFile* classFile, Constant* handle, char* buffer, size_t size)
+{
+	Constant *member, *ref, *className, *typedesc, *name;
+
+	member = find_constant(classFile, handle->handleref);
+	if (member == NULL || handle->refkind > REF_INVOKEINTERFACE ||
+		(member->tag != TAG_FIELDREF && member->tag != TAG_METHODREF && member->tag != TAG_IFACEREF))
+		return snprintf(buffer, size, "???");
+
+	ref = find_constant(classFile, member->classref);
+	className = ref != NULL && ref->tag == TAG_CLASSREF ? find_constant(classFile, ref->ref) : NULL;
+	typedesc = find_constant(classFile, member->typedescref);
+	name = typedesc != NULL && typedesc->tag == TAG_TYPEDESC ? find_constant(classFile, typedesc->nameref) : NULL;
+	if (className == NULL || className->tag != TAG_STRING || name == NULL || name->tag != TAG_STRING)
+		return snprintf(buffer, size, "???");
+
+	return snprintf(buffer, size, "%s %s.%s", ReferenceKinds[handle->refkind],
+		class_name_from_internal(className->buffer), name->buffer);
+}
+
+/*
+	A dynamic constant with its bootstrap method and static arguments.
+	Lambdas, string concatenations and records each bring one, and are
+	called from many places, so the text is kept per constant.
+*/
+const char* call_site_to_string(ClassFile* classFile, Constant* constant)
+{
+	BootstrapMethod* method;
+	Constant *handle, *argument;
+	char buffer[4096], value[1024];
+	size_t n, offset;
+	uint32_t i;
+
+	if (constant == NULL || (constant->tag != TAG_DYNAMIC && constant->tag != TAG_INVOKEDYNAMIC))
+		return NULL;
+
+	offset = constant - classFile->constants;
+	if (classFile->call_sites == NULL)
+	{
+		classFile->call_sites = calloc(classFile->constant_count, sizeof(char*));
+		STAT_ADD(allocations, 1);
+	}
+	if (classFile->call_sites[offset] != NULL)
+		return classFile->call_sites[offset];
+
+	n = snprintf(buffer, sizeof(buffer), "%s", constant_to_string_r(classFile, constant, value));
+
+	method = find_bootstrap_method(classFile, constant);
+	handle = method != NULL ? find_constant(classFile, method->method_handle) : NULL;
+	if (handle != NULL && handle->tag == TAG_METHODHANDLE)
+	{
+		n += snprintf(buffer + n, sizeof(buffer) - n, " via ");
+		n += handle_to_string(classFile, handle, buffer + n, n < sizeof(buffer) ? sizeof(buffer) - n : 0);
+
+		for (i = 0; i < method->argument_count && n < sizeof(buffer); i += 1)
+		{
+			argument = find_constant(classFile, classFile->bootstrap_arguments[method->arguments + i]);
+			if (argument == NULL)
+				strcpy(value, "???");
+			else if (argument->tag == TAG_METHODHANDLE)
+				handle_to_string(classFile, argument, value, sizeof(value));
+			else if (argument->tag == TAG_DYNAMIC)
+				snprintf(value, sizeof(value), "dynamic %hu", argument->bootstrap);
+			else
+				constant_to_string_r(classFile, argument, value);
+
+			n += snprintf(buffer + n, sizeof(buffer) - n, "%s%s", i == 0 ? "(" : ", ", value);
+		}
+
+		if (method->argument_count > 0 && n < sizeof(buffer))
+			snprintf(buffer + n, sizeof(buffer) - n, ")");
+	}
+
+	classFile->call_sites[offset] = strdup(buffer);
+	STAT_ADD(allocations, 1);
+	return classFile->call_sites[offset];
+}
+
+static int compare_line_numbers(const void* a, const void* b)
+{
+	return (int)((const LineNumber*)a)->start_pc - (int)((const LineNumber*)b)->start_pc;
+}
+
+static int compare_local_variables(const void* a, const void* b)
+{
+	const LocalVariable *x = a, *y = b;
+
+	if (x->slot != y->slot)
+		return (int)x->slot - (int)y->slot;
+	return (int)x->start_pc - (int)y->start_pc;
+}
+
+/* Number of entries of a table attribute, as far as its length allows */
+static uint32_t table_entries(Attribute* a, uint32_t entry_size)
+{
+	uint32_t count;
+
+	if (a->length < 2)
+		return 0;
+
+	count = be16toh(*(uint16_t*)a->buffer);
+	if (2 + count * entry_size > a->length)
+		count = (a->length - 2) / entry_size;
+	return count;
+}
+
+#define get16(p, i) be16toh(*(uint16_t*)((p) + 2 * (i)))
+
+/*
+	Decodes the LineNumberTable and LocalVariableTable attributes of a Code
+	attribute into arrays sorted for binary search. There may be several
+	of each; the entries of a LocalVariableTypeTable are merged into the
+	matching LocalVariableTable entries.
+*/
+static void decode_debug_tables(ClassFile* classFile, Attribute* codeAttribute)
+{
+	Attribute* a;
+	Constant* name;
+	LineNumber* line;
+	LocalVariable *local, key;
+	unsigned char* p;
+	uint32_t i, j, count, line_count = 0, local_count = 0;
+
+	codeAttribute->code.line_count = codeAttribute->code.local_count = 0;
+	codeAttribute->code.lines = NULL;
+	codeAttribute->code.locals = NULL;
+
+	for (a = codeAttribute->code.attributes, i = 0; i < codeAttribute->code.attribute_count; a += 1, i += 1)
+	{
+		name = find_constant(classFile, a->name_index);
+		if (a->type != ATT_UNKNOWN || name == NULL || name->tag != TAG_STRING)
+			continue;
+
+		if (strcmp(name->buffer, ATT_NAME_LINENUMBERS) == 0)
+			line_count += table_entries(a, 4);
+		else if (strcmp(name->buffer, ATT_NAME_LOCALVARIABLES) == 0)
+			local_count += table_entries(a, 10);
+	}
+
+	if (line_count == 0 && local_count == 0)
+		return;
+
+	line = codeAttribute->code.lines = malloc(line_count * sizeof(LineNumber));
+	local = codeAttribute->code.locals = malloc(local_count * sizeof(LocalVariable));
+	STAT_ADD(allocations, 2);
+
+	for (a = codeAttribute->code.attributes, i = 0; i < codeAttribute->code.attribute_count; a += 1, i += 1)
+	{
+		name = find_constant(classFile, a->name_index);
+		if (a->type != ATT_UNKNOWN || name == NULL || name->tag != TAG_STRING)
+			continue;
+
+		p = (unsigned char*)a->buffer + 2;
+		if (strcmp(name->buffer, ATT_NAME_LINENUMBERS) == 0)
+		{
+			count = table_entries(a, 4);
+			for (j = 0; j < count; j += 1, p += 4, line += 1)
+			{
+				line->start_pc = get16(p, 0);
+				line->line = get16(p, 1);
+			}
+		}
+		else if (strcmp(name->buffer, ATT_NAME_LOCALVARIABLES) == 0)
+		{
+			count = table_entries(a, 10);
+			for (j = 0; j < count; j += 1, p += 10, local += 1)
+			{
+				local->start_pc = get16(p, 0);
+				local->length = get16(p, 1);
+				local->name_index = get16(p, 2);
+				local->descriptor_index = get16(p, 3);
+				local->slot = get16(p, 4);
+				local->signature_index = 0;
+			}
+		}
+	}
+
+	codeAttribute->code.line_count = line_count;
+	codeAttribute->code.local_count = local_count;
+	qsort(codeAttribute->code.lines, line_count, sizeof(LineNumber), compare_line_numbers);
+	qsort(codeAttribute->code.locals, local_count, sizeof(LocalVariable), compare_local_variables);
+
+	/* The type table only lists generic variables, each of which also has
+		an entry (with the erased type) in the variable table */
+	for (a = codeAttribute->code.attributes, i = 0; i < codeAttribute->code.attribute_count && local_count > 0; a += 1, i += 1)
+	{
+		name = find_constant(classFile, a->name_index);
+		if (a->type != ATT_UNKNOWN || name == NULL || name->tag != TAG_STRING ||
+			strcmp(name->buffer, ATT_NAME_LOCALVARIABLETYPES) != 0)
+			continue;
+
+		p = (unsigned char*)a->buffer + 2;
+		count = table_entries(a, 10);
+		for (j = 0; j < count; j += 1, p += 10)
+		{
+			key.start_pc = get16(p, 0);
+			key.slot = get16(p, 4);
+
+			local = bsearch(&key, codeAttribute->code.locals, local_count, sizeof(LocalVariable), compare_local_variables);
+			if (local != NULL)
+				local->signature_index = get16(p, 3);
+		}
+	}
+}
+
+/*
+	Decodes the BootstrapMethods attribute of a class into one table of
+	entries and one of their arguments, so the bootstrap method of a
+	dynamic constant is an index away. A table that runs past the end of
+	the attribute is left undecoded.
+*/
+static void decode_bootstrap_methods(ClassFile* classFile)
+{
+	Attribute* a;
+	BootstrapMethod* method;
+	unsigned char *p, *end;
+	uint32_t i, j, count, argument_count = 0;
+
+	a = find_attribute(classFile, ATT_NAME_BOOTSTRAPMETHODS, classFile->attribute_count, classFile->attributes);
+	if (a == NULL || a->type != ATT_UNKNOWN || a->length < 2)
+		return;
+
+	p = (unsigned char*)a->buffer;
+	end = p + a->length;
+	count = get16(p, 0);
+
+	for (i = 0, p += 2; i < count; i += 1)
+	{
+		if (end - p < 4 || end - p < 4 + 2 * get16(p, 1))
+			return;
+		argument_count += get16(p, 1);
+		p += 4 + 2 * get16(p, 1);
+	}
+
+	method = classFile->bootstrap_methods = malloc(count * sizeof(BootstrapMethod) + 1);
+	classFile->bootstrap_arguments = malloc(argument_count * sizeof(uint16_t) + 1);
+	STAT_ADD(allocations, 2);
+	classFile->bootstrap_count = count;
+
+	for (i = 0, p = (unsigned char*)a->buffer + 2, argument_count = 0; i < count; i += 1, method += 1)
+	{
+		method->method_handle = get16(p, 0);
+		method->argument_count = get16(p, 1);
+		method->arguments = argument_count;
+		for (j = 0; j < method->argument_count; j += 1)
+			classFile->bootstrap_arguments[argument_count++] = get16(p, 2 + j);
+		p += 4 + 2 * method->argument_count;
+	}
+}
+
+#undef get16
+
+/* Bootstrap method of a TAG_DYNAMIC or TAG_INVOKEDYNAMIC constant, NULL
+	if the class has no (such) entry */
+BootstrapMethod* find_bootstrap_method(ClassFile* classFile, Constant* constant)
+{
+	if (constant == NULL || (constant->tag != TAG_DYNAMIC && constant->tag != TAG_INVOKEDYNAMIC) ||
+		constant->bootstrap >= classFile->bootstrap_count)
+		return NULL;
+	return classFile->bootstrap_methods + constant->bootstrap;
+}
+
+/* Line number entry covering pc, NULL if there is none */
+LineNumber* find_line_number(Attribute* codeAttribute, uint32_t pc)
+{
+	LineNumber* lines = codeAttribute->code.lines;
+	uint32_t low = 0, high = codeAttribute->code.line_count, middle;
+
+	/* Last entry starting at or before pc */
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		if (lines[middle].start_pc <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low > 0 ? &lines[low - 1] : NULL;
+}
+
+/* Local variable in slot whose scope covers pc, NULL if there is none */
+LocalVariable* find_local_variable(Attribute* codeAttribute, uint16_t slot, uint32_t pc)
+{
+	LocalVariable* locals = codeAttribute->code.locals;
+	uint32_t low = 0, high = codeAttribute->code.local_count, middle;
+
+	/* Last entry before (slot, pc + 1) */
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		if (locals[middle].slot < slot || (locals[middle].slot == slot && locals[middle].start_pc <= pc))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	if (low == 0)
+		return NULL;
+
+	locals += low - 1;
+	if (locals->slot != slot || pc >= (uint32_t)locals->start_pc + locals->length)
+		return NULL;
+	return locals;
+}
+
 uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes)
 {
 	int i, j;
@@ -437,6 +1119,7 @@ uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes)
 
 	read16(count);
 	a = *attributes = malloc(sizeof(Attribute) * count);
+	STAT_ADD(allocations, 1);
 
 	for (i = 0; i < count; i += 1)
 	{
@@ -444,7 +1127,7 @@ uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes)
 		read32(a->length);
 
 		name = find_constant(classFile, a->name_index);
-		if (strcmp(name->buffer, ATT_NAME_CODE) == 0)
+		if (name != NULL && name->tag == TAG_STRING && strcmp(name->buffer, ATT_NAME_CODE) == 0)
 		{
 			a->type = ATT_CODE;
 
@@ -453,10 +1136,12 @@ uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes)
 			read32(a->code.code_length);
 
 			a->code.code = malloc(a->code.code_length);
+			STAT_ADD(allocations, 1);
 			fread(a->code.code, sizeof(char), a->code.code_length, fp);
 
 			read16(a->code.exception_table_length);
 			e = a->code.exception_table = malloc(a->code.exception_table_length * sizeof(ExceptionTableEntry));
+			STAT_ADD(allocations, 1);
 			for (j = 0; j < a->code.exception_table_length; j += 1)
 			{
 				read16(e->start_pc);
@@ -468,11 +1153,13 @@ uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes)
 			}
 
 			a->code.attribute_count = read_attributes(fp, classFile, &a->code.attributes);
+			decode_debug_tables(classFile, a);
 		}
 		else
 		{
 			a->type = ATT_UNKNOWN;
 			a->buffer = malloc(a->length);
+			STAT_ADD(allocations, 1);
 			fread(a->buffer, sizeof(char), a->length, fp);
 		}
 
@@ -503,8 +1190,9 @@ int write_attributes(FILE* fp, uint16_t count, Attribute* attributes)
 			length += sizeof(a->code.exception_table_length) + sizeof(ExceptionTableEntry) * a->code.exception_table_length;
 			length += sizeof(a->code.attribute_count);
 
-			for (a2 = a->code.attributes, i = 0; i < a->code.attribute_count; a2 += 1, i += 1)
-				length += a2->length;
+			/* Each nested attribute also has a name index and length */
+			for (a2 = a->code.attributes, j = 0; j < a->code.attribute_count; a2 += 1, j += 1)
+				length += sizeof(a2->name_index) + sizeof(a2->length) + a2->length;
 
 			write32(length);
 
@@ -544,7 +1232,7 @@ Attribute* find_attribute(ClassFile* classFile, const char* name, int attribute_
 	for (a = attributes, i = 0; i < attribute_count; i += 1, a += 1)
 	{
 		c = find_constant(classFile, a->name_index);
-		if (strcmp(c->buffer, name) == 0)
+		if (c != NULL && c->tag == TAG_STRING && strcmp(c->buffer, name) == 0)
 			return a;
 	}
 
@@ -555,10 +1243,55 @@ ClassFile* read_class_file(const char* filename)
 {
 	ClassFile* classFile;
 	FILE* fp;
+	char* buffer;
+	long size;
+	int phase;
+
+	phase = STATS_PHASE(PHASE_IO);
 
 	if ((fp = fopen(filename, "r")) == NULL)
 	{
 		perror("fopen");
+		STATS_PHASE(phase);
+		return NULL;
+	}
+
+	/* Read the whole file up front, so I/O is not interleaved with parsing.
+		Streams that can't seek (pipes) are parsed directly. */
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0)
+	{
+		STATS_PHASE(phase);
+		classFile = read_class(fp);
+		fclose(fp);
+		return classFile;
+	}
+
+	fseek(fp, 0, SEEK_SET);
+	buffer = malloc(size);
+	size = fread(buffer, sizeof(char), size, fp);
+	fclose(fp);
+
+	STAT_ADD(bytes_read, size);
+	STATS_PHASE(phase);
+
+	classFile = read_class_buffer(buffer, size);
+	free(buffer);
+
+	return classFile;
+}
+
+ClassFile* read_class_buffer(const void* buffer, size_t size)
+{
+	ClassFile* classFile;
+	FILE* fp;
+
+	/* fmemopen refuses zero-sized buffers, and those are not classes anyway */
+	if (size < sizeof(ClassFileHeader))
+		return NULL;
+
+	if ((fp = fmemopen((void*)buffer, size, "r")) == NULL)
+	{
+		perror("fmemopen");
 		return NULL;
 	}
 
@@ -568,13 +1301,61 @@ ClassFile* read_class_file(const char* filename)
 	return classFile;
 }
 
+static int is_class_ref(ClassFile* classFile, uint16_t index)
+{
+	Constant* constant = find_constant(classFile, index);
+
+	return constant != NULL && constant->tag == TAG_CLASSREF && member_string(classFile, constant->ref) != NULL;
+}
+
+/*
+	The indices every tool follows without checking: the class and its
+	super and interfaces must name classes, and fields and methods must
+	have a name and descriptor. Returns 0 if any doesn't resolve.
+*/
+static int check_class_references(ClassFile* classFile)
+{
+	int i;
+
+	if (!is_class_ref(classFile, classFile->this_class))
+		return 0;
+	if (classFile->super_class != 0 && !is_class_ref(classFile, classFile->super_class))
+		return 0;
+
+	for (i = 0; i < classFile->interface_count; i += 1)
+	{
+		if (!is_class_ref(classFile, classFile->interfaces[i]))
+			return 0;
+	}
+
+	for (i = 0; i < classFile->field_count; i += 1)
+	{
+		if (member_string(classFile, classFile->fields[i].name_index) == NULL ||
+			member_string(classFile, classFile->fields[i].descriptor_index) == NULL)
+			return 0;
+	}
+
+	for (i = 0; i < classFile->method_count; i += 1)
+	{
+		if (member_string(classFile, classFile->methods[i].name_index) == NULL ||
+			member_string(classFile, classFile->methods[i].descriptor_index) == NULL)
+			return 0;
+	}
+
+	return 1;
+}
+
 ClassFile* read_class(FILE* fp)
 {
 	ClassFile* classFile = malloc(sizeof(ClassFile));
 	Field* field;
 	Method* method;
+	const char* name;
 	uint16_t uint16;
-	int i;
+	int i, phase;
+
+	phase = STATS_PHASE(PHASE_PARSE);
+	STAT_ADD(allocations, 1);
 
 	memset(classFile, 0, sizeof(ClassFile));
 
@@ -582,6 +1363,7 @@ ClassFile* read_class(FILE* fp)
 	if (be32toh(classFile->header.magic) != MAGIC)
 	{
 		free_class(classFile);
+		STATS_PHASE(phase);
 		return NULL;
 	}
 
@@ -589,7 +1371,17 @@ ClassFile* read_class(FILE* fp)
 	swap16(classFile->header.minor);
 	swap16(classFile->header.major);
 
-	classFile->constant_count = read_constants(fp, &classFile->constants);
+	STATS_PHASE(PHASE_CONSTANTS);
+	i = read_constants(fp, &classFile->constants);
+	STATS_PHASE(PHASE_PARSE);
+
+	if (i < 0)
+	{
+		free_class(classFile);
+		STATS_PHASE(phase);
+		return NULL;
+	}
+	classFile->constant_count = i;
 
 	read16(classFile->access_flags);
 	read16(classFile->this_class);
@@ -597,6 +1389,7 @@ ClassFile* read_class(FILE* fp)
 
 	read16(classFile->interface_count);
 	classFile->interfaces = malloc(sizeof(uint16_t) * classFile->interface_count);
+	STAT_ADD(allocations, 1);
 	for (i = 0; i < classFile->interface_count; i += 1)
 	{
 		read16(classFile->interfaces[i]);
@@ -604,6 +1397,7 @@ ClassFile* read_class(FILE* fp)
 
 	read16(classFile->field_count);
 	field = classFile->fields = malloc(sizeof(Field) * classFile->field_count);
+	STAT_ADD(allocations, 1);
 	for (i = 0; i < classFile->field_count; i += 1)
 	{
 		read16(field->access_flags);
@@ -616,17 +1410,33 @@ ClassFile* read_class(FILE* fp)
 
 	read16(classFile->method_count);
 	method = classFile->methods = malloc(sizeof(Method) * classFile->method_count);
+	STAT_ADD(allocations, 1);
 	for (i = 0; i < classFile->method_count; i += 1)
 	{
 		read16(method->access_flags);
 		read16(method->name_index);
 		read16(method->descriptor_index);
 		method->attribute_count = read_attributes(fp, classFile, &method->attributes);
+
+		name = member_string(classFile, method->name_index);
+		method->special = name != NULL ? special_method(name) : 0;
 		method += 1;
 	}
 
 	classFile->attribute_count = read_attributes(fp, classFile, &classFile->attributes);
 
+	STATS_PHASE(phase);
+
+	/* A truncated file leaves (part of) the structures uninitialized */
+	if (ferror(fp) || feof(fp) || !check_class_references(classFile))
+	{
+		free_class(classFile);
+		return NULL;
+	}
+
+	decode_bootstrap_methods(classFile);
+
+	STAT_ADD(classes, 1);
 	return classFile;
 }
 
@@ -716,8 +1526,37 @@ int write_class(ClassFile* classFile, FILE* fp)
 	return 1;
 }
 
+void free_attributes(uint16_t count, Attribute* attributes)
+{
+	Attribute* a;
+	int i;
+
+	if (attributes == NULL)
+		return;
+
+	for (a = attributes, i = 0; i < count; a += 1, i += 1)
+	{
+		if (a->type == ATT_CODE)
+		{
+			free(a->code.code);
+			free(a->code.exception_table);
+			free_attributes(a->code.attribute_count, a->code.attributes);
+			free(a->code.lines);
+			free(a->code.locals);
+		}
+		else
+		{
+			free(a->buffer);
+		}
+	}
+
+	free(attributes);
+}
+
 void free_class(ClassFile* classFile)
 {
+	int i;
+
 	if (classFile == NULL)
 		return;
 
@@ -728,20 +1567,40 @@ void free_class(ClassFile* classFile)
 		free(classFile->interfaces);
 
 	if (classFile->fields != NULL)
+	{
+		for (i = 0; i < classFile->field_count; i += 1)
+			free_attributes(classFile->fields[i].attribute_count, classFile->fields[i].attributes);
 		free(classFile->fields);
+	}
 
 	if (classFile->methods != NULL)
+	{
+		for (i = 0; i < classFile->method_count; i += 1)
+			free_attributes(classFile->methods[i].attribute_count, classFile->methods[i].attributes);
 		free(classFile->methods);
+	}
 
 	if (classFile->attributes != NULL)
-		free(classFile->attributes);
+		free_attributes(classFile->attribute_count, classFile->attributes);
+
+	free_member_index(&classFile->field_index);
+	free_member_index(&classFile->method_index);
+
+	free(classFile->bootstrap_methods);
+	free(classFile->bootstrap_arguments);
+	if (classFile->call_sites != NULL)
+	{
+		for (i = 0; i < classFile->constant_count; i += 1)
+			free(classFile->call_sites[i]);
+		free(classFile->call_sites);
+	}
 
 	free(classFile);
 }
 
 const char* access_flags_to_string(uint16_t access_flags)
 {
-	static char buf[255];
+	static __thread char buf[255];
 
 	if (access_flags & ACC_PUBLIC)
 		strcpy(buf, "public");
@@ -813,19 +1672,22 @@ const char* parse_type_descriptor(const char* descriptor, TypeDescriptor* typeDe
 		// First, skip params
 		for (p = descriptor + 1; *p && *p != ')'; )
 			p += 1;
-		p += 1;
+		if (*p)
+			p += 1;
 
 		// parse return type
 		typeDescriptor->returnType = malloc(sizeof(TypeDescriptor));
+		STAT_ADD(allocations, 1);
 		ret = parse_type_descriptor(p, typeDescriptor->returnType);
 
 		// parse the parameter types
 		typeDescriptor->params = NULL;
 		typeDescriptor->param_count = 0;
-		for (p = descriptor + 1, i = 0; *p != ')'; i += 1)
+		for (p = descriptor + 1, i = 0; p != NULL && *p && *p != ')'; i += 1)
 		{
 			typeDescriptor->param_count += 1;
 			typeDescriptor->params = realloc(typeDescriptor->params, sizeof(TypeDescriptor) * typeDescriptor->param_count);
+			STAT_ADD(allocations, 1);
 			p = parse_type_descriptor(p, &typeDescriptor->params[i]);
 		}
 
@@ -843,6 +1705,7 @@ const char* parse_type_descriptor(const char* descriptor, TypeDescriptor* typeDe
 
 		// parse element type
 		typeDescriptor->elementType = malloc(sizeof(TypeDescriptor));
+		STAT_ADD(allocations, 1);
 		return parse_type_descriptor(p, typeDescriptor->elementType);
 	}
 
@@ -850,8 +1713,8 @@ const char* parse_type_descriptor(const char* descriptor, TypeDescriptor* typeDe
 	{
 		typeDescriptor->type = TYPE_CLASS;
 
-		p = strchr(descriptor + 1, ';');
-		typeDescriptor->name = malloc((p - descriptor) * sizeof(char));
+		typeDescriptor->name = malloc(strlen(descriptor) * sizeof(char));
+		STAT_ADD(allocations, 1);
 
 		for (p = descriptor + 1, q = typeDescriptor->name; *p && *p != ';'; )
 		{
@@ -860,7 +1723,7 @@ const char* parse_type_descriptor(const char* descriptor, TypeDescriptor* typeDe
 		}
 		*q++ = '\0';
 
-		return p + 1;
+		return *p == ';' ? p + 1 : NULL;
 	}
 
 	for (bt = BaseTypes; bt->name; bt += 1)
@@ -891,7 +1754,8 @@ const char* descriptor_to_string_ex(const char* descriptor, const char* name, ch
 		// First, skip params
 		for (p = descriptor + 1; *p && *p != ')'; )
 			p += 1;
-		p += 1;
+		if (*p)
+			p += 1;
 
 		// Format return type and method name
 		if (flags & FLAG_OMIT_RETURN_TYPE)
@@ -906,7 +1770,7 @@ const char* descriptor_to_string_ex(const char* descriptor, const char* name, ch
 		strcat(buf, "(");
 
 		// Add the parameters
-		for (p = descriptor + 1, i = 0; *p != ')'; i += 1)
+		for (p = descriptor + 1, i = 0; p != NULL && *p && *p != ')'; i += 1)
 		{
 			if (i > 0)
 				strcat(q, ", ");
@@ -957,7 +1821,7 @@ const char* descriptor_to_string_ex(const char* descriptor, const char* name, ch
 			strcat(buf, name);
 		}
 
-		return p + 1;
+		return *p == ';' ? p + 1 : NULL;
 	}
 
 	for (bt = BaseTypes; bt->name; bt += 1)
@@ -972,6 +1836,8 @@ const char* descriptor_to_string_ex(const char* descriptor, const char* name, ch
 		}
 	}
 
+	/* Not a descriptor: malformed classes */
+	buf[0] = '\0';
 	return NULL;
 }
 
@@ -982,7 +1848,7 @@ void descriptor_to_string(const char* descriptor, const char* name, char* buf)
 
 const char* class_name_from_internal(const char* name)
 {
-	static char buf[255];
+	static __thread char buf[255];
 	const char* in;
 	char* out;
 
@@ -998,7 +1864,7 @@ const char* class_name_from_internal(const char* name)
 
 const char* class_name_to_internal(const char* name)
 {
-	static char buf[255];
+	static __thread char buf[255];
 	const char* in;
 	char* out;
 
@@ -2,6 +2,7 @@
 #define CLASSFILE_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,6 +33,7 @@ typedef struct
 
 extern ConstantType ConstantTypes[];
 extern BaseType BaseTypes[];
+extern const char* ReferenceKinds[];
 
 #define TAG_STRING	   1
 #define TAG_INTEGER	   3
@@ -44,6 +46,26 @@ extern BaseType BaseTypes[];
 #define TAG_METHODREF 10
 #define TAG_IFACEREF  11
 #define TAG_TYPEDESC  12
+#define TAG_METHODHANDLE  15
+#define TAG_METHODTYPE    16
+#define TAG_DYNAMIC       17
+#define TAG_INVOKEDYNAMIC 18
+#define TAG_MODULE        19
+#define TAG_PACKAGE       20
+
+/* Size of ConstantTypes[]; tags above it are invalid */
+#define CONSTANT_TAG_COUNT 21
+
+/* Reference kinds of a TAG_METHODHANDLE */
+#define REF_GETFIELD         1
+#define REF_GETSTATIC        2
+#define REF_PUTFIELD         3
+#define REF_PUTSTATIC        4
+#define REF_INVOKEVIRTUAL    5
+#define REF_INVOKESTATIC     6
+#define REF_INVOKESPECIAL    7
+#define REF_NEWINVOKESPECIAL 8
+#define REF_INVOKEINTERFACE  9
 
 /* Declared  public; may be accessed from outside its package. */
 #define ACC_PUBLIC	   0x0001
@@ -70,6 +92,17 @@ extern BaseType BaseTypes[];
 /* Declared as an element of an enum. */
 #define ACC_ENUM	   0x4000
 
+/* Flags that only apply to classes or to methods, sharing bits with the
+	field flags above */
+#define ACC_SUPER        0x0020 /* class: invokespecial uses the new semantics */
+#define ACC_MODULE       0x8000 /* class: is a module, not a class */
+#define ACC_SYNCHRONIZED 0x0020 /* method: invocation is wrapped by a monitor */
+#define ACC_BRIDGE       0x0040 /* method: bridge method generated by the compiler */
+#define ACC_VARARGS      0x0080 /* method: declared with a variable number of arguments */
+#define ACC_NATIVE       0x0100 /* method: implemented in a language other than Java */
+#define ACC_STRICT       0x0800 /* method: declared strictfp */
+#define ACC_MANDATED     0x8000 /* parameter: implicitly declared, as the outer this of an inner class */
+
 typedef struct
 {
 	int index;
@@ -86,12 +119,21 @@ typedef struct
 		float floatval;   /* TAG_FLOAT */
 		int64_t longval;  /* TAG_LONG */
 		double doubleval; /* TAG_DOUBLE */
-		uint16_t ref;	  /* TAG_CLASSREF, TAG_STRINGREF */
-		struct			  /* TAG_FIELDREF, TAG_METHODREF, TAG_IFACEREF */
+		uint16_t ref;	  /* TAG_CLASSREF, TAG_STRINGREF, TAG_METHODTYPE, TAG_MODULE, TAG_PACKAGE */
+		struct			  /* TAG_FIELDREF, TAG_METHODREF, TAG_IFACEREF, TAG_DYNAMIC, TAG_INVOKEDYNAMIC */
 		{
-			uint16_t classref;
+			union
+			{
+				uint16_t classref;
+				uint16_t bootstrap; /* index into the BootstrapMethods attribute */
+			};
 			uint16_t typedescref;
 		};
+		struct			  /* TAG_METHODHANDLE */
+		{
+			uint8_t refkind;  /* REF_* */
+			uint16_t handleref;
+		};
 		struct			  /* TAG_TYPEDESC */
 		{
 			uint16_t nameref;
@@ -108,7 +150,32 @@ typedef struct
 	uint16_t catch_type;
 } ExceptionTableEntry;
 
+/* LineNumberTable entry */
+typedef struct
+{
+	uint16_t start_pc;
+	uint16_t line;
+} LineNumber;
+
+/* LocalVariableTable entry, with the signature from the matching
+	LocalVariableTypeTable entry if there is one */
+typedef struct
+{
+	uint16_t start_pc;
+	uint16_t length;
+	uint16_t name_index;
+	uint16_t descriptor_index;
+	uint16_t signature_index; /* 0 if not generic */
+	uint16_t slot;
+} LocalVariable;
+
 #define ATT_NAME_CODE "Code"
+#define ATT_NAME_LINENUMBERS "LineNumberTable"
+#define ATT_NAME_LOCALVARIABLES "LocalVariableTable"
+#define ATT_NAME_LOCALVARIABLETYPES "LocalVariableTypeTable"
+#define ATT_NAME_STACKMAPTABLE "StackMapTable"
+#define ATT_NAME_BOOTSTRAPMETHODS "BootstrapMethods"
+#define ATT_NAME_RUNTIMEVISIBLEANNOTATIONS "RuntimeVisibleAnnotations"
 
 #define ATT_UNKNOWN 0
 #define ATT_CODE    1
@@ -134,6 +201,13 @@ typedef struct tagAttribute
 			ExceptionTableEntry* exception_table;
 			uint16_t attribute_count;
 			struct tagAttribute* attributes;
+
+			/* Decoded from the attributes above, which are kept as they
+				are for writing */
+			uint32_t line_count;
+			LineNumber* lines;        /* sorted by start_pc */
+			uint32_t local_count;
+			LocalVariable* locals;    /* sorted by slot, then start_pc */
 		} code;
 		struct
 		{
@@ -159,8 +233,35 @@ typedef struct
 	uint16_t descriptor_index;
 	uint16_t attribute_count;
 	Attribute* attributes;
+	int special;              /* METHOD_INIT, METHOD_CLINIT or 0 */
 } Method;
 
+#define METHOD_INIT   1 /* <init>, instance initializer */
+#define METHOD_CLINIT 2 /* <clinit>, static class initializer */
+
+/* Hash table over the fields or methods of a class, keyed by name. The
+	descriptor is compared on lookup, so overloads share a chain. */
+typedef struct
+{
+	uint32_t hash;
+	int32_t member;           /* offset into fields/methods, -1 if empty */
+} MemberSlot;
+
+typedef struct
+{
+	uint32_t capacity;        /* power of two, 0 until first lookup */
+	MemberSlot* slots;
+} MemberIndex;
+
+/* BootstrapMethods entry; its static arguments are the constants
+	bootstrap_arguments[arguments .. arguments + argument_count) */
+typedef struct
+{
+	uint16_t method_handle;   /* TAG_METHODHANDLE constant */
+	uint16_t argument_count;
+	uint32_t arguments;
+} BootstrapMethod;
+
 typedef struct
 {
 	ClassFileHeader header;
@@ -178,6 +279,18 @@ typedef struct
 	Field* fields;
 	Method* methods;
 	Attribute* attributes;
+
+	MemberIndex field_index;
+	MemberIndex method_index;
+
+	/* Decoded from the BootstrapMethods attribute, which is kept as it is
+		for writing; NULL if there is none or it is malformed */
+	uint16_t bootstrap_count;
+	BootstrapMethod* bootstrap_methods;
+	uint16_t* bootstrap_arguments;
+
+	/* call_site_to_string results by constant offset, built on first use */
+	char** call_sites;
 } ClassFile;
 
 #define TYPE_UNKNOWN 0
@@ -205,15 +318,21 @@ typedef struct tagTypeDescriptor
 
 int read_constants(FILE* fp, Constant** constants);
 int write_constants(FILE* fp, uint16_t count, Constant* constants);
+size_t constant_entry_size(const unsigned char* pool, size_t size, size_t offset);
+size_t walk_constants(const unsigned char* pool, size_t size, uint32_t* offsets);
 void free_constants(int count, Constant* constants);
 
 uint16_t read_attributes(FILE* fp, ClassFile* classFile, Attribute** attributes);
 int write_attributes(FILE* fp, uint16_t count, Attribute* attributes);
+void free_attributes(uint16_t count, Attribute* attributes);
 
 Attribute* find_attribute(ClassFile* classFile, const char* name, int attribute_count, Attribute* attributes);
+LineNumber* find_line_number(Attribute* codeAttribute, uint32_t pc);
+LocalVariable* find_local_variable(Attribute* codeAttribute, uint16_t slot, uint32_t pc);
 
 ClassFile* read_class(FILE* fp);
 ClassFile* read_class_file(const char* filename);
+ClassFile* read_class_buffer(const void* buffer, size_t size);
 
 ClassFile* create_class(const char* className);
 
@@ -227,6 +346,16 @@ Constant* add_string_constant(ClassFile* classFile, const char* buffer);
 uint16_t add_classref(ClassFile* classFile, const char* className);
 
 Method* add_method(ClassFile* classFile, const char* methodName, const char* descriptor);
+int special_method(const char* name);
+
+Method* find_method(ClassFile* classFile, const char* name, const char* descriptor);
+Method* find_method_by_index(ClassFile* classFile, uint16_t name_index, uint16_t descriptor_index);
+Field* find_field(ClassFile* classFile, const char* name, const char* descriptor);
+Field* find_field_by_index(ClassFile* classFile, uint16_t name_index, uint16_t descriptor_index);
+void free_member_index(MemberIndex* index);
+
+BootstrapMethod* find_bootstrap_method(ClassFile* classFile, Constant* constant);
+const char* call_site_to_string(ClassFile* classFile, Constant* constant);
 
 const char* constant_to_string(ClassFile* classFile, Constant* constant);
 const char* constant_to_string_r(ClassFile* classFile, Constant* constant, char* buffer);
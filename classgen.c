@@ -0,0 +1,299 @@
+#include "classgen.h"
+#include "bytecode.h"
+
+/*
+	Generates synthetic (but structurally valid) class files, used as a
+	reproducible benchmark corpus. The output only depends on the options,
+	so the same seed always produces the same bytes.
+*/
+
+static uint32_t next_random(uint32_t* state)
+{
+	/* xorshift32; rand() is not reproducible across C libraries */
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+void classgen_default_options(ClassGenOptions* options)
+{
+	options->seed = 0x5eed;
+	options->constant_count = 200;
+	options->wide_percent = 25;
+	options->method_count = 20;
+	options->code_length = 200;
+	options->switch_size = 16;
+}
+
+static uint16_t add_methodref(ClassFile* classFile, uint16_t classref, const char* name, const char* descriptor)
+{
+	Constant *nameConstant, *descriptorConstant, *typedesc, *methodref;
+
+	nameConstant = add_string_constant(classFile, name);
+	descriptorConstant = add_string_constant(classFile, descriptor);
+
+	typedesc = add_constant(classFile, TAG_TYPEDESC);
+	typedesc->nameref = nameConstant->index;
+	typedesc->typeref = descriptorConstant->index;
+
+	methodref = add_constant(classFile, TAG_METHODREF);
+	methodref->classref = classref;
+	methodref->typedescref = typedesc->index;
+
+	return methodref->index;
+}
+
+static void add_numeric_constants(ClassFile* classFile, ClassGenOptions* options, uint32_t* state,
+	uint16_t* narrow, int* narrow_count, uint16_t* wide, int* wide_count)
+{
+	Constant *c, *utf8;
+	char string[64];
+	int i, kind;
+
+	for (i = 0; i < options->constant_count; i += 1)
+	{
+		if (next_random(state) % 100 < options->wide_percent)
+		{
+			if (next_random(state) & 1)
+			{
+				c = add_constant(classFile, TAG_LONG);
+				c->longval = ((int64_t)next_random(state) << 32) | next_random(state);
+			}
+			else
+			{
+				c = add_constant(classFile, TAG_DOUBLE);
+				c->doubleval = (double)next_random(state) / (next_random(state) | 1);
+			}
+
+			wide[(*wide_count)++] = c->index;
+			continue;
+		}
+
+		kind = next_random(state) % 3;
+		if (kind == 0)
+		{
+			c = add_constant(classFile, TAG_INTEGER);
+			c->intval = next_random(state);
+		}
+		else if (kind == 1)
+		{
+			c = add_constant(classFile, TAG_FLOAT);
+			c->floatval = (float)next_random(state) / 1000.0f;
+		}
+		else
+		{
+			snprintf(string, sizeof(string), "string constant %u \xc3\xa9\xe2\x82\xac", next_random(state));
+			utf8 = add_string_constant(classFile, string);
+			c = add_constant(classFile, TAG_STRINGREF);
+			c->ref = utf8->index;
+		}
+
+		narrow[(*narrow_count)++] = c->index;
+	}
+}
+
+static uint32_t emit(Instruction* ins, unsigned char* code, uint32_t pc)
+{
+	return pc + instruction_to_bytecode(ins, code + pc, pc);
+}
+
+static uint32_t emit_switch(ClassGenOptions* options, uint32_t* state, unsigned char* code, uint32_t pc)
+{
+	Instruction ins;
+	int32_t *matches, *offsets;
+	uint32_t start, end, size;
+	int i, cases = options->switch_size;
+
+	matches = malloc(cases * sizeof(int32_t));
+	offsets = malloc(cases * sizeof(int32_t));
+
+	/* The switch is followed by one "iconst_0; pop" pair per case, which
+		are all 2 bytes long, so the size of the switch itself is known up
+		front. */
+	ins.opcode = (next_random(state) & 1) ? OP_TABLESWITCH : OP_LOOKUPSWITCH;
+	if (ins.opcode == OP_TABLESWITCH)
+		size = (4 - (pc % 4)) + 12 + 4 * cases;
+	else
+		size = (4 - (pc % 4)) + 8 + 8 * cases;
+
+	start = pc;
+	end = start + size + 2 * cases;
+
+	for (i = 0; i < cases; i += 1)
+	{
+		matches[i] = i * 7 - cases;
+		offsets[i] = size + 2 * i;
+	}
+
+	ins.defaultoffset = end - start;
+	if (ins.opcode == OP_TABLESWITCH)
+	{
+		ins.low = 0;
+		ins.high = cases - 1;
+	}
+	else
+	{
+		ins.npairs = cases;
+	}
+	ins.matches = matches;
+	ins.branchoffsets = offsets;
+	pc = emit(&ins, code, pc);
+
+	for (i = 0; i < cases; i += 1)
+	{
+		code[pc++] = OP_ICONST_0;
+		code[pc++] = OP_POP;
+	}
+
+	free(matches);
+	free(offsets);
+	return pc;
+}
+
+static void add_code(ClassFile* classFile, Method* method, ClassGenOptions* options, uint32_t* state,
+	uint16_t codeName, uint16_t methodref,
+	uint16_t* narrow, int narrow_count, uint16_t* wide, int wide_count)
+{
+	Attribute* a;
+	Instruction ins;
+	unsigned char* code;
+	uint32_t pc, capacity;
+	int i;
+
+	/* Every 50th instruction may be a switch; the rest take at most 6 bytes */
+	capacity = options->code_length * 6 + (options->code_length / 50 + 1) * (16 + 10 * options->switch_size) + 16;
+	code = malloc(capacity);
+
+	for (pc = 0, i = 0; i < options->code_length; i += 1)
+	{
+		switch (next_random(state) % 10)
+		{
+			case 0:
+			case 1:
+				if (narrow_count == 0)
+					continue;
+				ins.opcode = OP_LDC_W;
+				ins.constant = narrow[next_random(state) % narrow_count];
+				pc = emit(&ins, code, pc);
+				code[pc++] = OP_POP;
+				break;
+
+			case 2:
+				if (wide_count == 0)
+					continue;
+				ins.opcode = OP_LDC2_W;
+				ins.constant = wide[next_random(state) % wide_count];
+				pc = emit(&ins, code, pc);
+				code[pc++] = OP_POP2;
+				break;
+
+			case 3:
+				ins.opcode = OP_BIPUSH;
+				ins.uint8 = next_random(state);
+				pc = emit(&ins, code, pc);
+				ins.opcode = OP_ISTORE;
+				ins.varIndex = 1;
+				pc = emit(&ins, code, pc);
+				break;
+
+			case 4:
+				ins.opcode = OP_SIPUSH;
+				ins.uint16 = next_random(state);
+				pc = emit(&ins, code, pc);
+				code[pc++] = OP_ILOAD_1;
+				code[pc++] = OP_IXOR;
+				code[pc++] = OP_ISTORE_1;
+				break;
+
+			case 5:
+				ins.opcode = OP_IINC;
+				ins.varIndex = 1;
+				ins.value = next_random(state);
+				pc = emit(&ins, code, pc);
+				break;
+
+			case 6:
+				code[pc++] = OP_ALOAD_0;
+				ins.opcode = OP_INVOKEVIRTUAL;
+				ins.constant = methodref;
+				pc = emit(&ins, code, pc);
+				break;
+
+			case 7:
+				code[pc++] = OP_ILOAD_1;
+				ins.opcode = OP_IFEQ;
+				ins.branchoffset = 4;
+				pc = emit(&ins, code, pc);
+				code[pc++] = OP_NOP;
+				break;
+
+			default:
+				if (i % 50 != 0 || options->switch_size <= 0)
+				{
+					code[pc++] = OP_NOP;
+					break;
+				}
+				code[pc++] = OP_ILOAD_1;
+				pc = emit_switch(options, state, code, pc);
+				break;
+		}
+	}
+	code[pc++] = OP_RETURN;
+
+	method->attribute_count = 1;
+	a = method->attributes = malloc(sizeof(Attribute));
+
+	a->name_index = codeName;
+	a->type = ATT_CODE;
+	a->code.max_stack = 2;
+	a->code.max_locals = 2;
+	a->code.code_length = pc;
+	a->code.code = code;
+	a->code.exception_table_length = 0;
+	a->code.exception_table = NULL;
+	a->code.attribute_count = 0;
+	a->code.attributes = NULL;
+	a->code.line_count = 0;
+	a->code.lines = NULL;
+	a->code.local_count = 0;
+	a->code.locals = NULL;
+	a->length = 12 + pc;
+}
+
+ClassFile* generate_class(const char* className, ClassGenOptions* options)
+{
+	ClassFile* classFile;
+	Method* method;
+	uint16_t *narrow, *wide, codeName, methodref;
+	int i, narrow_count = 0, wide_count = 0;
+	uint32_t state = options->seed ? options->seed : 1;
+	char name[32];
+
+	classFile = create_class(className);
+	classFile->access_flags = ACC_PUBLIC;
+
+	codeName = add_string_constant(classFile, ATT_NAME_CODE)->index;
+	methodref = add_methodref(classFile, classFile->this_class, "work", "()V");
+
+	narrow = malloc((options->constant_count + 1) * sizeof(uint16_t));
+	wide = malloc((options->constant_count + 1) * sizeof(uint16_t));
+	add_numeric_constants(classFile, options, &state, narrow, &narrow_count, wide, &wide_count);
+
+	for (i = 0; i < options->method_count; i += 1)
+	{
+		snprintf(name, sizeof(name), "method%d", i);
+		method = add_method(classFile, name, "()V");
+		method->access_flags = ACC_PUBLIC;
+
+		/* add_method may move the array, so keep this after it */
+		add_code(classFile, method, options, &state, codeName, methodref,
+			narrow, narrow_count, wide, wide_count);
+	}
+
+	free(narrow);
+	free(wide);
+
+	return classFile;
+}
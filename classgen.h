@@ -0,0 +1,21 @@
+#ifndef CLASSGEN_H
+#define CLASSGEN_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+typedef struct
+{
+	uint32_t seed;
+	int constant_count; /* Number of (extra) numeric and string constants */
+	int wide_percent;   /* Percentage of numeric constants that are long or double */
+	int method_count;
+	int code_length;    /* Approximate number of instructions per method */
+	int switch_size;    /* Number of cases in each tableswitch and lookupswitch */
+} ClassGenOptions;
+
+void classgen_default_options(ClassGenOptions* options);
+ClassFile* generate_class(const char* className, ClassGenOptions* options);
+
+#endif
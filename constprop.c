@@ -0,0 +1,407 @@
+#include <string.h>
+
+#include "constprop.h"
+#include "liveness.h"
+#include "stack.h"
+
+/*
+	The stack effect of every instruction comes from stack_effect(), so
+	only the int producing instructions need to be evaluated here: the
+	rest pop their operands and push varying values. Loads and stores go
+	through local_access(), which also covers their wide forms.
+
+	A jsr returns to the next instruction with the stack as it was before
+	the call, but the subroutine may have changed any local, so they all
+	become varying there. A handler starts with a varying exception on the
+	stack and the locals of every point of the protected blocks.
+*/
+
+typedef struct
+{
+	ClassFile* classFile;
+	DecodedCode* decoded;
+	ControlFlowGraph* cfg;
+	ConstProp* cp;
+	uint32_t slots;           /* max_stack + max_locals */
+
+	/* State of the block being evaluated: the stack, then the locals */
+	int depth;
+	ConstValue* state;
+
+	uint32_t* worklist;
+	uint8_t* queued;
+	uint32_t top;
+} Propagation;
+
+static const ConstValue Varying = { CONST_VARYING, 0 };
+
+static ConstValue int_value(int32_t value)
+{
+	ConstValue v;
+
+	v.kind = CONST_INT;
+	v.value = value;
+	return v;
+}
+
+/* Joins src into dst, returns nonzero if dst changed */
+static int merge_values(ConstValue* dst, ConstValue* src, int count)
+{
+	int i, changed = 0;
+
+	for (i = 0; i < count; i += 1)
+	{
+		if (src[i].kind == CONST_UNDEF || dst[i].kind == CONST_VARYING)
+			continue;
+		if (dst[i].kind == CONST_UNDEF)
+			dst[i] = src[i];
+		else if (src[i].kind == CONST_VARYING || src[i].value != dst[i].value)
+			dst[i] = Varying;
+		else
+			continue;
+		changed = 1;
+	}
+	return changed;
+}
+
+/* Merges a state into the entry of block b; 0 if the stack depths disagree */
+static int flow(Propagation* p, uint32_t b, int depth, ConstValue* stack, ConstValue* locals)
+{
+	ConstProp* cp = p->cp;
+	ConstValue* entry = cp->entry + (size_t)b * p->slots;
+	int changed;
+
+	if (cp->entry_depth[b] < 0)
+	{
+		cp->entry_depth[b] = depth;
+		changed = 1;
+	}
+	else if (cp->entry_depth[b] != depth)
+		return 0;
+	else
+		changed = 0;
+
+	changed |= merge_values(entry, stack, depth);
+	changed |= merge_values(entry + cp->max_stack, locals, cp->max_locals);
+
+	if (changed && !p->queued[b])
+	{
+		p->queued[b] = 1;
+		p->worklist[p->top++] = b;
+	}
+	return 1;
+}
+
+/* Handlers of block b can be entered with the current locals */
+static int flow_handlers(Propagation* p, BasicBlock* block)
+{
+	ControlFlowGraph* cfg = p->cfg;
+	ConstValue exception[1] = { Varying };
+	uint32_t k;
+
+	for (k = block->succ_start; k < block->succ_start + block->succ_count; k += 1)
+	{
+		if (cfg->successor_kinds[k] == EDGE_EXCEPTION &&
+			!flow(p, cfg->successors[k], 1, exception, p->state + p->cp->max_stack))
+			return 0;
+	}
+	return 1;
+}
+
+static int is_int_local(Instruction* ins)
+{
+	uint8_t opcode = ins->opcode == OP_WIDE ? ins->opcode2 : ins->opcode;
+
+	return opcode == OP_ILOAD || opcode == OP_ISTORE || opcode == OP_IINC ||
+		(opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3) ||
+		(opcode >= OP_ISTORE_0 && opcode <= OP_ISTORE_3);
+}
+
+static ConstValue binary(uint8_t opcode, int32_t a, int32_t b)
+{
+	uint32_t ua = (uint32_t)a, ub = (uint32_t)b;
+
+	switch (opcode)
+	{
+		case OP_IADD:  return int_value((int32_t)(ua + ub));
+		case OP_ISUB:  return int_value((int32_t)(ua - ub));
+		case OP_IMUL:  return int_value((int32_t)(ua * ub));
+		case OP_ISHL:  return int_value((int32_t)(ua << (b & 31)));
+		case OP_ISHR:  return int_value(a >> (b & 31));
+		case OP_IUSHR: return int_value((int32_t)(ua >> (b & 31)));
+		case OP_IAND:  return int_value(a & b);
+		case OP_IOR:   return int_value(a | b);
+		case OP_IXOR:  return int_value(a ^ b);
+
+		/* Division by zero throws; INT_MIN / -1 overflows back to INT_MIN */
+		case OP_IDIV:
+			if (b == 0)
+				return Varying;
+			return int_value(b == -1 ? (int32_t)(0 - ua) : a / b);
+
+		case OP_IREM:
+			if (b == 0)
+				return Varying;
+			return int_value(b == -1 ? 0 : a % b);
+	}
+	return Varying;
+}
+
+/* Value an instruction pushes, from the topmost (up to 4) slots it pops */
+static ConstValue evaluate(Propagation* p, Instruction* ins, ConstValue* operands, int count)
+{
+	ConstValue a = count > 0 ? operands[count - 1] : Varying;
+	ConstValue b = count > 1 ? operands[count - 2] : Varying;
+	Constant* constant;
+
+	switch (ins->opcode)
+	{
+		case OP_ICONST_M1:
+		case OP_ICONST_0:
+		case OP_ICONST_1:
+		case OP_ICONST_2:
+		case OP_ICONST_3:
+		case OP_ICONST_4:
+		case OP_ICONST_5:
+			return int_value(ins->opcode - OP_ICONST_0);
+
+		case OP_BIPUSH:
+			return int_value((int8_t)ins->uint8);
+
+		case OP_SIPUSH:
+			return int_value((int16_t)ins->uint16);
+
+		case OP_LDC:
+		case OP_LDC_W:
+			constant = find_constant(p->classFile, ins->constant);
+			if (constant != NULL && constant->tag == TAG_INTEGER)
+				return int_value(constant->intval);
+			return Varying;
+
+		case OP_IADD:
+		case OP_ISUB:
+		case OP_IMUL:
+		case OP_IDIV:
+		case OP_IREM:
+		case OP_ISHL:
+		case OP_ISHR:
+		case OP_IUSHR:
+		case OP_IAND:
+		case OP_IOR:
+		case OP_IXOR:
+			if (a.kind == CONST_INT && b.kind == CONST_INT)
+				return binary(ins->opcode, b.value, a.value);
+			return Varying;
+	}
+
+	if (a.kind != CONST_INT)
+		return Varying;
+
+	switch (ins->opcode)
+	{
+		case OP_INEG: return int_value((int32_t)(0 - (uint32_t)a.value));
+		case OP_I2B:  return int_value((int8_t)a.value);
+		case OP_I2C:  return int_value((uint16_t)a.value);
+		case OP_I2S:  return int_value((int16_t)a.value);
+	}
+	return Varying;
+}
+
+/* The dup and swap family; order lists the new slots as in stack.c */
+static const char* shuffle_order(uint8_t opcode)
+{
+	switch (opcode)
+	{
+		case OP_DUP:     return "aa";
+		case OP_DUP_X1:  return "bab";
+		case OP_DUP_X2:  return "cabc";
+		case OP_DUP2:    return "abab";
+		case OP_DUP2_X1: return "bcabc";
+		case OP_DUP2_X2: return "cdabcd";
+		case OP_SWAP:    return "ba";
+	}
+	return NULL;
+}
+
+/* Executes one instruction on p->state; 0 if the code is malformed */
+static int execute(Propagation* p, Instruction* ins)
+{
+	ConstProp* cp = p->cp;
+	ConstValue* stack = p->state;
+	ConstValue* locals = p->state + cp->max_stack;
+	ConstValue operands[4], value;
+	LocalAccess access;
+	const char* order;
+	int popped, pushed, count, i, increment;
+
+	if (!stack_effect(p->classFile, ins, &popped, &pushed))
+		return 0;
+	if (popped > p->depth || p->depth - popped + pushed > (int)cp->max_stack)
+		return 0;
+
+	/* Nothing looks deeper than four slots (dup2_x2) */
+	count = popped < 4 ? popped : 4;
+	memcpy(operands, stack + p->depth - count, count * sizeof(ConstValue));
+	p->depth -= popped;
+
+	if (local_access(ins, &access))
+	{
+		if (access.slot + access.width > cp->max_locals)
+			return 0;
+
+		if (ins->opcode == OP_WIDE && ins->opcode2 == OP_IINC)
+			increment = (int16_t)ins->value16;
+		else
+			increment = (int8_t)ins->value;
+
+		if (access.kind == ACCESS_USE && pushed > 0)
+		{
+			/* A load */
+			value = is_int_local(ins) ? locals[access.slot] : Varying;
+			for (i = 0; i < pushed; i += 1)
+				stack[p->depth++] = Varying;
+			stack[p->depth - pushed] = value;
+			return 1;
+		}
+
+		if (access.kind == (ACCESS_USE | ACCESS_DEF))
+		{
+			if (locals[access.slot].kind == CONST_INT)
+				locals[access.slot] = int_value((int32_t)((uint32_t)locals[access.slot].value + increment));
+			else
+				locals[access.slot] = Varying;
+			return 1;
+		}
+
+		if (access.kind == ACCESS_DEF)
+		{
+			locals[access.slot] = is_int_local(ins) ? operands[0] : Varying;
+			if (access.width == 2)
+				locals[access.slot + 1] = Varying;
+		}
+		return 1;
+	}
+
+	if ((order = shuffle_order(ins->opcode)) != NULL)
+	{
+		for (i = 0; order[i] != '\0'; i += 1)
+			stack[p->depth++] = operands[order[i] - 'a'];
+		return 1;
+	}
+
+	for (i = 0; i < pushed; i += 1)
+		stack[p->depth++] = Varying;
+	if (pushed == 1)
+		stack[p->depth - 1] = evaluate(p, ins, operands, count);
+	return 1;
+}
+
+static int is_jsr(Instruction* ins)
+{
+	return ins->opcode == OP_JSR || ins->opcode == OP_JSR_W;
+}
+
+static int evaluate_block(Propagation* p, uint32_t b, ConstValue* saved)
+{
+	ControlFlowGraph* cfg = p->cfg;
+	ConstProp* cp = p->cp;
+	BasicBlock* block = cfg->blocks + b;
+	Instruction* ins = NULL;
+	LocalAccess access;
+	uint32_t i, k, s;
+	int64_t pc;
+	int32_t target = -1;
+	int depth_before = 0;
+
+	p->depth = cp->entry_depth[b];
+	memcpy(p->state, cp->entry + (size_t)b * p->slots, p->slots * sizeof(ConstValue));
+
+	if (!flow_handlers(p, block))
+		return 0;
+
+	for (i = block->first; i < block->first + block->count; i += 1)
+	{
+		ins = p->decoded->instructions + i;
+		depth_before = p->depth;
+
+		if (!execute(p, ins))
+			return 0;
+
+		cp->top[i] = p->depth > 0 ? p->state[p->depth - 1] : Varying;
+
+		if (local_access(ins, &access) && (access.kind & ACCESS_DEF) && !flow_handlers(p, block))
+			return 0;
+	}
+
+	if (ins != NULL && is_jsr(ins))
+	{
+		pc = (int64_t)p->decoded->pcs[i - 1] + (ins->opcode == OP_JSR ? ins->branchoffset : ins->branchoffset32);
+		if (pc >= 0 && pc < p->decoded->code_length)
+			target = cfg_block_at(cfg, p->decoded, pc);
+	}
+
+	for (k = block->succ_start; k < block->succ_start + block->succ_count; k += 1)
+	{
+		if (cfg->successor_kinds[k] == EDGE_EXCEPTION)
+			continue;
+
+		s = cfg->successors[k];
+		if (target >= 0 && s != (uint32_t)target)
+		{
+			/* The return point of the subroutine */
+			for (i = 0; i < cp->max_locals; i += 1)
+				saved[i] = Varying;
+			if (!flow(p, s, depth_before, p->state, saved))
+				return 0;
+		}
+		else if (!flow(p, s, p->depth, p->state, p->state + cp->max_stack))
+			return 0;
+	}
+	return 1;
+}
+
+int propagate_constants(ClassFile* classFile, Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, ConstProp* cp)
+{
+	Propagation p;
+	ConstValue* saved;
+	uint32_t b, i;
+
+	cp->max_stack = codeAttribute->code.max_stack;
+	cp->max_locals = codeAttribute->code.max_locals;
+	cp->block_count = cfg->block_count;
+	cp->entry_depth = arena_alloc(arena, cfg->block_count * sizeof(int32_t) + 1);
+	cp->entry = arena_calloc(arena, (size_t)cfg->block_count * (cp->max_stack + cp->max_locals) + 1, sizeof(ConstValue));
+	cp->top = arena_calloc(arena, decoded->count + 1, sizeof(ConstValue));
+
+	for (b = 0; b < cfg->block_count; b += 1)
+		cp->entry_depth[b] = -1;
+
+	if (cfg->block_count == 0)
+		return 1;
+
+	p.classFile = classFile;
+	p.decoded = decoded;
+	p.cfg = cfg;
+	p.cp = cp;
+	p.slots = cp->max_stack + cp->max_locals;
+	p.state = arena_alloc(arena, (p.slots + 1) * sizeof(ConstValue));
+	p.worklist = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+	p.queued = arena_calloc(arena, cfg->block_count, sizeof(uint8_t));
+	p.top = 0;
+	saved = arena_alloc(arena, (cp->max_locals + 1) * sizeof(ConstValue));
+
+	/* Parameters and uninitialized locals are unknown on entry */
+	for (i = 0; i < cp->max_locals; i += 1)
+		saved[i] = Varying;
+	flow(&p, 0, 0, NULL, saved);
+
+	while (p.top > 0)
+	{
+		b = p.worklist[--p.top];
+		p.queued[b] = 0;
+
+		if (!evaluate_block(&p, b, saved))
+			return 0;
+	}
+	return 1;
+}
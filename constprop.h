@@ -0,0 +1,48 @@
+#ifndef CONSTPROP_H
+#define CONSTPROP_H
+
+#include <stdint.h>
+
+#include "cfg.h"
+#include "arena.h"
+
+/*
+	Constant propagation of int values through the operand stack and the
+	local variables. Every stack slot and local holds a lattice value:
+	undefined (not reached yet), a known int, or varying. Only int
+	arithmetic is evaluated; everything else produces varying values.
+
+	The analysis is a worklist over the blocks of the CFG with one state
+	per block entry; each value can only go up the lattice twice, so every
+	block is revisited a bounded number of times. All arrays are allocated
+	from the arena passed in.
+*/
+
+#define CONST_UNDEF   0
+#define CONST_INT     1
+#define CONST_VARYING 2
+
+typedef struct
+{
+	uint8_t kind;
+	int32_t value;            /* for CONST_INT */
+} ConstValue;
+
+typedef struct
+{
+	uint32_t max_stack;
+	uint32_t max_locals;
+	uint32_t block_count;
+	int32_t* entry_depth;     /* stack depth on entry to each block, -1 if not reached */
+	ConstValue* entry;        /* per block: max_stack stack slots, then max_locals locals */
+
+	ConstValue* top;          /* top of the stack after each instruction, by instruction index;
+	                             CONST_UNDEF if not reached, varying if the stack is empty */
+} ConstProp;
+
+int propagate_constants(ClassFile* classFile, Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, ConstProp* cp);
+
+/* Value on top of the stack after the instruction at pc executes */
+#define constant_after(cp, decoded, pc) ((cp)->top + instruction_index(decoded, pc))
+
+#endif
@@ -2,27 +2,129 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "classfile.h"
 #include "bytecode.h"
 #include "util.h"
 #include "utf8.h"
+#include "stats.h"
+#include "sources.h"
+#include "keycache.h"
+#include "cfg.h"
+#include "constprop.h"
+
+#define MAX_KEY_LENGTH 128
+
+#define DECRYPTOR_DESCRIPTOR "([C)Ljava/lang/String;"
+
+/* States of the decryptor call matcher in find_xor_key_in_method */
+#define MATCH_NONE 0
+#define MATCH_LOAD 1 /* aload or ldc */
+#define MATCH_PUSH 2 /* load, int constant */
+#define MATCH_LDC  3 /* load, int constant, ldc */
+#define MATCH_CALL 4 /* load, [int constant, ldc,] invokestatic */
+#define MATCH_DONE 5 /* ... invokestatic */
+
+/* Number of characters decoded and decrypted at a time */
+#define DECODE_BLOCK 256
+
+typedef struct
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+} TextBuffer;
+
+int xorcrypt(uint32_t* buf, int length, unsigned char* key, int keylen, int* keyoffset);
+void decrypt_string(TextBuffer* text, const char* string, int length, unsigned char* key, int keylen);
+uint8_t find_xor_byte(DecodedCode* decoded, ControlFlowGraph* cfg, ConstProp* cp, uint32_t start_pc, FILE* err);
+int find_xor_key_in_method(ClassFile* classFile, Attribute* codeAttribute, unsigned char* key, int recursive, FILE* err);
+int find_xor_method(ClassFile* classFile, uint16_t methodIndex, unsigned char* key, FILE* err);
+int find_xor_key(ClassFile* classFile, unsigned char* key, FILE* err);
+void dexor_class(ClassSources* sources, ClassSource* source, SourceReader* reader, TextBuffer* text, FILE* out, FILE* err);
 
-void xorcrypt(uint32_t* buf, int length, unsigned char* key, int keylen);
-uint8_t find_xor_byte(Attribute* codeAttribute, uint32_t start_pc);
-int find_xor_key_in_method(ClassFile* classFile, Attribute* codeAttribute, unsigned char* key, int recursive);
-int find_xor_method(ClassFile* classFile, Attribute* codeAttribute, uint32_t pc, unsigned char* key);
-int find_xor_key(ClassFile* classFile, unsigned char* key);
 
 static int verbose = 0;
+static int output_as_java_array = 0;
+static KeyCache key_cache;
+
+static int has_replacement_char(const uint32_t* buf, int length)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	const __m128i replacement = _mm_set1_epi32(0xFFFD);
+	__m128i any = _mm_setzero_si128();
+
+	for ( ; i + 4 <= length; i += 4)
+		any = _mm_or_si128(any, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(buf + i)), replacement));
+
+	if (_mm_movemask_epi8(any))
+		return 1;
+#endif
+
+	for ( ; i < length; i += 1)
+		if (buf[i] == 0xFFFD)
+			return 1;
+
+	return 0;
+}
+
+static int xorcrypt_fast(uint32_t* buf, int length, unsigned char* key, int keylen, int k)
+{
+	/* The key widened to 32 bits and extended by three entries, so that
+		any four consecutive key characters can be loaded in one go. */
+	uint32_t wkey[MAX_KEY_LENGTH + 3];
+	int i;
+
+	for (i = 0; i < keylen + 3; i += 1)
+		wkey[i] = key[i % keylen];
+
+	i = 0;
+
+#ifdef __SSE2__
+	for ( ; i + 4 <= length; i += 4)
+	{
+		__m128i data = _mm_loadu_si128((const __m128i*)(buf + i));
+		__m128i mask = _mm_loadu_si128((const __m128i*)(wkey + k));
+		_mm_storeu_si128((__m128i*)(buf + i), _mm_xor_si128(data, mask));
+
+		for (k += 4; k >= keylen; k -= keylen)
+			;
+	}
+#endif
+
+	for ( ; i < length; i += 1)
+	{
+		buf[i] ^= wkey[k];
+		if (++k == keylen)
+			k = 0;
+	}
+
+	return k;
+}
 
-void xorcrypt(uint32_t* buf, int length, unsigned char* key, int keylen)
+/* Decrypts length characters in place, starting at key offset *keyoffset,
+	and returns the number of characters left (a replacement pair turns
+	into a single character). buf must have room for a terminator. */
+int xorcrypt(uint32_t* buf, int length, unsigned char* key, int keylen, int* keyoffset)
 {
 	uint32_t *in, *out, *endptr = buf + length;
-	int k;
+	int k = *keyoffset;
 
+	if (!has_replacement_char(buf, length))
+	{
+		*keyoffset = xorcrypt_fast(buf, length, key, keylen, k);
+		buf[length] = L'\0';
+		return length;
+	}
+
+	buf[length] = L'\0';
 	in = out = buf;
-	k = 0;
 	while (in < endptr)
 	{
 		if (in[0] == 0xFFFD && in[1] == 0xFFFD)
@@ -41,183 +143,346 @@ void xorcrypt(uint32_t* buf, int length, unsigned char* key, int keylen)
 	}
 
 	*out = L'\0';
+	*keyoffset = k;
+	return out - buf;
+}
+
+static void text_reserve(TextBuffer* text, size_t length)
+{
+	if (text->length + length > text->capacity)
+	{
+		text->capacity = (text->length + length) * 2;
+		text->data = realloc(text->data, text->capacity);
+	}
+}
+
+static void escape_chars(TextBuffer* text, const uint32_t* buf, int length)
+{
+	uint32_t ch;
+	char* q;
+	int i;
+
+	/* Worst case is a surrogate pair, escaped as two \uXXXX sequences */
+	text_reserve(text, length * 12);
+	q = text->data + text->length;
+
+	for (i = 0; i < length; i += 1)
+	{
+		ch = buf[i];
+		if (ch == L'\\')
+			*q++ = '\\', *q++ = '\\';
+		else if (ch == L'\t')
+			*q++ = '\\', *q++ = 't';
+		else if (ch == L'\n')
+			*q++ = '\\', *q++ = 'n';
+		else if (ch == L'\r')
+			*q++ = '\\', *q++ = 'r';
+		else if (ch == L'"')
+			*q++ = '\\', *q++ = '"';
+		else if (ch < 0x0020 || (ch >= 0x007f && ch <= 0xffff))
+			q += sprintf(q, "\\u%04x", ch);
+		else if (ch > 0xffff)
+			q += sprintf(q, "\\u%04x\\u%04x", 0xD800 + ((ch - 0x10000) >> 10), 0xDC00 + ((ch - 0x10000) & 0x3FF));
+		else
+			*q++ = ch;
+	}
+
+	text->length = q - text->data;
 }
 
-uint8_t find_xor_byte(Attribute* codeAttribute, uint32_t start_pc)
+/* Decodes Modified UTF-8, decrypts and escapes the result into text, one
+	block of characters at a time, without limits on the string length. */
+void decrypt_string(TextBuffer* text, const char* string, int length, unsigned char* key, int keylen)
 {
-	uint32_t pc, size;
-	Instruction ins;
+	uint32_t block[DECODE_BLOCK + 1];
+	const unsigned char *p = (const unsigned char*)string, *end = p + length;
+	int n = 0, keep, nb, keyoffset = 0;
+
+	text->length = 0;
 
-	for (pc = start_pc; pc < codeAttribute->code.code_length; )
+	for (;;)
 	{
-		size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
+		if (p < end && n < DECODE_BLOCK)
+		{
+			nb = u8_seqlen((char*)p) - 1;
+			if (p + nb >= end)
+				p = end; /* truncated sequence */
+			else if (nb == 1)
+				block[n++] = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F), p += 2;
+			else if (nb == 2)
+				block[n++] = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F), p += 3;
+			else if (nb == 3)
+				block[n++] = ((p[0] & 0x07) << 18) | ((p[1] & 0x3F) << 12) | ((p[2] & 0x3F) << 6) | (p[3] & 0x3F), p += 4;
+			else
+				block[n++] = *p++;
+			continue;
+		}
+
+		if (n == 0)
+			break;
+
+		/* A run of replacement chars at the end of a full block may
+			continue in the next one, so hold it back unless the whole
+			block is such a run; in that case only an odd one out waits. */
+		keep = 0;
+		if (p < end)
+		{
+			while (keep < n && block[n - 1 - keep] == 0xFFFD)
+				keep += 1;
+			if (keep == n)
+				keep = n % 2;
+		}
+
+		escape_chars(text, block, xorcrypt(block, n - keep, key, keylen, &keyoffset));
 
-		if (ins.opcode >= OP_ICONST_0 && ins.opcode <= OP_ICONST_5)
-			return ins.opcode - OP_ICONST_0;
-		if (ins.opcode == OP_BIPUSH)
-			return ins.uint8;
+		for (n = 0; n < keep; n += 1)
+			block[n] = 0xFFFD;
+	}
+}
+
+/*
+	The key byte of a switch case is what the case leaves on the stack for
+	the xor it jumps (or falls through) to: the value after the last
+	instruction of its block, not counting the goto. Without propagated
+	constants (code that can't be analysed), or when the case stores the
+	byte in a local instead (k = 0x11; break;), falls back to the first int
+	literal from the case on.
+*/
+uint8_t find_xor_byte(DecodedCode* decoded, ControlFlowGraph* cfg, ConstProp* cp, uint32_t start_pc, FILE* err)
+{
+	Instruction* ins;
+	BasicBlock* block;
+	int32_t i;
+	uint32_t last;
+
+	i = instruction_index(decoded, start_pc);
+	if (i < 0)
+	{
+		fprintf(err, "No instruction at %d!\n", start_pc);
+		return 0;
+	}
+
+	if (cp != NULL)
+	{
+		block = cfg->blocks + cfg->block_of[i];
+		last = block->first + block->count - 1;
+		ins = decoded->instructions + last;
+		if (last > block->first && (ins->opcode == OP_GOTO || ins->opcode == OP_GOTO_W))
+			last -= 1;
+
+		if (cp->top[last].kind == CONST_INT)
+			return cp->top[last].value & 0xFF;
+	}
+
+	for (ins = decoded->instructions + i; i < decoded->count; i += 1, ins += 1)
+	{
+		if (ins->opcode >= OP_ICONST_0 && ins->opcode <= OP_ICONST_5)
+			return ins->opcode - OP_ICONST_0;
+		if (ins->opcode == OP_BIPUSH)
+			return ins->uint8;
 		// does this happen?
-		if (ins.opcode == OP_SIPUSH)
-			return ins.uint16 & 0xFF;
-		pc += size;
+		if (ins->opcode == OP_SIPUSH)
+			return ins->uint16 & 0xFF;
 	}
 
-	fprintf(stderr, "No bipush found at %d!", start_pc);
+	fprintf(err, "No bipush found at %d!\n", start_pc);
 	return 0;
 }
 
-int find_xor_key_in_method(ClassFile* classFile, Attribute* codeAttribute, unsigned char* key, int recursive)
+static int next_match_state(int state, uint8_t opcode)
+{
+	int is_load, is_push;
+
+	// aload_0
+	// { iconst_0-5 bipush 6-127 sipush 127-32767 }
+	// * { ldc, ldc_w }
+	// * invokestatic #175 // char[] com.whatsapp.App.z(java.lang.String param0)
+	// * invokestatic #178 // java.lang.String com.whatsapp.App.z(char[] param0)
+	// aastore
+
+	is_load  = opcode == OP_ALOAD;
+	is_load |= opcode >= OP_ALOAD_0 && opcode <= OP_ALOAD_3;
+	is_load |= opcode == OP_LDC || opcode == OP_LDC_W;
+
+	is_push  = opcode >= OP_ICONST_0 && opcode <= OP_ICONST_5;
+	is_push |= opcode == OP_BIPUSH || opcode == OP_SIPUSH;
+
+	switch (state)
+	{
+		case MATCH_LOAD:
+			if (opcode == OP_INVOKESTATIC)
+				return MATCH_CALL;
+			if (is_push)
+				return MATCH_PUSH;
+			break;
+
+		case MATCH_PUSH:
+			if (opcode == OP_LDC || opcode == OP_LDC_W)
+				return MATCH_LDC;
+			break;
+
+		case MATCH_LDC:
+			if (opcode == OP_INVOKESTATIC)
+				return MATCH_CALL;
+			break;
+
+		case MATCH_CALL:
+			if (opcode == OP_INVOKESTATIC)
+				return MATCH_DONE;
+			break;
+	}
+
+	return is_load ? MATCH_LOAD : MATCH_NONE;
+}
+
+int find_xor_key_in_method(ClassFile* classFile, Attribute* codeAttribute, unsigned char* key, int recursive, FILE* err)
 {
-	uint32_t pc, size;
-	Instruction ins;
-	int i, is_load;
+	DecodedCode decoded;
+	ControlFlowGraph cfg;
+	ConstProp constants, *cp = NULL;
+	Arena arena;
+	Instruction* ins;
+	uint64_t fingerprint;
+	uint32_t i, pc;
+	int j, state = MATCH_NONE, keylen = 0;
+
+	decode_code(codeAttribute, &decoded);
+
+	fingerprint = fingerprint_code(classFile, &decoded);
+	if ((keylen = lookup_key(&key_cache, fingerprint, key)) > 0)
+	{
+		if (verbose > 1)
+			fprintf(err, "Found key for fingerprint %016llx in cache\n", (unsigned long long)fingerprint);
+		free_decoded_code(&decoded);
+		return keylen;
+	}
 
-	for (pc = 0; pc < codeAttribute->code.code_length; )
+	for (i = 0, ins = decoded.instructions; i < decoded.count && keylen == 0; i += 1, ins += 1)
 	{
-		size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
+		pc = decoded.pcs[i];
 
-		if (ins.opcode == OP_TABLESWITCH && ins.low == 0)
+		if (ins->opcode == OP_TABLESWITCH && ins->low == 0)
 		{
 			if (verbose > 1)
-				fprintf(stderr, "Found tableswitch at %d, cases %d - %d\n", pc, ins.low, ins.high);
+				fprintf(err, "Found tableswitch at %d, cases %d - %d\n", pc, ins->low, ins->high);
 
-			if (ins.high > 10)
+			if (ins->high > 10)
 			{
 				if (verbose > 1)
-					fprintf(stderr, "  Discarding, too many cases\n");
+					fprintf(err, "  Discarding, too many cases\n");
 			}
 			else
 			{
-				for (i = 0; i <= ins.high - ins.low; i += 1)
-					key[i] = find_xor_byte(codeAttribute, pc + ins.branchoffsets[i]);
-				key[i] = find_xor_byte(codeAttribute, pc + ins.defaultoffset);
-				return i + 1;
+				/* Key bytes may be computed, so evaluate the method rather
+					than look for literals */
+				build_cfg(codeAttribute, &decoded, &cfg);
+				init_arena(&arena, 16 * 1024);
+				if (propagate_constants(classFile, codeAttribute, &decoded, &cfg, &arena, &constants))
+					cp = &constants;
+				else if (verbose > 1)
+					fprintf(err, "  Unable to propagate constants, looking for literals\n");
+
+				for (j = 0; j <= ins->high - ins->low; j += 1)
+					key[j] = find_xor_byte(&decoded, &cfg, cp, pc + ins->branchoffsets[j], err);
+				key[j] = find_xor_byte(&decoded, &cfg, cp, pc + ins->defaultoffset, err);
+				keylen = j + 1;
+
+				free_arena(&arena);
+				free_cfg(&cfg);
+
+				/* Only keys found in this method; one found by following
+					a call depends on more than this method's fingerprint */
+				store_key(&key_cache, fingerprint, key, keylen);
+				break;
 			}
 		}
 
 		if (recursive)
 		{
-			is_load  = ins.opcode == OP_ALOAD;
-			is_load |= ins.opcode >= OP_ALOAD_0 && ins.opcode <= OP_ALOAD_3;
-			is_load |= ins.opcode == OP_LDC || ins.opcode == OP_LDC_W;
-			if (is_load && (i = find_xor_method(classFile, codeAttribute, pc + size, key)) > 0)
-				return i;
+			state = next_match_state(state, ins->opcode);
+			if (state == MATCH_DONE)
+				keylen = find_xor_method(classFile, ins->constant, key, err);
 		}
-
-		pc += size;
 	}
 
-	return 0;
+	free_decoded_code(&decoded);
+	return keylen;
 }
 
-int find_xor_method(ClassFile* classFile, Attribute* codeAttribute, uint32_t pc, unsigned char* key)
+int find_xor_method(ClassFile* classFile, uint16_t methodIndex, unsigned char* key, FILE* err)
 {
-	uint32_t size;
-	Instruction ins;
 	Constant *methodRef, *typedesc, *descriptor;
+	Attribute* codeAttribute;
 	Method* method;
-	TypeDescriptor methodType;
-	int i, keylen;
-
-    // aload_0
-    // { iconst_0-5 bipush 6-127 sipush 127-32767 }
-    // * { ldc, ldc_w }
-    // * invokestatic #175 // char[] com.whatsapp.App.z(java.lang.String param0)
-    // * invokestatic #178 // java.lang.String com.whatsapp.App.z(char[] param0)
-    // aastore
-
-	size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
-	pc += size;
 
-	if (ins.opcode != OP_INVOKESTATIC)
-	{
-		if ((ins.opcode < OP_ICONST_0 || ins.opcode > OP_ICONST_5) && ins.opcode != OP_BIPUSH && ins.opcode != OP_SIPUSH)
-			return 0;
-
-		size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
-		pc += size;
-
-		if (ins.opcode != OP_LDC && ins.opcode != OP_LDC_W)
-			return 0;
-
-		size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
-		pc += size;
-
-		if (ins.opcode != OP_INVOKESTATIC)
-			return 0;
-	}
-
-	size = get_single_instruction(codeAttribute->code.code + pc, &ins, pc);
-	pc += size;
-
-	if (ins.opcode != OP_INVOKESTATIC)
-		return 0;
-
-	methodRef = find_constant(classFile, ins.constant);
+	methodRef = find_constant(classFile, methodIndex);
 	if (methodRef == NULL)
 	{
-		fprintf(stderr, "Unable to find method (#%d)\n", ins.constant);
+		fprintf(err, "Unable to find method (#%d)\n", methodIndex);
 		return 0;
 	}
 
 	typedesc = find_constant(classFile, methodRef->typedescref);
 	if (typedesc == NULL)
 	{
-		fprintf(stderr, "Unable to find typedesc (#%d)\n", methodRef->typedescref);
+		fprintf(err, "Unable to find typedesc (#%d)\n", methodRef->typedescref);
 		return 0;
 	}
 
 	descriptor = find_constant(classFile, typedesc->typeref);
 	if (descriptor == NULL)
 	{
-		fprintf(stderr, "Unable to find descriptor (#%d)\n", typedesc->typeref);
+		fprintf(err, "Unable to find descriptor (#%d)\n", typedesc->typeref);
 		return 0;
 	}
 
-	if (parse_type_descriptor(descriptor->buffer, &methodType) == NULL)
+	// The decryptor is java.lang.String z(char[])
+	if (strcmp(descriptor->buffer, DECRYPTOR_DESCRIPTOR) != 0)
+		return 0;
+
+	if (verbose > 1)
+		fprintf(err, "Looking for method with name #%hd and descriptor #%hd\n", typedesc->nameref, typedesc->typeref);
+
+	method = find_method_by_index(classFile, typedesc->nameref, typedesc->typeref);
+	if (method == NULL)
 	{
-		fprintf(stderr, "Unable to parse method type descriptor (%s)\n", descriptor->buffer);
+		fprintf(err, "Method (name: #%hd, descriptor: #%hd) not found in class!\n", typedesc->nameref, typedesc->typeref);
 		return 0;
 	}
 
-	if (methodType.type == TYPE_METHOD && strcmp(methodType.returnType->name, "java.lang.String") == 0 &&
-		methodType.param_count == 1 && methodType.params[0].type == TYPE_ARRAY &&
-		strcmp(methodType.params[0].elementType->name, "char") == 0)
+	codeAttribute = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+	if (codeAttribute == NULL)
 	{
-		if (verbose > 1)
-			fprintf(stderr, "Looking for method with name #%hd and descriptor #%hd\n", methodRef->nameref, methodRef->typedescref);
+		sprintf((char*)key, "Method has no " ATT_NAME_CODE " attribute (name: #%hd, descriptor: #%hd)", typedesc->nameref, typedesc->typeref);
+		return 0;
+	}
 
-		for (i = 0, method = classFile->methods; i < classFile->method_count; i += 1, method += 1)
-		{
-			if (method->name_index == typedesc->nameref && method->descriptor_index == typedesc->typeref)
-				break;
-		}
+	return find_xor_key_in_method(classFile, codeAttribute, key, 0, err);
+}
 
-		if (i >= classFile->method_count)
-		{
-			fprintf(stderr, "Method (name: #%hd, descriptor: #%hd) not found in class!\n", methodRef->nameref, methodRef->typedescref);
-			return 0;
-		}
+static int is_decryptor(ClassFile* classFile, Method* method)
+{
+	Constant* descriptor = find_constant(classFile, method->descriptor_index);
+	return descriptor != NULL && descriptor->tag == TAG_STRING && strcmp(descriptor->buffer, DECRYPTOR_DESCRIPTOR) == 0;
+}
 
-		if (codeAttribute == NULL)
-		{
-			sprintf((char*)key, "Method has no " ATT_NAME_CODE " attribute (name: #%hd, descriptor: #%hd)", methodRef->nameref, methodRef->typedescref);
-			return 0;
-		}
+static int find_cached_key(ClassFile* classFile, Attribute* codeAttribute, unsigned char* key, FILE* err)
+{
+	DecodedCode decoded;
+	uint64_t fingerprint;
+	int keylen;
 
-		codeAttribute = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
-		keylen = find_xor_key_in_method(classFile, codeAttribute, key, 0);
-	}
-	else
-	{
-		keylen = 0;
-	}
+	decode_code(codeAttribute, &decoded);
+	fingerprint = fingerprint_code(classFile, &decoded);
+	free_decoded_code(&decoded);
+
+	if ((keylen = lookup_key(&key_cache, fingerprint, key)) > 0 && verbose > 1)
+		fprintf(err, "Found key for fingerprint %016llx in cache\n", (unsigned long long)fingerprint);
 
-	free_type_descriptor(&methodType);
 	return keylen;
 }
 
-int find_xor_key(ClassFile* classFile, unsigned char* key)
+int find_xor_key(ClassFile* classFile, unsigned char* key, FILE* err)
 {
 	// 1. Find <clinit> method
 	// 2. Find tableswitch, either in <clinit> itself or in static method String[] z(char[] param0)
@@ -227,18 +492,22 @@ int find_xor_key(ClassFile* classFile, unsigned char* key)
 	// 5. Profit!
 
 	Method* method;
-	Constant* name;
 	Attribute* codeAttribute;
 	int i, keylen;
 
+	/* A decryptor method seen in an earlier class saves searching <clinit> */
 	for (i = 0, method = classFile->methods; i < classFile->method_count; i += 1, method += 1)
 	{
-		name = find_constant(classFile, method->name_index);
-		if (strcmp(name->buffer, "<clinit>") == 0)
-			break;
+		if (!(method->access_flags & ACC_STATIC) || !is_decryptor(classFile, method))
+			continue;
+
+		codeAttribute = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+		if (codeAttribute != NULL && (keylen = find_cached_key(classFile, codeAttribute, key, err)) > 0)
+			return keylen;
 	}
 
-	if (i >= classFile->method_count)
+	method = find_method(classFile, "<clinit>", NULL);
+	if (method == NULL)
 	{
 		strcpy((char*)key, "no static initializer");
 		return 0;
@@ -251,124 +520,202 @@ int find_xor_key(ClassFile* classFile, unsigned char* key)
 		return 0;
 	}
 
-	if ((keylen = find_xor_key_in_method(classFile, codeAttribute, key, 1)) > 0)
+	if ((keylen = find_xor_key_in_method(classFile, codeAttribute, key, 1, err)) > 0)
 		return keylen;
 
 	strcpy((char*)key, "no usable tableswitch found");
 	return 0;
 }
 
-int main(int argc, char** argv)
+void dexor_class(ClassSources* sources, ClassSource* source, SourceReader* reader, TextBuffer* text, FILE* out, FILE* err)
 {
-	int i, j, k, length, keylen, opt;
+	int j, k, keylen, phase;
 	ClassFile *classFile;
 	Constant *classRef, *className, *c, *string;
-	unsigned char key[128];
+	unsigned char key[MAX_KEY_LENGTH];
 	char classNameString[255];
-	uint32_t wbuffer[1024];
-
-	int output_as_java_array = 0;
 
-	while ((opt = getopt(argc, argv, "vhj")) != -1)
+	classFile = read_class_source(sources, source, reader, err);
+	if (classFile == NULL)
 	{
-		switch (opt)
-		{
-			case 'v':
-				verbose += 1;
-				break;
+		fprintf(err, "%s: Unable to read class file\n", source->name);
+		return;
+	}
 
-			case 'j':
-				output_as_java_array = 1;
-				break;
+	classRef = find_constant(classFile, classFile->this_class);
+	className = find_constant(classFile, classRef->ref);
 
-			case 'h':
-			case '?':
-				printf("Usage: %s [options] CLASSFILE...\n"
-					"options:\n"
-					"  -v  increase verbosity (can be specified multiple times)\n"
-					"  -j  output strings as Java array\n"
-					"", argv[0]);
-				return optopt ? 1 : 0;
-		}
-	}
+	strcpy(classNameString, class_name_from_internal(className->buffer));
 
-	for (i = optind; i < argc; i += 1)
+	key[0] = '\0';
+	phase = STATS_PHASE(PHASE_KEYSEARCH);
+	keylen = find_xor_key(classFile, key, err);
+	STATS_PHASE(PHASE_FORMAT);
+
+	if (keylen == 0)
 	{
-		classFile = read_class_file(argv[i]);
-		if (classFile == NULL)
+		fprintf(err, "%s: Unable to find XOR key (%s)\n", classNameString, key);
+	}
+	else
+	{
+		if (verbose)
 		{
-			fprintf(stderr, "%s: Unable to read class file\n", argv[i]);
-			continue;
-		}
+			if (output_as_java_array)
+				fprintf(out, "// ");
 
-		classRef = find_constant(classFile, classFile->this_class);
-		className = find_constant(classFile, classRef->ref);
+			fprintf(out, "%s  key: ", classNameString);
+			for (j = 0; j < keylen; j += 1)
+				fprintf(out, "%02x ", key[j]);
+			fprintf(out, "\n");
+		}
 
-		strcpy(classNameString, class_name_from_internal(className->buffer));
+		if (output_as_java_array)
+			fprintf(out, "private static final String[] z = new String[] {\n");
 
-		key[0] = '\0';
-		if ((keylen = find_xor_key(classFile, key)) == 0)
+		for (c = classFile->constants, j = k = 0; j < classFile->constant_count; j += 1, c += 1)
 		{
-			fprintf(stderr, "%s: Unable to find XOR key (%s)\n", classNameString, key);
-		}
-		else
-		{
-			if (verbose)
+			if (c->tag != TAG_STRINGREF)
+				continue;
+
+			string = find_constant(classFile, c->ref);
+			if (string == NULL || string->tag != TAG_STRING)
+				continue;
+
+			if (verbose > 1)
 			{
 				if (output_as_java_array)
-					printf("// ");
+					fprintf(out, "// ");
 
-				printf("%s  key: ", classNameString);
-				for (j = 0; j < keylen; j += 1)
-					printf("%02x ", key[j]);
-				printf("\n");
+				fprintf(out, "%s  raw: ", classNameString);
+				print_string(out, string->buffer);
+				fprintf(out, "\n");
 			}
 
-			if (output_as_java_array)
-				printf("private static final String[] z = new String[] {\n");
+			decrypt_string(text, string->buffer, string->length, key, keylen);
 
-			for (c = classFile->constants, j = k = 0; j < classFile->constant_count; j += 1, c += 1)
+			if (output_as_java_array)
+			{
+				fprintf(out, "\t/* %2d */ \"", k);
+				fwrite(text->data, sizeof(char), text->length, out);
+				fprintf(out, "\",\n");
+			}
+			else
 			{
-				if (c->tag != TAG_STRINGREF)
-					continue;
+				fprintf(out, "%s %4d: ", classNameString, c->index);
+				fwrite(text->data, sizeof(char), text->length, out);
+				fprintf(out, "\n");
+			}
 
-				string = find_constant(classFile, c->ref);
-				length = u8_toucs(wbuffer, sizeof(wbuffer) / sizeof(wbuffer[0]), string->buffer, string->length + 1);
+			k += 1;
+		}
 
-				if (verbose > 1)
-				{
-					if (output_as_java_array)
-						printf("// ");
+		if (output_as_java_array)
+			fprintf(out, "};\n\n");
+	}
 
-					printf("%s  raw: ", classNameString);
-					print_string(stdout, string->buffer);
-					printf("\n");
-				}
+	STATS_PHASE(phase);
+	free_class(classFile);
+}
 
-				xorcrypt(wbuffer, length - 1, key, keylen);
+static void dexor_source(ClassSources* sources, ClassSource* source, SourceReader* reader, void* scratch, void* context, FILE* out, FILE* err)
+{
+	dexor_class(sources, source, reader, scratch, out, err);
+}
 
-				if (output_as_java_array)
+static void free_text(void* scratch)
+{
+	free(((TextBuffer*)scratch)->data);
+}
+
+int main(int argc, char** argv)
+{
+	int i, opt, workers = 1;
+	const char* key_cache_file = NULL;
+	ClassSources sources;
+
+	static struct option long_options[] = {
+		{ "stats", optional_argument, NULL, 'S' },
+		{ "key-cache", required_argument, NULL, 'k' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "vhjt:k:", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'S':
+				if (optarg == NULL)
+					stats_enable(STATS_TEXT);
+				else if (strcmp(optarg, "json") == 0)
+					stats_enable(STATS_JSON);
+				else
 				{
-					printf("\t/* %2d */ \"", k);
-					print_string_w(stdout, wbuffer);
-					printf("\",\n");
+					fprintf(stderr, "%s: unknown statistics format '%s'\n", argv[0], optarg);
+					return 1;
 				}
-				else
+				break;
+
+			case 'v':
+				verbose += 1;
+				break;
+
+			case 'j':
+				output_as_java_array = 1;
+				break;
+
+			case 't':
+				workers = atoi(optarg);
+				if (workers < 1)
 				{
-					printf("%s %4d: ", classNameString, c->index);
-					print_string_w(stdout, wbuffer);
-					printf("\n");
+					fprintf(stderr, "%s: invalid number of workers '%s'\n", argv[0], optarg);
+					return 1;
 				}
+				break;
 
-				k += 1;
-			}
+			case 'k':
+				key_cache_file = optarg;
+				break;
 
-			if (output_as_java_array)
-				printf("};\n\n");
+			case 'h':
+			case '?':
+				printf("Usage: %s [options] PATH...\n"
+					"PATH is a class file, a jar/zip archive or a directory containing either\n"
+					"options:\n"
+					"  -v    increase verbosity (can be specified multiple times)\n"
+					"  -j    output strings as Java array\n"
+					"  -t N  process classes with N worker threads (default: 1)\n"
+					"  -k FILE, --key-cache=FILE\n"
+					"        load known keys from FILE, and save them back at exit\n"
+					"  --stats[=json]\n"
+					"        print counters and phase timings to stderr at exit\n"
+					"", argv[0]);
+				return optopt ? 1 : 0;
 		}
+	}
 
-		free_class(classFile);
+	init_key_cache(&key_cache);
+	if (key_cache_file != NULL && !load_key_cache(&key_cache, key_cache_file))
+		return 1;
+
+	memset(&sources, 0, sizeof(sources));
+	for (i = optind; i < argc; i += 1)
+		add_class_sources(&sources, argv[i]);
+
+	if (workers > 1)
+	{
+		/* The counters are not synchronized */
+		if (stats_enabled)
+			fprintf(stderr, "%s: --stats is ignored with -t\n", argv[0]);
+		stats_enable(STATS_NONE);
 	}
 
+	process_class_sources(&sources, workers, dexor_source, NULL, sizeof(TextBuffer), free_text);
+	free_class_sources(&sources);
+
+	if (key_cache_file != NULL)
+		save_key_cache(&key_cache, key_cache_file);
+	free_key_cache(&key_cache);
+
+	print_stats(stderr);
 	return 0;
-}
\ No newline at end of file
+}
@@ -2,40 +2,46 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
 
 #include "classfile.h"
 #include "bytecode.h"
 #include "util.h"
+#include "server.h"
+#include "stats.h"
+#include "export.h"
+#include "javap.h"
 
-void disassemble(const char* filename)
+/* dump_code_attribute_ex flags for the text output */
+static int dump_flags = 0;
+
+/* javap_class_ex flags for the javap output */
+static int javap_flags = 0;
+
+void disassemble_class(FILE* fp, ClassFile* classFile, const char* filename)
 {
-	ClassFile* classFile;
 	int i;
 	Constant *p, *ref, *className, *name, *descriptor;
 	Method* method;
 	Field* field;
 	Attribute* codeAttribute;
-	char buffer[1024], constantInfo[10], *dot, localClassName[128];
-
-	classFile = read_class_file(filename);
-	if (classFile == NULL)
-	{
-		fprintf(stderr, "Unable to read class file: '%s'\n", filename);
-		return;
-	}
+	char buffer[1024], constantInfo[24], *dot, localClassName[128];
 
 	ref = find_constant(classFile, classFile->this_class);
 	className = find_constant(classFile, ref->ref);
 
-	fprintf(stdout, "/*\n    Filename: %s\n    Class %s\n*/\n", filename, class_name_from_internal(className->buffer));
+	fprintf(fp, "/*\n    Filename: %s\n    Class %s\n*/\n", filename, class_name_from_internal(className->buffer));
 
-	fprintf(stdout, "/*\n    Constant Pool\n\n");
+	fprintf(fp, "/*\n    Constant Pool\n\n");
 	for (p = classFile->constants, i = 0; i < classFile->constant_count; i += 1, p += 1)
 	{
 		switch (p->tag)
 		{
 			case TAG_CLASSREF:
 			case TAG_STRINGREF:
+			case TAG_METHODTYPE:
+			case TAG_MODULE:
+			case TAG_PACKAGE:
 				sprintf(constantInfo, "#%hd", p->ref);
 				break;
 
@@ -45,22 +51,31 @@ void disassemble(const char* filename)
 				sprintf(constantInfo, "#%hd, #%hd", p->classref, p->typedescref);
 				break;
 
+			case TAG_DYNAMIC:
+			case TAG_INVOKEDYNAMIC:
+				sprintf(constantInfo, "%hd, #%hd", p->bootstrap, p->typedescref);
+				break;
+
 			case TAG_TYPEDESC:
 				sprintf(constantInfo, "#%hd, #%hd", p->nameref, p->typeref);
 				break;
 
+			case TAG_METHODHANDLE:
+				sprintf(constantInfo, "%hhu, #%hd", p->refkind, p->handleref);
+				break;
+
 			default:
 				strcpy(constantInfo, "");
 		}
 
-		fprintf(stdout, "    %3d: %-9s %-10s %s\n", p->index, ConstantTypes[p->tag].name, 
+		fprintf(fp, "    %3d: %-9s %-10s %s\n", p->index, ConstantTypes[p->tag].name, 
 			constantInfo, constant_to_string_r(classFile, p, buffer));
 	}
-	fprintf(stdout, "*/\n");
-	fprintf(stdout, "\n");
+	fprintf(fp, "*/\n");
+	fprintf(fp, "\n");
 
-	fprintf(stdout, "%s class ", access_flags_to_string(classFile->access_flags));
-	fprintf(stdout, "%s ", class_name_from_internal(className->buffer));
+	fprintf(fp, "%s class ", access_flags_to_string(classFile->access_flags));
+	fprintf(fp, "%s ", class_name_from_internal(className->buffer));
 
 	dot = strrchr(class_name_from_internal(className->buffer), '.');
 	strcpy(localClassName, dot ? dot + 1 : class_name_from_internal(className->buffer));
@@ -69,74 +84,196 @@ void disassemble(const char* filename)
 	{
 		ref = find_constant(classFile, classFile->super_class);
 		name = find_constant(classFile, ref->ref);
-		fprintf(stdout, "extends %s", class_name_from_internal(name->buffer));
+		fprintf(fp, "extends %s", class_name_from_internal(name->buffer));
 	}
 
 	if (classFile->interface_count > 0)
 	{
-		fprintf(stdout, " implements");
+		fprintf(fp, " implements");
 		for (i = 0; i < classFile->interface_count; i += 1)
 		{
 			ref = find_constant(classFile, classFile->interfaces[i]);
 			name = find_constant(classFile, ref->ref);
-			fprintf(stdout, " %s", class_name_from_internal(name->buffer));
+			fprintf(fp, " %s", class_name_from_internal(name->buffer));
 		}
 	}
 
-	fprintf(stdout, "\n");
-	fprintf(stdout, "{\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "{\n");
 
 	for (i = 0, field = classFile->fields; i < classFile->field_count; i += 1, field += 1)
 	{
 		name = find_constant(classFile, field->name_index);
 		descriptor = find_constant(classFile, field->descriptor_index);
 		descriptor_to_string(descriptor->buffer, name->buffer, buffer);
-		fprintf(stdout, "    %s %s;\n", access_flags_to_string(field->access_flags), buffer);
+		fprintf(fp, "    %s %s;\n", access_flags_to_string(field->access_flags), buffer);
 	}
 
 	for (i = 0, method = classFile->methods; i < classFile->method_count; i += 1, method += 1)
 	{
-		fprintf(stdout, "\n");
+		fprintf(fp, "\n");
 
 		name = find_constant(classFile, method->name_index);
-		if (strcmp(name->buffer, "<clinit>") == 0)
+		if (method->special == METHOD_CLINIT)
 		{
 			// Static Class Initializer
-			fprintf(stdout, "    static\n");
+			fprintf(fp, "    static\n");
 		}
 		else
 		{
 			descriptor = find_constant(classFile, method->descriptor_index);
 
-			if (strcmp(name->buffer, "<init>") == 0) // Constructor
+			if (method->special == METHOD_INIT) // Constructor
 				descriptor_to_string_ex(descriptor->buffer, localClassName, buffer, FLAG_OMIT_RETURN_TYPE);
 			else
 				descriptor_to_string(descriptor->buffer, name->buffer, buffer);
 
-			fprintf(stdout, "    %s %s\n", access_flags_to_string(method->access_flags), buffer);
+			fprintf(fp, "    %s %s\n", access_flags_to_string(method->access_flags), buffer);
 		}
-		fprintf(stdout, "    {\n");
+		fprintf(fp, "    {\n");
 
 		codeAttribute = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
 		if (codeAttribute == NULL)
-			fprintf(stdout, "        /* No Code */\n");
+			fprintf(fp, "        /* No Code */\n");
 		else
-			dump_code_attribute(stdout, classFile, codeAttribute);
+			dump_code_attribute_ex(fp, classFile, codeAttribute, dump_flags);
 
-		fprintf(stdout, "    }\n");
+		fprintf(fp, "    }\n");
+	}
+
+	fprintf(fp, "}\n");
+}
+
+static void javap_output(FILE* fp, ClassFile* classFile, const char* filename)
+{
+	javap_class_ex(fp, classFile, filename, javap_flags);
+}
+
+static ClassHandler output = disassemble_class;
+
+void disassemble(const char* filename)
+{
+	ClassFile* classFile;
+	int phase;
+
+	classFile = read_class_file(filename);
+	if (classFile == NULL)
+	{
+		fprintf(stderr, "Unable to read class file: '%s'\n", filename);
+		return;
 	}
 
-	fprintf(stdout, "}\n");
+	phase = STATS_PHASE(PHASE_FORMAT);
+	output(stdout, classFile, filename);
+	STATS_PHASE(phase);
 
 	free_class(classFile);
 }
 
 int main(int argc, char** argv)
 {
-	int i;
+	int i, opt, workers = 4;
+	const char* socket_path = NULL;
+
+	static struct option long_options[] = {
+		{ "stats", optional_argument, NULL, 'S' },
+		{ "stack", no_argument, NULL, 'K' },
+		{ "locals", no_argument, NULL, 'L' },
+		{ "frames", no_argument, NULL, 'F' },
+		{ "loops", no_argument, NULL, 'O' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	while ((opt = getopt_long(argc, argv, "f:ps:t:h", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+			case 'f':
+				if (strcmp(optarg, "text") == 0)
+					output = disassemble_class;
+				else if (strcmp(optarg, "json") == 0)
+					output = export_class_json;
+				else if (strcmp(optarg, "binary") == 0)
+					output = export_class_binary;
+				else if (strcmp(optarg, "javap") == 0)
+					output = javap_output;
+				else
+				{
+					fprintf(stderr, "%s: unknown output format '%s'\n", argv[0], optarg);
+					return 1;
+				}
+				break;
+
+			case 'S':
+				if (optarg == NULL)
+					stats_enable(STATS_TEXT);
+				else if (strcmp(optarg, "json") == 0)
+					stats_enable(STATS_JSON);
+				else
+				{
+					fprintf(stderr, "%s: unknown statistics format '%s'\n", argv[0], optarg);
+					return 1;
+				}
+				break;
+
+			case 'K':
+				dump_flags |= DUMP_STACK;
+				break;
+
+			case 'L':
+				dump_flags |= DUMP_LOCALS;
+				break;
+
+			case 'F':
+				dump_flags |= DUMP_FRAMES;
+				break;
+
+			case 'O':
+				dump_flags |= DUMP_LOOPS;
+				break;
+
+			case 'p':
+				javap_flags |= JAVAP_PRIVATE;
+				break;
+
+			case 's':
+				socket_path = optarg;
+				break;
+
+			case 't':
+				workers = atoi(optarg);
+				break;
+
+			case 'h':
+			case '?':
+				printf("Usage: %s [options] CLASSFILE...\n"
+					"options:\n"
+					"  -f FMT   output format: text (default), json (JSON Lines), binary\n"
+					"           or javap (the layout of javap -c -v)\n"
+					"  -p       also list private members in the javap output (javap -p)\n"
+					"  -s PATH  run as a server listening on the Unix socket PATH\n"
+					"  -t N     number of server worker threads (default: 4)\n"
+					"  --stack  annotate instructions with the operand stack (text output)\n"
+					"  --locals annotate instructions with live locals and def-use links (text output)\n"
+					"  --frames show the StackMapTable frames (text output)\n"
+					"  --loops  list each method's loops: header pc and nesting depth (text output)\n"
+					"  --stats[=json]\n"
+					"           print counters and phase timings to stderr at exit\n"
+					"", argv[0]);
+				return optopt ? 1 : 0;
+		}
+	}
+
+	if (socket_path != NULL)
+	{
+		/* The counters are not thread-safe */
+		stats_enable(STATS_NONE);
+		return run_server(socket_path, workers, output) ? 0 : 1;
+	}
 
-	for (i = 1; i < argc; i += 1)
+	for (i = optind; i < argc; i += 1)
 		disassemble(argv[i]);
 
+	print_stats(stderr);
 	return 0;
 }
\ No newline at end of file
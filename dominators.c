@@ -0,0 +1,278 @@
+#include <string.h>
+
+#include "dominators.h"
+
+/* Reverse postorder over successors, iterative so deep CFGs can't
+	overflow the stack */
+static void compute_rpo(ControlFlowGraph* cfg, Arena* arena, Dominators* dom)
+{
+	uint32_t *stack, *next, *postorder, top = 0, count = 0, b, s, i;
+	BasicBlock* block;
+
+	stack = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+	next = arena_calloc(arena, cfg->block_count, sizeof(uint32_t));
+	postorder = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+
+	for (b = 0; b < cfg->block_count; b += 1)
+		dom->rpo_index[b] = -1;
+
+	/* rpo_index doubles as the visited mark */
+	stack[top++] = 0;
+	dom->rpo_index[0] = 0;
+	while (top > 0)
+	{
+		b = stack[top - 1];
+		block = cfg->blocks + b;
+
+		if (next[b] < block->succ_count)
+		{
+			s = cfg->successors[block->succ_start + next[b]++];
+			if (dom->rpo_index[s] < 0)
+			{
+				dom->rpo_index[s] = 0;
+				stack[top++] = s;
+			}
+			continue;
+		}
+
+		postorder[count++] = b;
+		top -= 1;
+	}
+
+	dom->reachable_count = count;
+	for (i = 0; i < count; i += 1)
+	{
+		dom->rpo[i] = postorder[count - 1 - i];
+		dom->rpo_index[dom->rpo[i]] = i;
+	}
+}
+
+static int32_t intersect(Dominators* dom, int32_t a, int32_t b)
+{
+	while (a != b)
+	{
+		while (dom->rpo_index[a] > dom->rpo_index[b])
+			a = dom->idom[a];
+		while (dom->rpo_index[b] > dom->rpo_index[a])
+			b = dom->idom[b];
+	}
+	return a;
+}
+
+/* Numbers the dominator tree in preorder, so dominance is an interval test */
+static void number_tree(Dominators* dom, Arena* arena)
+{
+	uint32_t *first, *next_sibling, *stack, top = 0, counter = 0, i, b, c;
+
+	first = arena_alloc(arena, dom->block_count * sizeof(uint32_t));
+	next_sibling = arena_alloc(arena, dom->block_count * sizeof(uint32_t));
+	stack = arena_alloc(arena, dom->block_count * sizeof(uint32_t));
+
+	for (b = 0; b < dom->block_count; b += 1)
+	{
+		first[b] = UINT32_MAX;
+		dom->tree_enter[b] = dom->tree_exit[b] = 0;
+	}
+
+	/* Children lists; built backwards so they end up in rpo order */
+	for (i = dom->reachable_count; i-- > 1; )
+	{
+		b = dom->rpo[i];
+		next_sibling[b] = first[dom->idom[b]];
+		first[dom->idom[b]] = b;
+	}
+
+	/* Every node is pushed once; first[] is consumed as the iterator */
+	stack[top++] = dom->rpo[0];
+	dom->tree_enter[dom->rpo[0]] = counter++;
+	while (top > 0)
+	{
+		b = stack[top - 1];
+		if ((c = first[b]) != UINT32_MAX)
+		{
+			first[b] = next_sibling[c];
+			dom->tree_enter[c] = counter++;
+			stack[top++] = c;
+			continue;
+		}
+
+		dom->tree_exit[b] = counter;
+		top -= 1;
+	}
+}
+
+/*
+	Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm": the
+	iterative data flow solution over reverse postorder, with the
+	dominator sets represented by the idom tree itself. Converges in a
+	couple of passes for the reducible graphs javac produces.
+*/
+void compute_dominators(ControlFlowGraph* cfg, Arena* arena, Dominators* dom)
+{
+	BasicBlock* block;
+	uint32_t i, k, b;
+	int32_t p, idom;
+	int changed;
+
+	dom->block_count = cfg->block_count;
+	dom->reachable_count = 0;
+	dom->rpo = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+	dom->rpo_index = arena_alloc(arena, cfg->block_count * sizeof(int32_t));
+	dom->idom = arena_alloc(arena, cfg->block_count * sizeof(int32_t));
+	dom->tree_enter = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+	dom->tree_exit = arena_alloc(arena, cfg->block_count * sizeof(uint32_t));
+
+	if (cfg->block_count == 0)
+		return;
+
+	compute_rpo(cfg, arena, dom);
+
+	for (b = 0; b < cfg->block_count; b += 1)
+		dom->idom[b] = -1;
+	dom->idom[0] = 0;
+
+	do
+	{
+		changed = 0;
+		for (i = 1; i < dom->reachable_count; i += 1)
+		{
+			b = dom->rpo[i];
+			block = cfg->blocks + b;
+
+			idom = -1;
+			for (k = 0; k < block->pred_count; k += 1)
+			{
+				p = cfg->predecessors[block->pred_start + k];
+				if (dom->idom[p] < 0)
+					continue;
+				idom = idom < 0 ? p : intersect(dom, p, idom);
+			}
+
+			if (dom->idom[b] != idom)
+			{
+				dom->idom[b] = idom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	number_tree(dom, arena);
+	dom->idom[0] = -1;
+}
+
+/*
+	Natural loops: an edge n -> h where h dominates n is a back edge, and
+	the loop of h is every block that reaches n without passing h. Headers
+	are processed innermost first (reverse rpo), and a walk that runs into
+	a block of an already found loop jumps to the header of its outermost
+	enclosing loop, which becomes nested in the current one. Every block is
+	therefore claimed once, and loop bodies are never rescanned.
+*/
+void find_loops(ControlFlowGraph* cfg, Dominators* dom, Arena* arena, LoopForest* forest)
+{
+	uint32_t *worklist, top, i, k, b, h, n;
+	int32_t l, x;
+	BasicBlock* block;
+	Loop* loop;
+
+	forest->loop_count = 0;
+	forest->max_depth = 0;
+	forest->irreducible_edges = 0;
+	forest->loops = arena_alloc(arena, dom->reachable_count * sizeof(Loop) + 1);
+	forest->loop_of = arena_alloc(arena, cfg->block_count * sizeof(int32_t));
+	worklist = arena_alloc(arena, cfg->edge_count * sizeof(uint32_t) + 1);
+
+	for (b = 0; b < cfg->block_count; b += 1)
+		forest->loop_of[b] = -1;
+
+	for (i = dom->reachable_count; i-- > 0; )
+	{
+		h = dom->rpo[i];
+		block = cfg->blocks + h;
+		loop = NULL;
+		top = 0;
+
+		for (k = 0; k < block->pred_count; k += 1)
+		{
+			n = cfg->predecessors[block->pred_start + k];
+			if (dom->rpo_index[n] < 0 || dom->rpo_index[n] < (int32_t)i)
+				continue;
+
+			/* A retreating edge; only a back edge if h dominates n */
+			if (!dominates(dom, h, n))
+			{
+				forest->irreducible_edges += 1;
+				continue;
+			}
+
+			if (loop == NULL)
+			{
+				l = forest->loop_count++;
+				loop = forest->loops + l;
+				loop->header = h;
+				loop->parent = -1;
+				loop->depth = 0;
+				loop->block_count = 0;
+				loop->back_edges = 0;
+				forest->loop_of[h] = l;
+			}
+
+			loop->back_edges += 1;
+			if (n != h)
+				worklist[top++] = n;
+		}
+
+		if (loop == NULL)
+			continue;
+
+		l = loop - forest->loops;
+		loop->block_count = 1;
+
+		while (top > 0)
+		{
+			b = worklist[--top];
+
+			if ((x = forest->loop_of[b]) < 0)
+			{
+				forest->loop_of[b] = l;
+				loop->block_count += 1;
+			}
+			else
+			{
+				while (forest->loops[x].parent >= 0)
+					x = forest->loops[x].parent;
+				if (x == l)
+					continue;
+
+				/* An inner loop; continue from its header */
+				forest->loops[x].parent = l;
+				b = forest->loops[x].header;
+			}
+
+			block = cfg->blocks + b;
+			for (k = 0; k < block->pred_count; k += 1)
+			{
+				n = cfg->predecessors[block->pred_start + k];
+				if (dom->rpo_index[n] >= 0 && n != h)
+					worklist[top++] = n;
+			}
+		}
+	}
+
+	/* Parents are found after their children, so walk backwards for the
+		depth and forwards to add nested blocks to the enclosing loops */
+	for (l = forest->loop_count; l-- > 0; )
+	{
+		loop = forest->loops + l;
+		loop->depth = loop->parent < 0 ? 1 : forest->loops[loop->parent].depth + 1;
+		if (loop->depth > forest->max_depth)
+			forest->max_depth = loop->depth;
+	}
+
+	for (l = 0; l < (int32_t)forest->loop_count; l += 1)
+	{
+		loop = forest->loops + l;
+		if (loop->parent >= 0)
+			forest->loops[loop->parent].block_count += loop->block_count;
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef DOMINATORS_H
+#define DOMINATORS_H
+
+#include <stdint.h>
+
+#include "cfg.h"
+#include "arena.h"
+
+/*
+	Dominator tree and natural loops of a ControlFlowGraph. Exception
+	edges count as control flow, so handlers are reachable. All arrays are
+	indexed by block and allocated from the arena passed in; they stay
+	valid until it is reset.
+*/
+
+typedef struct
+{
+	uint32_t block_count;
+	uint32_t reachable_count;
+	uint32_t* rpo;            /* reachable blocks in reverse postorder */
+	int32_t* rpo_index;       /* position in rpo, -1 if unreachable */
+	int32_t* idom;            /* immediate dominator, -1 for the entry and unreachable blocks */
+
+	/* Preorder interval of each block in the dominator tree */
+	uint32_t* tree_enter;
+	uint32_t* tree_exit;
+} Dominators;
+
+/* Nonzero if a dominates b; both must be reachable */
+#define dominates(dom, a, b) \
+	((dom)->tree_enter[a] <= (dom)->tree_enter[b] && (dom)->tree_exit[b] <= (dom)->tree_exit[a])
+
+typedef struct
+{
+	uint32_t header;
+	int32_t parent;           /* enclosing loop, -1 for an outermost loop */
+	uint32_t depth;           /* 1 for an outermost loop */
+	uint32_t block_count;     /* including nested loops */
+	uint32_t back_edges;
+} Loop;
+
+typedef struct
+{
+	uint32_t loop_count;
+	Loop* loops;              /* inner loops come before the loops containing them */
+	int32_t* loop_of;         /* innermost loop of each block, -1 if none */
+	uint32_t max_depth;
+	uint32_t irreducible_edges; /* retreating edges to a block that does not dominate the source */
+} LoopForest;
+
+void compute_dominators(ControlFlowGraph* cfg, Arena* arena, Dominators* dom);
+void find_loops(ControlFlowGraph* cfg, Dominators* dom, Arena* arena, LoopForest* forest);
+
+#define loop_depth(forest, block) \
+	((forest)->loop_of[block] < 0 ? 0 : (forest)->loops[(forest)->loop_of[block]].depth)
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef DTOA_H
+#define DTOA_H
+
+#include <stdint.h>
+
+/*
+	Numbers as Java's Integer, Long, Float and Double.toString write them.
+
+	Floats and doubles get the shortest decimal that reads back as the same
+	value, nearest to it when there are several, found with the Ryu
+	algorithm (Adams, PLDI 2018): the bounds of the interval that rounds to
+	the value are scaled by a power of ten from a table, and digits are
+	dropped until the bounds meet, all in 64-bit integer arithmetic. As in
+	Java, a value with one significant digit is given two (4.9E-324, not
+	5.0E-324), and the notation is plain from 10^-3 up to 10^7, scientific
+	outside that range.
+
+	Each function writes a terminated string and returns its length.
+*/
+
+/* Room for any of the strings, with the terminator */
+#define NUMBER_BUFFER_SIZE 32
+
+int format_integer(int64_t value, char* buffer);
+int format_float(float value, char* buffer);
+int format_double(double value, char* buffer);
+
+#endif
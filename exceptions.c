@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "exceptions.h"
+#include "stats.h"
+
+#define KEY_START   0
+#define KEY_END     1
+#define KEY_HANDLER 2
+
+static uint32_t entry_key(ExceptionTableEntry* entry, int key)
+{
+	switch (key)
+	{
+		case KEY_START: return entry->start_pc;
+		case KEY_END:   return entry->end_pc;
+		default:        return entry->handler_pc;
+	}
+}
+
+static int compare_keys(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Entry indices sorted by the given pc, ties broken by secondary (which
+	is inverted so that ties go from the widest range to the narrowest
+	one) and then by table order. The low 16 bits of each key hold the
+	index. */
+static uint16_t* sort_entries(ExceptionIndex* index, uint64_t* keys, int key, int secondary)
+{
+	uint16_t* order = malloc(index->entry_count * sizeof(uint16_t));
+	uint32_t i;
+
+	STAT_ADD(allocations, 1);
+
+	for (i = 0; i < index->entry_count; i += 1)
+	{
+		keys[i] = (uint64_t)entry_key(index->table + i, key) << 32 | i;
+		if (secondary >= 0)
+			keys[i] |= (uint64_t)(0xFFFF - entry_key(index->table + i, secondary)) << 16;
+	}
+
+	qsort(keys, index->entry_count, sizeof(uint64_t), compare_keys);
+	for (i = 0; i < index->entry_count; i += 1)
+		order[i] = (uint16_t)keys[i];
+	return order;
+}
+
+/* Segment that starts exactly at pc; pc must be one of the bounds */
+static uint32_t bound_index(ExceptionIndex* index, uint32_t pc)
+{
+	uint32_t low = 0, high = index->segment_count, mid;
+
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		if (index->bounds[mid] < pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+uint32_t build_exception_index(Attribute* codeAttribute, ExceptionIndex* index)
+{
+	ExceptionTableEntry* entry;
+	uint64_t* keys;
+	uint32_t *next, i, s, last, count = 0;
+
+	memset(index, 0, sizeof(ExceptionIndex));
+	index->table = codeAttribute->code.exception_table;
+	index->entry_count = codeAttribute->code.exception_table_length;
+	if (index->entry_count == 0)
+		return 0;
+
+	/* Bounds: the distinct start and end pcs, in order */
+	index->bounds = malloc(2 * index->entry_count * sizeof(uint32_t));
+	keys = malloc(2 * index->entry_count * sizeof(uint64_t));
+	STAT_ADD(allocations, 2);
+
+	for (i = 0, entry = index->table; i < index->entry_count; i += 1, entry += 1)
+	{
+		keys[2 * i] = entry->start_pc;
+		keys[2 * i + 1] = entry->end_pc;
+	}
+	qsort(keys, 2 * index->entry_count, sizeof(uint64_t), compare_keys);
+
+	for (i = 0; i < 2 * index->entry_count; i += 1)
+	{
+		if (count == 0 || index->bounds[count - 1] != keys[i])
+			index->bounds[count++] = (uint32_t)keys[i];
+	}
+	index->segment_count = count - 1;
+
+	/* Covering entries per segment: count, then fill in table order */
+	index->cover_start = calloc(index->segment_count + 1, sizeof(uint32_t));
+	next = malloc((index->segment_count + 1) * sizeof(uint32_t));
+	STAT_ADD(allocations, 2);
+
+	for (i = 0, entry = index->table; i < index->entry_count; i += 1, entry += 1)
+	{
+		if (entry->start_pc >= entry->end_pc)
+			continue;
+
+		last = bound_index(index, entry->end_pc);
+		for (s = bound_index(index, entry->start_pc); s < last; s += 1)
+			index->cover_start[s + 1] += 1;
+	}
+	for (s = 0; s < index->segment_count; s += 1)
+		index->cover_start[s + 1] += index->cover_start[s];
+
+	index->covers = malloc(index->cover_start[index->segment_count] * sizeof(uint16_t) + 1);
+	STAT_ADD(allocations, 1);
+	memcpy(next, index->cover_start, (index->segment_count + 1) * sizeof(uint32_t));
+
+	for (i = 0, entry = index->table; i < index->entry_count; i += 1, entry += 1)
+	{
+		if (entry->start_pc >= entry->end_pc)
+			continue;
+
+		last = bound_index(index, entry->end_pc);
+		for (s = bound_index(index, entry->start_pc); s < last; s += 1)
+			index->covers[next[s]++] = (uint16_t)i;
+	}
+	free(next);
+
+	index->by_start = sort_entries(index, keys, KEY_START, KEY_END);
+	index->by_end = sort_entries(index, keys, KEY_END, KEY_START);
+	index->by_handler = sort_entries(index, keys, KEY_HANDLER, -1);
+	free(keys);
+
+	return index->segment_count;
+}
+
+void free_exception_index(ExceptionIndex* index)
+{
+	free(index->bounds);
+	free(index->cover_start);
+	free(index->covers);
+	free(index->by_start);
+	free(index->by_end);
+	free(index->by_handler);
+	memset(index, 0, sizeof(ExceptionIndex));
+}
+
+uint32_t handlers_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries)
+{
+	uint32_t low = 0, high = index->segment_count, mid;
+
+	*entries = NULL;
+	if (index->segment_count == 0 || pc < index->bounds[0] || pc >= index->bounds[index->segment_count])
+		return 0;
+
+	/* Last segment starting at or before pc */
+	while (high - low > 1)
+	{
+		mid = low + (high - low) / 2;
+		if (index->bounds[mid] <= pc)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	*entries = index->covers + index->cover_start[low];
+	return index->cover_start[low + 1] - index->cover_start[low];
+}
+
+/* Run of entries in order whose pc equals the one given */
+static uint32_t equal_range(ExceptionIndex* index, const uint16_t* order, int key, uint32_t pc, const uint16_t** entries)
+{
+	uint32_t low = 0, high = index->entry_count, mid, first;
+
+	while (low < high)
+	{
+		mid = low + (high - low) / 2;
+		if (entry_key(index->table + order[mid], key) < pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (first = low; low < index->entry_count && entry_key(index->table + order[low], key) == pc; low += 1)
+		;
+
+	*entries = order + first;
+	return low - first;
+}
+
+uint32_t ranges_starting_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries)
+{
+	return equal_range(index, index->by_start, KEY_START, pc, entries);
+}
+
+uint32_t ranges_ending_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries)
+{
+	return equal_range(index, index->by_end, KEY_END, pc, entries);
+}
+
+uint32_t handlers_entered_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries)
+{
+	return equal_range(index, index->by_handler, KEY_HANDLER, pc, entries);
+}
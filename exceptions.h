@@ -0,0 +1,47 @@
+#ifndef EXCEPTIONS_H
+#define EXCEPTIONS_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+	Interval index over the exception table of a Code attribute.
+
+	The start and end pcs of all entries cut the code into segments in
+	which the set of covering entries does not change. Each segment owns
+	the slice covers[cover_start[s] .. cover_start[s + 1]) of entry
+	indices, in exception table order (the order the JVM tries them), so
+	finding the handlers of a pc is one binary search over the segment
+	bounds. Entries are also kept sorted by start, end and handler pc to
+	answer which ranges begin or end at a pc.
+
+	Entries are referred to by their index in the exception table.
+*/
+
+typedef struct
+{
+	ExceptionTableEntry* table;
+	uint32_t entry_count;
+
+	uint32_t segment_count;
+	uint32_t* bounds;         /* segment s is [bounds[s], bounds[s + 1]) */
+	uint32_t* cover_start;
+	uint16_t* covers;
+
+	uint16_t* by_start;       /* by start_pc, outer ranges first */
+	uint16_t* by_end;         /* by end_pc, inner ranges first */
+	uint16_t* by_handler;     /* by handler_pc */
+} ExceptionIndex;
+
+uint32_t build_exception_index(Attribute* codeAttribute, ExceptionIndex* index);
+void free_exception_index(ExceptionIndex* index);
+
+/* Each query returns the number of entries and points entries at them;
+	the array belongs to the index */
+uint32_t handlers_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries);
+uint32_t ranges_starting_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries);
+uint32_t ranges_ending_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries);
+uint32_t handlers_entered_at(ExceptionIndex* index, uint32_t pc, const uint16_t** entries);
+
+#endif
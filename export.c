@@ -0,0 +1,469 @@
+#include <math.h>
+
+#include "export.h"
+#include "bytecode.h"
+#include "dtoa.h"
+
+typedef struct
+{
+	unsigned char* data;
+	size_t length;
+	size_t capacity;
+} ExportBuffer;
+
+#define MAX_INLINE_OPERANDS 64
+
+static const char* constant_name(ClassFile* classFile, uint16_t index)
+{
+	Constant* c = find_constant(classFile, index);
+
+	if (c != NULL && (c->tag == TAG_CLASSREF || c->tag == TAG_STRINGREF))
+		c = find_constant(classFile, c->ref);
+
+	if (c == NULL || c->tag != TAG_STRING)
+		return NULL;
+	return c->buffer;
+}
+
+static void json_string(FILE* fp, const char* string, int length)
+{
+	const unsigned char *p = (const unsigned char*)string, *end = p + length;
+	unsigned int ch;
+
+	fputc('"', fp);
+	while (p < end)
+	{
+		/* Decode modified UTF-8 into UTF-16 code units */
+		if (*p < 0x80)
+			ch = *p++;
+		else if ((*p & 0xE0) == 0xC0 && p + 1 < end)
+		{
+			ch = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+			p += 2;
+		}
+		else if ((*p & 0xF0) == 0xE0 && p + 2 < end)
+		{
+			ch = ((p[0] & 0x0F) << 12) | ((p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+			p += 3;
+		}
+		else
+			ch = 0xFFFD, p++;
+
+		if (ch == '"' || ch == '\\')
+		{
+			fputc('\\', fp);
+			fputc(ch, fp);
+		}
+		else if (ch < 0x20 || ch >= 0x7F)
+			fprintf(fp, "\\u%04x", ch);
+		else
+			fputc(ch, fp);
+	}
+	fputc('"', fp);
+}
+
+static void json_name(FILE* fp, ClassFile* classFile, uint16_t index)
+{
+	const char* name = constant_name(classFile, index);
+
+	if (name == NULL)
+		fputs("null", fp);
+	else
+		json_string(fp, name, strlen(name));
+}
+
+/* The shortest form that reads back as the same float or double */
+static void json_double(FILE* fp, double value, int is_float)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+
+	if (isfinite(value))
+	{
+		if (is_float)
+			format_float((float)value, buf);
+		else
+			format_double(value, buf);
+		fputs(buf, fp);
+	}
+	else
+		fprintf(fp, "\"%s\"", isnan(value) ? "NaN" : value > 0 ? "Infinity" : "-Infinity");
+}
+
+static void json_constant(FILE* fp, Constant* c)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+
+	fprintf(fp, "{\"type\":\"constant\",\"index\":%d,\"tag\":\"%s\"", c->index, ConstantTypes[c->tag].name);
+
+	switch (c->tag)
+	{
+		case TAG_STRING:
+			fputs(",\"value\":", fp);
+			json_string(fp, c->buffer, c->length);
+			break;
+
+		case TAG_INTEGER:
+			format_integer(c->intval, buf);
+			fputs(",\"value\":", fp);
+			fputs(buf, fp);
+			break;
+
+		case TAG_FLOAT:
+			fputs(",\"value\":", fp);
+			json_double(fp, c->floatval, 1);
+			break;
+
+		case TAG_LONG:
+			format_integer(c->longval, buf);
+			fputs(",\"value\":", fp);
+			fputs(buf, fp);
+			break;
+
+		case TAG_DOUBLE:
+			fputs(",\"value\":", fp);
+			json_double(fp, c->doubleval, 0);
+			break;
+
+		case TAG_CLASSREF:
+		case TAG_STRINGREF:
+		case TAG_METHODTYPE:
+		case TAG_MODULE:
+		case TAG_PACKAGE:
+			fprintf(fp, ",\"ref\":%hu", c->ref);
+			break;
+
+		case TAG_FIELDREF:
+		case TAG_METHODREF:
+		case TAG_IFACEREF:
+			fprintf(fp, ",\"class\":%hu,\"typedesc\":%hu", c->classref, c->typedescref);
+			break;
+
+		case TAG_DYNAMIC:
+		case TAG_INVOKEDYNAMIC:
+			fprintf(fp, ",\"bootstrap\":%hu,\"typedesc\":%hu", c->bootstrap, c->typedescref);
+			break;
+
+		case TAG_METHODHANDLE:
+			fprintf(fp, ",\"kind\":%hhu,\"ref\":%hu", c->refkind, c->handleref);
+			break;
+
+		case TAG_TYPEDESC:
+			fprintf(fp, ",\"name\":%hu,\"descriptor\":%hu", c->nameref, c->typeref);
+			break;
+	}
+
+	fputs("}\n", fp);
+}
+
+static void json_code(FILE* fp, Attribute* code)
+{
+	int32_t inline_operands[MAX_INLINE_OPERANDS], *operands;
+	ExceptionTableEntry* e;
+	Instruction ins;
+	uint32_t pc, size;
+	int i, count;
+
+	fprintf(fp, ",\"max_stack\":%hu,\"max_locals\":%hu,\"code_length\":%u,\"instructions\":[",
+		code->code.max_stack, code->code.max_locals, code->code.code_length);
+
+	for (pc = 0; pc < code->code.code_length; pc += size)
+	{
+		size = get_single_instruction(code->code.code + pc, &ins, pc);
+
+		operands = inline_operands;
+		count = get_instruction_operands(&ins, pc, operands, MAX_INLINE_OPERANDS);
+		if (count > MAX_INLINE_OPERANDS)
+		{
+			operands = malloc(count * sizeof(int32_t));
+			get_instruction_operands(&ins, pc, operands, count);
+		}
+
+		fprintf(fp, "%s[%u,\"%s\"", pc ? "," : "", pc, OpcodeNames[ins.opcode]);
+		for (i = 0; i < count; i += 1)
+			fprintf(fp, ",%d", operands[i]);
+		fputc(']', fp);
+
+		if (operands != inline_operands)
+			free(operands);
+		free_single_instruction(&ins);
+	}
+
+	fputs("],\"exception_table\":[", fp);
+	for (i = 0, e = code->code.exception_table; i < code->code.exception_table_length; i += 1, e += 1)
+		fprintf(fp, "%s[%hu,%hu,%hu,%hu]", i ? "," : "", e->start_pc, e->end_pc, e->handler_pc, e->catch_type);
+	fputc(']', fp);
+}
+
+void export_class_json(FILE* fp, ClassFile* classFile, const char* filename)
+{
+	Constant* c;
+	Field* field;
+	Method* method;
+	Attribute* code;
+	int i;
+
+	fputs("{\"type\":\"class\",\"file\":", fp);
+	json_string(fp, filename, strlen(filename));
+	fprintf(fp, ",\"minor\":%hu,\"major\":%hu,\"access_flags\":%hu,\"this_class\":",
+		classFile->header.minor, classFile->header.major, classFile->access_flags);
+	json_name(fp, classFile, classFile->this_class);
+	fputs(",\"super_class\":", fp);
+	json_name(fp, classFile, classFile->super_class);
+	fputs(",\"interfaces\":[", fp);
+	for (i = 0; i < classFile->interface_count; i += 1)
+	{
+		if (i > 0)
+			fputc(',', fp);
+		json_name(fp, classFile, classFile->interfaces[i]);
+	}
+	fprintf(fp, "],\"constant_count\":%hu,\"field_count\":%hu,\"method_count\":%hu}\n",
+		classFile->constant_count, classFile->field_count, classFile->method_count);
+
+	for (i = 0, c = classFile->constants; i < classFile->constant_count; i += 1, c += 1)
+		json_constant(fp, c);
+
+	for (i = 0, field = classFile->fields; i < classFile->field_count; i += 1, field += 1)
+	{
+		fprintf(fp, "{\"type\":\"field\",\"access_flags\":%hu,\"name\":", field->access_flags);
+		json_name(fp, classFile, field->name_index);
+		fputs(",\"descriptor\":", fp);
+		json_name(fp, classFile, field->descriptor_index);
+		fputs("}\n", fp);
+	}
+
+	for (i = 0, method = classFile->methods; i < classFile->method_count; i += 1, method += 1)
+	{
+		fprintf(fp, "{\"type\":\"method\",\"access_flags\":%hu,\"name\":", method->access_flags);
+		json_name(fp, classFile, method->name_index);
+		fputs(",\"descriptor\":", fp);
+		json_name(fp, classFile, method->descriptor_index);
+
+		code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+		if (code != NULL)
+			json_code(fp, code);
+
+		fputs("}\n", fp);
+	}
+}
+
+static void put_bytes(ExportBuffer* b, const void* data, size_t length)
+{
+	if (b->length + length > b->capacity)
+	{
+		b->capacity = (b->length + length) * 2;
+		b->data = realloc(b->data, b->capacity);
+	}
+
+	memcpy(b->data + b->length, data, length);
+	b->length += length;
+}
+
+static void put8(ExportBuffer* b, uint8_t value)
+{
+	put_bytes(b, &value, sizeof(value));
+}
+
+static void put16(ExportBuffer* b, uint16_t value)
+{
+	value = htobe16(value);
+	put_bytes(b, &value, sizeof(value));
+}
+
+static void put32(ExportBuffer* b, uint32_t value)
+{
+	value = htobe32(value);
+	put_bytes(b, &value, sizeof(value));
+}
+
+static void put64(ExportBuffer* b, uint64_t value)
+{
+	value = htobe64(value);
+	put_bytes(b, &value, sizeof(value));
+}
+
+static void flush_record(FILE* fp, ExportBuffer* b, uint8_t type)
+{
+	uint32_t length = htobe32(b->length);
+
+	fwrite(&type, sizeof(type), 1, fp);
+	fwrite(&length, sizeof(length), 1, fp);
+	fwrite(b->data, sizeof(char), b->length, fp);
+
+	b->length = 0;
+}
+
+static void put_constant(ExportBuffer* b, Constant* c)
+{
+	uint32_t bits32;
+	uint64_t bits64;
+
+	put16(b, c->index);
+	put8(b, c->tag);
+
+	switch (c->tag)
+	{
+		case TAG_STRING:
+			put16(b, c->length);
+			put_bytes(b, c->buffer, c->length);
+			break;
+
+		case TAG_INTEGER:
+			put32(b, c->intval);
+			break;
+
+		case TAG_FLOAT:
+			memcpy(&bits32, &c->floatval, sizeof(bits32));
+			put32(b, bits32);
+			break;
+
+		case TAG_LONG:
+			put64(b, c->longval);
+			break;
+
+		case TAG_DOUBLE:
+			memcpy(&bits64, &c->doubleval, sizeof(bits64));
+			put64(b, bits64);
+			break;
+
+		case TAG_CLASSREF:
+		case TAG_STRINGREF:
+		case TAG_METHODTYPE:
+		case TAG_MODULE:
+		case TAG_PACKAGE:
+			put16(b, c->ref);
+			break;
+
+		case TAG_FIELDREF:
+		case TAG_METHODREF:
+		case TAG_IFACEREF:
+		case TAG_DYNAMIC:
+		case TAG_INVOKEDYNAMIC:
+			put16(b, c->classref);
+			put16(b, c->typedescref);
+			break;
+
+		case TAG_METHODHANDLE:
+			put8(b, c->refkind);
+			put16(b, c->handleref);
+			break;
+
+		case TAG_TYPEDESC:
+			put16(b, c->nameref);
+			put16(b, c->typeref);
+			break;
+	}
+}
+
+static void put_code(ExportBuffer* b, Attribute* code)
+{
+	int32_t inline_operands[MAX_INLINE_OPERANDS], *operands;
+	ExceptionTableEntry* e;
+	Instruction ins;
+	uint32_t pc, size, count_offset, count = 0;
+	int i, noperands;
+
+	put16(b, code->code.max_stack);
+	put16(b, code->code.max_locals);
+	put32(b, code->code.code_length);
+
+	/* Patched once the instructions are written */
+	count_offset = b->length;
+	put32(b, 0);
+
+	for (pc = 0; pc < code->code.code_length; pc += size, count += 1)
+	{
+		size = get_single_instruction(code->code.code + pc, &ins, pc);
+
+		operands = inline_operands;
+		noperands = get_instruction_operands(&ins, pc, operands, MAX_INLINE_OPERANDS);
+		if (noperands > MAX_INLINE_OPERANDS)
+		{
+			operands = malloc(noperands * sizeof(int32_t));
+			get_instruction_operands(&ins, pc, operands, noperands);
+		}
+
+		put16(b, pc);
+		put8(b, ins.opcode);
+		put16(b, noperands);
+		for (i = 0; i < noperands; i += 1)
+			put32(b, operands[i]);
+
+		if (operands != inline_operands)
+			free(operands);
+		free_single_instruction(&ins);
+	}
+
+	count = htobe32(count);
+	memcpy(b->data + count_offset, &count, sizeof(count));
+
+	put16(b, code->code.exception_table_length);
+	for (i = 0, e = code->code.exception_table; i < code->code.exception_table_length; i += 1, e += 1)
+	{
+		put16(b, e->start_pc);
+		put16(b, e->end_pc);
+		put16(b, e->handler_pc);
+		put16(b, e->catch_type);
+	}
+}
+
+void export_class_binary(FILE* fp, ClassFile* classFile, const char* filename)
+{
+	ExportBuffer b = { NULL, 0, 0 };
+	Constant* c;
+	Field* field;
+	Method* method;
+	Attribute* code;
+	int i;
+
+	put32(&b, classFile->header.magic);
+	put16(&b, classFile->header.minor);
+	put16(&b, classFile->header.major);
+	put16(&b, classFile->access_flags);
+	put16(&b, classFile->this_class);
+	put16(&b, classFile->super_class);
+	put16(&b, classFile->interface_count);
+	for (i = 0; i < classFile->interface_count; i += 1)
+		put16(&b, classFile->interfaces[i]);
+	put16(&b, classFile->constant_count);
+	put16(&b, strlen(filename));
+	put_bytes(&b, filename, strlen(filename));
+	flush_record(fp, &b, EXPORT_CLASS);
+
+	for (i = 0, c = classFile->constants; i < classFile->constant_count; i += 1, c += 1)
+	{
+		put_constant(&b, c);
+		flush_record(fp, &b, EXPORT_CONSTANT);
+	}
+
+	for (i = 0, field = classFile->fields; i < classFile->field_count; i += 1, field += 1)
+	{
+		put16(&b, field->access_flags);
+		put16(&b, field->name_index);
+		put16(&b, field->descriptor_index);
+		flush_record(fp, &b, EXPORT_FIELD);
+	}
+
+	for (i = 0, method = classFile->methods; i < classFile->method_count; i += 1, method += 1)
+	{
+		put16(&b, method->access_flags);
+		put16(&b, method->name_index);
+		put16(&b, method->descriptor_index);
+
+		code = find_attribute(classFile, ATT_NAME_CODE, method->attribute_count, method->attributes);
+		if (code != NULL)
+			put_code(&b, code);
+		else
+		{
+			put16(&b, 0);
+			put16(&b, 0);
+			put32(&b, 0);
+			put32(&b, 0);
+			put16(&b, 0);
+		}
+
+		flush_record(fp, &b, EXPORT_METHOD);
+	}
+
+	flush_record(fp, &b, EXPORT_END);
+	free(b.data);
+}
@@ -0,0 +1,53 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+
+#include "classfile.h"
+
+/*
+	Machine-readable output, written straight from the ClassFile and
+	Instruction structures.
+
+	JSON Lines: one object per line, with a "type" of "class", "constant",
+	"field" or "method". Instructions are arrays of [pc, "opcode", operands...]
+	with branch targets as absolute pcs (see get_instruction_operands).
+
+	Binary: a sequence of records, each a u1 record type and a u4 payload
+	length followed by the payload. All multi-byte values are big-endian,
+	as in the class file itself.
+
+	EXPORT_CLASS     u4 magic, u2 minor, u2 major, u2 access_flags,
+	                 u2 this_class, u2 super_class,
+	                 u2 interface_count, u2 interfaces[interface_count],
+	                 u2 constant_count, u2 filename_length, u1 filename[]
+	EXPORT_CONSTANT  u2 index, u1 tag, then by tag:
+	                 string: u2 length, u1 bytes[length]
+	                 integer, float: u4;  long, double: u8
+	                 classref, stringref: u2 ref
+	                 fieldref, methodref, ifaceref: u2 class, u2 typedesc
+	                 typedesc: u2 name, u2 descriptor
+	                 methodhandle: u1 kind, u2 ref
+	                 methodtype, module, package: u2 ref
+	                 dynamic, invokedynamic: u2 bootstrap, u2 typedesc
+	EXPORT_FIELD     u2 access_flags, u2 name_index, u2 descriptor_index
+	EXPORT_METHOD    u2 access_flags, u2 name_index, u2 descriptor_index,
+	                 u2 max_stack, u2 max_locals, u4 code_length (0: no code),
+	                 u4 instruction_count, instructions[instruction_count],
+	                 u2 exception_table_length, exception_table[] (4 x u2)
+	EXPORT_END       empty; ends the class
+
+	Instructions are encoded as u2 pc, u1 opcode, u2 operand_count and
+	operand_count s4 operands.
+*/
+
+#define EXPORT_CLASS    1
+#define EXPORT_CONSTANT 2
+#define EXPORT_FIELD    3
+#define EXPORT_METHOD   4
+#define EXPORT_END      5
+
+void export_class_json(FILE* fp, ClassFile* classFile, const char* filename);
+void export_class_binary(FILE* fp, ClassFile* classFile, const char* filename);
+
+#endif
@@ -0,0 +1,1604 @@
+#include <stdarg.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "javap.h"
+#include "bytecode.h"
+#include "stackmap.h"
+#include "scan.h"
+#include "dtoa.h"
+#include "md5.h"
+#include "stats.h"
+
+/*
+	javap prints through a line buffer that indents a line when its first
+	character arrives, holds back spaces until something follows them (so
+	lines never end in spaces) and pads to a fixed column before comments.
+	Writer does the same straight into the FILE.
+*/
+typedef struct
+{
+	FILE* fp;
+	int indent;               /* in levels of two spaces */
+	int column;               /* characters written on the current line */
+	int pending;              /* spaces not written yet */
+	int flags;                /* JAVAP_* */
+} Writer;
+
+/* Comments start this far right of the indentation */
+#define TAB_COLUMN 40
+
+#define get16(p) (((p)[0] << 8) | (p)[1])
+
+typedef struct
+{
+	uint16_t flag;
+	const char* name;
+} FlagName;
+
+static const FlagName ClassFlags[] = {
+	{ ACC_PUBLIC,     "ACC_PUBLIC"     },
+	{ ACC_FINAL,      "ACC_FINAL"      },
+	{ ACC_SUPER,      "ACC_SUPER"      },
+	{ ACC_INTERFACE,  "ACC_INTERFACE"  },
+	{ ACC_ABSTRACT,   "ACC_ABSTRACT"   },
+	{ ACC_SYNTHETIC,  "ACC_SYNTHETIC"  },
+	{ ACC_ANNOTATION, "ACC_ANNOTATION" },
+	{ ACC_ENUM,       "ACC_ENUM"       },
+	{ ACC_MODULE,     "ACC_MODULE"     },
+	{ 0,              NULL             }
+};
+
+static const FlagName FieldFlags[] = {
+	{ ACC_PUBLIC,     "ACC_PUBLIC"     },
+	{ ACC_PRIVATE,    "ACC_PRIVATE"    },
+	{ ACC_PROTECTED,  "ACC_PROTECTED"  },
+	{ ACC_STATIC,     "ACC_STATIC"     },
+	{ ACC_FINAL,      "ACC_FINAL"      },
+	{ ACC_VOLATILE,   "ACC_VOLATILE"   },
+	{ ACC_TRANSIENT,  "ACC_TRANSIENT"  },
+	{ ACC_SYNTHETIC,  "ACC_SYNTHETIC"  },
+	{ ACC_ENUM,       "ACC_ENUM"       },
+	{ 0,              NULL             }
+};
+
+static const FlagName MethodFlags[] = {
+	{ ACC_PUBLIC,       "ACC_PUBLIC"       },
+	{ ACC_PRIVATE,      "ACC_PRIVATE"      },
+	{ ACC_PROTECTED,    "ACC_PROTECTED"    },
+	{ ACC_STATIC,       "ACC_STATIC"       },
+	{ ACC_FINAL,        "ACC_FINAL"        },
+	{ ACC_SYNCHRONIZED, "ACC_SYNCHRONIZED" },
+	{ ACC_BRIDGE,       "ACC_BRIDGE"       },
+	{ ACC_VARARGS,      "ACC_VARARGS"      },
+	{ ACC_NATIVE,       "ACC_NATIVE"       },
+	{ ACC_ABSTRACT,     "ACC_ABSTRACT"     },
+	{ ACC_STRICT,       "ACC_STRICT"       },
+	{ ACC_SYNTHETIC,    "ACC_SYNTHETIC"    },
+	{ 0,                NULL               }
+};
+
+/* Source modifiers, in the order javap writes them */
+static const FlagName ClassModifiers[] = {
+	{ ACC_PUBLIC,   "public"   },
+	{ ACC_FINAL,    "final"    },
+	{ ACC_ABSTRACT, "abstract" },
+	{ 0,            NULL       }
+};
+
+static const FlagName InnerClassModifiers[] = {
+	{ ACC_PUBLIC,    "public"    },
+	{ ACC_PRIVATE,   "private"   },
+	{ ACC_PROTECTED, "protected" },
+	{ ACC_STATIC,    "static"    },
+	{ ACC_FINAL,     "final"     },
+	{ ACC_ABSTRACT,  "abstract"  },
+	{ 0,             NULL        }
+};
+
+static const FlagName FieldModifiers[] = {
+	{ ACC_PUBLIC,    "public"    },
+	{ ACC_PRIVATE,   "private"   },
+	{ ACC_PROTECTED, "protected" },
+	{ ACC_STATIC,    "static"    },
+	{ ACC_FINAL,     "final"     },
+	{ ACC_VOLATILE,  "volatile"  },
+	{ ACC_TRANSIENT, "transient" },
+	{ 0,             NULL        }
+};
+
+static const FlagName MethodModifiers[] = {
+	{ ACC_PUBLIC,       "public"       },
+	{ ACC_PRIVATE,      "private"      },
+	{ ACC_PROTECTED,    "protected"    },
+	{ ACC_STATIC,       "static"       },
+	{ ACC_FINAL,        "final"        },
+	{ ACC_SYNCHRONIZED, "synchronized" },
+	{ ACC_NATIVE,       "native"       },
+	{ ACC_ABSTRACT,     "abstract"     },
+	{ ACC_STRICT,       "strictfp"     },
+	{ 0,                NULL           }
+};
+
+/* Tag names in the constant pool listing, and in comments */
+static const char* PoolTagNames[CONSTANT_TAG_COUNT] = {
+	NULL, "Utf8", NULL, "Integer", "Float", "Long", "Double", "Class", "String",
+	"Fieldref", "Methodref", "InterfaceMethodref", "NameAndType", NULL, NULL,
+	"MethodHandle", "MethodType", "Dynamic", "InvokeDynamic", "Module", "Package",
+};
+
+static const char* CommentTagNames[CONSTANT_TAG_COUNT] = {
+	NULL, "Utf8", NULL, "int", "float", "long", "double", "class", "String",
+	"Field", "Method", "InterfaceMethod", "NameAndType", NULL, NULL,
+	"MethodHandle", "MethodType", "Dynamic", "InvokeDynamic", "Module", "Package",
+};
+
+static void put_char(Writer* w, char c)
+{
+	if (c == ' ')
+	{
+		w->pending += 1;
+		return;
+	}
+
+	if (c == '\n')
+	{
+		fputc('\n', w->fp);
+		w->column = w->pending = 0;
+		return;
+	}
+
+	if (w->column == 0 && w->indent > 0)
+	{
+		fprintf(w->fp, "%*s", w->indent * 2, "");
+		w->column = w->indent * 2;
+	}
+
+	for (; w->pending > 0; w->pending -= 1, w->column += 1)
+		fputc(' ', w->fp);
+
+	fputc(c, w->fp);
+
+	/* Count characters, not the continuation bytes of UTF-8 sequences */
+	if ((c & 0xC0) != 0x80)
+		w->column += 1;
+}
+
+static void put_string(Writer* w, const char* string)
+{
+	for (; *string; string += 1)
+		put_char(w, *string);
+}
+
+static void put_format(Writer* w, const char* format, ...)
+{
+	char buf[256];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	put_string(w, buf);
+}
+
+static void tab(Writer* w)
+{
+	int column = w->indent * 2 + TAB_COLUMN;
+	w->pending += column <= w->column ? 1 : column - w->column;
+}
+
+/* A modified UTF-8 string, with the escapes javap uses for string values */
+static void put_escaped(Writer* w, const char* string, int length)
+{
+	const unsigned char *p = (const unsigned char*)string, *end = p + length;
+	unsigned int ch;
+
+	while (p < end)
+	{
+		switch (*p)
+		{
+			case '\t': put_string(w, "\\t"); p += 1; continue;
+			case '\n': put_string(w, "\\n"); p += 1; continue;
+			case '\r': put_string(w, "\\r"); p += 1; continue;
+			case '\b': put_string(w, "\\b"); p += 1; continue;
+			case '\f': put_string(w, "\\f"); p += 1; continue;
+			case '"':  put_string(w, "\\\""); p += 1; continue;
+			case '\'': put_string(w, "\\'"); p += 1; continue;
+			case '\\': put_string(w, "\\\\"); p += 1; continue;
+		}
+
+		if (*p < 0x20 || *p == 0x7F)
+		{
+			put_format(w, "\\u%04x", *p);
+			p += 1;
+		}
+		else if ((*p & 0xE0) == 0xC0 && p + 1 < end && (ch = ((p[0] & 0x1F) << 6) | (p[1] & 0x3F)) < 0xA0)
+		{
+			/* Encoded NUL, and the C1 control characters */
+			put_format(w, "\\u%04x", ch);
+			p += 2;
+		}
+		else
+			put_char(w, *p++);
+	}
+}
+
+static int is_identifier_start(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$' || c >= 0x80;
+}
+
+static int is_identifier_part(unsigned char c)
+{
+	return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+/* Class and member names as they are, unless they aren't (slash separated)
+	Java identifiers, like "<init>" or array classes: those are quoted */
+static void put_name(Writer* w, const char* name, int length)
+{
+	int i;
+	char previous = '/';
+
+	for (i = 0; i < length; previous = name[i], i += 1)
+	{
+		if ((previous == '/' && !is_identifier_start(name[i])) || (name[i] != '/' && !is_identifier_part(name[i])))
+			break;
+	}
+
+	if (length > 0 && i == length)
+	{
+		put_escaped(w, name, length);
+		return;
+	}
+
+	put_char(w, '"');
+	put_escaped(w, name, length);
+	put_char(w, '"');
+}
+
+/* An internal class name with dots, as in declarations */
+static void put_java_name(Writer* w, const char* name)
+{
+	for (; *name; name += 1)
+		put_char(w, *name == '/' ? '.' : *name);
+}
+
+/* Float.toString and Double.toString */
+static void put_java_double(Writer* w, double value, int is_float)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+
+	if (is_float)
+		format_float((float)value, buf);
+	else
+		format_double(value, buf);
+	put_string(w, buf);
+}
+
+static Constant* constant_of(ClassFile* classFile, uint16_t index, int tag)
+{
+	Constant* c = find_constant(classFile, index);
+	return c != NULL && c->tag == tag ? c : NULL;
+}
+
+static const char* utf8_of(ClassFile* classFile, uint16_t index)
+{
+	Constant* c = constant_of(classFile, index, TAG_STRING);
+	return c != NULL ? c->buffer : NULL;
+}
+
+/* Name of the class a classref names */
+static const char* class_name_of(ClassFile* classFile, uint16_t index)
+{
+	Constant* c = constant_of(classFile, index, TAG_CLASSREF);
+	return c != NULL ? utf8_of(classFile, c->ref) : NULL;
+}
+
+static void put_utf8_name(Writer* w, ClassFile* classFile, uint16_t index)
+{
+	Constant* c = constant_of(classFile, index, TAG_STRING);
+
+	if (c == NULL)
+		put_format(w, "#%hu", index);
+	else
+		put_name(w, c->buffer, c->length);
+}
+
+/* The value of a constant, as javap's comments show it */
+static void put_value(Writer* w, ClassFile* classFile, Constant* c)
+{
+	Constant* ref;
+	char buf[NUMBER_BUFFER_SIZE];
+
+	switch (c->tag)
+	{
+		case TAG_STRING:
+			put_escaped(w, c->buffer, c->length);
+			break;
+
+		case TAG_INTEGER:
+			format_integer(c->intval, buf);
+			put_string(w, buf);
+			break;
+
+		case TAG_FLOAT:
+			put_java_double(w, c->floatval, 1);
+			put_char(w, 'f');
+			break;
+
+		case TAG_LONG:
+			format_integer(c->longval, buf);
+			put_string(w, buf);
+			put_char(w, 'l');
+			break;
+
+		case TAG_DOUBLE:
+			put_java_double(w, c->doubleval, 0);
+			put_char(w, 'd');
+			break;
+
+		case TAG_CLASSREF:
+		case TAG_MODULE:
+		case TAG_PACKAGE:
+			put_utf8_name(w, classFile, c->ref);
+			break;
+
+		case TAG_STRINGREF:
+		case TAG_METHODTYPE:
+			if ((ref = constant_of(classFile, c->ref, TAG_STRING)) != NULL)
+				put_escaped(w, ref->buffer, ref->length);
+			break;
+
+		case TAG_FIELDREF:
+		case TAG_METHODREF:
+		case TAG_IFACEREF:
+			if ((ref = constant_of(classFile, c->classref, TAG_CLASSREF)) != NULL)
+				put_utf8_name(w, classFile, ref->ref);
+			put_char(w, '.');
+			if ((ref = constant_of(classFile, c->typedescref, TAG_TYPEDESC)) != NULL)
+				put_value(w, classFile, ref);
+			break;
+
+		case TAG_TYPEDESC:
+			put_utf8_name(w, classFile, c->nameref);
+			put_char(w, ':');
+			if ((ref = constant_of(classFile, c->typeref, TAG_STRING)) != NULL)
+				put_escaped(w, ref->buffer, ref->length);
+			break;
+
+		case TAG_METHODHANDLE:
+			if (c->refkind <= REF_INVOKEINTERFACE)
+				put_string(w, ReferenceKinds[c->refkind]);
+			put_char(w, ' ');
+			if ((ref = find_constant(classFile, c->handleref)) != NULL)
+				put_value(w, classFile, ref);
+			break;
+
+		case TAG_DYNAMIC:
+		case TAG_INVOKEDYNAMIC:
+			put_format(w, "#%hu:", c->bootstrap);
+			if ((ref = constant_of(classFile, c->typedescref, TAG_TYPEDESC)) != NULL)
+				put_value(w, classFile, ref);
+			break;
+	}
+}
+
+/* A constant in an instruction comment or attribute: the kind, then the
+	value; members of the class itself are shown without the class name */
+static void put_constant(Writer* w, ClassFile* classFile, uint16_t index)
+{
+	Constant *c = find_constant(classFile, index), *typedesc;
+
+	if (c == NULL)
+	{
+		put_format(w, "#%hu", index);
+		return;
+	}
+
+	put_string(w, CommentTagNames[c->tag]);
+	put_char(w, ' ');
+
+	if ((c->tag == TAG_FIELDREF || c->tag == TAG_METHODREF || c->tag == TAG_IFACEREF) &&
+		c->classref == classFile->this_class &&
+		(typedesc = constant_of(classFile, c->typedescref, TAG_TYPEDESC)) != NULL)
+		c = typedesc;
+
+	put_value(w, classFile, c);
+}
+
+static void put_constant_pool(Writer* w, ClassFile* classFile)
+{
+	Constant* c;
+	int i, width, count = 1;
+	char index[8];
+
+	if (classFile->constant_count > 0)
+	{
+		c = &classFile->constants[classFile->constant_count - 1];
+		count = c->index + ((c->tag == TAG_LONG || c->tag == TAG_DOUBLE) ? 2 : 1);
+	}
+	width = snprintf(index, sizeof(index), "%d", count) + 1;
+
+	put_string(w, "Constant pool:\n");
+	w->indent += 1;
+
+	for (i = 0, c = classFile->constants; i < classFile->constant_count; i += 1, c += 1)
+	{
+		snprintf(index, sizeof(index), "#%d", c->index);
+		put_format(w, "%*s = %-18s ", width, index, PoolTagNames[c->tag]);
+
+		switch (c->tag)
+		{
+			case TAG_STRING:
+			case TAG_INTEGER:
+			case TAG_FLOAT:
+			case TAG_LONG:
+			case TAG_DOUBLE:
+				put_value(w, classFile, c);
+				put_char(w, '\n');
+				continue;
+
+			case TAG_CLASSREF:
+			case TAG_STRINGREF:
+			case TAG_METHODTYPE:
+			case TAG_MODULE:
+			case TAG_PACKAGE:
+				put_format(w, "#%hu", c->ref);
+				break;
+
+			case TAG_FIELDREF:
+			case TAG_METHODREF:
+			case TAG_IFACEREF:
+				put_format(w, "#%hu.#%hu", c->classref, c->typedescref);
+				break;
+
+			case TAG_TYPEDESC:
+				put_format(w, "#%hu:#%hu", c->nameref, c->typeref);
+				break;
+
+			case TAG_METHODHANDLE:
+				put_format(w, "%hhu:#%hu", c->refkind, c->handleref);
+				break;
+
+			case TAG_DYNAMIC:
+			case TAG_INVOKEDYNAMIC:
+				put_format(w, "#%hu:#%hu", c->bootstrap, c->typedescref);
+				break;
+		}
+
+		tab(w);
+		/* sic: javap puts two spaces after the slashes of method types */
+		put_string(w, c->tag == TAG_METHODTYPE ? "//  " : "// ");
+		put_value(w, classFile, c);
+		put_char(w, '\n');
+	}
+
+	w->indent -= 1;
+}
+
+static void put_modifiers(Writer* w, const FlagName* names, uint16_t flags)
+{
+	for (; names->name != NULL; names += 1)
+	{
+		if (flags & names->flag)
+		{
+			put_string(w, names->name);
+			put_char(w, ' ');
+		}
+	}
+}
+
+static void put_flags(Writer* w, const FlagName* names, uint16_t flags)
+{
+	const char* separator = "";
+
+	put_format(w, "flags: (0x%04x) ", flags);
+	for (; names->name != NULL; names += 1)
+	{
+		if (flags & names->flag)
+		{
+			put_string(w, separator);
+			put_string(w, names->name);
+			separator = ", ";
+		}
+	}
+	put_char(w, '\n');
+}
+
+static const char* skip_type(const char* descriptor)
+{
+	while (*descriptor == '[')
+		descriptor += 1;
+
+	if (*descriptor == 'L')
+	{
+		while (*descriptor != ';' && *descriptor != '\0')
+			descriptor += 1;
+	}
+
+	return *descriptor != '\0' ? descriptor + 1 : descriptor;
+}
+
+/* One type of a descriptor as Java source writes it */
+static void put_java_type(Writer* w, const char* descriptor, int varargs)
+{
+	BaseType* base;
+	int dimensions = 0;
+
+	for (; *descriptor == '['; descriptor += 1)
+		dimensions += 1;
+
+	if (*descriptor == 'L')
+	{
+		for (descriptor += 1; *descriptor != ';' && *descriptor != '\0'; descriptor += 1)
+			put_char(w, *descriptor == '/' ? '.' : *descriptor);
+	}
+	else
+	{
+		for (base = BaseTypes; base->name != NULL && base->type != *descriptor; base += 1)
+			;
+		put_string(w, base->name != NULL ? base->name : "?");
+	}
+
+	if (varargs && dimensions > 0)
+		dimensions -= 1;
+	for (; dimensions > 0; dimensions -= 1)
+		put_string(w, "[]");
+	if (varargs)
+		put_string(w, "...");
+}
+
+/* "(int, java.lang.String...)" */
+static void put_parameters(Writer* w, const char* descriptor, int varargs)
+{
+	const char *p, *next;
+
+	put_char(w, '(');
+	for (p = descriptor + 1; *p != ')' && *p != '\0'; p = next)
+	{
+		if (p != descriptor + 1)
+			put_string(w, ", ");
+
+		next = skip_type(p);
+		put_java_type(w, p, varargs && *next == ')');
+	}
+	put_char(w, ')');
+}
+
+static int parameter_count(const char* descriptor)
+{
+	const char* p;
+	int count = 0;
+
+	for (p = descriptor + 1; *p != ')' && *p != '\0'; p = skip_type(p))
+		count += 1;
+	return count;
+}
+
+static const char* attribute_name(ClassFile* classFile, Attribute* a)
+{
+	const char* name = utf8_of(classFile, a->name_index);
+	return name != NULL ? name : "";
+}
+
+/* Attributes javap doesn't decode come out as a hex dump */
+static void put_hex_dump(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	uint32_t i;
+
+	put_format(w, "%s: length = 0x%X\n", attribute_name(classFile, a), a->length);
+	put_string(w, "   ");
+	for (i = 0; i < a->length; i += 1)
+	{
+		put_format(w, "%02X", p[i]);
+		if (i % 16 == 15)
+			put_string(w, "\n   ");
+		else
+			put_char(w, ' ');
+	}
+	put_char(w, '\n');
+}
+
+static void put_line_numbers(Writer* w, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	int i, count = get16(p);
+
+	put_string(w, "LineNumberTable:\n");
+	w->indent += 1;
+	for (i = 0, p += 2; i < count; i += 1, p += 4)
+		put_format(w, "line %d: %d\n", get16(p + 2), get16(p));
+	w->indent -= 1;
+}
+
+static void put_local_variables(Writer* w, ClassFile* classFile, Attribute* a, const char* title)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	const char *name, *descriptor;
+	int i, count = get16(p);
+
+	put_format(w, "%s:\n", title);
+	w->indent += 1;
+	put_string(w, "Start  Length  Slot  Name   Signature\n");
+	for (i = 0, p += 2; i < count; i += 1, p += 10)
+	{
+		name = utf8_of(classFile, get16(p + 4));
+		descriptor = utf8_of(classFile, get16(p + 6));
+		put_format(w, "%5d %7d %5d %5s   ", get16(p), get16(p + 2), get16(p + 8), name ? name : "");
+		put_string(w, descriptor ? descriptor : "");
+		put_char(w, '\n');
+	}
+	w->indent -= 1;
+}
+
+static void put_items(Writer* w, ClassFile* classFile, const char* title, VerificationItem* item, uint32_t count)
+{
+	static const char* Names[] = { "top", "int", "float", "double", "long", "null", "this" };
+	uint32_t i;
+
+	put_format(w, "%s = [", title);
+	for (i = 0; i < count; i += 1, item += 1)
+	{
+		put_char(w, ' ');
+		if (item->tag == ITEM_OBJECT)
+			put_constant(w, classFile, item->value);
+		else if (item->tag == ITEM_UNINITIALIZED)
+			put_format(w, "uninitialized %hu", item->value);
+		else
+			put_string(w, Names[item->tag]);
+		put_char(w, i + 1 < count ? ',' : ' ');
+	}
+	put_string(w, "]\n");
+}
+
+/* The frames as stored, deltas included; 0 if the table doesn't decode
+	(it is dumped instead) */
+static int put_stack_map(Writer* w, ClassFile* classFile, Attribute* codeAttribute, Attribute* a)
+{
+	StackMap map;
+	StackMapFrame* frame;
+	VerificationItem* items;
+	uint32_t i;
+
+	if (find_attribute(classFile, ATT_NAME_STACKMAPTABLE, codeAttribute->code.attribute_count, codeAttribute->code.attributes) != a ||
+		decode_stack_map(classFile, NULL, codeAttribute, &map) < 0)
+		return 0;
+
+	put_format(w, "StackMapTable: number_of_entries = %u\n", map.frame_count);
+	w->indent += 1;
+	for (i = 0, frame = map.frames; i < map.frame_count; i += 1, frame += 1)
+	{
+		items = map.items + frame->items;
+		put_format(w, "frame_type = %hhu /* %s */\n", frame->type, frame_type_to_string(frame->type));
+
+		w->indent += 1;
+		if (frame->type >= 247)
+			put_format(w, "offset_delta = %u\n", i == 0 ? frame->pc : frame->pc - frame[-1].pc - 1);
+		if (FRAME_APPEND(frame->type) || FRAME_FULL(frame->type))
+			put_items(w, classFile, "locals", items, frame->local_count);
+		if (FRAME_SAME_STACK1(frame->type) || FRAME_FULL(frame->type))
+			put_items(w, classFile, "stack", items + frame->local_count, frame->stack_count);
+		w->indent -= 1;
+	}
+	w->indent -= 1;
+
+	free_stack_map(&map);
+	return 1;
+}
+
+static void put_bootstrap_methods(Writer* w, ClassFile* classFile)
+{
+	BootstrapMethod* method;
+	Constant* c;
+	uint16_t index;
+	uint32_t i, j;
+
+	put_string(w, "BootstrapMethods:\n");
+	for (i = 0, method = classFile->bootstrap_methods; i < classFile->bootstrap_count; i += 1, method += 1)
+	{
+		w->indent += 1;
+		put_format(w, "%u: #%hu ", i, method->method_handle);
+		if ((c = find_constant(classFile, method->method_handle)) != NULL)
+			put_value(w, classFile, c);
+		put_char(w, '\n');
+
+		w->indent += 1;
+		put_string(w, "Method arguments:\n");
+		w->indent += 1;
+		for (j = 0; j < method->argument_count; j += 1)
+		{
+			index = classFile->bootstrap_arguments[method->arguments + j];
+			put_format(w, "#%hu ", index);
+			if ((c = find_constant(classFile, index)) != NULL)
+				put_value(w, classFile, c);
+			put_char(w, '\n');
+		}
+		w->indent -= 3;
+	}
+}
+
+/* A constant pool index: its value, or the index itself */
+static void put_index(Writer* w, ClassFile* classFile, uint16_t index, int resolve)
+{
+	Constant* c = resolve ? find_constant(classFile, index) : NULL;
+
+	if (c != NULL)
+		put_value(w, classFile, c);
+	else
+		put_format(w, "#%hu", index);
+}
+
+static void put_inner_classes(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	const char* name;
+	uint16_t flags;
+	int i, count = get16(p), first = 1;
+
+	for (i = 0, p += 2; i < count; i += 1, p += 8)
+	{
+		/* As javap, private classes only with -p, and no header without
+			a class to list */
+		flags = get16(p + 6);
+		if ((flags & ACC_PRIVATE) && !(w->flags & JAVAP_PRIVATE))
+			continue;
+
+		if (first)
+		{
+			put_string(w, "InnerClasses:\n");
+			w->indent += 1;
+			first = 0;
+		}
+
+		put_modifiers(w, InnerClassModifiers, (flags & ACC_INTERFACE) ? flags & ~ACC_ABSTRACT : flags);
+		if (get16(p + 4) != 0)
+			put_format(w, "#%d= ", get16(p + 4));
+		put_format(w, "#%d", get16(p));
+		if (get16(p + 2) != 0)
+			put_format(w, " of #%d", get16(p + 2));
+		put_char(w, ';');
+
+		tab(w);
+		put_string(w, "// ");
+		if (get16(p + 4) != 0 && (name = utf8_of(classFile, get16(p + 4))) != NULL)
+		{
+			put_string(w, name);
+			put_char(w, '=');
+		}
+		put_constant(w, classFile, get16(p));
+		if (get16(p + 2) != 0)
+		{
+			put_string(w, " of ");
+			put_constant(w, classFile, get16(p + 2));
+		}
+		put_char(w, '\n');
+	}
+
+	if (!first)
+		w->indent -= 1;
+}
+
+static const unsigned char* put_annotation(Writer* w, ClassFile* classFile, const unsigned char* p, int resolve);
+
+/*
+	Annotations are printed twice by javap: as indices on one line,
+	"#20(#21=s#22)", then resolved below it. The attribute has been checked
+	with skip_annotation before any of it is printed.
+*/
+static const unsigned char* put_element_value(Writer* w, ClassFile* classFile, const unsigned char* p, int resolve)
+{
+	Constant* c;
+	char tag = *p;
+	uint16_t index = get16(p + 1);
+	int i, count;
+
+	switch (tag)
+	{
+		case 'e':
+			if (resolve)
+			{
+				put_index(w, classFile, index, 1);
+				put_char(w, '.');
+				put_index(w, classFile, get16(p + 3), 1);
+			}
+			else
+				put_format(w, "e#%hu.#%d", index, get16(p + 3));
+			return p + 5;
+
+		case 'c':
+			if (resolve)
+			{
+				put_string(w, "class ");
+				put_index(w, classFile, index, 1);
+			}
+			else
+				put_format(w, "c#%hu", index);
+			return p + 3;
+
+		case '@':
+			put_char(w, '@');
+			return put_annotation(w, classFile, p + 1, resolve);
+
+		case '[':
+			put_char(w, '[');
+			for (i = 0, count = index, p += 3; i < count; i += 1)
+			{
+				if (i > 0)
+					put_char(w, ',');
+				p = put_element_value(w, classFile, p, resolve);
+			}
+			put_char(w, ']');
+			return p;
+	}
+
+	c = resolve ? find_constant(classFile, index) : NULL;
+	if (c == NULL)
+	{
+		put_format(w, "%c#%hu", tag, index);
+		return p + 3;
+	}
+
+	switch (tag)
+	{
+		case 'B':
+			put_string(w, "(byte) ");
+			put_value(w, classFile, c);
+			break;
+
+		case 'S':
+			put_string(w, "(short) ");
+			put_value(w, classFile, c);
+			break;
+
+		case 'C':
+			put_char(w, '\'');
+			if (c->tag == TAG_INTEGER && (uint16_t)c->intval >= 0x20 && (uint16_t)c->intval < 0x7F)
+				put_char(w, (char)c->intval);
+			else if (c->tag == TAG_INTEGER)
+				put_format(w, "\\u%04x", (uint16_t)c->intval);
+			put_char(w, '\'');
+			break;
+
+		case 'Z':
+			if (c->tag == TAG_INTEGER)
+				put_string(w, c->intval != 0 ? "true" : "false");
+			else
+				put_value(w, classFile, c);
+			break;
+
+		case 's':
+			put_char(w, '"');
+			put_value(w, classFile, c);
+			put_char(w, '"');
+			break;
+
+		default:
+			put_value(w, classFile, c);
+	}
+
+	return p + 3;
+}
+
+static const unsigned char* put_annotation(Writer* w, ClassFile* classFile, const unsigned char* p, int resolve)
+{
+	const char* type = resolve ? utf8_of(classFile, get16(p)) : NULL;
+	int i, count = get16(p + 2);
+
+	if (type != NULL)
+		put_java_type(w, type, 0);
+	else
+		put_format(w, "#%d", get16(p));
+
+	if (!resolve)
+		put_char(w, '(');
+	else if (count > 0)
+	{
+		put_string(w, "(\n");
+		w->indent += 1;
+	}
+
+	for (i = 0, p += 4; i < count; i += 1)
+	{
+		if (i > 0 && !resolve)
+			put_char(w, ',');
+		put_index(w, classFile, get16(p), resolve);
+		put_char(w, '=');
+		p = put_element_value(w, classFile, p + 2, resolve);
+		if (resolve)
+			put_char(w, '\n');
+	}
+
+	if (!resolve)
+		put_char(w, ')');
+	else if (count > 0)
+	{
+		w->indent -= 1;
+		put_char(w, ')');
+	}
+
+	return p;
+}
+
+/* "0: #20()", then the annotation resolved, one level further in */
+static const unsigned char* put_annotation_entry(Writer* w, ClassFile* classFile, const unsigned char* p, int i)
+{
+	put_format(w, "%d: ", i);
+	put_annotation(w, classFile, p, 0);
+	put_char(w, '\n');
+	w->indent += 1;
+	p = put_annotation(w, classFile, p, 1);
+	w->indent -= 1;
+	put_char(w, '\n');
+	return p;
+}
+
+/* Whether the attribute holds exactly the annotations it counts: a list,
+	or with parameters a list of lists */
+static int check_annotations(Attribute* a, int parameters)
+{
+	const unsigned char *p = (const unsigned char*)a->buffer, *end = p + a->length;
+	int i, lists = 1, count;
+
+	if (parameters)
+	{
+		if (p + 1 > end)
+			return 0;
+		lists = *p++;
+	}
+
+	for (; lists > 0; lists -= 1)
+	{
+		if (p + 2 > end)
+			return 0;
+		for (i = 0, count = get16(p), p += 2; i < count && p != NULL; i += 1)
+			p = skip_annotation(p, end, 0);
+		if (p == NULL)
+			return 0;
+	}
+
+	return p == end;
+}
+
+static void put_annotations(Writer* w, ClassFile* classFile, Attribute* a, const char* name)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	int i, count;
+
+	put_format(w, "%s:\n", name);
+	w->indent += 1;
+	for (i = 0, count = get16(p), p += 2; i < count; i += 1)
+		p = put_annotation_entry(w, classFile, p, i);
+	w->indent -= 1;
+}
+
+static void put_parameter_annotations(Writer* w, ClassFile* classFile, Attribute* a, const char* name)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	int i, j, count, parameters = *p++;
+
+	put_format(w, "%s:\n", name);
+	w->indent += 1;
+	for (i = 0; i < parameters; i += 1)
+	{
+		put_format(w, "parameter %d:\n", i);
+		w->indent += 1;
+		for (j = 0, count = get16(p), p += 2; j < count; j += 1)
+			p = put_annotation_entry(w, classFile, p, j);
+		w->indent -= 1;
+	}
+	w->indent -= 1;
+}
+
+static void put_annotation_default(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+
+	put_string(w, "AnnotationDefault:\n");
+	w->indent += 1;
+	put_string(w, "default_value: ");
+	put_element_value(w, classFile, p, 0);
+	put_char(w, '\n');
+	w->indent += 1;
+	put_element_value(w, classFile, p, 1);
+	w->indent -= 2;
+	put_char(w, '\n');
+}
+
+static void put_enclosing_method(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	const char* name = class_name_of(classFile, get16(p));
+	Constant* typedesc;
+
+	put_format(w, "EnclosingMethod: #%d.#%d", get16(p), get16(p + 2));
+	tab(w);
+	put_string(w, "// ");
+	put_java_name(w, name ? name : "");
+	if (get16(p + 2) != 0 && (typedesc = constant_of(classFile, get16(p + 2), TAG_TYPEDESC)) != NULL &&
+		(name = utf8_of(classFile, typedesc->nameref)) != NULL)
+	{
+		put_char(w, '.');
+		put_string(w, name);
+	}
+	put_char(w, '\n');
+}
+
+static void put_nest_members(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	int i, count = get16(p);
+
+	put_string(w, "NestMembers:\n");
+	w->indent += 1;
+	for (i = 0, p += 2; i < count; i += 1, p += 2)
+	{
+		put_index(w, classFile, get16(p), 1);
+		put_char(w, '\n');
+	}
+	w->indent -= 1;
+}
+
+static void put_method_parameters(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	Constant* name;
+	uint16_t flags;
+	int i, width, count = *p;
+
+	put_string(w, "MethodParameters:\n");
+	w->indent += 1;
+	put_format(w, "%-31s%s\n", "Name", "Flags");
+	for (i = 0, p += 1; i < count; i += 1, p += 4)
+	{
+		name = get16(p) != 0 ? constant_of(classFile, get16(p), TAG_STRING) : NULL;
+		if (name != NULL)
+			put_escaped(w, name->buffer, name->length);
+		else
+			put_string(w, "<no name>");
+
+		/* Names are padded to 31 columns */
+		width = w->column > 0 ? w->column - w->indent * 2 : 0;
+		w->pending += width < 31 ? 31 - width : 0;
+
+		flags = get16(p + 2);
+		if (flags & ACC_FINAL)
+			put_string(w, "final ");
+		if (flags & ACC_MANDATED)
+			put_string(w, "mandated ");
+		if (flags & ACC_SYNTHETIC)
+			put_string(w, "synthetic");
+		put_char(w, '\n');
+	}
+	w->indent -= 1;
+}
+
+static void put_attribute(Writer* w, ClassFile* classFile, Attribute* a)
+{
+	const unsigned char* p = (const unsigned char*)a->buffer;
+	const char *name = attribute_name(classFile, a), *value;
+	int i, count;
+
+	/* Tables whose size doesn't match their count are dumped instead */
+	count = a->length >= 2 ? get16(p) : -1;
+
+	if (strcmp(name, "SourceFile") == 0 && a->length == 2)
+	{
+		value = utf8_of(classFile, get16(p));
+		put_string(w, "SourceFile: \"");
+		put_string(w, value ? value : "");
+		put_string(w, "\"\n");
+	}
+	else if (strcmp(name, "ConstantValue") == 0 && a->length == 2)
+	{
+		put_string(w, "ConstantValue: ");
+		put_constant(w, classFile, get16(p));
+		put_char(w, '\n');
+	}
+	else if (strcmp(name, "Signature") == 0 && a->length == 2)
+	{
+		put_format(w, "Signature: #%d", get16(p));
+		tab(w);
+		put_string(w, "// ");
+		value = utf8_of(classFile, get16(p));
+		put_string(w, value ? value : "");
+		put_char(w, '\n');
+	}
+	else if (strcmp(name, "Exceptions") == 0 && a->length == 2 + 2 * count)
+	{
+		put_string(w, "Exceptions:\n");
+		w->indent += 1;
+		put_string(w, "throws ");
+		for (i = 0; i < count; i += 1)
+		{
+			if (i > 0)
+				put_string(w, ", ");
+			value = class_name_of(classFile, get16(p + 2 + 2 * i));
+			put_java_name(w, value ? value : "");
+		}
+		put_char(w, '\n');
+		w->indent -= 1;
+	}
+	else if ((strcmp(name, "Deprecated") == 0 || strcmp(name, "Synthetic") == 0) && a->length == 0)
+		put_format(w, "%s: true\n", name);
+	else if (strcmp(name, ATT_NAME_BOOTSTRAPMETHODS) == 0 && classFile->bootstrap_methods != NULL &&
+		a == find_attribute(classFile, name, classFile->attribute_count, classFile->attributes))
+		put_bootstrap_methods(w, classFile);
+	else if (strcmp(name, "LineNumberTable") == 0 && a->length == 2 + 4 * count)
+		put_line_numbers(w, a);
+	else if ((strcmp(name, "LocalVariableTable") == 0 || strcmp(name, "LocalVariableTypeTable") == 0) &&
+		a->length == 2 + 10 * count)
+		put_local_variables(w, classFile, a, name);
+	else if (strcmp(name, "InnerClasses") == 0 && a->length == 2 + 8 * count)
+		put_inner_classes(w, classFile, a);
+	else if ((strcmp(name, "RuntimeVisibleAnnotations") == 0 || strcmp(name, "RuntimeInvisibleAnnotations") == 0) &&
+		check_annotations(a, 0))
+		put_annotations(w, classFile, a, name);
+	else if ((strcmp(name, "RuntimeVisibleParameterAnnotations") == 0 || strcmp(name, "RuntimeInvisibleParameterAnnotations") == 0) &&
+		check_annotations(a, 1))
+		put_parameter_annotations(w, classFile, a, name);
+	else if (strcmp(name, "AnnotationDefault") == 0 && skip_element_value((const unsigned char*)a->buffer,
+		(const unsigned char*)a->buffer + a->length, 0) == (const unsigned char*)a->buffer + a->length)
+		put_annotation_default(w, classFile, a);
+	else if (strcmp(name, "EnclosingMethod") == 0 && a->length == 4)
+		put_enclosing_method(w, classFile, a);
+	else if (strcmp(name, "NestHost") == 0 && a->length == 2)
+	{
+		put_string(w, "NestHost: ");
+		put_constant(w, classFile, get16(p));
+		put_char(w, '\n');
+	}
+	else if (strcmp(name, "NestMembers") == 0 && a->length == 2 + 2 * count)
+		put_nest_members(w, classFile, a);
+	else if (strcmp(name, "MethodParameters") == 0 && a->length >= 1 && a->length == 1 + 4 * *p)
+		put_method_parameters(w, classFile, a);
+	else
+		put_hex_dump(w, classFile, a);
+}
+
+static void put_instruction(Writer* w, ClassFile* classFile, Attribute* codeAttribute, Instruction* ins, uint32_t pc)
+{
+	char mnemonic[32];
+	int i;
+
+	/* javap names the wide forms after the instruction they modify */
+	if (ins->opcode == OP_WIDE)
+	{
+		snprintf(mnemonic, sizeof(mnemonic), "%s_w", OpcodeNames[ins->opcode2]);
+		put_format(w, "%4u: %-13s ", pc, mnemonic);
+	}
+	else
+		put_format(w, "%4u: %-13s ", pc, OpcodeNames[ins->opcode]);
+
+	switch (ins->opcode)
+	{
+		case OP_BIPUSH:
+			put_format(w, "%d", (int8_t)ins->uint8);
+			break;
+
+		case OP_SIPUSH:
+			put_format(w, "%d", (int16_t)ins->uint16);
+			break;
+
+		case OP_LDC:
+		case OP_LDC_W:
+		case OP_LDC2_W:
+		case OP_GETSTATIC:
+		case OP_PUTSTATIC:
+		case OP_GETFIELD:
+		case OP_PUTFIELD:
+		case OP_INVOKEVIRTUAL:
+		case OP_INVOKESPECIAL:
+		case OP_INVOKESTATIC:
+		case OP_NEW:
+		case OP_ANEWARRAY:
+		case OP_CHECKCAST:
+		case OP_INSTANCEOF:
+			put_format(w, "#%hu", ins->constant);
+			tab(w);
+			put_string(w, "// ");
+			put_constant(w, classFile, ins->constant);
+			break;
+
+		case OP_INVOKEINTERFACE:
+		case OP_INVOKEDYNAMIC:
+		case OP_MULTIANEWARRAY:
+			/* The argument count of invokeinterface isn't decoded, so it
+				comes straight from the code */
+			if (ins->opcode == OP_MULTIANEWARRAY)
+				put_format(w, "#%hu,  %d", ins->constant, (uint8_t)ins->dimensions);
+			else if (ins->opcode == OP_INVOKEDYNAMIC)
+				put_format(w, "#%hu,  0", ins->constant);
+			else
+				put_format(w, "#%hu,  %d", ins->constant, codeAttribute->code.code[pc + 3]);
+			tab(w);
+			put_string(w, "// ");
+			put_constant(w, classFile, ins->constant);
+			break;
+
+		case OP_ILOAD:
+		case OP_LLOAD:
+		case OP_FLOAD:
+		case OP_DLOAD:
+		case OP_ALOAD:
+		case OP_ISTORE:
+		case OP_LSTORE:
+		case OP_FSTORE:
+		case OP_DSTORE:
+		case OP_ASTORE:
+		case OP_RET:
+			put_format(w, "%d", (uint8_t)ins->varIndex);
+			break;
+
+		case OP_IINC:
+			put_format(w, "%d, %d", (uint8_t)ins->varIndex, (int8_t)ins->value);
+			break;
+
+		case OP_WIDE:
+			if (ins->opcode2 == OP_IINC)
+				put_format(w, "%u, %d", ins->varIndex16, (int16_t)ins->value16);
+			else
+				put_format(w, "%u", ins->varIndex16);
+			break;
+
+		case OP_IFEQ:
+		case OP_IFNE:
+		case OP_IFLT:
+		case OP_IFGE:
+		case OP_IFGT:
+		case OP_IFLE:
+		case OP_IF_ICMPEQ:
+		case OP_IF_ICMPNE:
+		case OP_IF_ICMPLT:
+		case OP_IF_ICMPGE:
+		case OP_IF_ICMPGT:
+		case OP_IF_ICMPLE:
+		case OP_IF_ACMPEQ:
+		case OP_IF_ACMPNE:
+		case OP_GOTO:
+		case OP_JSR:
+		case OP_IFNULL:
+		case OP_IFNONNULL:
+			put_format(w, "%d", (int)pc + ins->branchoffset);
+			break;
+
+		case OP_GOTO_W:
+		case OP_JSR_W:
+			put_format(w, "%d", (int)pc + ins->branchoffset32);
+			break;
+
+		case OP_NEWARRAY:
+			if (ins->uint8 >= ATYPE_BOOLEAN && ins->uint8 <= ATYPE_LONG)
+				put_format(w, " %s", ArrayTypeNames[ins->uint8]);
+			else
+				put_format(w, " %d", ins->uint8);
+			break;
+
+		/* The cases line up under the pc, six columns in */
+		case OP_TABLESWITCH:
+			put_format(w, "{ // %d to %d", ins->low, ins->high);
+			for (i = 0; i <= ins->high - ins->low; i += 1)
+				put_format(w, "\n      %12d: %d", ins->low + i, (int)pc + ins->branchoffsets[i]);
+			put_format(w, "\n      %12s: %d", "default", (int)pc + ins->defaultoffset);
+			put_string(w, "\n      }");
+			break;
+
+		case OP_LOOKUPSWITCH:
+			put_format(w, "{ // %u", ins->npairs);
+			for (i = 0; i < ins->npairs; i += 1)
+				put_format(w, "\n      %12d: %d", ins->matches[i], (int)pc + ins->branchoffsets[i]);
+			put_format(w, "\n      %12s: %d", "default", (int)pc + ins->defaultoffset);
+			put_string(w, "\n      }");
+			break;
+	}
+
+	put_char(w, '\n');
+}
+
+static void put_code(Writer* w, ClassFile* classFile, Method* method, Attribute* codeAttribute)
+{
+	DecodedCode decoded;
+	ExceptionTableEntry* e;
+	Attribute* a;
+	const char* descriptor;
+	const char* type;
+	uint32_t i;
+	int phase;
+
+	descriptor = utf8_of(classFile, method->descriptor_index);
+
+	put_string(w, "Code:\n");
+	w->indent += 1;
+	put_format(w, "stack=%hu, locals=%hu, args_size=%d\n", codeAttribute->code.max_stack, codeAttribute->code.max_locals,
+		(descriptor ? parameter_count(descriptor) : 0) + !(method->access_flags & ACC_STATIC));
+
+	phase = STATS_PHASE(PHASE_DECODE);
+	decode_code(codeAttribute, &decoded);
+	STATS_PHASE(phase);
+
+	for (i = 0; i < decoded.count; i += 1)
+		put_instruction(w, classFile, codeAttribute, &decoded.instructions[i], decoded.pcs[i]);
+
+	free_decoded_code(&decoded);
+
+	if (codeAttribute->code.exception_table_length > 0)
+	{
+		put_string(w, "Exception table:\n");
+		w->indent += 1;
+		put_string(w, " from    to  target type\n");
+
+		e = codeAttribute->code.exception_table;
+		for (i = 0; i < codeAttribute->code.exception_table_length; i += 1, e += 1)
+		{
+			put_format(w, " %5hu %5hu %5hu   ", e->start_pc, e->end_pc, e->handler_pc);
+			if (e->catch_type == 0)
+				put_string(w, "any");
+			else
+			{
+				put_string(w, "Class ");
+				type = class_name_of(classFile, e->catch_type);
+				if (type != NULL)
+					put_name(w, type, strlen(type));
+			}
+			put_char(w, '\n');
+		}
+		w->indent -= 1;
+	}
+
+	for (i = 0, a = codeAttribute->code.attributes; i < codeAttribute->code.attribute_count; i += 1, a += 1)
+	{
+		if (strcmp(attribute_name(classFile, a), ATT_NAME_STACKMAPTABLE) != 0 || !put_stack_map(w, classFile, codeAttribute, a))
+			put_attribute(w, classFile, a);
+	}
+
+	w->indent -= 1;
+}
+
+static void put_field(Writer* w, ClassFile* classFile, Field* field)
+{
+	const char *name, *descriptor;
+	int i;
+
+	name = utf8_of(classFile, field->name_index);
+	descriptor = utf8_of(classFile, field->descriptor_index);
+	if (name == NULL || descriptor == NULL)
+		return;
+
+	put_modifiers(w, FieldModifiers, field->access_flags);
+	put_java_type(w, descriptor, 0);
+	put_format(w, " %s;\n", name);
+
+	w->indent += 1;
+	put_format(w, "descriptor: %s\n", descriptor);
+	put_flags(w, FieldFlags, field->access_flags);
+	for (i = 0; i < field->attribute_count; i += 1)
+		put_attribute(w, classFile, &field->attributes[i]);
+	w->indent -= 1;
+
+	/* Fields are always followed by a blank line, even the last one */
+	put_char(w, '\n');
+}
+
+static void put_method(Writer* w, ClassFile* classFile, Method* method)
+{
+	const char *name, *descriptor, *exception;
+	const unsigned char* p;
+	Attribute* a;
+	uint16_t flags = method->access_flags;
+	int i, count;
+
+	name = utf8_of(classFile, method->name_index);
+	descriptor = utf8_of(classFile, method->descriptor_index);
+	if (name == NULL || descriptor == NULL)
+		return;
+
+	put_modifiers(w, MethodModifiers, flags);
+
+	/* Non-abstract interface methods are default methods, from Java 8 */
+	if ((classFile->access_flags & ACC_INTERFACE) && !(flags & (ACC_ABSTRACT | ACC_STATIC | ACC_PRIVATE)) &&
+		method->special != METHOD_CLINIT && classFile->header.major >= 52)
+		put_string(w, "default ");
+
+	if (method->special == METHOD_INIT)
+	{
+		exception = class_name_of(classFile, classFile->this_class);
+		put_java_name(w, exception ? exception : "");
+		put_parameters(w, descriptor, flags & ACC_VARARGS);
+	}
+	else if (method->special == METHOD_CLINIT)
+		put_string(w, "{}");
+	else
+	{
+		put_java_type(w, strchr(descriptor, ')') ? strchr(descriptor, ')') + 1 : "V", 0);
+		put_format(w, " %s", name);
+		put_parameters(w, descriptor, flags & ACC_VARARGS);
+	}
+
+	a = find_attribute(classFile, "Exceptions", method->attribute_count, method->attributes);
+	if (a != NULL && a->type == ATT_UNKNOWN && a->length >= 2)
+	{
+		p = (const unsigned char*)a->buffer;
+		count = get16(p);
+		put_string(w, " throws ");
+		for (i = 0; i < count && 4 + 2 * i <= a->length; i += 1)
+		{
+			if (i > 0)
+				put_string(w, ", ");
+			exception = class_name_of(classFile, get16(p + 2 + 2 * i));
+			put_java_name(w, exception ? exception : "");
+		}
+	}
+	put_string(w, ";\n");
+
+	w->indent += 1;
+	put_format(w, "descriptor: %s\n", descriptor);
+	put_flags(w, MethodFlags, flags);
+
+	for (i = 0, a = method->attributes; i < method->attribute_count; i += 1, a += 1)
+	{
+		if (a->type == ATT_CODE)
+			put_code(w, classFile, method, a);
+		else
+			put_attribute(w, classFile, a);
+	}
+	w->indent -= 1;
+}
+
+/* The file is read again: the ClassFile doesn't keep its bytes */
+static void put_checksum(Writer* w, const char* filename, off_t size)
+{
+	uint8_t digest[MD5_DIGEST_SIZE];
+	char* buffer;
+	FILE* fp;
+	int i;
+
+	if ((fp = fopen(filename, "rb")) == NULL)
+		return;
+
+	buffer = malloc(size + 1);
+	if (fread(buffer, sizeof(char), size, fp) == (size_t)size)
+	{
+		md5(buffer, size, digest);
+		put_string(w, "MD5 checksum ");
+		for (i = 0; i < MD5_DIGEST_SIZE; i += 1)
+			put_format(w, "%02x", digest[i]);
+		put_char(w, '\n');
+	}
+
+	free(buffer);
+	fclose(fp);
+}
+
+static void put_file_header(Writer* w, ClassFile* classFile, const char* filename)
+{
+	static const char* Months[] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	char path[PATH_MAX];
+	struct stat st;
+	struct tm tm;
+	Attribute* a;
+	const char* source;
+
+	put_string(w, "Classfile ");
+	put_string(w, realpath(filename, path) ? path : filename);
+	put_char(w, '\n');
+
+	w->indent += 1;
+
+	/* Not available for classes that didn't come from a file (server mode) */
+	if (stat(filename, &st) == 0)
+	{
+		localtime_r(&st.st_mtime, &tm);
+		put_format(w, "Last modified %s %d, %d; size %ld bytes\n", Months[tm.tm_mon], tm.tm_mday, tm.tm_year + 1900, (long)st.st_size);
+		put_checksum(w, filename, st.st_size);
+	}
+
+	a = find_attribute(classFile, "SourceFile", classFile->attribute_count, classFile->attributes);
+	if (a != NULL && a->type == ATT_UNKNOWN && a->length == 2 &&
+		(source = utf8_of(classFile, get16((const unsigned char*)a->buffer))) != NULL)
+		put_format(w, "Compiled from \"%s\"\n", source);
+
+	w->indent -= 1;
+}
+
+static void put_class_header(Writer* w, ClassFile* classFile)
+{
+	const char *name, *super;
+	uint16_t flags = classFile->access_flags;
+	int i, interface = flags & ACC_INTERFACE;
+
+	name = class_name_of(classFile, classFile->this_class);
+	super = class_name_of(classFile, classFile->super_class);
+
+	put_modifiers(w, ClassModifiers, interface ? flags & ~ACC_ABSTRACT : flags);
+	put_string(w, interface ? "interface " : "class ");
+	put_java_name(w, name ? name : "");
+
+	if (!interface && super != NULL && strcmp(super, "java/lang/Object") != 0)
+	{
+		put_string(w, " extends ");
+		put_java_name(w, super);
+	}
+
+	for (i = 0; i < classFile->interface_count; i += 1)
+	{
+		put_string(w, i > 0 ? "," : interface ? " extends " : " implements ");
+		name = class_name_of(classFile, classFile->interfaces[i]);
+		put_java_name(w, name ? name : "");
+	}
+	put_char(w, '\n');
+
+	name = class_name_of(classFile, classFile->this_class);
+
+	w->indent += 1;
+	put_format(w, "minor version: %hu\n", classFile->header.minor);
+	put_format(w, "major version: %hu\n", classFile->header.major);
+	put_flags(w, ClassFlags, flags);
+
+	put_format(w, "this_class: #%hu", classFile->this_class);
+	tab(w);
+	put_string(w, "// ");
+	if (name != NULL)
+		put_name(w, name, strlen(name));
+	put_char(w, '\n');
+
+	put_format(w, "super_class: #%hu", classFile->super_class);
+	if (classFile->super_class != 0)
+	{
+		tab(w);
+		put_string(w, "// ");
+		if (super != NULL)
+			put_name(w, super, strlen(super));
+	}
+	put_char(w, '\n');
+
+	put_format(w, "interfaces: %hu, fields: %hu, methods: %hu, attributes: %hu\n",
+		classFile->interface_count, classFile->field_count, classFile->method_count, classFile->attribute_count);
+	w->indent -= 1;
+}
+
+void javap_class(FILE* fp, ClassFile* classFile, const char* filename)
+{
+	javap_class_ex(fp, classFile, filename, 0);
+}
+
+void javap_class_ex(FILE* fp, ClassFile* classFile, const char* filename, int flags)
+{
+	Writer writer = { fp, 0, 0, 0, flags }, *w = &writer;
+	int i, separate = 0;
+
+	put_file_header(w, classFile, filename);
+	put_class_header(w, classFile);
+	put_constant_pool(w, classFile);
+
+	put_string(w, "{\n");
+	w->indent += 1;
+
+	for (i = 0; i < classFile->field_count; i += 1)
+	{
+		if ((classFile->fields[i].access_flags & ACC_PRIVATE) && !(flags & JAVAP_PRIVATE))
+			continue;
+		put_field(w, classFile, &classFile->fields[i]);
+	}
+
+	for (i = 0; i < classFile->method_count; i += 1)
+	{
+		if ((classFile->methods[i].access_flags & ACC_PRIVATE) && !(flags & JAVAP_PRIVATE))
+			continue;
+
+		if (separate)
+			put_char(w, '\n');
+		put_method(w, classFile, &classFile->methods[i]);
+		separate = 1;
+	}
+
+	w->indent -= 1;
+	put_string(w, "}\n");
+
+	for (i = 0; i < classFile->attribute_count; i += 1)
+		put_attribute(w, classFile, &classFile->attributes[i]);
+}
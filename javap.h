@@ -0,0 +1,29 @@
+#ifndef JAVAP_H
+#define JAVAP_H
+
+#include <stdio.h>
+
+#include "classfile.h"
+
+/*
+	Text output in the layout of "javap -c -v" (as of JDK 11), so scripts
+	that parse javap can use this instead of starting a JVM per class.
+
+	The header with its MD5 checksum, flags, constant pool, members, code
+	listings, exception tables, line number, local variable and stack map
+	tables, inner classes, annotations (class, member, parameter and
+	default values), enclosing method, nest host and members, method
+	parameters and the simple member and class attributes follow javap
+	line by line, including its column padding. Not reproduced: generic
+	signatures in declarations (the erased descriptor types are shown),
+	and the detailed forms of the remaining attributes (type annotations,
+	Module, Record and the like), which are printed as a hex dump the way
+	javap prints attributes it does not know.
+*/
+
+#define JAVAP_PRIVATE 0x01 /* also list private members, as javap -p */
+
+void javap_class(FILE* fp, ClassFile* classFile, const char* filename);
+void javap_class_ex(FILE* fp, ClassFile* classFile, const char* filename, int flags);
+
+#endif
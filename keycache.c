@@ -0,0 +1,270 @@
+#include <errno.h>
+
+#include "keycache.h"
+
+/* Operands beyond this (large switches) are only counted */
+#define MAX_OPERANDS 64
+
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME  1099511628211ull
+
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t length)
+{
+	const unsigned char* p = data;
+
+	for ( ; length > 0; length -= 1, p += 1)
+		hash = (hash ^ *p) * FNV_PRIME;
+	return hash;
+}
+
+static uint64_t hash_int(uint64_t hash, int64_t value)
+{
+	return hash_bytes(hash, &value, sizeof(value));
+}
+
+static int has_constant_operand(uint8_t opcode)
+{
+	switch (opcode)
+	{
+		case OP_LDC:
+		case OP_LDC_W:
+		case OP_LDC2_W:
+		case OP_GETSTATIC:
+		case OP_PUTSTATIC:
+		case OP_GETFIELD:
+		case OP_PUTFIELD:
+		case OP_INVOKEVIRTUAL:
+		case OP_INVOKESPECIAL:
+		case OP_INVOKESTATIC:
+		case OP_INVOKEINTERFACE:
+		case OP_INVOKEDYNAMIC:
+		case OP_NEW:
+		case OP_ANEWARRAY:
+		case OP_CHECKCAST:
+		case OP_INSTANCEOF:
+		case OP_MULTIANEWARRAY:
+			return 1;
+	}
+	return 0;
+}
+
+static uint64_t hash_constant(uint64_t hash, ClassFile* classFile, int index)
+{
+	Constant* constant = find_constant(classFile, index);
+
+	if (constant == NULL)
+		return hash_int(hash, -1);
+
+	hash = hash_int(hash, constant->tag);
+	switch (constant->tag)
+	{
+		/* Numbers may take part in computing the key */
+		case TAG_INTEGER:
+			return hash_int(hash, constant->intval);
+		case TAG_FLOAT:
+			return hash_bytes(hash, &constant->floatval, sizeof(float));
+		case TAG_LONG:
+			return hash_int(hash, constant->longval);
+		case TAG_DOUBLE:
+			return hash_bytes(hash, &constant->doubleval, sizeof(double));
+	}
+	return hash;
+}
+
+uint64_t fingerprint_code(ClassFile* classFile, DecodedCode* decoded)
+{
+	int32_t operands[MAX_OPERANDS];
+	uint64_t hash = FNV_OFFSET;
+	Instruction* ins;
+	uint32_t i;
+	int j, count;
+
+	for (i = 0, ins = decoded->instructions; i < decoded->count; i += 1, ins += 1)
+	{
+		hash = hash_int(hash, ins->opcode);
+
+		count = get_instruction_operands(ins, decoded->pcs[i], operands, MAX_OPERANDS);
+		hash = hash_int(hash, count);
+
+		for (j = 0; j < count && j < MAX_OPERANDS; j += 1)
+		{
+			if (j == 0 && has_constant_operand(ins->opcode))
+				hash = hash_constant(hash, classFile, operands[0]);
+			else
+				hash = hash_int(hash, operands[j]);
+		}
+	}
+
+	/* 0 marks empty slots */
+	return hash ? hash : 1;
+}
+
+void init_key_cache(KeyCache* cache)
+{
+	cache->count = 0;
+	cache->capacity = 64;
+	cache->entries = calloc(cache->capacity, sizeof(CachedKey));
+	pthread_mutex_init(&cache->lock, NULL);
+}
+
+void free_key_cache(KeyCache* cache)
+{
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->count = cache->capacity = 0;
+	pthread_mutex_destroy(&cache->lock);
+}
+
+static CachedKey* find_slot(CachedKey* entries, uint32_t capacity, uint64_t fingerprint)
+{
+	uint32_t slot;
+
+	for (slot = fingerprint & (capacity - 1); entries[slot].fingerprint != 0; slot = (slot + 1) & (capacity - 1))
+	{
+		if (entries[slot].fingerprint == fingerprint)
+			break;
+	}
+	return entries + slot;
+}
+
+/* Returns the key length, 0 if the fingerprint is not known */
+int lookup_key(KeyCache* cache, uint64_t fingerprint, unsigned char* key)
+{
+	CachedKey* entry;
+	int keylen = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_slot(cache->entries, cache->capacity, fingerprint);
+	if (entry->fingerprint != 0)
+	{
+		keylen = entry->keylen;
+		memcpy(key, entry->key, keylen);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return keylen;
+}
+
+void store_key(KeyCache* cache, uint64_t fingerprint, const unsigned char* key, int keylen)
+{
+	CachedKey *entries, *entry;
+	uint32_t i, capacity;
+
+	if (keylen <= 0 || keylen > KEY_CACHE_MAX_KEY)
+		return;
+
+	pthread_mutex_lock(&cache->lock);
+
+	/* Keep the load factor at or below one half */
+	if (2 * (cache->count + 1) > cache->capacity)
+	{
+		capacity = cache->capacity * 2;
+		entries = calloc(capacity, sizeof(CachedKey));
+		for (i = 0; i < cache->capacity; i += 1)
+		{
+			if (cache->entries[i].fingerprint != 0)
+				*find_slot(entries, capacity, cache->entries[i].fingerprint) = cache->entries[i];
+		}
+		free(cache->entries);
+		cache->entries = entries;
+		cache->capacity = capacity;
+	}
+
+	entry = find_slot(cache->entries, cache->capacity, fingerprint);
+	if (entry->fingerprint == 0)
+		cache->count += 1;
+
+	entry->fingerprint = fingerprint;
+	entry->keylen = keylen;
+	memcpy(entry->key, key, keylen);
+
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+	The cache file has one line per key: the fingerprint and the key
+	bytes, both in hex.
+
+		8c0f1d2e3a4b5c6d 3a157e224c
+*/
+int load_key_cache(KeyCache* cache, const char* filename)
+{
+	unsigned char key[KEY_CACHE_MAX_KEY];
+	char line[2 * KEY_CACHE_MAX_KEY + 64], *p;
+	unsigned long long fingerprint;
+	unsigned int byte;
+	int keylen, offset, lineno = 0;
+	FILE* fp;
+
+	if ((fp = fopen(filename, "r")) == NULL)
+	{
+		/* Not an error, the file is created on save */
+		if (errno == ENOENT)
+			return 1;
+
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineno += 1;
+
+		if (sscanf(line, "%llx %n", &fingerprint, &offset) != 1 || fingerprint == 0)
+		{
+			fprintf(stderr, "%s:%d: Invalid key cache entry\n", filename, lineno);
+			continue;
+		}
+
+		for (keylen = 0, p = line + offset; keylen < KEY_CACHE_MAX_KEY && sscanf(p, "%2x", &byte) == 1; keylen += 1, p += 2)
+			key[keylen] = byte;
+
+		store_key(cache, fingerprint, key, keylen);
+	}
+
+	fclose(fp);
+	return 1;
+}
+
+static int compare_fingerprints(const void* a, const void* b)
+{
+	uint64_t fa = ((const CachedKey*)a)->fingerprint, fb = ((const CachedKey*)b)->fingerprint;
+	return fa < fb ? -1 : fa > fb;
+}
+
+int save_key_cache(KeyCache* cache, const char* filename)
+{
+	CachedKey* entries;
+	uint32_t i, count;
+	int j;
+	FILE* fp;
+
+	if ((fp = fopen(filename, "w")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return 0;
+	}
+
+	/* Sorted, so the file only changes when the keys do */
+	pthread_mutex_lock(&cache->lock);
+	entries = malloc(cache->count * sizeof(CachedKey));
+	for (i = count = 0; i < cache->capacity; i += 1)
+	{
+		if (cache->entries[i].fingerprint != 0)
+			entries[count++] = cache->entries[i];
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	qsort(entries, count, sizeof(CachedKey), compare_fingerprints);
+
+	for (i = 0; i < count; i += 1)
+	{
+		fprintf(fp, "%016llx ", (unsigned long long)entries[i].fingerprint);
+		for (j = 0; j < entries[i].keylen; j += 1)
+			fprintf(fp, "%02x", entries[i].key[j]);
+		fprintf(fp, "\n");
+	}
+
+	free(entries);
+	return fclose(fp) == 0;
+}
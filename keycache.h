@@ -0,0 +1,53 @@
+#ifndef KEYCACHE_H
+#define KEYCACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "classfile.h"
+#include "bytecode.h"
+
+/*
+	XOR keys by the fingerprint of the method they were found in.
+
+	Obfuscators reuse the same decryptor across the classes of an
+	application, so a method with a known fingerprint yields its key
+	without searching. The fingerprint keeps every immediate operand (the
+	key bytes are bipush operands) and the shape of the code, but replaces
+	constant pool indices, which differ from class to class, with the tag
+	(and for numbers, the value) of the constant they refer to.
+
+	Lookups and stores are synchronized, so one cache can be shared by
+	worker threads.
+*/
+
+#define KEY_CACHE_MAX_KEY 128
+
+typedef struct
+{
+	uint64_t fingerprint;     /* 0 if the slot is empty */
+	int keylen;
+	unsigned char key[KEY_CACHE_MAX_KEY];
+} CachedKey;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t capacity;        /* power of two */
+	CachedKey* entries;
+	pthread_mutex_t lock;
+} KeyCache;
+
+void init_key_cache(KeyCache* cache);
+void free_key_cache(KeyCache* cache);
+
+uint64_t fingerprint_code(ClassFile* classFile, DecodedCode* decoded);
+
+int lookup_key(KeyCache* cache, uint64_t fingerprint, unsigned char* key);
+void store_key(KeyCache* cache, uint64_t fingerprint, const unsigned char* key, int keylen);
+
+int load_key_cache(KeyCache* cache, const char* filename);
+int save_key_cache(KeyCache* cache, const char* filename);
+
+#endif
@@ -0,0 +1,429 @@
+#include <string.h>
+
+#include "liveness.h"
+
+/*
+	Both analyses are the usual iterative bit vector problems over the
+	blocks of the CFG, with per block summaries so the fixpoint loop only
+	touches whole words:
+
+	- liveness runs backwards with use/def sets over slots,
+	- def-use runs forwards with gen/kill sets over definitions (reaching
+	  definitions), then replays each block once to link every read of a
+	  slot to the definitions that can reach it.
+
+	An exception handler can be entered from anywhere inside a protected
+	block, so it sees the state at the start of the block as well as every
+	definition made in it. A ret block continues at an unknown jsr return
+	point: everything is live after it, and its reaching definitions flow
+	to the instruction after every jsr.
+*/
+
+int local_access(Instruction* ins, LocalAccess* access)
+{
+	uint8_t opcode = ins->opcode;
+	uint16_t slot = (uint8_t)ins->varIndex;
+
+	if (opcode == OP_WIDE)
+	{
+		opcode = ins->opcode2;
+		slot = ins->varIndex16;
+	}
+	else if (opcode >= OP_ILOAD_0 && opcode <= OP_ALOAD_3)
+	{
+		slot = (opcode - OP_ILOAD_0) % 4;
+		opcode = OP_ILOAD + (opcode - OP_ILOAD_0) / 4;
+	}
+	else if (opcode >= OP_ISTORE_0 && opcode <= OP_ASTORE_3)
+	{
+		slot = (opcode - OP_ISTORE_0) % 4;
+		opcode = OP_ISTORE + (opcode - OP_ISTORE_0) / 4;
+	}
+
+	if (opcode >= OP_ILOAD && opcode <= OP_ALOAD)
+		access->kind = ACCESS_USE;
+	else if (opcode >= OP_ISTORE && opcode <= OP_ASTORE)
+		access->kind = ACCESS_DEF;
+	else if (opcode == OP_IINC)
+		access->kind = ACCESS_USE | ACCESS_DEF;
+	else if (opcode == OP_RET)
+		access->kind = ACCESS_USE;
+	else
+		return 0;
+
+	access->slot = slot;
+	access->width = (opcode == OP_LLOAD || opcode == OP_DLOAD || opcode == OP_LSTORE || opcode == OP_DSTORE) ? 2 : 1;
+	return 1;
+}
+
+static int is_jsr(Instruction* ins)
+{
+	return ins->opcode == OP_JSR || ins->opcode == OP_JSR_W;
+}
+
+/* dst |= src, returns nonzero if dst changed */
+static int union_words(uint64_t* dst, uint64_t* src, uint32_t words)
+{
+	uint64_t changed = 0, w;
+	uint32_t i;
+
+	for (i = 0; i < words; i += 1)
+	{
+		w = dst[i] | src[i];
+		changed |= w ^ dst[i];
+		dst[i] = w;
+	}
+	return changed != 0;
+}
+
+void compute_liveness(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, Liveness* live)
+{
+	uint64_t *use, *def, *in, *out, *exc, *scratch, w;
+	uint32_t words, b, k, i, s;
+	BasicBlock* block;
+	LocalAccess access;
+	int changed;
+
+	live->max_locals = codeAttribute->code.max_locals;
+	live->words_per_set = words = (live->max_locals + 63) / 64;
+	live->block_count = cfg->block_count;
+	live->live_in = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	live->live_out = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+
+	use = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	def = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	scratch = arena_alloc(arena, words * sizeof(uint64_t) + 1);
+
+	/* Upward exposed uses and definitions of every block, walking it
+		backwards so a use after a def in the same block is not exposed */
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		for (i = block->first + block->count; i-- > block->first; )
+		{
+			if (!local_access(decoded->instructions + i, &access) || access.slot >= live->max_locals)
+				continue;
+
+			if (access.kind & ACCESS_DEF)
+			{
+				bitset_set(def + b * words, access.slot);
+				bitset_clear(use + b * words, access.slot);
+			}
+			if (access.kind & ACCESS_USE)
+				bitset_set(use + b * words, access.slot);
+		}
+
+		if (block->flags & BLOCK_RET)
+		{
+			out = live->live_out + b * words;
+			memset(out, 0xff, words * sizeof(uint64_t));
+			if (live->max_locals % 64)
+				out[words - 1] = ((uint64_t)1 << (live->max_locals % 64)) - 1;
+		}
+	}
+
+	/* Reverse pc order visits most successors first */
+	do
+	{
+		changed = 0;
+		for (b = cfg->block_count; b-- > 0; )
+		{
+			block = cfg->blocks + b;
+			in = live->live_in + b * words;
+			out = live->live_out + b * words;
+
+			memset(scratch, 0, words * sizeof(uint64_t));
+			for (k = 0; k < block->succ_count; k += 1)
+			{
+				s = cfg->successors[block->succ_start + k];
+				exc = live->live_in + s * words;
+
+				if (cfg->successor_kinds[block->succ_start + k] == EDGE_EXCEPTION)
+					union_words(scratch, exc, words);
+				union_words(out, exc, words);
+			}
+
+			for (i = 0; i < words; i += 1)
+			{
+				w = use[b * words + i] | (out[i] & ~def[b * words + i]) | scratch[i];
+				if (w != in[i])
+				{
+					in[i] = w;
+					changed = 1;
+				}
+			}
+		}
+	} while (changed);
+}
+
+/* Slots live just before instruction index executes */
+void live_before(Liveness* live, DecodedCode* decoded, ControlFlowGraph* cfg, uint32_t index, uint64_t* set)
+{
+	uint32_t b = cfg->block_of[index], words = live->words_per_set, i, k;
+	BasicBlock* block = cfg->blocks + b;
+	LocalAccess access;
+
+	memcpy(set, live->live_out + b * words, words * sizeof(uint64_t));
+
+	for (i = block->first + block->count; i-- > index; )
+	{
+		if (!local_access(decoded->instructions + i, &access) || access.slot >= live->max_locals)
+			continue;
+
+		if (access.kind & ACCESS_DEF)
+			bitset_clear(set, access.slot);
+		if (access.kind & ACCESS_USE)
+			bitset_set(set, access.slot);
+	}
+
+	for (k = 0; k < block->succ_count; k += 1)
+	{
+		if (cfg->successor_kinds[block->succ_start + k] == EDGE_EXCEPTION)
+			union_words(set, live->live_in + cfg->successors[block->succ_start + k] * words, words);
+	}
+}
+
+typedef struct
+{
+	uint32_t words;
+	uint8_t* def_width;
+	uint32_t* slot_start;     /* definitions of slot s are numbered slot_start[s] .. slot_start[s + 1] - 1 */
+	uint8_t* slot_wide;       /* nonzero if a long or double is stored in the slot */
+} Definitions;
+
+/* Sets (or clears) the bits lo .. hi - 1 a word at a time */
+static void fill_range(uint64_t* set, uint32_t lo, uint32_t hi, int value)
+{
+	uint64_t mask;
+
+	while (lo < hi)
+	{
+		mask = ~(uint64_t)0 << (lo & 63);
+		if ((lo | 63) >= hi)
+			mask &= ~(uint64_t)0 >> (63 - ((hi - 1) & 63));
+
+		if (value)
+			set[lo >> 6] |= mask;
+		else
+			set[lo >> 6] &= ~mask;
+		lo = (lo | 63) + 1;
+	}
+}
+
+/* Applies definition d to a reaching set: every other definition of the
+	slots it overwrites is killed */
+static void apply_def(Definitions* defs, DefUse* du, uint32_t max_locals, uint32_t d, uint64_t* set, uint64_t* kill)
+{
+	uint32_t s = du->def_slot[d], last = s + defs->def_width[d] - 1, x;
+
+	if (last >= max_locals)
+		last = max_locals - 1;
+
+	fill_range(set, defs->slot_start[s], defs->slot_start[last + 1], 0);
+	if (kill != NULL)
+		fill_range(kill, defs->slot_start[s], defs->slot_start[last + 1], 1);
+
+	/* A long or double in the slot below also loses its second half */
+	if (s > 0 && defs->slot_wide[s - 1])
+	{
+		for (x = defs->slot_start[s - 1]; x < defs->slot_start[s]; x += 1)
+		{
+			if (defs->def_width[x] == 2)
+			{
+				bitset_clear(set, x);
+				if (kill != NULL)
+					bitset_set(kill, x);
+			}
+		}
+	}
+
+	bitset_set(set, d);
+}
+
+/* Replays each block from its reaching set, counting (or storing) the
+	definitions that reach every read */
+static void link_uses(DecodedCode* decoded, ControlFlowGraph* cfg, Definitions* defs, DefUse* du,
+	uint32_t max_locals, uint64_t* in, uint64_t* current, int fill)
+{
+	uint32_t b, i, lo, hi, word, d, n = 0;
+	uint64_t bits;
+	BasicBlock* block;
+	LocalAccess access;
+
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		memcpy(current, in + b * defs->words, defs->words * sizeof(uint64_t));
+
+		for (i = block->first; i < block->first + block->count; i += 1)
+		{
+			if (!fill)
+				du->reach_start[i] = n;
+
+			if (!local_access(decoded->instructions + i, &access) || access.slot >= max_locals)
+				continue;
+
+			if (access.kind & ACCESS_USE)
+			{
+				lo = defs->slot_start[access.slot];
+				hi = defs->slot_start[access.slot + 1];
+				for (word = lo >> 6; word <= (hi - 1) >> 6; word += 1)
+				{
+					bits = current[word];
+					while (bits != 0)
+					{
+						d = (word << 6) + __builtin_ctzll(bits);
+						bits &= bits - 1;
+						if (d < lo || d >= hi)
+							continue;
+						if (fill)
+							du->reaching[n] = d;
+						n += 1;
+					}
+				}
+			}
+
+			if (access.kind & ACCESS_DEF)
+				apply_def(defs, du, max_locals, du->def_at[i], current, NULL);
+		}
+	}
+
+	if (!fill)
+		du->reach_start[decoded->count] = n;
+}
+
+void build_def_use(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, DefUse* du)
+{
+	uint32_t max_locals = codeAttribute->code.max_locals, words, count, b, i, k, p, d, s, *next, *fill;
+	uint64_t *in, *out, *gen, *kill, *all, *ret_out, *scratch, w;
+	Definitions defs;
+	BasicBlock* block;
+	LocalAccess access;
+	int changed;
+
+	/* Definitions are grouped by slot, so each slot owns a contiguous range
+		of bits: its value on entry first, then its stores in instruction
+		order */
+	defs.slot_start = arena_calloc(arena, max_locals + 1, sizeof(uint32_t));
+	defs.slot_wide = arena_calloc(arena, max_locals + 1, 1);
+	for (s = 0; s < max_locals; s += 1)
+		defs.slot_start[s + 1] = 1;
+	for (i = 0; i < decoded->count; i += 1)
+	{
+		if (local_access(decoded->instructions + i, &access) && (access.kind & ACCESS_DEF) && access.slot < max_locals)
+			defs.slot_start[access.slot + 1] += 1;
+	}
+	for (s = 0; s < max_locals; s += 1)
+		defs.slot_start[s + 1] += defs.slot_start[s];
+
+	du->def_count = count = defs.slot_start[max_locals];
+	du->def_instruction = arena_alloc(arena, count * sizeof(uint32_t) + 1);
+	du->def_slot = arena_alloc(arena, count * sizeof(uint16_t) + 1);
+	du->def_at = arena_alloc(arena, decoded->count * sizeof(uint32_t) + 1);
+	defs.def_width = arena_alloc(arena, count + 1);
+	next = arena_alloc(arena, max_locals * sizeof(uint32_t) + 1);
+
+	for (s = 0; s < max_locals; s += 1)
+	{
+		d = defs.slot_start[s];
+		du->def_instruction[d] = DEF_ENTRY;
+		du->def_slot[d] = s;
+		defs.def_width[d] = 1;
+		next[s] = d + 1;
+	}
+	for (i = 0; i < decoded->count; i += 1)
+	{
+		du->def_at[i] = UINT32_MAX;
+		if (!local_access(decoded->instructions + i, &access) || !(access.kind & ACCESS_DEF) || access.slot >= max_locals)
+			continue;
+
+		du->def_at[i] = d = next[access.slot]++;
+		du->def_instruction[d] = i;
+		du->def_slot[d] = access.slot;
+		defs.def_width[d] = access.width;
+		if (access.width == 2)
+			defs.slot_wide[access.slot] = 1;
+	}
+
+	defs.words = words = (count + 63) / 64;
+	in = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	out = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	gen = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	kill = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	all = arena_calloc(arena, (size_t)cfg->block_count * words, sizeof(uint64_t));
+	ret_out = arena_calloc(arena, words + 1, sizeof(uint64_t));
+	scratch = arena_alloc(arena, words * sizeof(uint64_t) + 1);
+
+	for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+	{
+		for (i = block->first; i < block->first + block->count; i += 1)
+		{
+			if ((d = du->def_at[i]) == UINT32_MAX)
+				continue;
+			apply_def(&defs, du, max_locals, d, gen + b * words, kill + b * words);
+			bitset_set(all + b * words, d);
+		}
+	}
+
+	do
+	{
+		changed = 0;
+		for (b = 0, block = cfg->blocks; b < cfg->block_count; b += 1, block += 1)
+		{
+			memset(scratch, 0, words * sizeof(uint64_t));
+			if (b == 0)
+			{
+				for (s = 0; s < max_locals; s += 1)
+					bitset_set(scratch, defs.slot_start[s]);
+			}
+
+			for (k = 0; k < block->pred_count; k += 1)
+			{
+				p = cfg->predecessors[block->pred_start + k];
+				if (cfg->predecessor_kinds[block->pred_start + k] == EDGE_EXCEPTION)
+				{
+					union_words(scratch, in + p * words, words);
+					union_words(scratch, all + p * words, words);
+				}
+				else
+					union_words(scratch, out + p * words, words);
+			}
+
+			/* The return point of a subroutine call */
+			if (b > 0 && is_jsr(decoded->instructions + cfg->blocks[b - 1].first + cfg->blocks[b - 1].count - 1))
+				union_words(scratch, ret_out, words);
+
+			memcpy(in + b * words, scratch, words * sizeof(uint64_t));
+			for (i = 0; i < words; i += 1)
+			{
+				w = gen[b * words + i] | (scratch[i] & ~kill[b * words + i]);
+				if (w != out[b * words + i])
+				{
+					out[b * words + i] = w;
+					changed = 1;
+				}
+			}
+
+			if ((block->flags & BLOCK_RET) && union_words(ret_out, out + b * words, words))
+				changed = 1;
+		}
+	} while (changed);
+
+	/* Definitions reaching each read, then the same links inverted */
+	du->reach_start = arena_alloc(arena, (decoded->count + 1) * sizeof(uint32_t));
+	link_uses(decoded, cfg, &defs, du, max_locals, in, scratch, 0);
+	du->reaching = arena_alloc(arena, du->reach_start[decoded->count] * sizeof(uint32_t) + 1);
+	link_uses(decoded, cfg, &defs, du, max_locals, in, scratch, 1);
+
+	du->use_start = arena_calloc(arena, count + 2, sizeof(uint32_t));
+	du->uses = arena_alloc(arena, du->reach_start[decoded->count] * sizeof(uint32_t) + 1);
+	for (k = 0; k < du->reach_start[decoded->count]; k += 1)
+		du->use_start[du->reaching[k] + 2] += 1;
+	for (d = 0; d < count; d += 1)
+		du->use_start[d + 2] += du->use_start[d + 1];
+
+	fill = du->use_start + 1;
+	for (i = 0; i < decoded->count; i += 1)
+	{
+		for (k = du->reach_start[i]; k < du->reach_start[i + 1]; k += 1)
+			du->uses[fill[du->reaching[k]]++] = i;
+	}
+}
@@ -0,0 +1,67 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <stdint.h>
+
+#include "cfg.h"
+#include "arena.h"
+
+/*
+	Liveness and def-use chains of the local variable slots of a method.
+
+	Sets of locals are bitsets of max_locals bits, stored as words of 64
+	bits; live_in and live_out hold one set per block, words_per_set words
+	apart. A long or double occupies two slots but is tracked by its first
+	one. All arrays are allocated from the arena passed in and stay valid
+	until it is reset.
+*/
+
+#define ACCESS_USE 0x01 /* reads the slot (load, iinc, ret) */
+#define ACCESS_DEF 0x02 /* writes the slot (store, iinc) */
+
+typedef struct
+{
+	uint16_t slot;
+	uint8_t width;            /* 2 for long and double */
+	uint8_t kind;             /* ACCESS_USE and/or ACCESS_DEF */
+} LocalAccess;
+
+typedef struct
+{
+	uint32_t max_locals;
+	uint32_t words_per_set;
+	uint32_t block_count;
+	uint64_t* live_in;        /* live on entry to each block */
+	uint64_t* live_out;       /* live on exit from each block */
+} Liveness;
+
+/* Value of a slot on method entry (a parameter, or nothing) */
+#define DEF_ENTRY UINT32_MAX
+
+typedef struct
+{
+	uint32_t def_count;
+	uint32_t* def_instruction; /* instruction index of each definition, DEF_ENTRY for slot values on entry */
+	uint16_t* def_slot;
+	uint32_t* def_at;          /* instruction index -> the definition it makes, UINT32_MAX if none */
+
+	/* Instructions reading each definition: uses[use_start[d] .. use_start[d + 1]) */
+	uint32_t* use_start;
+	uint32_t* uses;
+
+	/* Definitions reaching each instruction that reads a local:
+		reaching[reach_start[i] .. reach_start[i + 1]), by instruction index */
+	uint32_t* reach_start;
+	uint32_t* reaching;
+} DefUse;
+
+#define bitset_test(set, bit) (((set)[(bit) >> 6] >> ((bit) & 63)) & 1)
+#define bitset_set(set, bit) ((set)[(bit) >> 6] |= (uint64_t)1 << ((bit) & 63))
+#define bitset_clear(set, bit) ((set)[(bit) >> 6] &= ~((uint64_t)1 << ((bit) & 63)))
+
+int local_access(Instruction* ins, LocalAccess* access);
+void compute_liveness(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, Liveness* live);
+void live_before(Liveness* live, DecodedCode* decoded, ControlFlowGraph* cfg, uint32_t index, uint64_t* set);
+void build_def_use(Attribute* codeAttribute, DecodedCode* decoded, ControlFlowGraph* cfg, Arena* arena, DefUse* du);
+
+#endif
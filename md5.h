@@ -0,0 +1,16 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	MD5 (RFC 1321), for the checksum line of the javap output; not for
+	anything that needs a secure hash.
+*/
+
+#define MD5_DIGEST_SIZE 16
+
+void md5(const void* data, size_t size, uint8_t* digest);
+
+#endif
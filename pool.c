@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pool.h"
+#include "stats.h"
+
+/* Number of slots of the pool, from the index of its last constant */
+static uint32_t slot_count(ClassFile* classFile)
+{
+	Constant* last;
+
+	if (classFile->constant_count == 0)
+		return 1;
+
+	last = classFile->constants + classFile->constant_count - 1;
+	return last->index + ((last->tag == TAG_LONG || last->tag == TAG_DOUBLE) ? 2 : 1);
+}
+
+/* Returns 0 if a constant has an index out of order */
+int build_constant_pool(ClassFile* classFile, ConstantPool* pool)
+{
+	Constant* c;
+	uint32_t i, text_size = 0, blocks;
+	uint64_t bits;
+
+	memset(pool, 0, sizeof(ConstantPool));
+	pool->slot_count = slot_count(classFile);
+
+	/* Sizes first, so that every array is allocated once */
+	for (i = 0, c = classFile->constants; i < classFile->constant_count; i += 1, c += 1)
+	{
+		switch (c->tag)
+		{
+			case TAG_STRING:
+				pool->string_count += 1;
+				text_size += c->length + 1;
+				break;
+
+			case TAG_INTEGER:
+			case TAG_FLOAT:
+			case TAG_LONG:
+			case TAG_DOUBLE:
+				pool->numeric_count += 1;
+				break;
+
+			default:
+				pool->ref_count += 1;
+		}
+	}
+
+	/* One block more, as a scan may start at any slot */
+	blocks = (pool->slot_count + POOL_TAG_BLOCK - 1) / POOL_TAG_BLOCK + 1;
+	pool->tags = calloc(blocks, POOL_TAG_BLOCK);
+	pool->records = calloc(pool->slot_count, sizeof(uint16_t));
+	pool->refs = malloc(pool->ref_count * sizeof(uint32_t) + 1);
+	pool->numerics = malloc(pool->numeric_count * sizeof(uint64_t) + 1);
+	pool->strings = malloc(pool->string_count * sizeof(StringSpan) + 1);
+	pool->text = malloc(text_size + 1);
+	STAT_ADD(allocations, 6);
+
+	pool->ref_count = pool->numeric_count = pool->string_count = text_size = 0;
+
+	for (i = 0, c = classFile->constants; i < classFile->constant_count; i += 1, c += 1)
+	{
+		if (c->index <= 0 || (uint32_t)c->index >= pool->slot_count || pool->tags[c->index] != 0)
+		{
+			free_constant_pool(pool);
+			return 0;
+		}
+
+		pool->tags[c->index] = c->tag;
+
+		switch (c->tag)
+		{
+			case TAG_STRING:
+				pool->records[c->index] = pool->string_count;
+				pool->strings[pool->string_count].offset = text_size;
+				pool->strings[pool->string_count].length = c->length;
+				memcpy(pool->text + text_size, c->buffer, c->length);
+				pool->text[text_size + c->length] = '\0';
+				pool->string_count += 1;
+				text_size += c->length + 1;
+				continue;
+
+			case TAG_INTEGER:
+				bits = (uint32_t)c->intval;
+				break;
+
+			case TAG_FLOAT:
+				bits = 0;
+				memcpy(&bits, &c->floatval, sizeof(float));
+				break;
+
+			case TAG_LONG:
+				bits = c->longval;
+				break;
+
+			case TAG_DOUBLE:
+				memcpy(&bits, &c->doubleval, sizeof(double));
+				break;
+
+			case TAG_CLASSREF:
+			case TAG_STRINGREF:
+			case TAG_METHODTYPE:
+			case TAG_MODULE:
+			case TAG_PACKAGE:
+				pool->records[c->index] = pool->ref_count;
+				pool->refs[pool->ref_count++] = (uint32_t)c->ref << 16;
+				continue;
+
+			case TAG_METHODHANDLE:
+				pool->records[c->index] = pool->ref_count;
+				pool->refs[pool->ref_count++] = (uint32_t)c->refkind << 16 | c->handleref;
+				continue;
+
+			case TAG_TYPEDESC:
+				pool->records[c->index] = pool->ref_count;
+				pool->refs[pool->ref_count++] = (uint32_t)c->nameref << 16 | c->typeref;
+				continue;
+
+			default:
+				/* TAG_FIELDREF, TAG_METHODREF, TAG_IFACEREF, TAG_DYNAMIC, TAG_INVOKEDYNAMIC */
+				pool->records[c->index] = pool->ref_count;
+				pool->refs[pool->ref_count++] = (uint32_t)c->classref << 16 | c->typedescref;
+				continue;
+		}
+
+		pool->records[c->index] = pool->numeric_count;
+		pool->numerics[pool->numeric_count++] = bits;
+	}
+
+	return 1;
+}
+
+void free_constant_pool(ConstantPool* pool)
+{
+	free(pool->tags);
+	free(pool->records);
+	free(pool->refs);
+	free(pool->numerics);
+	free(pool->strings);
+	free(pool->text);
+	memset(pool, 0, sizeof(ConstantPool));
+}
+
+/* Bytes held by the pool, for comparison with its Constants */
+size_t constant_pool_size(ConstantPool* pool)
+{
+	size_t size = pool->slot_count * (sizeof(uint8_t) + sizeof(uint16_t));
+	uint32_t i;
+
+	size += pool->ref_count * sizeof(uint32_t);
+	size += pool->numeric_count * sizeof(uint64_t);
+	size += pool->string_count * sizeof(StringSpan);
+	for (i = 0; i < pool->string_count; i += 1)
+		size += pool->strings[i].length + 1;
+	return size;
+}
+
+/* First slot at or after slot with the given tag, slot_count if there is
+	none. Slots are compared POOL_TAG_BLOCK at a time. */
+uint32_t find_next_tag(ConstantPool* pool, uint8_t tag, uint32_t slot)
+{
+#ifdef __SSE2__
+	const __m128i needle = _mm_set1_epi8(tag);
+	uint32_t mask;
+
+	/* The padding keeps the last load within the array */
+	for ( ; slot < pool->slot_count; slot += POOL_TAG_BLOCK)
+	{
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pool->tags + slot)), needle));
+		if (mask != 0)
+		{
+			slot += __builtin_ctz(mask);
+			return slot < pool->slot_count ? slot : pool->slot_count;
+		}
+	}
+#else
+	for ( ; slot < pool->slot_count; slot += 1)
+	{
+		if (pool->tags[slot] == tag)
+			return slot;
+	}
+#endif
+
+	return pool->slot_count;
+}
+
+float pool_float(ConstantPool* pool, uint32_t slot)
+{
+	uint32_t bits = (uint32_t)pool->numerics[pool->records[slot]];
+	float value;
+
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+double pool_double(ConstantPool* pool, uint32_t slot)
+{
+	double value;
+
+	memcpy(&value, pool->numerics + pool->records[slot], sizeof(double));
+	return value;
+}
@@ -0,0 +1,70 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+	The constant pool of a class as a structure of arrays, for passes that
+	only look at some of the constants: finding the string constants is a
+	scan of one byte per slot, rather than a walk over 24-byte Constants.
+
+	Every slot has a tag (0 for slot 0, the second slot of a long or double
+	and any slot the class leaves out) and a record number into the array
+	for its kind of constant:
+
+	  refs      the one or two pool indices of the reference tags, first
+	            in the high half (the reference kind of a method handle,
+	            the bootstrap method of a dynamic constant)
+	  numerics  the bits of an int, float, long or double
+	  strings   offset and length of the contents of a string constant in
+	            text, where they are terminated
+
+	so a ref takes 7 bytes in all and a number 11, against the 24 of a
+	Constant. tags is padded with zeros to a whole POOL_TAG_BLOCK past its
+	last slot, so a block can be loaded from any slot.
+*/
+
+#define POOL_TAG_BLOCK 16
+
+typedef struct
+{
+	uint32_t offset;
+	uint32_t length;
+} StringSpan;
+
+typedef struct
+{
+	uint32_t slot_count;      /* constant_pool_count */
+	uint8_t* tags;
+	uint16_t* records;
+
+	uint32_t ref_count;
+	uint32_t* refs;
+	uint32_t numeric_count;
+	uint64_t* numerics;
+	uint32_t string_count;
+	StringSpan* strings;
+	char* text;
+} ConstantPool;
+
+#define POOL_TAG(pool, slot) ((uint32_t)(slot) < (pool)->slot_count ? (pool)->tags[slot] : 0)
+
+/* Only valid for a slot of the right tag */
+#define POOL_REF(pool, slot)     ((uint16_t)((pool)->refs[(pool)->records[slot]] >> 16))
+#define POOL_REF2(pool, slot)    ((uint16_t)(pool)->refs[(pool)->records[slot]])
+#define POOL_INT(pool, slot)     ((int32_t)(pool)->numerics[(pool)->records[slot]])
+#define POOL_LONG(pool, slot)    ((int64_t)(pool)->numerics[(pool)->records[slot]])
+#define POOL_STRING(pool, slot)  ((pool)->text + (pool)->strings[(pool)->records[slot]].offset)
+#define POOL_STRING_LENGTH(pool, slot) ((pool)->strings[(pool)->records[slot]].length)
+
+int build_constant_pool(ClassFile* classFile, ConstantPool* pool);
+void free_constant_pool(ConstantPool* pool);
+size_t constant_pool_size(ConstantPool* pool);
+
+uint32_t find_next_tag(ConstantPool* pool, uint8_t tag, uint32_t slot);
+float pool_float(ConstantPool* pool, uint32_t slot);
+double pool_double(ConstantPool* pool, uint32_t slot);
+
+#endif
@@ -0,0 +1,493 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+#include "classfile.h"
+
+#define get16(p) (((p)[0] << 8) | (p)[1])
+#define get32(p) (((uint32_t)(p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+
+#define CHECKPOINTS (65536 / SCAN_STRIDE)
+
+/* Nesting of annotations in element values before a class is rejected */
+#define MAX_ELEMENT_DEPTH 32
+
+/* Annotation types already matched in the current class, by pool index */
+#define TYPE_CACHE_SIZE 64
+
+/* The first entry at or after each multiple of SCAN_STRIDE; a slot after
+	a long or double is no entry of its own */
+typedef struct
+{
+	const unsigned char* pool;
+	size_t size;
+	uint16_t count;
+	uint16_t index[CHECKPOINTS];
+	uint32_t offset[CHECKPOINTS];
+} Checkpoints;
+
+/* Returns the size of the pool, 0 if it is malformed */
+static size_t walk_pool(Checkpoints* cp, const unsigned char* pool, size_t size)
+{
+	size_t offset = 2, length;
+	uint32_t i, next = 0;
+
+	if (size < 2)
+		return 0;
+
+	cp->pool = pool;
+	cp->size = size;
+	cp->count = get16(pool);
+
+	for (i = 1; i < cp->count; i += 1)
+	{
+		for ( ; next * SCAN_STRIDE <= i; next += 1)
+		{
+			cp->index[next] = i;
+			cp->offset[next] = offset;
+		}
+
+		if ((length = constant_entry_size(pool, size, offset)) == 0)
+			return 0;
+
+		if (pool[offset] == TAG_LONG || pool[offset] == TAG_DOUBLE)
+			i += 1;
+		offset += length;
+	}
+
+	/* A stride that only holds the second slot of a long has no entry */
+	for ( ; next * SCAN_STRIDE < cp->count; next += 1)
+	{
+		cp->index[next] = cp->count;
+		cp->offset[next] = offset;
+	}
+
+	return offset <= size ? offset : 0;
+}
+
+/* Offset of entry index in the pool, 0 if there is no such entry */
+static size_t find_entry(Checkpoints* cp, uint16_t index)
+{
+	size_t offset;
+	uint32_t i;
+
+	if (index == 0 || index >= cp->count)
+		return 0;
+
+	i = cp->index[index / SCAN_STRIDE];
+	offset = cp->offset[index / SCAN_STRIDE];
+
+	for ( ; i < index; i += 1)
+	{
+		if (cp->pool[offset] == TAG_LONG || cp->pool[offset] == TAG_DOUBLE)
+			i += 1;
+		offset += constant_entry_size(cp->pool, cp->size, offset);
+	}
+
+	return i == index ? offset : 0;
+}
+
+static int string_entry(Checkpoints* cp, uint16_t index, ScanName* name)
+{
+	size_t offset;
+
+	offset = find_entry(cp, index);
+	if (offset == 0 || cp->pool[offset] != TAG_STRING)
+		return 0;
+
+	name->data = (const char*)cp->pool + offset + 3;
+	name->length = get16(cp->pool + offset + 1);
+	return 1;
+}
+
+static int class_name(Checkpoints* cp, uint16_t classref, ScanName* name)
+{
+	size_t offset;
+
+	offset = find_entry(cp, classref);
+	if (offset == 0 || cp->pool[offset] != TAG_CLASSREF)
+		return 0;
+
+	return string_entry(cp, get16(cp->pool + offset + 1), name);
+}
+
+/* Returns 0 if the buffer is not a class file or is cut short before
+	the end of the interface list */
+int scan_class_header(const void* buffer, size_t size, ClassHeader* header)
+{
+	const unsigned char *data = buffer, *p;
+	Checkpoints cp;
+
+	if (size < sizeof(ClassFileHeader) || get32(data) != MAGIC)
+		return 0;
+
+	header->minor = get16(data + 4);
+	header->major = get16(data + 6);
+
+	header->pool_size = walk_pool(&cp, data + sizeof(ClassFileHeader), size - sizeof(ClassFileHeader));
+	if (header->pool_size == 0 || size - sizeof(ClassFileHeader) - header->pool_size < 8)
+		return 0;
+
+	p = data + sizeof(ClassFileHeader) + header->pool_size;
+	header->access_flags = get16(p);
+	header->this_class = get16(p + 2);
+	header->super_class = get16(p + 4);
+	header->interface_count = get16(p + 6);
+	header->interfaces = p + 8 - data;
+	header->members = header->interfaces + 2 * (uint32_t)header->interface_count;
+	if (header->members > size)
+		return 0;
+
+	header->super_name.data = NULL;
+	header->super_name.length = 0;
+	return class_name(&cp, header->this_class, &header->name) &&
+		(header->super_class == 0 || class_name(&cp, header->super_class, &header->super_name));
+}
+
+/* Name of the class a classref names; walks the whole pool */
+int scan_class_name(const void* buffer, size_t size, uint16_t classref, ScanName* name)
+{
+	Checkpoints cp;
+
+	if (size < sizeof(ClassFileHeader) || walk_pool(&cp, (const unsigned char*)buffer + sizeof(ClassFileHeader), size - sizeof(ClassFileHeader)) == 0)
+		return 0;
+	return class_name(&cp, classref, name);
+}
+
+int scan_interface_name(const void* buffer, size_t size, ClassHeader* header, uint16_t i, ScanName* name)
+{
+	if (i >= header->interface_count)
+		return 0;
+	return scan_class_name(buffer, size, get16((const unsigned char*)buffer + header->interfaces + 2 * i), name);
+}
+
+void init_annotation_targets(AnnotationTargets* targets)
+{
+	memset(targets, 0, sizeof(AnnotationTargets));
+}
+
+void free_annotation_targets(AnnotationTargets* targets)
+{
+	uint32_t i;
+
+	for (i = 0; i < targets->count; i += 1)
+		free(targets->descriptors[i]);
+	free(targets->descriptors);
+	free(targets->hashes);
+	free(targets->slots);
+	init_annotation_targets(targets);
+}
+
+/* FNV-1a */
+static uint32_t hash_name(const char* data, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < length; i += 1)
+		hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+	return hash;
+}
+
+/* Target with the given descriptor, -1 if there is none */
+static int32_t find_target(AnnotationTargets* targets, const char* data, size_t length)
+{
+	uint32_t hash, slot;
+	int32_t target;
+
+	if (targets->slots == NULL)
+		return -1;
+
+	hash = hash_name(data, length);
+	for (slot = hash & targets->slot_mask; (target = targets->slots[slot]) >= 0; slot = (slot + 1) & targets->slot_mask)
+	{
+		if (targets->hashes[target] == hash && strlen(targets->descriptors[target]) == length
+			&& memcmp(targets->descriptors[target], data, length) == 0)
+			return target;
+	}
+	return -1;
+}
+
+/* Slots are kept at most half full */
+static void rehash_targets(AnnotationTargets* targets, uint32_t slot_count)
+{
+	uint32_t i, slot;
+
+	free(targets->slots);
+	targets->slots = malloc(slot_count * sizeof(int32_t));
+	targets->slot_mask = slot_count - 1;
+	memset(targets->slots, 0xFF, slot_count * sizeof(int32_t));
+
+	for (i = 0; i < targets->count; i += 1)
+	{
+		for (slot = targets->hashes[i] & targets->slot_mask; targets->slots[slot] >= 0; slot = (slot + 1) & targets->slot_mask)
+			;
+		targets->slots[slot] = i;
+	}
+}
+
+/* Accepts a type descriptor, an internal name or a Java class name, and
+	returns the index of the target */
+int add_annotation_target(AnnotationTargets* targets, const char* name)
+{
+	size_t length = strlen(name);
+	char *descriptor, *c;
+	int32_t target;
+
+	descriptor = malloc(length + 3);
+	if (name[0] == 'L' && length > 2 && name[length - 1] == ';')
+		strcpy(descriptor, name);
+	else
+		sprintf(descriptor, "L%s;", name);
+
+	for (c = descriptor; *c != '\0'; c += 1)
+	{
+		if (*c == '.')
+			*c = '/';
+	}
+
+	if ((target = find_target(targets, descriptor, strlen(descriptor))) >= 0)
+	{
+		free(descriptor);
+		return target;
+	}
+
+	if (targets->count == targets->capacity)
+	{
+		targets->capacity = targets->capacity ? 2 * targets->capacity : 8;
+		targets->descriptors = realloc(targets->descriptors, targets->capacity * sizeof(char*));
+		targets->hashes = realloc(targets->hashes, targets->capacity * sizeof(uint32_t));
+	}
+
+	targets->descriptors[targets->count] = descriptor;
+	targets->hashes[targets->count] = hash_name(descriptor, strlen(descriptor));
+	targets->count += 1;
+
+	if (targets->slots == NULL || 2 * targets->count > targets->slot_mask + 1)
+		rehash_targets(targets, targets->slots == NULL ? 16 : 2 * (targets->slot_mask + 1));
+	else
+		rehash_targets(targets, targets->slot_mask + 1);
+
+	return targets->count - 1;
+}
+
+void free_annotation_hits(AnnotationHits* hits)
+{
+	free(hits->hits);
+	memset(hits, 0, sizeof(AnnotationHits));
+}
+
+typedef struct
+{
+	Checkpoints cp;
+	const unsigned char* end;
+	AnnotationTargets* targets;
+	AnnotationHits* hits;
+	uint16_t annotations_name;  /* pool index of "RuntimeVisibleAnnotations" */
+
+	uint16_t cached_type[TYPE_CACHE_SIZE];
+	int32_t cached_target[TYPE_CACHE_SIZE];
+} AnnotationScan;
+
+/* Index of a string entry with the given contents, 0 if there is none;
+	walks the whole pool, as a class without annotations is not worth
+	scanning any further */
+static uint16_t find_string(Checkpoints* cp, const char* string)
+{
+	size_t offset = 2, length = strlen(string);
+	uint32_t i;
+
+	for (i = 1; i < cp->count; i += 1)
+	{
+		if (cp->pool[offset] == TAG_STRING && get16(cp->pool + offset + 1) == length
+			&& memcmp(cp->pool + offset + 3, string, length) == 0)
+			return i;
+
+		if (cp->pool[offset] == TAG_LONG || cp->pool[offset] == TAG_DOUBLE)
+			i += 1;
+		offset += constant_entry_size(cp->pool, cp->size, offset);
+	}
+	return 0;
+}
+
+/* Target an annotation type is, -1 if it is none */
+static int32_t match_type(AnnotationScan* scan, uint16_t type)
+{
+	int slot = type % TYPE_CACHE_SIZE;
+	ScanName descriptor;
+
+	if (scan->cached_type[slot] != type)
+	{
+		scan->cached_type[slot] = type;
+		scan->cached_target[slot] = string_entry(&scan->cp, type, &descriptor)
+			? find_target(scan->targets, descriptor.data, descriptor.length) : -1;
+	}
+	return scan->cached_target[slot];
+}
+
+static void add_hit(AnnotationHits* hits, uint8_t kind, uint32_t target, ScanName* name, ScanName* descriptor)
+{
+	AnnotationHit* hit;
+
+	if (hits->count == hits->capacity)
+	{
+		hits->capacity = hits->capacity ? 2 * hits->capacity : 16;
+		hits->hits = realloc(hits->hits, hits->capacity * sizeof(AnnotationHit));
+	}
+
+	hit = hits->hits + hits->count++;
+	hit->kind = kind;
+	hit->target = target;
+	hit->name = *name;
+	hit->descriptor = *descriptor;
+}
+
+/* Returns the end of the element_value at p, NULL if it is malformed or
+	runs past end */
+const unsigned char* skip_element_value(const unsigned char* p, const unsigned char* end, int depth)
+{
+	uint16_t count;
+
+	if (p >= end)
+		return NULL;
+
+	switch (*p++)
+	{
+		case 'B': case 'C': case 'D': case 'F': case 'I':
+		case 'J': case 'S': case 'Z': case 's': case 'c':
+			p += 2;
+			break;
+
+		case 'e':
+			p += 4;
+			break;
+
+		case '@':
+			return skip_annotation(p, end, depth + 1);
+
+		case '[':
+			if (p + 2 > end || depth >= MAX_ELEMENT_DEPTH)
+				return NULL;
+			for (count = get16(p), p += 2; count > 0 && p != NULL; count -= 1)
+				p = skip_element_value(p, end, depth + 1);
+			return p;
+
+		default:
+			return NULL;
+	}
+
+	return p <= end ? p : NULL;
+}
+
+/* The same for an annotation (type_index, element_value_pairs) */
+const unsigned char* skip_annotation(const unsigned char* p, const unsigned char* end, int depth)
+{
+	uint16_t count;
+
+	if (p + 4 > end || depth >= MAX_ELEMENT_DEPTH)
+		return NULL;
+
+	for (count = get16(p + 2), p += 4; count > 0 && p != NULL; count -= 1)
+		p = p + 2 <= end ? skip_element_value(p + 2, end, depth) : NULL;
+	return p;
+}
+
+/* Matches the annotations in the attributes at p, returning the end of
+	the attributes or NULL if they are malformed */
+static const unsigned char* scan_attributes(AnnotationScan* scan, const unsigned char* p, uint8_t kind, ScanName* name, ScanName* descriptor)
+{
+	const unsigned char *next, *annotation;
+	uint16_t count, annotations;
+	int32_t target;
+
+	if (p + 2 > scan->end)
+		return NULL;
+
+	for (count = get16(p), p += 2; count > 0; count -= 1, p = next)
+	{
+		if (p + 6 > scan->end || (size_t)(scan->end - p - 6) < get32(p + 2))
+			return NULL;
+		next = p + 6 + get32(p + 2);
+
+		if (get16(p) != scan->annotations_name)
+			continue;
+
+		/* Bounded by the attribute, not by the class */
+		annotation = p + 6;
+		if (annotation + 2 > next)
+			return NULL;
+
+		for (annotations = get16(annotation), annotation += 2; annotations > 0; annotations -= 1)
+		{
+			if (annotation + 4 > next)
+				return NULL;
+
+			if ((target = match_type(scan, get16(annotation))) >= 0)
+				add_hit(scan->hits, kind, target, name, descriptor);
+
+			if ((annotation = skip_annotation(annotation, next, 0)) == NULL)
+				return NULL;
+		}
+	}
+
+	return p;
+}
+
+static const unsigned char* scan_members(AnnotationScan* scan, const unsigned char* p, uint8_t kind)
+{
+	ScanName name, descriptor;
+	uint16_t count;
+
+	if (p + 2 > scan->end)
+		return NULL;
+
+	for (count = get16(p), p += 2; count > 0 && p != NULL; count -= 1)
+	{
+		if (p + 6 > scan->end || !string_entry(&scan->cp, get16(p + 2), &name)
+			|| !string_entry(&scan->cp, get16(p + 4), &descriptor))
+			return NULL;
+		p = scan_attributes(scan, p + 6, kind, &name, &descriptor);
+	}
+	return p;
+}
+
+/* Appends the annotations of the class that are targets to the hits.
+	Returns the number of hits in the class, -1 if it is malformed. */
+int scan_annotations(const void* buffer, size_t size, AnnotationTargets* targets, AnnotationHits* hits)
+{
+	const unsigned char *data = buffer, *p;
+	AnnotationScan scan;
+	ScanName name, none = { NULL, 0 };
+	uint32_t first = hits->count, pool_size;
+
+	if (size < sizeof(ClassFileHeader) || get32(data) != MAGIC)
+		return -1;
+
+	pool_size = walk_pool(&scan.cp, data + sizeof(ClassFileHeader), size - sizeof(ClassFileHeader));
+	if (pool_size == 0 || size - sizeof(ClassFileHeader) - pool_size < 8)
+		return -1;
+
+	if (targets->count == 0 || (scan.annotations_name = find_string(&scan.cp, ATT_NAME_RUNTIMEVISIBLEANNOTATIONS)) == 0)
+		return 0;
+
+	scan.end = data + size;
+	scan.targets = targets;
+	scan.hits = hits;
+	memset(scan.cached_type, 0, sizeof(scan.cached_type));
+	memset(scan.cached_target, 0xFF, sizeof(scan.cached_target));
+
+	p = data + sizeof(ClassFileHeader) + pool_size;
+	if (!class_name(&scan.cp, get16(p + 2), &name) || (size_t)(scan.end - p - 8) < 2 * (uint32_t)get16(p + 6))
+		return -1;
+	p += 8 + 2 * (uint32_t)get16(p + 6);
+
+	if ((p = scan_members(&scan, p, ANNOTATED_FIELD)) == NULL
+		|| (p = scan_members(&scan, p, ANNOTATED_METHOD)) == NULL
+		|| scan_attributes(&scan, p, ANNOTATED_CLASS, &name, &none) == NULL)
+	{
+		hits->count = first;
+		return -1;
+	}
+
+	return hits->count - first;
+}
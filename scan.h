@@ -0,0 +1,102 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+	Quick scan of a class file in memory, for indexing a classpath: the
+	version, access flags, class, superclass and interfaces, without
+	decoding a single constant or member.
+
+	The constant pool is walked once by tag length, keeping the offset of
+	every SCAN_STRIDE-th entry on the stack, so looking up the class names
+	afterwards is a walk of less than SCAN_STRIDE entries. Nothing is
+	allocated: names point into the buffer, in the internal form
+	("java/lang/String") and modified UTF-8, and are not terminated.
+*/
+
+#define SCAN_STRIDE 64
+
+typedef struct
+{
+	const char* data;
+	uint16_t length;
+} ScanName;
+
+typedef struct
+{
+	uint16_t minor;
+	uint16_t major;
+	uint16_t access_flags;
+	uint16_t this_class;
+	uint16_t super_class;     /* 0 for java/lang/Object and module-info */
+	uint16_t interface_count;
+
+	uint32_t pool_size;       /* from the constant_pool_count on */
+	uint32_t interfaces;      /* offset of the interface indices in the buffer */
+	uint32_t members;         /* offset of fields_count, where a full parse would go on */
+
+	ScanName name;
+	ScanName super_name;      /* data is NULL without a superclass */
+} ClassHeader;
+
+/*
+	Annotation scan: the RuntimeVisibleAnnotations of the class, its fields
+	and its methods, matched against a set of annotation types. Members are
+	skipped by their attribute lengths, and no attribute other than the
+	annotations is looked at; a class whose pool has no
+	"RuntimeVisibleAnnotations" string is rejected after the pool walk.
+
+	Targets are kept as type descriptors ("Ljavax/inject/Named;") in an
+	open-addressed table of their hashes, so each annotation costs one hash
+	of its descriptor in the pool, and a compare only when the hash matches.
+*/
+
+#define ANNOTATED_CLASS  0
+#define ANNOTATED_FIELD  1
+#define ANNOTATED_METHOD 2
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t capacity;
+	char** descriptors;
+	uint32_t* hashes;         /* of each descriptor */
+
+	uint32_t slot_mask;
+	int32_t* slots;           /* target index, -1 for an empty slot */
+} AnnotationTargets;
+
+typedef struct
+{
+	uint8_t kind;             /* ANNOTATED_* */
+	uint32_t target;          /* index into the targets */
+	ScanName name;            /* of the member, or of the class */
+	ScanName descriptor;      /* of the member; data is NULL for the class */
+} AnnotationHit;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t capacity;
+	AnnotationHit* hits;
+} AnnotationHits;
+
+int scan_class_header(const void* buffer, size_t size, ClassHeader* header);
+int scan_class_name(const void* buffer, size_t size, uint16_t classref, ScanName* name);
+int scan_interface_name(const void* buffer, size_t size, ClassHeader* header, uint16_t i, ScanName* name);
+
+void init_annotation_targets(AnnotationTargets* targets);
+int add_annotation_target(AnnotationTargets* targets, const char* name);
+void free_annotation_targets(AnnotationTargets* targets);
+
+int scan_annotations(const void* buffer, size_t size, AnnotationTargets* targets, AnnotationHits* hits);
+void free_annotation_hits(AnnotationHits* hits);
+
+/* Bounds checked walks over annotations in memory, for any reader of
+	annotation attributes; depth is 0 at the top level */
+const unsigned char* skip_annotation(const unsigned char* p, const unsigned char* end, int depth);
+const unsigned char* skip_element_value(const unsigned char* p, const unsigned char* end, int depth);
+
+#endif
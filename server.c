@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+/*
+	Protocol
+
+	A connection carries any number of requests. Clients may send several
+	requests before reading any response (pipelining); responses are always
+	returned in request order. A request is a single line, optionally
+	followed by a payload:
+
+		PATH <filename>          a class file on the server's filesystem
+		CLASS <length> [<name>]  followed by <length> bytes of class data
+		QUIT                     close the connection
+
+	A CLASS request without a length gets an error and the connection is
+	closed, since its payload can't be told from the next request.
+
+	Every request gets exactly one response: a status line followed by
+	<length> bytes of text (the disassembly, or an error message).
+
+		OK <length>
+		ERROR <length>
+
+	Each worker thread accepts and serves one connection at a time, so up
+	to <workers> clients are served concurrently; others wait in the
+	listen backlog.
+*/
+
+#define MAX_REQUEST_LINE 4096
+#define MAX_CLASS_SIZE   (64 * 1024 * 1024)
+
+typedef struct
+{
+	int listener;
+	ClassHandler handler;
+} Server;
+
+typedef struct
+{
+	Server* server;
+	pthread_t thread;
+
+	/* Class data buffer, kept across requests */
+	char* buffer;
+	size_t buffer_size;
+} Worker;
+
+static void send_response(FILE* out, const char* status, const char* text, size_t length)
+{
+	fprintf(out, "%s %zu\n", status, length);
+	fwrite(text, sizeof(char), length, out);
+	fflush(out);
+}
+
+static void send_error(FILE* out, const char* format, ...)
+{
+	char message[MAX_REQUEST_LINE + 64];
+	va_list args;
+	int length;
+
+	va_start(args, format);
+	length = vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+
+	if (length >= sizeof(message))
+		length = sizeof(message) - 1;
+
+	send_response(out, "ERROR", message, length);
+}
+
+/* Sets name to NULL if the request has no length, as there is then no
+	telling where its payload ends */
+static ClassFile* read_request_class(Worker* worker, FILE* in, const char* arguments, const char** name)
+{
+	char skip[4096], *end;
+	unsigned long length;
+	size_t count;
+
+	if (*arguments < '0' || *arguments > '9')
+	{
+		*name = NULL;
+		return NULL;
+	}
+
+	length = strtoul(arguments, &end, 10);
+	while (*end == ' ')
+		end += 1;
+	*name = *end ? end : "<data>";
+
+	/* Skipped, so that the next request is read from its start */
+	if (length > MAX_CLASS_SIZE)
+	{
+		while (length > 0 && (count = fread(skip, sizeof(char), length < sizeof(skip) ? length : sizeof(skip), in)) > 0)
+			length -= count;
+		return NULL;
+	}
+
+	if (length > worker->buffer_size)
+	{
+		worker->buffer = realloc(worker->buffer, length);
+		worker->buffer_size = length;
+	}
+
+	if (fread(worker->buffer, sizeof(char), length, in) < length)
+		return NULL;
+
+	return read_class_buffer(worker->buffer, length);
+}
+
+static void handle_connection(Worker* worker, int fd)
+{
+	FILE *in, *out, *text;
+	ClassFile* classFile;
+	char line[MAX_REQUEST_LINE], *textbuf, *newline;
+	const char* name;
+	size_t textsize;
+
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	if (in == NULL || out == NULL)
+	{
+		perror("fdopen");
+		if (in != NULL) fclose(in); else close(fd);
+		if (out != NULL) fclose(out);
+		return;
+	}
+
+	while (fgets(line, sizeof(line), in) != NULL)
+	{
+		if ((newline = strchr(line, '\n')) == NULL)
+		{
+			send_error(out, "request line too long\n");
+			break;
+		}
+		*newline = '\0';
+
+		if (strncmp(line, "PATH ", 5) == 0)
+		{
+			name = line + 5;
+			classFile = read_class_file(name);
+		}
+		else if (strncmp(line, "CLASS ", 6) == 0)
+		{
+			classFile = read_request_class(worker, in, line + 6, &name);
+			if (name == NULL)
+			{
+				send_error(out, "bad request: %s\n", line);
+				break;
+			}
+			if (classFile == NULL && feof(in))
+				break;
+		}
+		else if (strcmp(line, "QUIT") == 0)
+		{
+			break;
+		}
+		else
+		{
+			send_error(out, "unknown request: %s\n", line);
+			continue;
+		}
+
+		if (classFile == NULL)
+		{
+			send_error(out, "unable to read class file: %s\n", name);
+			continue;
+		}
+
+		if ((text = open_memstream(&textbuf, &textsize)) == NULL)
+		{
+			perror("open_memstream");
+			free_class(classFile);
+			break;
+		}
+
+		worker->server->handler(text, classFile, name);
+		fclose(text);
+		free_class(classFile);
+
+		send_response(out, "OK", textbuf, textsize);
+		free(textbuf);
+
+		if (ferror(out))
+			break;
+	}
+
+	fclose(in);
+	fclose(out);
+}
+
+static void* worker_main(void* arg)
+{
+	Worker* worker = arg;
+	int fd;
+
+	for (;;)
+	{
+		if ((fd = accept(worker->server->listener, NULL, NULL)) < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			perror("accept");
+			break;
+		}
+
+		handle_connection(worker, fd);
+	}
+
+	free(worker->buffer);
+	return NULL;
+}
+
+int run_server(const char* socket_path, int workers, ClassHandler handler)
+{
+	struct sockaddr_un address;
+	Server server;
+	Worker* pool;
+	int i;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Socket path too long: '%s'\n", socket_path);
+		return 0;
+	}
+
+	if (workers < 1)
+		workers = 1;
+
+	/* A client going away must not take the whole server down */
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((server.listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	{
+		perror("socket");
+		return 0;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	unlink(socket_path);
+	if (bind(server.listener, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+		listen(server.listener, SOMAXCONN) < 0)
+	{
+		perror("bind");
+		close(server.listener);
+		return 0;
+	}
+
+	server.handler = handler;
+
+	pool = calloc(workers, sizeof(Worker));
+	for (i = 0; i < workers; i += 1)
+	{
+		pool[i].server = &server;
+		if (pthread_create(&pool[i].thread, NULL, worker_main, &pool[i]) != 0)
+		{
+			fprintf(stderr, "Unable to start worker thread %d\n", i);
+			workers = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < workers; i += 1)
+		pthread_join(pool[i].thread, NULL);
+
+	free(pool);
+	close(server.listener);
+	unlink(socket_path);
+
+	return workers > 0;
+}
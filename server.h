@@ -0,0 +1,13 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+
+#include "classfile.h"
+
+/* Writes the response text for one class; called from the worker threads */
+typedef void (*ClassHandler)(FILE* fp, ClassFile* classFile, const char* name);
+
+int run_server(const char* socket_path, int workers, ClassHandler handler);
+
+#endif
@@ -0,0 +1,535 @@
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "sources.h"
+#include "stats.h"
+
+/* Zip structures are little-endian and unaligned */
+#define get16(p) ((uint16_t)((p)[0] | (p)[1] << 8))
+#define get32(p) ((uint32_t)((p)[0] | (p)[1] << 8 | (p)[2] << 16 | (uint32_t)(p)[3] << 24))
+
+#define ZIP_LOCAL_HEADER      0x04034b50
+#define ZIP_CENTRAL_HEADER    0x02014b50
+#define ZIP_END_OF_DIRECTORY  0x06054b50
+
+#define ZIP_LOCAL_HEADER_SIZE   30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE            22
+#define ZIP_MAX_COMMENT         0xFFFF
+
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+static int has_suffix(const char* string, const char* suffix)
+{
+	size_t length = strlen(string), suffix_length = strlen(suffix);
+	return length >= suffix_length && strcmp(string + length - suffix_length, suffix) == 0;
+}
+
+static int is_archive(const char* path)
+{
+	return has_suffix(path, ".jar") || has_suffix(path, ".zip");
+}
+
+static ClassSource* add_source(ClassSources* sources, char* name, int archive)
+{
+	ClassSource* source;
+
+	if (sources->count == sources->capacity)
+	{
+		sources->capacity = sources->capacity ? sources->capacity * 2 : 64;
+		sources->sources = realloc(sources->sources, sources->capacity * sizeof(ClassSource));
+	}
+
+	source = sources->sources + sources->count++;
+	memset(source, 0, sizeof(ClassSource));
+	source->name = name;
+	source->archive = archive;
+	return source;
+}
+
+static int add_archive(ClassSources* sources, const char* path)
+{
+	unsigned char *tail, header[ZIP_CENTRAL_HEADER_SIZE];
+	uint32_t directory_offset;
+	int i, entry_count, archive, name_length, skip;
+	long size, start;
+	size_t path_length;
+	ClassSource* source;
+	char* name;
+	FILE* fp;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	/* The end of central directory record is followed by a comment of up
+		to 64K, so it has to be searched for backwards */
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	start = size > ZIP_END_SIZE + ZIP_MAX_COMMENT ? size - (ZIP_END_SIZE + ZIP_MAX_COMMENT) : 0;
+
+	tail = malloc(size - start);
+	fseek(fp, start, SEEK_SET);
+	size = fread(tail, sizeof(char), size - start, fp);
+
+	for (i = size - ZIP_END_SIZE; i >= 0; i -= 1)
+	{
+		if (get32(tail + i) == ZIP_END_OF_DIRECTORY)
+			break;
+	}
+
+	if (i < 0)
+	{
+		fprintf(stderr, "%s: Not a zip archive\n", path);
+		free(tail);
+		fclose(fp);
+		return 0;
+	}
+
+	entry_count = get16(tail + i + 10);
+	directory_offset = get32(tail + i + 16);
+	free(tail);
+
+	if (entry_count == 0xFFFF || directory_offset == 0xFFFFFFFF)
+	{
+		fprintf(stderr, "%s: Zip64 archives are not supported\n", path);
+		fclose(fp);
+		return 0;
+	}
+
+	archive = sources->archive_count++;
+	sources->archives = realloc(sources->archives, sources->archive_count * sizeof(char*));
+	sources->archives[archive] = strdup(path);
+	path_length = strlen(path);
+
+	fseek(fp, directory_offset, SEEK_SET);
+	for (i = 0; i < entry_count; i += 1)
+	{
+		if (fread(header, sizeof(header), 1, fp) != 1 || get32(header) != ZIP_CENTRAL_HEADER)
+		{
+			fprintf(stderr, "%s: Corrupt central directory\n", path);
+			break;
+		}
+
+		name_length = get16(header + 28);
+		skip = get16(header + 30) + get16(header + 32);
+
+		/* "archive!entry" */
+		name = malloc(path_length + 1 + name_length + 1);
+		sprintf(name, "%s!", path);
+		if (fread(name + path_length + 1, sizeof(char), name_length, fp) != name_length)
+		{
+			free(name);
+			fprintf(stderr, "%s: Corrupt central directory\n", path);
+			break;
+		}
+		name[path_length + 1 + name_length] = '\0';
+		fseek(fp, skip, SEEK_CUR);
+
+		if (!has_suffix(name, ".class"))
+		{
+			free(name);
+			continue;
+		}
+
+		/* Bit 0: encrypted */
+		if (get16(header + 8) & 1)
+		{
+			fprintf(stderr, "%s: Encrypted entries are not supported\n", name);
+			free(name);
+			continue;
+		}
+
+		source = add_source(sources, name, archive);
+		source->method = get16(header + 10);
+		source->compressed_size = get32(header + 20);
+		source->size = get32(header + 24);
+		source->offset = get32(header + 42);
+	}
+
+	fclose(fp);
+	return 1;
+}
+
+static int compare_entries(const struct dirent** a, const struct dirent** b)
+{
+	/* Not alphasort(), which depends on the locale */
+	return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static int add_directory(ClassSources* sources, const char* path)
+{
+	struct dirent** entries;
+	struct stat st;
+	char* name;
+	int i, count, result = 1;
+
+	if ((count = scandir(path, &entries, NULL, compare_entries)) < 0)
+	{
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	for (i = 0; i < count; i += 1)
+	{
+		name = NULL;
+		if (entries[i]->d_name[0] == '.' && (entries[i]->d_name[1] == '\0' ||
+			(entries[i]->d_name[1] == '.' && entries[i]->d_name[2] == '\0')))
+			goto next;
+
+		name = malloc(strlen(path) + 1 + strlen(entries[i]->d_name) + 1);
+		sprintf(name, "%s/%s", path, entries[i]->d_name);
+
+		if (stat(name, &st) != 0)
+			goto next;
+
+		if (S_ISDIR(st.st_mode))
+			result &= add_directory(sources, name);
+		else if (is_archive(name))
+			result &= add_archive(sources, name);
+		else if (has_suffix(name, ".class"))
+		{
+			add_source(sources, name, -1);
+			name = NULL;
+		}
+
+next:
+		free(name);
+		free(entries[i]);
+	}
+
+	free(entries);
+	return result;
+}
+
+/*
+	Adds the classes found at path: a directory, a jar/zip archive or a
+	single class file. Directories are listed in name order and archives
+	in central directory order, so the result is the same on every run.
+	Returns 0 if (part of) path could not be read.
+*/
+int add_class_sources(ClassSources* sources, const char* path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0)
+	{
+		if (S_ISDIR(st.st_mode))
+			return add_directory(sources, path);
+		if (is_archive(path))
+			return add_archive(sources, path);
+	}
+
+	/* Anything else is left for read_class_file to complain about */
+	add_source(sources, strdup(path), -1);
+	return 1;
+}
+
+void free_class_sources(ClassSources* sources)
+{
+	int i;
+
+	for (i = 0; i < sources->count; i += 1)
+		free(sources->sources[i].name);
+	free(sources->sources);
+
+	for (i = 0; i < sources->archive_count; i += 1)
+		free(sources->archives[i]);
+	free(sources->archives);
+
+	memset(sources, 0, sizeof(ClassSources));
+}
+
+void init_source_reader(SourceReader* reader)
+{
+	memset(reader, 0, sizeof(SourceReader));
+	reader->archive = -1;
+}
+
+void free_source_reader(SourceReader* reader)
+{
+	if (reader->fp != NULL)
+		fclose(reader->fp);
+	free(reader->compressed);
+	free(reader->data);
+	init_source_reader(reader);
+}
+
+static unsigned char* reserve(unsigned char** buffer, size_t* capacity, size_t size)
+{
+	if (size > *capacity)
+	{
+		*capacity = size;
+		*buffer = realloc(*buffer, size);
+	}
+	return *buffer;
+}
+
+/* Returns the class bytes in reader->data, NULL if the entry can't be read */
+static unsigned char* load_archive_entry(ClassSources* sources, ClassSource* source, SourceReader* reader, FILE* err)
+{
+	unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+	z_stream stream;
+	int result;
+
+	if (reader->archive != source->archive)
+	{
+		if (reader->fp != NULL)
+			fclose(reader->fp);
+
+		reader->archive = source->archive;
+		if ((reader->fp = fopen(sources->archives[source->archive], "rb")) == NULL)
+		{
+			fprintf(err, "%s: %s\n", sources->archives[source->archive], strerror(errno));
+			reader->archive = -1;
+			return NULL;
+		}
+	}
+
+	/* The sizes in the local header may be deferred to a data descriptor,
+		so only the name and extra field lengths are used */
+	if (fseek(reader->fp, source->offset, SEEK_SET) != 0
+		|| fread(header, sizeof(header), 1, reader->fp) != 1
+		|| get32(header) != ZIP_LOCAL_HEADER)
+	{
+		fprintf(err, "%s: Corrupt local header\n", source->name);
+		return NULL;
+	}
+
+	fseek(reader->fp, get16(header + 26) + get16(header + 28), SEEK_CUR);
+
+	if (source->method == ZIP_STORED)
+	{
+		reserve(&reader->data, &reader->data_capacity, source->size);
+		if (fread(reader->data, sizeof(char), source->size, reader->fp) != source->size)
+		{
+			fprintf(err, "%s: Truncated entry\n", source->name);
+			return NULL;
+		}
+		STAT_ADD(bytes_read, source->size);
+		return reader->data;
+	}
+
+	if (source->method != ZIP_DEFLATED)
+	{
+		fprintf(err, "%s: Unsupported compression method %d\n", source->name, source->method);
+		return NULL;
+	}
+
+	reserve(&reader->compressed, &reader->compressed_capacity, source->compressed_size);
+	reserve(&reader->data, &reader->data_capacity, source->size);
+	if (fread(reader->compressed, sizeof(char), source->compressed_size, reader->fp) != source->compressed_size)
+	{
+		fprintf(err, "%s: Truncated entry\n", source->name);
+		return NULL;
+	}
+	STAT_ADD(bytes_read, source->compressed_size);
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = reader->compressed;
+	stream.avail_in = source->compressed_size;
+	stream.next_out = reader->data;
+	stream.avail_out = source->size;
+
+	/* Negative window bits: raw deflate data, without a zlib header */
+	inflateInit2(&stream, -MAX_WBITS);
+	result = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+
+	if (result != Z_STREAM_END || stream.total_out != source->size)
+	{
+		fprintf(err, "%s: Unable to inflate entry\n", source->name);
+		return NULL;
+	}
+
+	return reader->data;
+}
+
+/* The bytes of a class, without parsing it; they stay in the reader until
+	the next class is loaded */
+const unsigned char* load_class_source(ClassSources* sources, ClassSource* source, SourceReader* reader, size_t* size, FILE* err)
+{
+	unsigned char* data;
+	FILE* fp;
+	long length;
+	int phase;
+
+	phase = STATS_PHASE(PHASE_IO);
+
+	if (source->archive >= 0)
+	{
+		data = load_archive_entry(sources, source, reader, err);
+		*size = source->size;
+		STATS_PHASE(phase);
+		return data;
+	}
+
+	if ((fp = fopen(source->name, "rb")) == NULL)
+	{
+		fprintf(err, "%s: %s\n", source->name, strerror(errno));
+		STATS_PHASE(phase);
+		return NULL;
+	}
+
+	data = NULL;
+	if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+	{
+		data = reserve(&reader->data, &reader->data_capacity, length);
+		*size = fread(data, sizeof(char), length, fp);
+		STAT_ADD(bytes_read, *size);
+	}
+	else
+		fprintf(err, "%s: Unable to read file\n", source->name);
+
+	fclose(fp);
+	STATS_PHASE(phase);
+	return data;
+}
+
+/* Messages about the source go to err, so that a worker can keep them
+	with the rest of the class's output */
+ClassFile* read_class_source(ClassSources* sources, ClassSource* source, SourceReader* reader, FILE* err)
+{
+	const unsigned char* data;
+	size_t size;
+
+	data = load_class_source(sources, source, reader, &size, err);
+	return data != NULL ? read_class_buffer(data, size) : NULL;
+}
+
+/* Output of one class, kept until all classes before it are printed */
+typedef struct
+{
+	char* output;
+	size_t output_length;
+	char* errors;
+	size_t errors_length;
+	int done;
+} ClassResult;
+
+typedef struct
+{
+	ClassSources* sources;
+	SourceCallback process;
+	void* context;
+	size_t scratch_size;
+	ScratchCallback free_scratch;
+
+	ClassResult* results;
+	int next;                 /* next source to be claimed by a worker */
+
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+} Batch;
+
+static void* batch_worker(void* arg)
+{
+	Batch* batch = arg;
+	ClassResult* result;
+	SourceReader reader;
+	FILE *out, *err;
+	void* scratch;
+	int i;
+
+	init_source_reader(&reader);
+	scratch = calloc(1, batch->scratch_size + 1);
+
+	while ((i = __sync_fetch_and_add(&batch->next, 1)) < batch->sources->count)
+	{
+		result = batch->results + i;
+		out = open_memstream(&result->output, &result->output_length);
+		err = open_memstream(&result->errors, &result->errors_length);
+
+		batch->process(batch->sources, batch->sources->sources + i, &reader, scratch, batch->context, out, err);
+
+		fclose(out);
+		fclose(err);
+
+		pthread_mutex_lock(&batch->lock);
+		result->done = 1;
+		pthread_cond_broadcast(&batch->done);
+		pthread_mutex_unlock(&batch->lock);
+	}
+
+	if (batch->free_scratch != NULL)
+		batch->free_scratch(scratch);
+	free(scratch);
+	free_source_reader(&reader);
+	return NULL;
+}
+
+/*
+	Calls process for every class. Each worker gets a reader and
+	scratch_size bytes of scratch space, zeroed at first and released
+	with free_scratch at the end.
+
+	With several workers, classes are processed in any order but printed
+	in the order they were collected, as soon as all classes before them
+	are done. A single worker runs on the calling thread and writes
+	straight to stdout and stderr.
+*/
+void process_class_sources(ClassSources* sources, int workers, SourceCallback process, void* context, size_t scratch_size, ScratchCallback free_scratch)
+{
+	Batch batch;
+	ClassResult* result;
+	SourceReader reader;
+	pthread_t* threads;
+	void* scratch;
+	int i;
+
+	if (workers <= 1)
+	{
+		init_source_reader(&reader);
+		scratch = calloc(1, scratch_size + 1);
+
+		for (i = 0; i < sources->count; i += 1)
+			process(sources, sources->sources + i, &reader, scratch, context, stdout, stderr);
+
+		if (free_scratch != NULL)
+			free_scratch(scratch);
+		free(scratch);
+		free_source_reader(&reader);
+		return;
+	}
+
+	batch.sources = sources;
+	batch.process = process;
+	batch.context = context;
+	batch.scratch_size = scratch_size;
+	batch.free_scratch = free_scratch;
+	batch.results = calloc(sources->count, sizeof(ClassResult));
+	batch.next = 0;
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.done, NULL);
+
+	threads = malloc(workers * sizeof(pthread_t));
+	for (i = 0; i < workers; i += 1)
+		pthread_create(&threads[i], NULL, batch_worker, &batch);
+
+	for (i = 0, result = batch.results; i < sources->count; i += 1, result += 1)
+	{
+		pthread_mutex_lock(&batch.lock);
+		while (!result->done)
+			pthread_cond_wait(&batch.done, &batch.lock);
+		pthread_mutex_unlock(&batch.lock);
+
+		fwrite(result->output, sizeof(char), result->output_length, stdout);
+		fwrite(result->errors, sizeof(char), result->errors_length, stderr);
+		free(result->output);
+		free(result->errors);
+	}
+
+	for (i = 0; i < workers; i += 1)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&batch.done);
+	pthread_mutex_destroy(&batch.lock);
+	free(threads);
+	free(batch.results);
+}
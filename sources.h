@@ -0,0 +1,68 @@
+#ifndef SOURCES_H
+#define SOURCES_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "classfile.h"
+
+/*
+	A list of class files to process, collected from plain files,
+	directories (searched recursively) and jar/zip archives. Archive
+	entries are only located when collecting; they are read and inflated
+	when the class is loaded, so a large archive is never held in memory.
+*/
+
+typedef struct
+{
+	char* name;               /* path, or archive path "!" entry name */
+	int archive;              /* index into archives, -1 for plain files */
+	uint32_t offset;          /* local header offset within the archive */
+	uint32_t compressed_size;
+	uint32_t size;
+	uint16_t method;          /* 0: stored, 8: deflated */
+} ClassSource;
+
+typedef struct
+{
+	int count;
+	int capacity;
+	ClassSource* sources;
+
+	int archive_count;
+	char** archives;
+} ClassSources;
+
+/* Scratch space for loading classes; one per thread */
+typedef struct
+{
+	int archive;              /* archive currently open in fp, -1 if none */
+	FILE* fp;
+
+	unsigned char* compressed;
+	size_t compressed_capacity;
+	unsigned char* data;
+	size_t data_capacity;
+} SourceReader;
+
+/*
+	Called for each class by process_class_sources, with the worker's
+	reader and scratch space, and the context given to it. Output goes to
+	out and err, which are per class buffers when there are several workers.
+*/
+typedef void (*SourceCallback)(ClassSources* sources, ClassSource* source, SourceReader* reader, void* scratch, void* context, FILE* out, FILE* err);
+
+/* Releases what a worker's scratch space holds, not the space itself */
+typedef void (*ScratchCallback)(void* scratch);
+
+int add_class_sources(ClassSources* sources, const char* path);
+void free_class_sources(ClassSources* sources);
+
+void init_source_reader(SourceReader* reader);
+ClassFile* read_class_source(ClassSources* sources, ClassSource* source, SourceReader* reader, FILE* err);
+const unsigned char* load_class_source(ClassSources* sources, ClassSource* source, SourceReader* reader, size_t* size, FILE* err);
+void free_source_reader(SourceReader* reader);
+
+void process_class_sources(ClassSources* sources, int workers, SourceCallback process, void* context, size_t scratch_size, ScratchCallback free_scratch);
+
+#endif
@@ -0,0 +1,760 @@
+#include "stack.h"
+#include "exceptions.h"
+
+/*
+	Stack effect of the opcodes that don't need the constant pool or
+	special handling: the popped types (top last), '>', the pushed types.
+
+		I int, F float, J long, D double, A reference, N null,
+		R return address, U uninitialized, x any single slot
+
+	NULL entries are handled in execute(), or are invalid opcodes.
+*/
+static const char* Effects[256] = {
+	[OP_NOP] = ">",
+	[OP_ACONST_NULL] = ">N",
+	[OP_ICONST_M1 ... OP_ICONST_5] = ">I",
+	[OP_LCONST_0 ... OP_LCONST_1] = ">J",
+	[OP_FCONST_0 ... OP_FCONST_2] = ">F",
+	[OP_DCONST_0 ... OP_DCONST_1] = ">D",
+	[OP_BIPUSH] = ">I",
+	[OP_SIPUSH] = ">I",
+
+	[OP_ILOAD] = ">I",
+	[OP_LLOAD] = ">J",
+	[OP_FLOAD] = ">F",
+	[OP_DLOAD] = ">D",
+	[OP_ALOAD] = ">A",
+	[OP_ILOAD_0 ... OP_ILOAD_3] = ">I",
+	[OP_LLOAD_0 ... OP_LLOAD_3] = ">J",
+	[OP_FLOAD_0 ... OP_FLOAD_3] = ">F",
+	[OP_DLOAD_0 ... OP_DLOAD_3] = ">D",
+	[OP_ALOAD_0 ... OP_ALOAD_3] = ">A",
+
+	[OP_IALOAD] = "AI>I",
+	[OP_LALOAD] = "AI>J",
+	[OP_FALOAD] = "AI>F",
+	[OP_DALOAD] = "AI>D",
+	[OP_AALOAD] = "AI>A",
+	[OP_BALOAD] = "AI>I",
+	[OP_CALOAD] = "AI>I",
+	[OP_SALOAD] = "AI>I",
+
+	[OP_ISTORE] = "I>",
+	[OP_LSTORE] = "J>",
+	[OP_FSTORE] = "F>",
+	[OP_DSTORE] = "D>",
+	[OP_ASTORE] = "x>",   /* references and return addresses */
+	[OP_ISTORE_0 ... OP_ISTORE_3] = "I>",
+	[OP_LSTORE_0 ... OP_LSTORE_3] = "J>",
+	[OP_FSTORE_0 ... OP_FSTORE_3] = "F>",
+	[OP_DSTORE_0 ... OP_DSTORE_3] = "D>",
+	[OP_ASTORE_0 ... OP_ASTORE_3] = "x>",
+
+	[OP_IASTORE] = "AII>",
+	[OP_LASTORE] = "AIJ>",
+	[OP_FASTORE] = "AIF>",
+	[OP_DASTORE] = "AID>",
+	[OP_AASTORE] = "AIA>",
+	[OP_BASTORE] = "AII>",
+	[OP_CASTORE] = "AII>",
+	[OP_SASTORE] = "AII>",
+
+	[OP_POP] = "x>",
+	[OP_POP2] = "xx>",
+
+	[OP_IADD] = "II>I", [OP_LADD] = "JJ>J", [OP_FADD] = "FF>F", [OP_DADD] = "DD>D",
+	[OP_ISUB] = "II>I", [OP_LSUB] = "JJ>J", [OP_FSUB] = "FF>F", [OP_DSUB] = "DD>D",
+	[OP_IMUL] = "II>I", [OP_LMUL] = "JJ>J", [OP_FMUL] = "FF>F", [OP_DMUL] = "DD>D",
+	[OP_IDIV] = "II>I", [OP_LDIV] = "JJ>J", [OP_FDIV] = "FF>F", [OP_DDIV] = "DD>D",
+	[OP_IREM] = "II>I", [OP_LREM] = "JJ>J", [OP_FREM] = "FF>F", [OP_DREM] = "DD>D",
+	[OP_INEG] = "I>I",  [OP_LNEG] = "J>J",  [OP_FNEG] = "F>F",  [OP_DNEG] = "D>D",
+
+	[OP_ISHL] = "II>I", [OP_LSHL] = "JI>J",
+	[OP_ISHR] = "II>I", [OP_LSHR] = "JI>J",
+	[OP_IUSHR] = "II>I", [OP_LUSHR] = "JI>J",
+	[OP_IAND] = "II>I", [OP_LAND] = "JJ>J",
+	[OP_IOR] = "II>I",  [OP_LOR] = "JJ>J",
+	[OP_IXOR] = "II>I", [OP_LXOR] = "JJ>J",
+	[OP_IINC] = ">",
+
+	[OP_I2L] = "I>J", [OP_I2F] = "I>F", [OP_I2D] = "I>D",
+	[OP_L2I] = "J>I", [OP_L2F] = "J>F", [OP_L2D] = "J>D",
+	[OP_F2I] = "F>I", [OP_F2L] = "F>J", [OP_F2D] = "F>D",
+	[OP_D2I] = "D>I", [OP_D2L] = "D>J", [OP_D2F] = "D>F",
+	[OP_I2B] = "I>I", [OP_I2C] = "I>I", [OP_I2S] = "I>I",
+
+	[OP_LCMP] = "JJ>I",
+	[OP_FCMPL] = "FF>I", [OP_FCMPG] = "FF>I",
+	[OP_DCMPL] = "DD>I", [OP_DCMPG] = "DD>I",
+
+	[OP_IFEQ ... OP_IFLE] = "I>",
+	[OP_IF_ICMPEQ ... OP_IF_ICMPLE] = "II>",
+	[OP_IF_ACMPEQ] = "AA>",
+	[OP_IF_ACMPNE] = "AA>",
+	[OP_GOTO] = ">",
+	[OP_JSR] = ">R",
+	[OP_RET] = ">",
+	[OP_TABLESWITCH] = "I>",
+	[OP_LOOKUPSWITCH] = "I>",
+
+	[OP_IRETURN] = "I>",
+	[OP_LRETURN] = "J>",
+	[OP_FRETURN] = "F>",
+	[OP_DRETURN] = "D>",
+	[OP_ARETURN] = "A>",
+	[OP_RETURN] = ">",
+
+	[OP_NEW] = ">U",
+	[OP_NEWARRAY] = "I>A",
+	[OP_ANEWARRAY] = "I>A",
+	[OP_ARRAYLENGTH] = "A>I",
+	[OP_ATHROW] = "A>",
+	[OP_CHECKCAST] = "A>A",
+	[OP_INSTANCEOF] = "A>I",
+	[OP_MONITORENTER] = "A>",
+	[OP_MONITOREXIT] = "A>",
+
+	[OP_IFNULL] = "A>",
+	[OP_IFNONNULL] = "A>",
+	[OP_GOTO_W] = ">",
+	[OP_JSR_W] = ">R",
+};
+
+typedef struct
+{
+	ClassFile* classFile;
+	DecodedCode* decoded;
+	StackInfo* info;
+	int types;
+
+	/* State of the instruction being executed */
+	int depth;
+	uint8_t* stack;
+
+	uint32_t* worklist;
+	uint8_t* queued;
+	uint32_t top;
+} Simulation;
+
+static int fail(Simulation* sim, int error, uint32_t pc)
+{
+	if (sim->info->error == STACK_OK)
+	{
+		sim->info->error = error;
+		sim->info->error_pc = pc;
+	}
+	return 0;
+}
+
+static int push(Simulation* sim, uint8_t type, uint32_t pc)
+{
+	int slots = (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+
+	if (sim->depth + slots > sim->info->max_stack)
+		return fail(sim, STACK_OVERFLOW, pc);
+
+	sim->stack[sim->depth++] = type;
+	if (slots == 2)
+		sim->stack[sim->depth++] = VT_TOP;
+	return 1;
+}
+
+static int pop(Simulation* sim, int slots, uint32_t pc)
+{
+	if (sim->depth < slots)
+		return fail(sim, STACK_UNDERFLOW, pc);
+
+	sim->depth -= slots;
+	return 1;
+}
+
+static uint8_t letter_type(char c)
+{
+	switch (c)
+	{
+		case 'I': return VT_INT;
+		case 'F': return VT_FLOAT;
+		case 'J': return VT_LONG;
+		case 'D': return VT_DOUBLE;
+		case 'N': return VT_NULL;
+		case 'R': return VT_ADDRESS;
+		case 'U': return VT_UNINIT;
+	}
+	return VT_REFERENCE;
+}
+
+/* Type of a field descriptor, or of a method's return type; 0 for void */
+static uint8_t descriptor_type(char c)
+{
+	switch (c)
+	{
+		case 'B':
+		case 'C':
+		case 'I':
+		case 'S':
+		case 'Z':
+			return VT_INT;
+		case 'F': return VT_FLOAT;
+		case 'J': return VT_LONG;
+		case 'D': return VT_DOUBLE;
+		case 'L':
+		case '[':
+			return VT_REFERENCE;
+	}
+	return 0;
+}
+
+/* Slots taken by the parameters of a method descriptor; sets *ret to the
+	first character of the return type */
+static int parameter_slots(const char* descriptor, const char** ret)
+{
+	const char* p = descriptor + 1;
+	int slots = 0;
+
+	while (*p != ')' && *p != '\0')
+	{
+		slots += (*p == 'J' || *p == 'D') ? 2 : 1;
+
+		while (*p == '[')
+			p += 1;
+		if (*p == 'L')
+		{
+			while (*p != ';' && *p != '\0')
+				p += 1;
+		}
+		if (*p != '\0')
+			p += 1;
+	}
+
+	*ret = *p == ')' ? p + 1 : p;
+	return slots;
+}
+
+/* Descriptor (and name) of the member a field or method reference names;
+	dynamic constants and call sites carry one too */
+static const char* member_descriptor(ClassFile* classFile, uint16_t index, const char** name)
+{
+	Constant *ref, *typedesc, *descriptor, *nameConstant;
+
+	ref = find_constant(classFile, index);
+	if (ref == NULL || (ref->tag != TAG_FIELDREF && ref->tag != TAG_METHODREF && ref->tag != TAG_IFACEREF &&
+		ref->tag != TAG_DYNAMIC && ref->tag != TAG_INVOKEDYNAMIC))
+		return NULL;
+
+	typedesc = find_constant(classFile, ref->typedescref);
+	if (typedesc == NULL || typedesc->tag != TAG_TYPEDESC)
+		return NULL;
+
+	descriptor = find_constant(classFile, typedesc->typeref);
+	nameConstant = find_constant(classFile, typedesc->nameref);
+	if (descriptor == NULL || descriptor->tag != TAG_STRING || nameConstant == NULL || nameConstant->tag != TAG_STRING)
+		return NULL;
+
+	*name = nameConstant->buffer;
+	return descriptor->buffer;
+}
+
+static int apply_effect(Simulation* sim, const char* effect, uint32_t pc)
+{
+	const char* p;
+	int slots = 0;
+
+	for (p = effect; *p != '>'; p += 1)
+		slots += (*p == 'J' || *p == 'D') ? 2 : 1;
+
+	if (!pop(sim, slots, pc))
+		return 0;
+
+	for (p += 1; *p != '\0'; p += 1)
+	{
+		if (!push(sim, letter_type(*p), pc))
+			return 0;
+	}
+	return 1;
+}
+
+/* The dup and swap family rearrange slots, regardless of their types */
+static int shuffle(Simulation* sim, int popped, const char* order, uint32_t pc)
+{
+	uint8_t saved[4];
+	int i, base;
+
+	if (sim->depth < popped)
+		return fail(sim, STACK_UNDERFLOW, pc);
+	if (sim->depth - popped + (int)strlen(order) > sim->info->max_stack)
+		return fail(sim, STACK_OVERFLOW, pc);
+
+	base = sim->depth - popped;
+	for (i = 0; i < popped; i += 1)
+		saved[i] = sim->stack[base + i];
+
+	/* order lists the new slots, bottom first; 'a' is the lowest popped slot */
+	for (i = 0; order[i] != '\0'; i += 1)
+		sim->stack[base + i] = saved[order[i] - 'a'];
+
+	sim->depth = base + i;
+	return 1;
+}
+
+static int execute_ldc(Simulation* sim, uint16_t index, uint32_t pc)
+{
+	Constant* constant = find_constant(sim->classFile, index);
+	const char *descriptor, *name;
+	uint8_t type;
+
+	if (constant == NULL)
+		return fail(sim, STACK_BAD_CONSTANT, pc);
+
+	switch (constant->tag)
+	{
+		case TAG_INTEGER:
+			return push(sim, VT_INT, pc);
+		case TAG_FLOAT:
+			return push(sim, VT_FLOAT, pc);
+		case TAG_LONG:
+			return push(sim, VT_LONG, pc);
+		case TAG_DOUBLE:
+			return push(sim, VT_DOUBLE, pc);
+
+		case TAG_DYNAMIC:
+			descriptor = member_descriptor(sim->classFile, index, &name);
+			if (descriptor == NULL || (type = descriptor_type(descriptor[0])) == 0)
+				return fail(sim, STACK_BAD_CONSTANT, pc);
+			return push(sim, type, pc);
+	}
+
+	/* Strings, classes, method handles and types */
+	return push(sim, VT_REFERENCE, pc);
+}
+
+static int execute_invoke(Simulation* sim, Instruction* ins, uint32_t pc)
+{
+	const char *descriptor, *name, *ret;
+	uint8_t type;
+	int slots, i;
+
+	descriptor = member_descriptor(sim->classFile, ins->constant, &name);
+	if (descriptor == NULL || descriptor[0] != '(')
+		return fail(sim, STACK_BAD_CONSTANT, pc);
+
+	slots = parameter_slots(descriptor, &ret);
+	if (ins->opcode != OP_INVOKESTATIC && ins->opcode != OP_INVOKEDYNAMIC)
+		slots += 1;
+
+	if (!pop(sim, slots, pc))
+		return 0;
+
+	/* A constructor initializes the object created by new. The receiver
+		is gone; its copy left by the usual "new, dup" is the topmost
+		uninitialized slot. */
+	if (ins->opcode == OP_INVOKESPECIAL && strcmp(name, "<init>") == 0)
+	{
+		for (i = sim->depth - 1; i >= 0; i -= 1)
+		{
+			if (sim->stack[i] == VT_UNINIT)
+			{
+				sim->stack[i] = VT_REFERENCE;
+				break;
+			}
+		}
+	}
+
+	type = descriptor_type(*ret);
+	return type == 0 ? 1 : push(sim, type, pc);
+}
+
+static int execute_field(Simulation* sim, Instruction* ins, uint32_t pc)
+{
+	const char *descriptor, *name;
+	uint8_t type;
+	int slots;
+
+	descriptor = member_descriptor(sim->classFile, ins->constant, &name);
+	if (descriptor == NULL || (type = descriptor_type(descriptor[0])) == 0)
+		return fail(sim, STACK_BAD_CONSTANT, pc);
+
+	slots = (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+
+	switch (ins->opcode)
+	{
+		case OP_GETSTATIC:
+			return push(sim, type, pc);
+		case OP_PUTSTATIC:
+			return pop(sim, slots, pc);
+		case OP_GETFIELD:
+			return pop(sim, 1, pc) && push(sim, type, pc);
+		default: /* OP_PUTFIELD */
+			return pop(sim, slots + 1, pc);
+	}
+}
+
+static int execute(Simulation* sim, Instruction* ins, uint32_t pc)
+{
+	switch (ins->opcode)
+	{
+		case OP_LDC:
+		case OP_LDC_W:
+		case OP_LDC2_W:
+			return execute_ldc(sim, ins->constant, pc);
+
+		case OP_GETSTATIC:
+		case OP_PUTSTATIC:
+		case OP_GETFIELD:
+		case OP_PUTFIELD:
+			return execute_field(sim, ins, pc);
+
+		case OP_INVOKEVIRTUAL:
+		case OP_INVOKESPECIAL:
+		case OP_INVOKESTATIC:
+		case OP_INVOKEINTERFACE:
+		case OP_INVOKEDYNAMIC:
+			return execute_invoke(sim, ins, pc);
+
+		case OP_MULTIANEWARRAY:
+			return pop(sim, (uint8_t)ins->dimensions, pc) && push(sim, VT_REFERENCE, pc);
+
+		case OP_WIDE:
+			switch (ins->opcode2)
+			{
+				case OP_IINC:
+				case OP_RET:
+					return 1;
+				case OP_ASTORE:
+					return apply_effect(sim, "x>", pc);
+			}
+			if (Effects[ins->opcode2] == NULL)
+				return fail(sim, STACK_BAD_OPCODE, pc);
+			return apply_effect(sim, Effects[ins->opcode2], pc);
+
+		case OP_DUP:     return shuffle(sim, 1, "aa", pc);
+		case OP_DUP_X1:  return shuffle(sim, 2, "bab", pc);
+		case OP_DUP_X2:  return shuffle(sim, 3, "cabc", pc);
+		case OP_DUP2:    return shuffle(sim, 2, "abab", pc);
+		case OP_DUP2_X1: return shuffle(sim, 3, "bcabc", pc);
+		case OP_DUP2_X2: return shuffle(sim, 4, "cdabcd", pc);
+		case OP_SWAP:    return shuffle(sim, 2, "ba", pc);
+	}
+
+	if (Effects[ins->opcode] == NULL)
+		return fail(sim, STACK_BAD_OPCODE, pc);
+
+	return apply_effect(sim, Effects[ins->opcode], pc);
+}
+
+static void count_effect(const char* effect, int* popped, int* pushed)
+{
+	const char* p;
+
+	*popped = *pushed = 0;
+	for (p = effect; *p != '>'; p += 1)
+		*popped += (*p == 'J' || *p == 'D') ? 2 : 1;
+	for (p += 1; *p != '\0'; p += 1)
+		*pushed += (*p == 'J' || *p == 'D') ? 2 : 1;
+}
+
+/* Slots an instruction pops and pushes, without simulating it; returns 0
+	for an invalid opcode or constant reference */
+int stack_effect(ClassFile* classFile, Instruction* ins, int* popped, int* pushed)
+{
+	const char *descriptor, *name, *ret;
+	Constant* constant;
+	uint8_t type;
+
+	*popped = *pushed = 0;
+
+	switch (ins->opcode)
+	{
+		case OP_LDC:
+		case OP_LDC_W:
+		case OP_LDC2_W:
+			if ((constant = find_constant(classFile, ins->constant)) == NULL)
+				return 0;
+			if (constant->tag == TAG_DYNAMIC)
+			{
+				descriptor = member_descriptor(classFile, ins->constant, &name);
+				if (descriptor == NULL || (type = descriptor_type(descriptor[0])) == 0)
+					return 0;
+				*pushed = (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+				return 1;
+			}
+			*pushed = (constant->tag == TAG_LONG || constant->tag == TAG_DOUBLE) ? 2 : 1;
+			return 1;
+
+		case OP_GETSTATIC:
+		case OP_PUTSTATIC:
+		case OP_GETFIELD:
+		case OP_PUTFIELD:
+			descriptor = member_descriptor(classFile, ins->constant, &name);
+			if (descriptor == NULL || (type = descriptor_type(descriptor[0])) == 0)
+				return 0;
+
+			if (ins->opcode == OP_GETFIELD || ins->opcode == OP_PUTFIELD)
+				*popped = 1;
+			if (ins->opcode == OP_GETSTATIC || ins->opcode == OP_GETFIELD)
+				*pushed = (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+			else
+				*popped += (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+			return 1;
+
+		case OP_INVOKEVIRTUAL:
+		case OP_INVOKESPECIAL:
+		case OP_INVOKESTATIC:
+		case OP_INVOKEINTERFACE:
+		case OP_INVOKEDYNAMIC:
+			descriptor = member_descriptor(classFile, ins->constant, &name);
+			if (descriptor == NULL || descriptor[0] != '(')
+				return 0;
+
+			*popped = parameter_slots(descriptor, &ret);
+			if (ins->opcode != OP_INVOKESTATIC && ins->opcode != OP_INVOKEDYNAMIC)
+				*popped += 1;
+			type = descriptor_type(*ret);
+			*pushed = type == 0 ? 0 : (type == VT_LONG || type == VT_DOUBLE) ? 2 : 1;
+			return 1;
+
+		case OP_MULTIANEWARRAY:
+			*popped = (uint8_t)ins->dimensions;
+			*pushed = 1;
+			return 1;
+
+		case OP_WIDE:
+			if (ins->opcode2 == OP_IINC || ins->opcode2 == OP_RET)
+				return 1;
+			if (Effects[ins->opcode2] == NULL)
+				return 0;
+			count_effect(Effects[ins->opcode2], popped, pushed);
+			return 1;
+
+		case OP_DUP:     *popped = 1; *pushed = 2; return 1;
+		case OP_DUP_X1:  *popped = 2; *pushed = 3; return 1;
+		case OP_DUP_X2:  *popped = 3; *pushed = 4; return 1;
+		case OP_DUP2:    *popped = 2; *pushed = 4; return 1;
+		case OP_DUP2_X1: *popped = 3; *pushed = 5; return 1;
+		case OP_DUP2_X2: *popped = 4; *pushed = 6; return 1;
+		case OP_SWAP:    *popped = 2; *pushed = 2; return 1;
+	}
+
+	if (Effects[ins->opcode] == NULL)
+		return 0;
+
+	count_effect(Effects[ins->opcode], popped, pushed);
+	return 1;
+}
+
+static uint8_t merge_type(uint8_t a, uint8_t b)
+{
+	if (a == b)
+		return a;
+	if ((a == VT_NULL || a == VT_REFERENCE) && (b == VT_NULL || b == VT_REFERENCE))
+		return VT_REFERENCE;
+	return VT_TOP;
+}
+
+/* Merges a state into the entry state of the instruction at target */
+static void flow(Simulation* sim, int64_t target, int depth, uint8_t* stack, uint32_t from)
+{
+	StackInfo* info = sim->info;
+	uint8_t *types, merged;
+	int32_t i;
+	int k, changed = 0;
+
+	if (target < 0 || target >= info->code_length || (i = sim->decoded->index[target]) < 0)
+	{
+		fail(sim, STACK_BAD_TARGET, from);
+		return;
+	}
+
+	/* Only possible for a handler when max_stack is 0 */
+	if (depth > info->max_stack)
+	{
+		fail(sim, STACK_OVERFLOW, from);
+		return;
+	}
+
+	types = sim->types ? info->types + (size_t)i * info->max_stack : NULL;
+
+	if (info->depth[target] < 0)
+	{
+		info->depth[target] = depth;
+		if (depth > info->max_depth)
+			info->max_depth = depth;
+		if (types != NULL)
+			memcpy(types, stack, depth);
+		changed = 1;
+	}
+	else if (info->depth[target] != depth)
+	{
+		fail(sim, STACK_MISMATCH, target);
+		return;
+	}
+	else if (types != NULL)
+	{
+		for (k = 0; k < depth; k += 1)
+		{
+			merged = merge_type(types[k], stack[k]);
+			if (merged != types[k])
+			{
+				types[k] = merged;
+				changed = 1;
+			}
+		}
+	}
+
+	if (changed && !sim->queued[i])
+	{
+		sim->queued[i] = 1;
+		sim->worklist[sim->top++] = i;
+	}
+}
+
+static void successors(Simulation* sim, Instruction* ins, uint32_t pc, uint32_t next, int entry_depth)
+{
+	int i, fallthrough = 1;
+
+	switch (ins->opcode)
+	{
+		case OP_GOTO:
+			flow(sim, (int64_t)pc + ins->branchoffset, sim->depth, sim->stack, pc);
+			fallthrough = 0;
+			break;
+
+		case OP_GOTO_W:
+			flow(sim, (int64_t)pc + ins->branchoffset32, sim->depth, sim->stack, pc);
+			fallthrough = 0;
+			break;
+
+		/* The subroutine returns to the next instruction with the stack
+			as it was before the jsr */
+		case OP_JSR:
+		case OP_JSR_W:
+			flow(sim, (int64_t)pc + (ins->opcode == OP_JSR ? ins->branchoffset : ins->branchoffset32), sim->depth, sim->stack, pc);
+			sim->depth = entry_depth;
+			break;
+
+		case OP_TABLESWITCH:
+			for (i = 0; i <= ins->high - ins->low; i += 1)
+				flow(sim, (int64_t)pc + ins->branchoffsets[i], sim->depth, sim->stack, pc);
+			flow(sim, (int64_t)pc + ins->defaultoffset, sim->depth, sim->stack, pc);
+			fallthrough = 0;
+			break;
+
+		case OP_LOOKUPSWITCH:
+			for (i = 0; i < ins->npairs; i += 1)
+				flow(sim, (int64_t)pc + ins->branchoffsets[i], sim->depth, sim->stack, pc);
+			flow(sim, (int64_t)pc + ins->defaultoffset, sim->depth, sim->stack, pc);
+			fallthrough = 0;
+			break;
+
+		case OP_IRETURN:
+		case OP_LRETURN:
+		case OP_FRETURN:
+		case OP_DRETURN:
+		case OP_ARETURN:
+		case OP_RETURN:
+		case OP_ATHROW:
+		case OP_RET:
+			fallthrough = 0;
+			break;
+
+		case OP_WIDE:
+			fallthrough = ins->opcode2 != OP_RET;
+			break;
+
+		default:
+			if ((ins->opcode >= OP_IFEQ && ins->opcode <= OP_IF_ACMPNE) || ins->opcode == OP_IFNULL || ins->opcode == OP_IFNONNULL)
+				flow(sim, (int64_t)pc + ins->branchoffset, sim->depth, sim->stack, pc);
+			break;
+	}
+
+	if (fallthrough)
+	{
+		/* Running off the end of the code */
+		if (next >= sim->info->code_length)
+			fail(sim, STACK_BAD_TARGET, pc);
+		else
+			flow(sim, next, sim->depth, sim->stack, pc);
+	}
+}
+
+int simulate_stack(ClassFile* classFile, Attribute* codeAttribute, DecodedCode* decoded, Arena* arena, int flags, StackInfo* info)
+{
+	ExceptionIndex exceptions;
+	const uint16_t* entries;
+	Simulation sim;
+	Instruction* ins;
+	uint8_t handler_stack[1] = { VT_REFERENCE };
+	uint32_t i, pc, next, count, k;
+	int entry_depth;
+
+	info->code_length = decoded->code_length;
+	info->max_stack = codeAttribute->code.max_stack;
+	info->max_depth = 0;
+	info->error = STACK_OK;
+	info->error_pc = 0;
+	info->depth = arena_alloc(arena, (decoded->code_length + 1) * sizeof(int32_t));
+	info->types = NULL;
+
+	for (pc = 0; pc < decoded->code_length; pc += 1)
+		info->depth[pc] = -1;
+
+	if (decoded->count == 0)
+		return info->error;
+
+	sim.classFile = classFile;
+	sim.decoded = decoded;
+	sim.info = info;
+	sim.types = flags & STACK_TYPES;
+	sim.stack = arena_calloc(arena, info->max_stack + 1, sizeof(uint8_t));
+	sim.worklist = arena_alloc(arena, decoded->count * sizeof(uint32_t));
+	sim.queued = arena_calloc(arena, decoded->count, sizeof(uint8_t));
+	sim.top = 0;
+
+	if (sim.types)
+		info->types = arena_calloc(arena, (size_t)decoded->count * info->max_stack + 1, sizeof(uint8_t));
+
+	build_exception_index(codeAttribute, &exceptions);
+
+	sim.depth = 0;
+	flow(&sim, 0, 0, sim.stack, 0);
+
+	while (sim.top > 0)
+	{
+		i = sim.worklist[--sim.top];
+		sim.queued[i] = 0;
+
+		ins = decoded->instructions + i;
+		pc = decoded->pcs[i];
+		next = i + 1 < decoded->count ? decoded->pcs[i + 1] : decoded->code_length;
+
+		/* A handler starts with just the exception on the stack */
+		count = handlers_at(&exceptions, pc, &entries);
+		for (k = 0; k < count; k += 1)
+			flow(&sim, exceptions.table[entries[k]].handler_pc, 1, handler_stack, pc);
+
+		entry_depth = sim.depth = info->depth[pc];
+		if (sim.types)
+			memcpy(sim.stack, info->types + (size_t)i * info->max_stack, sim.depth);
+
+		if (execute(&sim, ins, pc))
+			successors(&sim, ins, pc, next, entry_depth);
+	}
+
+	free_exception_index(&exceptions);
+	return info->error;
+}
+
+const char* stack_error_to_string(int error)
+{
+	switch (error)
+	{
+		case STACK_OK:           return "ok";
+		case STACK_UNDERFLOW:    return "stack underflow";
+		case STACK_OVERFLOW:     return "stack exceeds max_stack";
+		case STACK_MISMATCH:     return "stack depth differs between paths";
+		case STACK_BAD_TARGET:   return "branch to an invalid pc";
+		case STACK_BAD_OPCODE:   return "invalid opcode";
+		case STACK_BAD_CONSTANT: return "invalid constant reference";
+	}
+	return "unknown error";
+}
@@ -0,0 +1,61 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "bytecode.h"
+#include "arena.h"
+
+/*
+	Operand stack simulation. Follows every path through the code (a
+	worklist over branch targets and exception handlers) and records the
+	stack on entry to each instruction: its depth in slots, as counted by
+	max_stack, and optionally the verification type of every slot.
+
+	Types are only as precise as the bytecode makes them: references are
+	not told apart by class, and a slot that holds different types on
+	different paths becomes VT_TOP.
+*/
+
+#define VT_TOP       0 /* unknown, or the second slot of a long or double */
+#define VT_INT       1
+#define VT_FLOAT     2
+#define VT_LONG      3
+#define VT_DOUBLE    4
+#define VT_NULL      5
+#define VT_REFERENCE 6
+#define VT_UNINIT    7 /* created by new, constructor not yet called */
+#define VT_ADDRESS   8 /* return address pushed by jsr */
+
+#define STACK_OK         0
+#define STACK_UNDERFLOW  1 /* an instruction pops more than the stack holds */
+#define STACK_OVERFLOW   2 /* the stack grows beyond max_stack */
+#define STACK_MISMATCH   3 /* paths join with different depths */
+#define STACK_BAD_TARGET 4 /* a branch into the middle of an instruction */
+#define STACK_BAD_OPCODE 5
+#define STACK_BAD_CONSTANT 6 /* unresolvable constant of an invoke, field access or ldc */
+
+#define STACK_TYPES 0x01 /* also compute the verification types */
+
+typedef struct
+{
+	uint32_t code_length;
+	uint16_t max_stack;
+	int32_t* depth;           /* per pc, -1 if not reached or not an instruction */
+	uint8_t* types;           /* max_stack entries per instruction index, NULL without STACK_TYPES */
+	uint16_t max_depth;       /* deepest stack reached */
+
+	int error;                /* first error found, STACK_OK if none */
+	uint32_t error_pc;
+} StackInfo;
+
+int simulate_stack(ClassFile* classFile, Attribute* codeAttribute, DecodedCode* decoded, Arena* arena, int flags, StackInfo* info);
+const char* stack_error_to_string(int error);
+int stack_effect(ClassFile* classFile, Instruction* ins, int* popped, int* pushed);
+
+/* Types of the slots on entry to the instruction at pc, bottom first */
+#define stack_types_at(info, decoded, pc) \
+	((info)->types + (size_t)instruction_index(decoded, pc) * (info)->max_stack)
+
+#endif
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stackmap.h"
+#include "stats.h"
+
+#define get16(p) (((p)[0] << 8) | (p)[1])
+
+typedef struct
+{
+	const unsigned char* p;
+	const unsigned char* end;
+	uint32_t capacity;        /* of map->items */
+} Decoder;
+
+static VerificationItem* reserve_items(StackMap* map, Decoder* d, uint32_t count)
+{
+	if (map->item_count + count > d->capacity)
+	{
+		while (map->item_count + count > d->capacity)
+			d->capacity = d->capacity ? d->capacity * 2 : 64;
+		map->items = realloc(map->items, d->capacity * sizeof(VerificationItem));
+		STAT_ADD(allocations, 1);
+	}
+	return map->items + map->item_count;
+}
+
+/* Reads count items into the item array; 0 if they run past the end */
+static int read_items(StackMap* map, Decoder* d, uint32_t count)
+{
+	VerificationItem* item = reserve_items(map, d, count);
+	uint32_t i;
+
+	for (i = 0; i < count; i += 1, item += 1)
+	{
+		if (d->p >= d->end || *d->p > ITEM_UNINITIALIZED)
+			return 0;
+
+		item->tag = *d->p++;
+		item->value = 0;
+		if (item->tag == ITEM_OBJECT || item->tag == ITEM_UNINITIALIZED)
+		{
+			if (d->end - d->p < 2)
+				return 0;
+			item->value = get16(d->p);
+			d->p += 2;
+		}
+	}
+
+	map->item_count += count;
+	return 1;
+}
+
+/* The first frame: this and the parameters */
+static int initial_frame(ClassFile* classFile, Method* method, StackMap* map, Decoder* d)
+{
+	VerificationItem* item;
+	Constant* name;
+	const char* p;
+	uint32_t count = 0;
+
+	map->snapshots[0].frame = -1;
+	map->snapshots[0].local_count = 0;
+	map->snapshots[0].items = 0;
+	map->snapshot_count = 1;
+
+	item = reserve_items(map, d, map->max_locals + 1);
+	if (method == NULL || map->descriptor == NULL || *map->descriptor != '(')
+		return 1;
+
+	if (!(method->access_flags & ACC_STATIC))
+	{
+		if (count >= map->max_locals)
+			return 0;
+
+		/* A constructor gets an uninitialized this, except Object's own */
+		name = find_constant(classFile, classFile->this_class);
+		name = name != NULL && name->tag == TAG_CLASSREF ? find_constant(classFile, name->ref) : NULL;
+		if (method->special == METHOD_INIT && (name == NULL || name->tag != TAG_STRING || strcmp(name->buffer, "java/lang/Object") != 0))
+			item[count].tag = ITEM_UNINITIALIZED_THIS;
+		else
+			item[count].tag = ITEM_OBJECT;
+		item[count++].value = classFile->this_class;
+	}
+
+	for (p = map->descriptor + 1; *p && *p != ')'; p += 1)
+	{
+		if (count >= map->max_locals)
+			return 0;
+
+		item[count].value = 0;
+		switch (*p)
+		{
+			case 'B':
+			case 'C':
+			case 'I':
+			case 'S':
+			case 'Z':
+				item[count++].tag = ITEM_INTEGER;
+				break;
+
+			case 'F':
+				item[count++].tag = ITEM_FLOAT;
+				break;
+
+			case 'J':
+				item[count++].tag = ITEM_LONG;
+				break;
+
+			case 'D':
+				item[count++].tag = ITEM_DOUBLE;
+				break;
+
+			case 'L':
+			case '[':
+				item[count].tag = ITEM_PARAMETER;
+				item[count++].value = p - map->descriptor;
+				while (*p == '[')
+					p += 1;
+				if (*p == 'L')
+				{
+					while (*p && *p != ';')
+						p += 1;
+				}
+				if (*p == '\0')
+					return 0;
+				break;
+
+			default:
+				return 0;
+		}
+	}
+
+	map->snapshots[0].local_count = count;
+	map->item_count = count;
+	return 1;
+}
+
+static void take_snapshot(StackMap* map, Decoder* d, int32_t frame, VerificationItem* locals, uint16_t count)
+{
+	StackMapSnapshot* snapshot = map->snapshots + map->snapshot_count++;
+
+	snapshot->frame = frame;
+	snapshot->local_count = count;
+	snapshot->items = map->item_count;
+	memcpy(reserve_items(map, d, count), locals, count * sizeof(VerificationItem));
+	map->item_count += count;
+}
+
+/*
+	Decodes the frames while keeping the complete local list up to date,
+	to take the snapshots. Fails on reserved frame types, truncated
+	frames, frames past the end of the code, chops of more locals than
+	there are and lists that don't fit max_locals or max_stack.
+*/
+int decode_stack_map(ClassFile* classFile, Method* method, Attribute* codeAttribute, StackMap* map)
+{
+	Attribute* attribute;
+	Constant* descriptor;
+	StackMapFrame* frame;
+	VerificationItem* locals;
+	Decoder d = { NULL, NULL, 0 };
+	uint32_t i, pc = 0, since = 0, count = 0;
+	uint16_t local_count, delta;
+	uint8_t type;
+
+	memset(map, 0, sizeof(StackMap));
+	map->max_locals = codeAttribute->code.max_locals;
+	map->max_stack = codeAttribute->code.max_stack;
+	descriptor = method != NULL ? find_constant(classFile, method->descriptor_index) : NULL;
+	map->descriptor = descriptor != NULL && descriptor->tag == TAG_STRING ? descriptor->buffer : NULL;
+
+	attribute = find_attribute(classFile, ATT_NAME_STACKMAPTABLE, codeAttribute->code.attribute_count, codeAttribute->code.attributes);
+	if (attribute != NULL && attribute->length >= 2)
+	{
+		d.p = (const unsigned char*)attribute->buffer + 2;
+		d.end = (const unsigned char*)attribute->buffer + attribute->length;
+		count = get16((const unsigned char*)attribute->buffer);
+	}
+
+	map->frames = malloc(count * sizeof(StackMapFrame) + 1);
+	map->snapshots = malloc((count + 1) * sizeof(StackMapSnapshot));
+	locals = malloc(map->max_locals * sizeof(VerificationItem) + 1);
+	STAT_ADD(allocations, 3);
+
+	if (!initial_frame(classFile, method, map, &d))
+		goto fail;
+
+	local_count = map->snapshots[0].local_count;
+	memcpy(locals, map->items, local_count * sizeof(VerificationItem));
+
+	for (i = 0, frame = map->frames; i < count; i += 1, frame += 1)
+	{
+		if (d.p >= d.end)
+			goto fail;
+
+		type = *d.p++;
+		memset(frame, 0, sizeof(StackMapFrame));
+		frame->type = type;
+		frame->items = map->item_count;
+
+		if (type < 128)
+			delta = type & 63;
+		else if (type < 247 || d.end - d.p < 2)
+			goto fail;
+		else
+		{
+			delta = get16(d.p);
+			d.p += 2;
+		}
+
+		pc = i == 0 ? delta : pc + delta + 1;
+		if (pc >= codeAttribute->code.code_length)
+			goto fail;
+		frame->pc = pc;
+
+		if (FRAME_SAME_STACK1(type))
+		{
+			frame->stack_count = 1;
+			if (map->max_stack < 1 || !read_items(map, &d, 1))
+				goto fail;
+		}
+		else if (FRAME_CHOP(type))
+		{
+			frame->chop = 251 - type;
+			if (frame->chop > local_count)
+				goto fail;
+			local_count -= frame->chop;
+		}
+		else if (FRAME_APPEND(type))
+		{
+			frame->local_count = type - 251;
+			if (local_count + frame->local_count > map->max_locals || !read_items(map, &d, frame->local_count))
+				goto fail;
+			memcpy(locals + local_count, map->items + frame->items, frame->local_count * sizeof(VerificationItem));
+			local_count += frame->local_count;
+		}
+		else if (FRAME_FULL(type))
+		{
+			if (d.end - d.p < 2 || (frame->local_count = get16(d.p)) > map->max_locals)
+				goto fail;
+			d.p += 2;
+			if (!read_items(map, &d, frame->local_count) || d.end - d.p < 2)
+				goto fail;
+
+			if ((frame->stack_count = get16(d.p)) > map->max_stack)
+				goto fail;
+			d.p += 2;
+			if (!read_items(map, &d, frame->stack_count))
+				goto fail;
+
+			local_count = frame->local_count;
+			memcpy(locals, map->items + frame->items, local_count * sizeof(VerificationItem));
+
+			/* The frame's own items serve as the snapshot */
+			map->snapshots[map->snapshot_count].frame = i;
+			map->snapshots[map->snapshot_count].local_count = local_count;
+			map->snapshots[map->snapshot_count].items = frame->items;
+			map->snapshot_count += 1;
+			since = 0;
+		}
+
+		if (!FRAME_FULL(type) && ++since == STACKMAP_SNAPSHOT_INTERVAL)
+		{
+			take_snapshot(map, &d, i, locals, local_count);
+			since = 0;
+		}
+		frame->snapshot = map->snapshot_count - 1;
+	}
+
+	free(locals);
+	map->frame_count = count;
+	return count;
+
+fail:
+	free(locals);
+	free_stack_map(map);
+	return -1;
+}
+
+void free_stack_map(StackMap* map)
+{
+	free(map->frames);
+	free(map->snapshots);
+	free(map->items);
+	memset(map, 0, sizeof(StackMap));
+}
+
+/* Last frame at or before pc, -1 if only the implicit first frame is */
+int32_t stack_map_frame_at(StackMap* map, uint32_t pc)
+{
+	uint32_t low = 0, high = map->frame_count, middle;
+
+	while (low < high)
+	{
+		middle = low + (high - low) / 2;
+		if (map->frames[middle].pc <= pc)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (int32_t)low - 1;
+}
+
+/* Replays the frames after the closest snapshot; returns the frame */
+int32_t stack_map_state(StackMap* map, int32_t index, FrameState* state)
+{
+	StackMapSnapshot* snapshot = map->snapshots + (index >= 0 ? map->frames[index].snapshot : 0);
+	StackMapFrame* frame;
+	int32_t i;
+
+	state->frame = index;
+	state->pc = index >= 0 ? map->frames[index].pc : 0;
+	state->local_count = snapshot->local_count;
+	state->stack_count = 0;
+	memcpy(state->locals, map->items + snapshot->items, snapshot->local_count * sizeof(VerificationItem));
+
+	for (i = snapshot->frame + 1, frame = map->frames + i; i <= index; i += 1, frame += 1)
+	{
+		if (FRAME_CHOP(frame->type))
+			state->local_count -= frame->chop;
+		else if (FRAME_APPEND(frame->type))
+		{
+			memcpy(state->locals + state->local_count, map->items + frame->items, frame->local_count * sizeof(VerificationItem));
+			state->local_count += frame->local_count;
+		}
+	}
+
+	if (index >= 0)
+	{
+		frame = map->frames + index;
+		state->stack_count = frame->stack_count;
+		memcpy(state->stack, map->items + frame->items + frame->local_count, frame->stack_count * sizeof(VerificationItem));
+	}
+
+	return index;
+}
+
+/* Types at the last frame at or before pc; the instructions between it
+	and pc are not applied */
+int32_t stack_map_state_at(StackMap* map, uint32_t pc, FrameState* state)
+{
+	return stack_map_state(map, stack_map_frame_at(map, pc), state);
+}
+
+const char* frame_type_to_string(uint8_t type)
+{
+	if (type < 64)
+		return "same";
+	if (type < 128)
+		return "same_locals_1_stack_item";
+	if (type == 247)
+		return "same_locals_1_stack_item_frame_extended";
+	if (FRAME_CHOP(type))
+		return "chop";
+	if (type == 251)
+		return "same_frame_extended";
+	if (FRAME_APPEND(type))
+		return "append";
+	if (FRAME_FULL(type))
+		return "full_frame";
+	return "reserved";
+}
+
+char* verification_item_to_string(ClassFile* classFile, StackMap* map, VerificationItem* item, char* buffer, size_t size)
+{
+	static const char* Names[] = {
+		"top", "int", "float", "double", "long", "null", "uninitialized_this",
+	};
+	Constant* name;
+	const char *type, *end;
+	char* out;
+
+	switch (item->tag)
+	{
+		case ITEM_OBJECT:
+			name = find_constant(classFile, item->value);
+			name = name != NULL && name->tag == TAG_CLASSREF ? find_constant(classFile, name->ref) : NULL;
+			snprintf(buffer, size, "%s", name != NULL && name->tag == TAG_STRING ? class_name_from_internal(name->buffer) : "?");
+			break;
+
+		case ITEM_UNINITIALIZED:
+			snprintf(buffer, size, "uninitialized %hu", item->value);
+			break;
+
+		case ITEM_PARAMETER:
+			/* Class names without the L and ;, like those of the pool */
+			type = map->descriptor + item->value;
+			if (*type == 'L')
+				end = strchr(++type, ';');
+			else
+			{
+				for (end = type; *end == '['; end += 1)
+					;
+				end = *end == 'L' ? strchr(end, ';') + 1 : end + 1;
+			}
+
+			snprintf(buffer, size, "%.*s", (int)(end - type), type);
+			for (out = buffer; *out; out += 1)
+			{
+				if (*out == '/')
+					*out = '.';
+			}
+			break;
+
+		default:
+			snprintf(buffer, size, "%s", item->tag < ITEM_OBJECT ? Names[item->tag] : "?");
+			break;
+	}
+
+	return buffer;
+}
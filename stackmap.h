@@ -0,0 +1,105 @@
+#ifndef STACKMAP_H
+#define STACKMAP_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+	Decoded StackMapTable of a Code attribute: the verifier's types of the
+	locals and the operand stack at every branch target and handler.
+
+	Frames are kept as the deltas the class file stores (a chop frame only
+	says how many locals to drop, an append frame only lists the new ones),
+	with their items in one flat array. To bound the work of a query, the
+	complete local list is saved as a snapshot every STACKMAP_SNAPSHOT_INTERVAL
+	frames; full frames are snapshots of themselves, and snapshot 0 is the
+	implicit first frame built from the method descriptor. The state at a
+	pc is then a binary search for the frame plus a replay of at most that
+	many frames from the snapshot before it.
+
+	Items follow the verification_type_info of the class file: a long or
+	double is one item, although it takes two local or stack slots.
+*/
+
+#define ITEM_TOP                0
+#define ITEM_INTEGER            1
+#define ITEM_FLOAT              2
+#define ITEM_DOUBLE             3
+#define ITEM_LONG               4
+#define ITEM_NULL               5
+#define ITEM_UNINITIALIZED_THIS 6
+#define ITEM_OBJECT             7
+#define ITEM_UNINITIALIZED      8
+#define ITEM_PARAMETER          9 /* not in class files: a reference parameter of the implicit first frame */
+
+typedef struct
+{
+	uint8_t tag;              /* ITEM_* */
+	uint16_t value;           /* ITEM_OBJECT: classref; ITEM_UNINITIALIZED: pc of the new;
+	                             ITEM_PARAMETER: offset of its type in the method descriptor */
+} VerificationItem;
+
+/* frame_type ranges */
+#define FRAME_SAME(type)         ((type) < 64 || (type) == 251)
+#define FRAME_SAME_STACK1(type)  (((type) >= 64 && (type) < 128) || (type) == 247)
+#define FRAME_CHOP(type)         ((type) >= 248 && (type) <= 250)
+#define FRAME_APPEND(type)       ((type) >= 252 && (type) <= 254)
+#define FRAME_FULL(type)         ((type) == 255)
+
+#define STACKMAP_SNAPSHOT_INTERVAL 16
+
+typedef struct
+{
+	uint16_t pc;
+	uint8_t type;             /* frame_type as in the class file */
+	uint8_t chop;             /* locals dropped by a chop frame */
+	uint16_t local_count;     /* locals added by an append frame, all locals of a full frame */
+	uint16_t stack_count;
+	uint32_t items;           /* local_count locals, then stack_count stack items */
+	uint32_t snapshot;        /* latest snapshot at or before this frame */
+} StackMapFrame;
+
+typedef struct
+{
+	int32_t frame;            /* frame it was taken at, -1 for the implicit first frame */
+	uint16_t local_count;
+	uint32_t items;
+} StackMapSnapshot;
+
+typedef struct
+{
+	uint16_t max_locals;      /* bounds the item counts of a state */
+	uint16_t max_stack;
+	const char* descriptor;   /* of the method, for ITEM_PARAMETER */
+
+	uint32_t frame_count;
+	StackMapFrame* frames;    /* in pc order */
+	uint32_t snapshot_count;
+	StackMapSnapshot* snapshots;
+	uint32_t item_count;
+	VerificationItem* items;
+} StackMap;
+
+/* Types at a frame; the arrays have room for max_locals and max_stack items */
+typedef struct
+{
+	int32_t frame;            /* -1 for the implicit first frame */
+	uint32_t pc;
+	uint16_t local_count;
+	uint16_t stack_count;
+	VerificationItem* locals;
+	VerificationItem* stack;
+} FrameState;
+
+int decode_stack_map(ClassFile* classFile, Method* method, Attribute* codeAttribute, StackMap* map);
+void free_stack_map(StackMap* map);
+
+int32_t stack_map_frame_at(StackMap* map, uint32_t pc);
+int32_t stack_map_state(StackMap* map, int32_t frame, FrameState* state);
+int32_t stack_map_state_at(StackMap* map, uint32_t pc, FrameState* state);
+
+const char* frame_type_to_string(uint8_t type);
+char* verification_item_to_string(ClassFile* classFile, StackMap* map, VerificationItem* item, char* buffer, size_t size);
+
+#endif
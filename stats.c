@@ -0,0 +1,80 @@
+#include <time.h>
+
+#include "stats.h"
+
+int stats_enabled = STATS_NONE;
+Stats stats;
+
+static const char* PhaseNames[PHASE_COUNT] = {
+	"other", "io", "parse", "constants", "decode", "keysearch", "format"
+};
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void stats_enable(int mode)
+{
+	stats_enabled = mode;
+	if (mode != STATS_NONE)
+	{
+		stats.phase = PHASE_OTHER;
+		stats.phase_start = monotonic_ns();
+	}
+}
+
+int stats_switch_phase(int phase)
+{
+	uint64_t now = monotonic_ns();
+	int previous = stats.phase;
+
+	stats.phase_ns[previous] += now - stats.phase_start;
+	stats.phase_start = now;
+	stats.phase = phase;
+
+	return previous;
+}
+
+void print_stats(FILE* fp)
+{
+	uint64_t total = 0;
+	int i;
+
+	if (stats_enabled == STATS_NONE)
+		return;
+
+	/* Close the running phase */
+	stats_switch_phase(stats.phase);
+
+	for (i = 0; i < PHASE_COUNT; i += 1)
+		total += stats.phase_ns[i];
+
+	if (stats_enabled == STATS_JSON)
+	{
+		fprintf(fp, "{\"classes\": %lu, \"bytes_read\": %lu, \"constants\": %lu, \"instructions\": %lu, "
+			"\"allocations\": %lu, \"find_constant_calls\": %lu, \"find_constant_steps\": %lu, \"phases_ms\": {",
+			stats.classes, stats.bytes_read, stats.constants, stats.instructions,
+			stats.allocations, stats.find_constant_calls, stats.find_constant_steps);
+		for (i = 0; i < PHASE_COUNT; i += 1)
+			fprintf(fp, "%s\"%s\": %.3f", i ? ", " : "", PhaseNames[i], stats.phase_ns[i] / 1e6);
+		fprintf(fp, "}, \"total_ms\": %.3f}\n", total / 1e6);
+		return;
+	}
+
+	fprintf(fp, "Statistics:\n");
+	fprintf(fp, "  classes:             %lu\n", stats.classes);
+	fprintf(fp, "  bytes read:          %lu\n", stats.bytes_read);
+	fprintf(fp, "  constants:           %lu\n", stats.constants);
+	fprintf(fp, "  instructions:        %lu\n", stats.instructions);
+	fprintf(fp, "  allocations:         %lu\n", stats.allocations);
+	fprintf(fp, "  find_constant calls: %lu (%.2f steps/call)\n", stats.find_constant_calls,
+		stats.find_constant_calls ? (double)stats.find_constant_steps / stats.find_constant_calls : 0.0);
+	fprintf(fp, "Phases:\n");
+	for (i = 0; i < PHASE_COUNT; i += 1)
+		fprintf(fp, "  %-10s %10.3f ms %5.1f%%\n", PhaseNames[i], stats.phase_ns[i] / 1e6,
+			total ? 100.0 * stats.phase_ns[i] / total : 0.0);
+	fprintf(fp, "  %-10s %10.3f ms\n", "total", total / 1e6);
+}
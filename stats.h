@@ -0,0 +1,55 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+	Opt-in counters and per-phase timings. Everything is guarded by
+	stats_enabled, so the cost when disabled is a single predictable branch.
+	The counters are not synchronized; don't enable them in server mode.
+*/
+
+#define PHASE_OTHER     0
+#define PHASE_IO        1
+#define PHASE_PARSE     2
+#define PHASE_CONSTANTS 3
+#define PHASE_DECODE    4
+#define PHASE_KEYSEARCH 5
+#define PHASE_FORMAT    6
+#define PHASE_COUNT     7
+
+typedef struct
+{
+	uint64_t classes;
+	uint64_t bytes_read;
+	uint64_t constants;
+	uint64_t instructions;
+	uint64_t allocations;
+	uint64_t find_constant_calls;
+	uint64_t find_constant_steps;
+
+	int phase;
+	uint64_t phase_start;
+	uint64_t phase_ns[PHASE_COUNT];
+} Stats;
+
+#define STATS_NONE 0
+#define STATS_TEXT 1
+#define STATS_JSON 2
+
+extern int stats_enabled;
+extern Stats stats;
+
+#define STAT_ADD(counter, n) do { if (stats_enabled) stats.counter += (n); } while (0)
+
+/* Charges the time since the last switch to the current phase and makes
+	phase the current one. Returns the previous phase, so nested code can
+	switch back when done. */
+#define STATS_PHASE(phase) (stats_enabled ? stats_switch_phase(phase) : PHASE_OTHER)
+
+void stats_enable(int mode);
+int stats_switch_phase(int phase);
+void print_stats(FILE* fp);
+
+#endif